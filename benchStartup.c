@@ -0,0 +1,150 @@
+/*
+ * benchStartup.c
+ *
+ * Measures how long the shell takes from exec to its first prompt (run by
+ * 'make bench').  The shell is started repeatedly with its standard input
+ * and output on pipes; the time to the first byte of output is one
+ * sample.  Its input is then closed so it exits.
+ *
+ * Usage: benchStartup shell [runs]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/wait.h>
+
+/* Runs made when no count is given */
+#define DEFAULT_RUNS 1000
+
+extern char** environ;
+
+/* Function prototypes */
+static double timeToPrompt(const char* shell);
+static double now(void);
+static int    compareTimes(const void* first, const void* second);
+
+/*
+ * Entry point of the benchmark
+ */
+int main(int argc, char* argv[]) {
+    double* samples;
+    double  total = 0;
+    long    runs = DEFAULT_RUNS;
+    long    i;
+
+    if (argc < 2 || argc > 3 || (argc == 3 && (runs = atol(argv[2])) <= 0)) {
+        fprintf(stderr, "Usage: %s shell [runs]\n", argv[0]);
+        return 1;
+    }
+
+    samples = (double*) malloc(runs * sizeof(double));
+    if (samples == NULL) {
+        perror("malloc");
+        return 1;
+    }
+
+    /* The first run may write the rc snapshot; it is not counted */
+    if (timeToPrompt(argv[1]) < 0) {
+        return 1;
+    }
+    for (i = 0; i < runs; ++i) {
+        samples[i] = timeToPrompt(argv[1]);
+        if (samples[i] < 0) {
+            return 1;
+        }
+        total += samples[i];
+    }
+    qsort(samples, runs, sizeof(double), compareTimes);
+
+    printf("exec to first prompt over %ld runs: min %.0f us, median %.0f us, "
+           "mean %.0f us, p99 %.0f us\n", runs, samples[0] * 1e6,
+           samples[runs / 2] * 1e6, total / runs * 1e6,
+           samples[runs * 99 / 100] * 1e6);
+
+    free(samples);
+    return 0;
+}
+
+/*
+ * timeToPrompt
+ *
+ * Starts the shell once and returns the seconds until it first wrote
+ * something, or -1 on error.
+ */
+static double timeToPrompt(const char* shell) {
+    posix_spawn_file_actions_t actions;
+    char*                      args[] = { (char*) shell, NULL };
+    char                       output[4096];
+    int                        input[2];
+    int                        prompt[2];
+    pid_t                      pid;
+    double                     start;
+    double                     elapsed;
+    int                        error;
+
+    if (pipe(input) < 0 || pipe(prompt) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, input[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, prompt[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, input[1]);
+    posix_spawn_file_actions_addclose(&actions, prompt[0]);
+
+    start = now();
+    error = posix_spawn(&pid, shell, &actions, NULL, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(input[0]);
+    close(prompt[1]);
+    if (error != 0) {
+        fprintf(stderr, "%s: %s\n", shell, strerror(error));
+        return -1;
+    }
+
+    if (read(prompt[0], output, sizeof(output)) <= 0) {
+        fprintf(stderr, "%s: exited without a prompt\n", shell);
+        elapsed = -1;
+    } else {
+        elapsed = now() - start;
+    }
+
+    /* End of input makes the shell exit */
+    close(input[1]);
+    while (read(prompt[0], output, sizeof(output)) > 0) {
+    }
+    close(prompt[0]);
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) {
+    }
+
+    return elapsed;
+}
+
+/*
+ * now
+ *
+ * Returns the monotonic time in seconds.
+ */
+static double now(void) {
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/*
+ * compareTimes
+ *
+ * Orders samples (qsort() comparator).
+ */
+static int compareTimes(const void* first, const void* second) {
+    double a = *(const double*) first;
+    double b = *(const double*) second;
+
+    return (a > b) - (a < b);
+}
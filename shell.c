@@ -9,31 +9,64 @@
  * An implementation of a simple UNIX shell.  This program supports:
  *
  *     - Running processes
- *     - Redirecting standard output (>)
- *     - Redirecting standard input (<)
- *     - Appending standard output to a file (>>)
- *     - Redirecting both standard output and standard input (&>)
+ *     - Redirecting any file descriptor n (default in brackets):
+ *           [0]<  file     read from a file
+ *           [1]>  file     overwrite a file
+ *           [1]>> file     append to a file
+ *           [0]<> file     open a file for reading and writing
+ *           [1]>& m        duplicate descriptor m ('-' closes n)
+ *           [0]<& m        duplicate descriptor m ('-' closes n)
+ *           [0]<< EOF      here-documents (also <<-EOF)
+ *           [0]<<< word    here-strings
+ *              &>  file    overwrite a file with stdout and stderr
+ *              &>> file    append stdout and stderr to a file
  *     - Creating process pipelines (p1 | p2 | ...)
+ *     - Unconditionally chaining processes (p1; p2)
+ *     - Backgrounding processes (p1 &), started only while the machine's
+ *       CPU, memory and I/O pressure are under the 'admit' limits
+ *     - Running a pipeline in its own cgroup, under CPU, memory and I/O
+ *       limits, and reporting the CPU time and memory it used ('limit')
+ *     - Running a command string (-c) or a script, whose last command
+ *       replaces the shell instead of being forked (as 'exec' does)
+ *     - Brace expansion (a{b,c}d, {1..100}, {01..10..2}, {a..z})
+ *     - Command substitution ($(cmd) and `cmd`)
+ *     - Process substitution (<(cmd) and >(cmd))
  *     - Interrupting a running process (i.e., Ctrl-C)
  *     - A built-in version of the 'ls' command
  *     - A built-in version of the 'rm' command
+ *     - Built-in versions of 'cat' and 'cp' that copy inside the kernel
+ *     - A built-in, vectorized version of the 'wc' command
+ *     - A built-in 'fgrep' that searches several files in parallel
+ *     - A built-in, parallel external merge 'sort'
+ *     - A built-in 'count' of distinct lines (sort | uniq -c in one pass)
+ *     - Built-in 'head' and 'tail' commands
+ *     - A built-in 'find' that walks directory trees in parallel
+ *     - A built-in, parallel 'du' that counts hard links once
+ *     - A built-in 'checksum' (CRC32C, XXH3, SHA-256) using SIMD kernels
+ *     - A command history shared by every session (~/.shell_history), with
+ *       a 'history' built-in that searches it through a trigram index
+ *     - Line editing (Emacs keys, history recall, Ctrl-R search) that
+ *       redraws only what changed, and Tab completion
+ *     - A configurable prompt (the 'prompt' built-in) whose git branch is
+ *       found in the background, and a 'cd' built-in
+ *     - A startup file (~/.shellrc) whose scanned commands are kept in a
+ *       binary snapshot, so later startups skip scanning it
+ *     - Aliases and functions, found with the built-ins in one hash table
+ *     - Piping/IO redirection for built-in commands (a built-in stage of a
+ *       pipeline runs on a thread of the shell instead of a new process)
  *
  * Among the many things it does _NOT_ support are:
  *
  *     - PATH searching -- you must supply the absolute path to all programs
  *       (e.g., /bin/ls instead of just ls)
  *     - Environment variables
- *     - Appending standard error to a file (2>>)
- *     - Appending both standard output and standard input (2&>)
- *     - Backgrounding processes (p1&)
- *     - Unconditionally chaining processes (p1;p2)
  *     - Conditionally chaining processes (p1 && p2 or p1 || p2)
- *     - Piping/IO redirection for built-in commands
  *
  * Keep in mind that this program was written to be easily understood/modified
  * for educational purposes.  The author makes no claim that this is the
  * "best" way to solve this problem.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
@@ -43,89 +76,1604 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
-#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
 #include "shellParser.h"
+#include "shellBuiltins.h"
+#include "shellCgroup.h"
+#include "shellCommands.h"
+#include "shellHistory.h"
+#include "shellJobs.h"
+#include "shellLineEditor.h"
+#include "shellPrompt.h"
+#include "shellRc.h"
 
 /* Macros to test whether a process ID is a parent's or a child's. */
 #define PARENT_PID(pid) ((pid) > 0)
 #define CHILD_PID(pid)  ((pid) == 0)
 
+/* Initial size of the buffer used to read a command substitution's output */
+#define CAPTURE_BUFFER_SIZE (64 * 1024)
+
+/*
+ * Here-document bodies up to this size are handed to the command through a
+ * pipe (the write can never block); larger ones go into a memfd, or into a
+ * pipe enlarged to hold them if memfd_create() is unavailable.
+ */
+#define HEREDOC_PIPE_LIMIT  PIPE_BUF
+
+/*
+ * How deeply aliases may expand to aliases, and how many functions one
+ * line may call (which ends a function that calls itself forever)
+ */
+#define MAX_ALIAS_DEPTH 16
+#define MAX_CALLS       1000
+
+/* A copy of a line's tokens and their kinds, being rewritten */
+typedef struct {
+    char** tokens;  /* NULL terminated copies     */
+    char*  kinds;   /* TOKEN_WORD, ...            */
+    int    count;
+    int    capacity;
+} TokenList;
+
+/* The captured standard output of a command substitution */
+typedef struct {
+    char*  data;    /* The output, followed by a NUL byte              */
+    size_t length;  /* The number of bytes of output                   */
+    size_t size;    /* The size of the allocation or mapping of 'data' */
+    bool   mapped;  /* true if 'data' is an mmap()ed memfd             */
+} Capture;
+
+/* Permissions for files created by redirections (before the umask) */
+#define REDIRECTION_MODE    (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP \
+                             | S_IROTH | S_IWOTH)
+
+/* The redirection operators understood by parseRedirection() */
+typedef enum {
+    REDIRECT_INPUT,        /* [n]<   file               */
+    REDIRECT_OUTPUT,       /* [n]>   file               */
+    REDIRECT_APPEND,       /* [n]>>  file               */
+    REDIRECT_READ_WRITE,   /* [n]<>  file               */
+    REDIRECT_DUPLICATE,    /* [n]>&  m, [n]<& m, or '-' */
+    REDIRECT_HEREDOC,      /* [n]<<  body, [n]<<- body  */
+    REDIRECT_HERESTRING,   /* [n]<<< word               */
+    REDIRECT_BOTH,         /* &>     file               */
+    REDIRECT_BOTH_APPEND   /* &>>    file               */
+} RedirectionOp;
+
+/* A parsed redirection operator */
+typedef struct {
+    int           fd;      /* The descriptor being redirected */
+    RedirectionOp op;      /* What to do with it              */
+} Redirection;
+
+/* A running process substitution and the shell's end of its pipe */
+typedef struct {
+    pid_t pid;      /* The process running the substituted command */
+    int   fd;       /* The shell's end of the pipe to that process */
+    char* path;     /* The /dev/fd/N path handed to the command    */
+} ProcessSub;
+
+/* The connection between two adjacent stages of a pipeline */
+typedef struct {
+    int         fds[2];     /* A pipe, unless 'ring' is used          */
+    RingBuffer* ring;       /* A ring buffer between two built-ins    */
+} Link;
+
+/* One command of a pipeline */
+typedef struct {
+    char**          args;       /* The command and its arguments          */
+    int             start;      /* Index of the stage's first token       */
+    BuiltinFunction builtin;    /* The built-in to run, or NULL           */
+    pid_t           pid;        /* The child running an external command  */
+    pthread_t       thread;     /* The thread running a piped built-in    */
+    bool            threaded;   /* true if 'thread' was started           */
+    BuiltinIo       io;         /* The streams of a built-in              */
+    int*            ownedFds;   /* Descriptors the built-in must close    */
+    int             ownedCount; /* The number of 'ownedFds'               */
+    int             status;     /* The wait status of the stage           */
+} Stage;
+
 /* Function prototypes */
 static char** promptAndRead(void);
+static const char* continuationPrompt(void);
+static int    runCommandLine(char** line, bool reportStatus, bool mayExec);
+static int    runCommand(char** line, bool reportStatus, bool mayExec);
+static int    runLimited(char** line, const char* kinds, bool reportStatus);
+static void   runStartupLine(char** line);
+static bool   needsResolving(char** line);
+static int    runTokens(TokenList* pending, bool reportStatus, bool mayExec,
+                        bool expanded);
+static int    runInBackground(TokenList* command, bool expanded);
+static bool   takeCommand(TokenList* pending, TokenList* command,
+                          bool* background);
+static bool   isSeparator(const TokenList* list, int index);
+static bool   expandAliases(TokenList* command, TokenList* pending);
+static bool   splitCommand(TokenList* command, int index, TokenList* pending);
+static void   callFunction(TokenList* command, TokenList* pending);
+static void   prependTokens(TokenList* list, const TokenList* front);
+static void   addToken(TokenList* list, const char* token, char kind);
+static char*  replaceToken(TokenList* list, int index, const CommandPlan* plan);
+static void   freeTokens(TokenList* list);
+static int    runPipeline(char** line, const char* kinds, bool reportStatus,
+                          bool mayExec);
+static void   replaceShell(char** line, const char* kinds, Stage* stage);
+static void   startExternalStage(char** line, const char* kinds, Stage* stage,
+                                 int in, int out);
+static void   startBuiltinStage(char** line, const char* kinds, Stage* stage,
+                                const Link* inLink, const Link* outLink,
+                                bool onThisThread);
+static bool   redirectBuiltin(char** line, const char* kinds, Stage* stage);
+static void   ownFd(Stage* stage, int fd);
+static void*  runBuiltinStage(void* stage);
+static void   finishBuiltinStage(Stage* stage);
+static char** expandLine(char** line, const char** kinds);
+static void   appendWord(char*** words, char** kinds, int* count,
+                         int* capacity, char* word, char kind);
+static void   splitWords(Capture* capture, char*** words, char** kinds,
+                         int* count, int* capacity);
+static void   captureCommandOutput(const char* text, Capture* capture);
+static void   runSubstitution(const char* text);
+static char*  startProcessSubstitution(const char* text, bool readFrom);
+static void   reapProcessSubstitutions(void);
 static pid_t  forkWrapper(void);
 static void   pipeWrapper(int fds[]);
 //static int    dupWrapper(int fd);
-static bool   isSpecial(char* token);
+static bool   isSpecial(char** line, const char* kinds, int index);
+static bool   isPipe(char** line, const char* kinds, int index);
+static bool   isRedirection(char** line, const char* kinds, int index,
+                            Redirection* redirection);
 static void   signalHandler(int signo);
 
-static void   parseArgs(char** args, char** line, int* lineIndex);
-static void   continueProcessingLine(char** line, int* lineIndex, char** args);
-static void   doAppendRedirection(char* filename);
-static void   doStdoutRedirection(char* filename);
-static void   doStderrRedirection(char* filename);
-static void   doStdoutStderrRedirection(char* filename);
-static void   doStdinRedirection(char* filename);
-static void   doPipe(char** p1Args, char** line, int* lineIndex);
-static void   doLs(char** args);
-static void   doRm(char** args);
-static void lsHelper(struct dirent *dptr, DIR *dp);
+static char** parseArgs(char** line, const char* kinds, int* lineIndex);
+static void   continueProcessingLine(char** line, const char* kinds,
+                                     int* lineIndex, char** args);
+static bool   parseRedirection(const char* token, Redirection* redirection);
+static void   applyRedirection(const Redirection* redirection,
+                               const char* target);
+static int    openRedirectionTarget(RedirectionOp op, const char* target);
+static void   doDupRedirection(int fd, const char* target);
+static int    openHereDoc(const char* body, size_t length);
+static void   moveFd(int from, int to);
+static bool   writeAll(int fd, const char* data, size_t length);
+
+/*
+ * A global variable representing the process ID of this shell's child.  When the value of this
+ * variable is 0, there are no running children.
+ */
+static pid_t childPid = 0;
+
+/*
+ * The links of the pipeline being run, so that Ctrl-C can wake built-in
+ * stages asleep on a ring buffer (signals only reach the main thread).
+ */
+static Link* volatile        runningLinks     = NULL;
+static volatile sig_atomic_t runningLinkCount = 0;
+
+/*
+ * The words of the most recently expanded line, their kinds, and the
+ * captured output of its command substitutions.  Words produced by a
+ * substitution point directly into the capture they came from.  All are
+ * released the next time expandLine() is called.
+ */
+static char**   expandedLine  = NULL;
+static char*    expandedKinds = NULL;
+static Capture* captures     = NULL;
+static int      captureCount = 0;
+
+/*
+ * The line of input being handed to the scanner, and the text of the whole
+ * command read since the prompt (its lines, and any here-document bodies),
+ * which goes into the history once the command is complete.
+ */
+static char*   inputLine       = NULL;
+static size_t  inputCapacity   = 0;
+static ssize_t inputLength     = 0;
+static size_t  inputOffset     = 0;
+static char*   commandText     = NULL;
+static size_t  commandLength   = 0;
+static size_t  commandCapacity = 0;
+static bool    inputEnded      = false;
+
+/*
+ * Where commands are read from: standard input, or the -c string or
+ * script given on the command line.  Only commands from standard input
+ * are prompted for and go into the history.  When reading a script (or
+ * -c string), 'inputDrained' is set once its last line has been read,
+ * so the shell knows that nothing follows the command being run.
+ */
+static FILE*   input           = NULL;
+static bool    interactive     = true;
+static bool    inputDrained    = false;
+
+/*
+ * Whether commands are read through the line editor (when typed at a
+ * terminal), and whether the next line continues a command (so the
+ * editor shows the continuation prompt).
+ */
+static bool lineEditing   = false;
+static bool lineContinues = false;
+
+/*
+ * The process substitutions started for the current line.  They are reaped
+ * once the command using them has finished.
+ */
+static ProcessSub* processSubs     = NULL;
+static int         processSubCount = 0;
+
+/*
+ * Entry point of the application
+ *
+ * Usage: shell [-c command | script]
+ *
+ * With no arguments, commands are read from standard input (a terminal
+ * or not).  Otherwise the command string or the script's commands are run
+ * without prompting, and the shell exits with the status of the last.
+ */
+int main(int argc, char* argv[]) {
+    char** line;
+    char*  text;
+    int    status = 0;
+
+    if (argc == 3 && strcmp(argv[1], "-c") == 0) {
+        /* The scanner ends a command at a newline */
+        if (asprintf(&text, "%s\n", argv[2]) < 0
+                || (input = fmemopen(text, strlen(text), "r")) == NULL) {
+            perror("-c");
+            return 1;
+        }
+    } else if (argc == 2 && argv[1][0] != '-') {
+        input = fopen(argv[1], "re");
+        if (input == NULL) {
+            perror(argv[1]);
+            return 1;
+        }
+    } else if (argc != 1) {
+        fprintf(stderr, "Usage: %s [-c command | script]\n", argv[0]);
+        return 2;
+    }
+    interactive = (argc == 1);
+
+    signal(SIGINT, signalHandler);
+
+    /*
+     * Built-ins run inside the shell, so a closed pipe must show up as an
+     * EPIPE error rather than kill us.  Commands get SIGPIPE back.
+     */
+    signal(SIGPIPE, SIG_IGN);
+
+    if (interactive) {
+        historyOpen();
+        promptInit();
+        rcLoad(runStartupLine);
+        lineEditing = editorUsable();
+    }
+
+    /* Read a line of input from the keyboard */
+    line = promptAndRead();
+
+    /* While the line was blank or the user didn't type exit */
+    while (line[0] == NULL || (strcmp(line[0], "exit") != 0)) {
+
+        /* Stop at the end of input (e.g., Ctrl-D) */
+        if (line[0] == NULL && inputEnded) {
+            break;
+        }
+
+        /* Ignore blank lines */
+        if (line[0] != NULL && interactive) {
+            struct timespec start;
+            struct timespec end;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            status = runCommandLine(line, true, false);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            promptCommandDone(status, (end.tv_sec - start.tv_sec)
+                                      + (end.tv_nsec - start.tv_nsec) / 1e9);
+        } else if (line[0] != NULL) {
+            /* The last command of a script may replace the shell */
+            status = runCommandLine(line, false, inputDrained);
+        }
+
+        /* Read the next line of input from the keyboard */
+        line = promptAndRead();
+    }
+
+    /* User must have typed "exit", time to gracefully exit. */
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/*
+ * runCommandLine
+ *
+ * Runs the commands on a line of tokens (p1; p2 & ...) one after another,
+ * waiting for each to finish unless it ends with '&'.  The alias starting
+ * each command is expanded (an alias may start with another alias, but
+ * not with itself), and a command starting with a function is replaced
+ * by the function's body with "$0" to "$9" and "$@" replaced by the
+ * command's words.
+ *
+ * line         - An array of pointers to string corresponding to ALL of the
+ *                tokens entered on the command line.
+ * reportStatus - If true, the exit status of the child is printed.
+ * mayExec      - If true, the shell has nothing left to do after this line,
+ *                so its last command may replace the shell (see
+ *                runPipeline()).
+ *
+ * Returns the wait status of the last command (0 for built-in commands
+ * and background jobs).
+ */
+static int runCommandLine(char** line, bool reportStatus, bool mayExec) {
+    TokenList pending = { NULL, NULL, 0, 0 };
+    int       status;
+    int       i;
+
+    if (!needsResolving(line)) {
+        return runCommand(line, reportStatus, mayExec);
+    }
+
+    /* Running a command replaces the scanner's line, so copy it first */
+    for (i = 0; line[i] != NULL; ++i) {
+        addToken(&pending, line[i], getArgKind(i));
+    }
+    status = runTokens(&pending, reportStatus, mayExec, false);
+    freeTokens(&pending);
+
+    return status;
+}
+
+/*
+ * runTokens
+ *
+ * Runs the commands of a list of tokens, taking them off the list (see
+ * runCommandLine()).  If 'expanded' is true, the aliases of the first
+ * command have already been expanded.
+ */
+static int runTokens(TokenList* pending, bool reportStatus, bool mayExec,
+                     bool expanded) {
+    TokenList command = { NULL, NULL, 0, 0 };
+    bool      background;
+    int       calls  = 0;
+    int       status = 0;
+
+    while (takeCommand(pending, &command, &background)) {
+        /* A background job resolves its command itself */
+        if (!background && !expanded) {
+            background = expandAliases(&command, pending);
+            expanded   = background;
+        }
+        if (command.count == 0) {
+            continue;
+        }
+        if (background) {
+            status   = runInBackground(&command, expanded);
+            expanded = false;
+            continue;
+        }
+        expanded = false;
+
+        if (command.kinds[0] == TOKEN_WORD
+                && isPlanDefined(command.tokens[0], PLAN_FUNCTION)) {
+            if (++calls > MAX_CALLS) {
+                fprintf(stderr, "%s: too many function calls\n",
+                        command.tokens[0]);
+                status = 1 << 8;  /* Exit status 1 */
+                break;
+            }
+            callFunction(&command, pending);
+            continue;
+        }
+
+        status = runCommand(getArgListFromTokens(command.tokens,
+                                                 command.kinds),
+                            reportStatus, mayExec && pending->count == 0);
+    }
+
+    freeTokens(&command);
+
+    return status;
+}
+
+/*
+ * runInBackground
+ *
+ * Starts a command as a background job, once jobAdmit() lets it, in a
+ * child shell that ignores Ctrl-C.  Returns the wait status to report
+ * for it: 0, or exit status 1 if it was not started.
+ *
+ * command  - The command's tokens.
+ * expanded - true if its aliases have already been expanded.
+ */
+static int runInBackground(TokenList* command, bool expanded) {
+    pid_t pid;
+    int   number;
+
+    if (!jobAdmit()) {
+        fprintf(stderr, "%s: not started\n", command->tokens[0]);
+        return 1 << 8;  /* Exit status 1 */
+    }
+
+    fflush(stdout);
+    pid = forkWrapper();
+    if (CHILD_PID(pid)) {
+        int status;
+
+        signal(SIGINT, SIG_IGN);
+        status = runTokens(command, false, true, expanded);
+        fflush(stdout);
+        _exit(WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+    }
+
+    number = jobAdd(pid, command->tokens);
+    if (interactive) {
+        printf("[%d] %d\n", number, pid);
+    }
+
+    return 0;
+}
+
+/*
+ * runCommand
+ *
+ * Expands and runs one command of a line (a pipeline), and waits for it
+ * to finish.  See runCommandLine() for the arguments.
+ */
+static int runCommand(char** line, bool reportStatus, bool mayExec) {
+    const char* kinds;
+    int         status;
+
+    /* Replace command substitutions by their output */
+    line = expandLine(line, &kinds);
+
+    if (line[0] != NULL && line[1] != NULL && findBuiltin(line[0]) == doLimit) {
+        status = runLimited(line, kinds, reportStatus);
+    } else {
+        /* A process substitution must be reaped, so the shell has to stay */
+        status = runPipeline(line, kinds, reportStatus,
+                             mayExec && processSubCount == 0);
+    }
+
+    /* The command is done with any <(...) or >(...) pipes */
+    reapProcessSubstitutions();
+
+    return status;
+}
+
+/*
+ * runLimited
+ *
+ * Runs the pipeline of a 'limit' command in a transient cgroup (see
+ * shellCgroup.h), waits for it to finish and reports what it used.
+ * Returns its wait status.  A 'limit' command that is wrong is run as
+ * an ordinary pipeline, so that the built-in reports the mistake
+ * wherever the line sends its errors.
+ */
+static int runLimited(char** line, const char* kinds, bool reportStatus) {
+    CgroupLimits limits;
+    Cgroup       group;
+    BuiltinIo    quiet;
+    pid_t        pid;
+    int          status = 1 << 8;  /* Exit status 1 */
+    int          start;
+
+    builtinIoInit(&quiet, -1, -1, -1);
+    start = cgroupParseLimits(line, &limits, &quiet);
+    if (start < 0 || kinds[start] != TOKEN_WORD) {
+        return runPipeline(line, kinds, reportStatus, false);
+    }
+    if (!cgroupCreate(&limits, &group)) {
+        return status;
+    }
+
+    fflush(stdout);
+    pid = childPid = cgroupFork(&group);
+    if (CHILD_PID(pid)) {
+        status = runPipeline(line + start, kinds + start, false, true);
+        fflush(stdout);
+        _exit(WIFEXITED(status) ? WEXITSTATUS(status)
+                                : 128 + WTERMSIG(status));
+    }
+
+    if (pid > 0) {
+        waitpid(pid, &status, 0);
+        childPid = 0;
+        if (reportStatus) {
+            printf("\nChild %d exited with status %d\n", pid, status);
+        }
+    }
+    cgroupFinish(&group);
+
+    return status;
+}
+
+/*
+ * runStartupLine
+ *
+ * Runs a command of the rc file (see rcLoad()).
+ */
+static void runStartupLine(char** line) {
+    runCommandLine(line, false, false);
+}
+
+/*
+ * needsResolving
+ *
+ * Returns true if the line has more than one command or a background
+ * one, or its command starts with a function, or a stage of it starts
+ * with an alias.
+ */
+static bool needsResolving(char** line) {
+    bool start = true;
+    int  i;
+
+    if (line[0] != NULL && getArgKind(0) == TOKEN_WORD
+            && isPlanDefined(line[0], PLAN_FUNCTION)) {
+        return true;
+    }
+    for (i = 0; line[i] != NULL; ++i) {
+        if (getArgKind(i) == TOKEN_OPERATOR
+                && (strcmp(line[i], ";") == 0 || strcmp(line[i], "&") == 0)) {
+            return true;
+        }
+        if (start && getArgKind(i) == TOKEN_WORD
+                && isPlanDefined(line[i], PLAN_ALIAS)) {
+            return true;
+        }
+        start = (getArgKind(i) == TOKEN_OPERATOR && strcmp(line[i], "|") == 0);
+    }
+    return false;
+}
+
+/*
+ * takeCommand
+ *
+ * Moves the first command (the tokens up to the next ';' or '&') of a
+ * list into 'command', and drops the operator after it.  'background' is
+ * set if that operator is '&'.  Returns false if the list has no more
+ * commands.
+ */
+static bool takeCommand(TokenList* pending, TokenList* command,
+                        bool* background) {
+    int start = 0;
+    int end;
+    int i;
+
+    freeTokens(command);
+    *background = false;
+    if (pending->count == 0) {
+        return false;
+    }
+
+    while (start < pending->count && isSeparator(pending, start)) {
+        ++start;
+    }
+    for (end = start; end < pending->count && !isSeparator(pending, end);
+         ++end) {
+        addToken(command, pending->tokens[end], pending->kinds[end]);
+    }
+    if (end < pending->count) {
+        *background = (strcmp(pending->tokens[end], "&") == 0);
+        ++end;
+    }
+
+    for (i = 0; i < end; ++i) {
+        free(pending->tokens[i]);
+    }
+    memmove(pending->tokens, pending->tokens + end,
+            (pending->count - end + 1) * sizeof(char*));
+    memmove(pending->kinds, pending->kinds + end, pending->count - end);
+    pending->count -= end;
+
+    return command->count > 0;
+}
+
+/*
+ * isSeparator
+ *
+ * Returns true if the token at 'index' of a list is the ';' or '&'
+ * operator.
+ */
+static bool isSeparator(const TokenList* list, int index) {
+    return list->kinds[index] == TOKEN_OPERATOR
+           && (strcmp(list->tokens[index], ";") == 0
+               || strcmp(list->tokens[index], "&") == 0);
+}
+
+/*
+ * expandAliases
+ *
+ * Replaces the alias starting each stage of a command (after each '|') by
+ * its text.  If the text has several commands, those after the first go
+ * back to the front of 'pending', to be expanded when they are run.
+ * Returns true if the text put the command in the background ('&').
+ */
+static bool expandAliases(TokenList* command, TokenList* pending) {
+    bool background = false;
+    int  start      = 0;
+
+    while (start < command->count) {
+        char* expanded = NULL;
+        int   depth;
+        int   i;
+
+        for (depth = 0; depth < MAX_ALIAS_DEPTH && start < command->count
+                        && command->kinds[start] == TOKEN_WORD
+                        && (expanded == NULL
+                            || strcmp(expanded, command->tokens[start]) != 0)
+                        && isPlanDefined(command->tokens[start], PLAN_ALIAS);
+             ++depth) {
+            const CommandPlan* plan = findPlan(command->tokens[start],
+                                               PLAN_ALIAS);
+
+            if (plan == NULL) {
+                break;
+            }
+            free(expanded);
+            expanded = replaceToken(command, start, plan);
+
+            i = start;
+            while (i < command->count && !isSeparator(command, i)) {
+                ++i;
+            }
+            if (i < command->count) {
+                background = splitCommand(command, i, pending);
+            }
+        }
+        free(expanded);
+
+        /* On to the next stage */
+        while (start < command->count
+               && !(command->kinds[start] == TOKEN_OPERATOR
+                    && strcmp(command->tokens[start], "|") == 0)) {
+            ++start;
+        }
+        ++start;
+    }
+
+    return background;
+}
+
+/*
+ * splitCommand
+ *
+ * Ends a command at the ';' or '&' at 'index', moving the tokens after it
+ * to the front of 'pending'.  Returns true if it ended with '&'.
+ */
+static bool splitCommand(TokenList* command, int index, TokenList* pending) {
+    TokenList rest       = { NULL, NULL, 0, 0 };
+    bool      background = (strcmp(command->tokens[index], "&") == 0);
+    int       i;
+
+    for (i = index + 1; i < command->count; ++i) {
+        addToken(&rest, command->tokens[i], command->kinds[i]);
+    }
+    while (command->count > index) {
+        free(command->tokens[--command->count]);
+    }
+    command->tokens[index] = NULL;
+
+    prependTokens(pending, &rest);
+    freeTokens(&rest);
+
+    return background;
+}
+
+/*
+ * callFunction
+ *
+ * Replaces a command starting with a function by the function's body,
+ * with its arguments substituted.  The body goes to the front of
+ * 'pending', so its commands are run next; 'command' is emptied.
+ */
+static void callFunction(TokenList* command, TokenList* pending) {
+    const CommandPlan* plan = findPlan(command->tokens[0], PLAN_FUNCTION);
+    TokenList          body = { NULL, NULL, 0, 0 };
+    int                i;
+    int                j;
+
+    for (i = 0; plan != NULL && i < plan->count; ++i) {
+        const char* token = plan->tokens[i];
+
+        if (plan->kinds[i] != TOKEN_WORD || token[0] != '$') {
+            addToken(&body, token, plan->kinds[i]);
+        } else if (strcmp(token, "$@") == 0) {
+            for (j = 1; j < command->count; ++j) {
+                addToken(&body, command->tokens[j], command->kinds[j]);
+            }
+        } else if (token[1] >= '0' && token[1] <= '9' && token[2] == '\0') {
+            j = token[1] - '0';
+            if (j < command->count) {
+                addToken(&body, command->tokens[j], command->kinds[j]);
+            }
+        } else {
+            addToken(&body, token, plan->kinds[i]);
+        }
+    }
+
+    prependTokens(pending, &body);
+    freeTokens(&body);
+    freeTokens(command);
+}
+
+/*
+ * prependTokens
+ *
+ * Puts (copies of) the tokens of 'front' before those of a list, as a
+ * separate command.
+ */
+static void prependTokens(TokenList* list, const TokenList* front) {
+    TokenList joined = { NULL, NULL, 0, 0 };
+    int       i;
+
+    for (i = 0; i < front->count; ++i) {
+        addToken(&joined, front->tokens[i], front->kinds[i]);
+    }
+    if (front->count > 0 && list->count > 0) {
+        addToken(&joined, ";", TOKEN_OPERATOR);
+    }
+    for (i = 0; i < list->count; ++i) {
+        addToken(&joined, list->tokens[i], list->kinds[i]);
+    }
+
+    freeTokens(list);
+    *list = joined;
+}
+
+/*
+ * addToken
+ *
+ * Appends a copy of a token (or, for NULL, the terminating NULL) to a
+ * list.
+ */
+static void addToken(TokenList* list, const char* token, char kind) {
+    if (list->count + 2 > list->capacity) {
+        list->capacity = (list->capacity > 0) ? list->capacity * 2 : MAX_ARGS;
+        list->tokens   = (char**) realloc(list->tokens,
+                                          list->capacity * sizeof(char*));
+        list->kinds    = (char*) realloc(list->kinds, list->capacity);
+        if (list->tokens == NULL || list->kinds == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    list->tokens[list->count] = NULL;
+    if (token == NULL) {
+        return;
+    }
+    list->tokens[list->count] = strdup(token);
+    if (list->tokens[list->count] == NULL) {
+        perror("strdup");
+        exit(1);
+    }
+    list->kinds[list->count++] = kind;
+    list->tokens[list->count]  = NULL;
+}
+
+/*
+ * replaceToken
+ *
+ * Replaces the token at 'index' by (copies of) the tokens of a plan, and
+ * returns the token replaced, which the caller must free.
+ */
+static char* replaceToken(TokenList* list, int index, const CommandPlan* plan) {
+    TokenList rebuilt = { NULL, NULL, 0, 0 };
+    char*     replaced = list->tokens[index];
+    int       i;
+
+    for (i = 0; i < index; ++i) {
+        addToken(&rebuilt, list->tokens[i], list->kinds[i]);
+    }
+    for (i = 0; i < plan->count; ++i) {
+        addToken(&rebuilt, plan->tokens[i], plan->kinds[i]);
+    }
+    for (i = index + 1; i < list->count; ++i) {
+        addToken(&rebuilt, list->tokens[i], list->kinds[i]);
+    }
+
+    list->tokens[index] = NULL;
+    for (i = 0; i < list->count; ++i) {
+        free(list->tokens[i]);
+    }
+    free(list->tokens);
+    free(list->kinds);
+    *list = rebuilt;
+
+    return replaced;
+}
+
+/*
+ * freeTokens
+ *
+ * Frees the tokens of a list and empties it.
+ */
+static void freeTokens(TokenList* list) {
+    int i;
+
+    for (i = 0; i < list->count; ++i) {
+        free(list->tokens[i]);
+    }
+    free(list->tokens);
+    free(list->kinds);
+    list->tokens   = NULL;
+    list->kinds    = NULL;
+    list->count    = 0;
+    list->capacity = 0;
+}
+
+/*
+ * runPipeline
+ *
+ * Runs a pipeline (p1 | p2 | ...) and waits for every stage to finish.
+ * External commands run in child processes.  Built-in commands run inside
+ * the shell: on this thread if the built-in is the only stage, otherwise
+ * on a thread of their own that reads and writes the stage's pipes.  Two
+ * adjacent built-ins are connected by a shared-memory ring buffer instead
+ * of a pipe, so data passes between them without system calls.
+ *
+ * All pipes are created and all child processes forked before any
+ * built-in thread is started, so the shell never forks while one of its
+ * threads may be holding a lock.
+ *
+ * A single external command replaces the shell instead of being forked
+ * when nothing is left for the shell to do after it (see mayExec), or
+ * when it is run by 'exec'.  'exec' with a built-in runs the built-in and
+ * then exits with its status.
+ *
+ * line         - The expanded tokens of the line.
+ * kinds        - The kind (TOKEN_WORD, ...) of each token.
+ * reportStatus - If true, the exit status of the last child is printed.
+ * mayExec      - If true, the shell exits once the pipeline is done.
+ *
+ * Returns the wait status of the last stage.
+ */
+static int runPipeline(char** line, const char* kinds, bool reportStatus,
+                       bool mayExec) {
+    Stage* stages     = NULL;
+    int    stageCount = 0;
+    Link*  links;
+    int    lineIndex  = 0;
+    bool   exiting    = false;
+    int    status;
+    int    i;
+
+    /* Break the line into stages at each '|' */
+    while (line[lineIndex] != NULL) {
+        Stage* stage;
+
+        stages = (Stage*) realloc(stages, (stageCount + 1) * sizeof(Stage));
+        if (stages == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+        stage = &stages[stageCount++];
+        memset(stage, 0, sizeof(Stage));
+
+        stage->start   = lineIndex;
+        stage->args    = parseArgs(line, kinds, &lineIndex);
+        stage->builtin = (stage->args[0] != NULL) ? findBuiltin(stage->args[0])
+                                                  : NULL;
+        if (line[lineIndex] != NULL) {
+            lineIndex++; /* Skip the '|' */
+        }
+    }
+    if (stageCount == 0) {
+        return 0;
+    }
+
+    /* 'exec command' runs the command in place of the shell */
+    if (stageCount == 1 && stages[0].builtin == doExec
+            && stages[0].args[1] != NULL) {
+        for (i = 0; stages[0].args[i] != NULL; ++i) {
+            stages[0].args[i] = stages[0].args[i + 1];
+        }
+        stages[0].builtin = findBuiltin(stages[0].args[0]);
+        exiting = true;
+    }
+
+    links = (Link*) malloc(stageCount * sizeof(Link));
+    if (links == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    for (i = 0; i < stageCount - 1; ++i) {
+        links[i].ring = NULL;
+        if (stages[i].builtin != NULL && stages[i + 1].builtin != NULL) {
+            links[i].ring = ringCreate(RING_BUFFER_SIZE);
+        }
+        if (links[i].ring == NULL) {
+            pipeWrapper(links[i].fds);
+        }
+    }
+    builtinClearInterrupt();
+    runningLinks     = links;
+    runningLinkCount = stageCount - 1;
+
+    /* Don't let children inherit (and repeat) our pending output */
+    fflush(stdout);
+
+    /* Waiting for the only command would be the shell's last act */
+    if (stageCount == 1 && stages[0].builtin == NULL && (mayExec || exiting)) {
+        replaceShell(line, kinds, &stages[0]);
+    }
+
+    /* Fork the external commands first */
+    for (i = 0; i < stageCount; ++i) {
+        if (stages[i].builtin == NULL) {
+            startExternalStage(line, kinds, &stages[i],
+                               (i > 0)              ? links[i - 1].fds[0] : 0,
+                               (i < stageCount - 1) ? links[i].fds[1]     : 1);
+        }
+    }
+
+    /* The shell's copies of the children's pipe ends aren't needed */
+    for (i = 0; i < stageCount - 1; ++i) {
+        if (stages[i].builtin == NULL) {
+            close(links[i].fds[1]);
+        }
+        if (stages[i + 1].builtin == NULL) {
+            close(links[i].fds[0]);
+        }
+    }
+
+    /* Then the built-ins, which take over their own pipe ends */
+    for (i = 0; i < stageCount; ++i) {
+        if (stages[i].builtin != NULL) {
+            startBuiltinStage(line, kinds, &stages[i],
+                              (i > 0)              ? &links[i - 1] : NULL,
+                              (i < stageCount - 1) ? &links[i]     : NULL,
+                              stageCount == 1);
+        }
+    }
+
+    /* Wait for every stage */
+    for (i = 0; i < stageCount; ++i) {
+        if (stages[i].builtin == NULL) {
+            waitpid(stages[i].pid, &stages[i].status, 0);
+        } else if (stages[i].threaded) {
+            pthread_join(stages[i].thread, NULL);
+        }
+    }
+    childPid         = 0;
+    runningLinkCount = 0;
+    runningLinks     = NULL;
+
+    status = stages[stageCount - 1].status;
+    if (reportStatus && stages[stageCount - 1].builtin == NULL) {
+        printf("\nChild %d exited with status %d\n",
+                stages[stageCount - 1].pid, status);
+    }
+    if (exiting) {
+        fflush(stdout);
+        exit(WIFEXITED(status) ? WEXITSTATUS(status)
+                               : 128 + WTERMSIG(status));
+    }
+
+    for (i = 0; i < stageCount; ++i) {
+        free(stages[i].args);
+    }
+    for (i = 0; i < stageCount - 1; ++i) {
+        ringDestroy(links[i].ring);
+    }
+    free(stages);
+    free(links);
+
+    return status;
+}
+
+/*
+ * replaceShell
+ *
+ * Runs an external command in the shell's own process instead of a child,
+ * saving the fork() and the wait for it.  Does not return.
+ *
+ * line  - The expanded tokens of the line.
+ * kinds - The kind of each token.
+ * stage - The only stage of the pipeline.
+ */
+static void replaceShell(char** line, const char* kinds, Stage* stage) {
+    int lineIndex = stage->start;
+
+    signal(SIGPIPE, SIG_DFL);
+    continueProcessingLine(line, kinds, &lineIndex, stage->args);
+}
+
+/**
+ * doExec
+ *
+ * Implements the 'exec' built-in, which replaces the shell with a command.
+ * runPipeline() does that itself, so the built-in only runs when there is
+ * nothing to replace the shell with, or 'exec' is part of a larger
+ * pipeline.
+ *
+ * args - args[1], if present, is the command to run.
+ */
+int doExec(char** args, BuiltinIo* io) {
+    if (args[1] != NULL) {
+        builtinError(io, "exec: cannot replace the shell from a pipeline\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * startExternalStage
+ *
+ * Forks a child process to run an external command of a pipeline.
+ *
+ * line  - The expanded tokens of the line.
+ * kinds - The kind of each token.
+ * stage - The stage to run; its pid is filled in.
+ * in    - The descriptor to use as the command's standard input.
+ * out   - The descriptor to use as the command's standard output.
+ */
+static void startExternalStage(char** line, const char* kinds, Stage* stage,
+                               int in, int out) {
+    /* Fork off a child process */
+    stage->pid = childPid = forkWrapper();
+
+    if (CHILD_PID(stage->pid)) {
+        int lineIndex = stage->start;
+
+        signal(SIGPIPE, SIG_DFL);
+
+        if (in != 0) {
+            dup2(in, 0);
+        }
+        if (out != 1) {
+            dup2(out, 1);
+        }
+
+        /* The child shell continues to process its part of the line */
+        continueProcessingLine(line, kinds, &lineIndex, stage->args);
+    }
+}
+
+/*
+ * startBuiltinStage
+ *
+ * Runs a built-in command of a pipeline inside the shell.  The built-in
+ * takes ownership of its ends of the links to the neighbouring stages and
+ * closes them when it is done, so those stages see end-of-file or EPIPE.
+ *
+ * line         - The expanded tokens of the line.
+ * kinds        - The kind of each token.
+ * stage        - The stage to run.
+ * inLink       - The link from the previous stage, or NULL if the
+ *                built-in reads the shell's standard input.
+ * outLink      - The link to the next stage, or NULL if the built-in
+ *                writes to the shell's standard output.
+ * onThisThread - If true, run the built-in before returning; otherwise
+ *                start a thread for it.
+ */
+static void startBuiltinStage(char** line, const char* kinds, Stage* stage,
+                              const Link* inLink, const Link* outLink,
+                              bool onThisThread) {
+    builtinIoInit(&stage->io, 0, 1, 2);
+
+    if (inLink != NULL && inLink->ring != NULL) {
+        stage->io.in     = -1;
+        stage->io.inRing = inLink->ring;
+    } else if (inLink != NULL) {
+        stage->io.in = inLink->fds[0];
+        ownFd(stage, stage->io.in);
+    }
+
+    if (outLink != NULL && outLink->ring != NULL) {
+        stage->io.out     = -1;
+        stage->io.outRing = outLink->ring;
+    } else if (outLink != NULL) {
+        stage->io.out = outLink->fds[1];
+        ownFd(stage, stage->io.out);
+    }
+
+    if (!redirectBuiltin(line, kinds, stage)) {
+        stage->status = W_EXITCODE(1, 0);
+        finishBuiltinStage(stage);
+    } else if (onThisThread) {
+        runBuiltinStage(stage);
+    } else {
+        sigset_t allSignals;
+        sigset_t oldSignals;
+
+        /* Signals are for the main thread (see signalHandler()) */
+        sigfillset(&allSignals);
+        pthread_sigmask(SIG_BLOCK, &allSignals, &oldSignals);
+        stage->threaded = (pthread_create(&stage->thread, NULL,
+                                          runBuiltinStage, stage) == 0);
+        pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+        if (!stage->threaded) {
+            perror("pthread_create");
+            runBuiltinStage(stage);
+        }
+    }
+}
+
+/*
+ * redirectBuiltin
+ *
+ * Performs the redirections of a built-in stage by changing the
+ * descriptors in its BuiltinIo; the shell's own descriptors are left
+ * alone.  Only descriptors 0, 1 and 2 can be redirected.
+ *
+ * Returns false (after reporting the problem) if a redirection failed.
+ */
+static bool redirectBuiltin(char** line, const char* kinds, Stage* stage) {
+    int* streams[3];
+    int  lineIndex;
+
+    streams[0] = &stage->io.in;
+    streams[1] = &stage->io.out;
+    streams[2] = &stage->io.err;
+
+    for (lineIndex = stage->start;
+            line[lineIndex] != NULL && !isPipe(line, kinds, lineIndex);
+            ++lineIndex) {
+        Redirection redirection;
+        const char* target;
+        int         fd;
+
+        if (!isRedirection(line, kinds, lineIndex, &redirection)) {
+            continue;
+        }
+
+        target = line[++lineIndex];
+        if (target == NULL) {
+            builtinError(&stage->io, "Missing target for '%s'\n",
+                         line[lineIndex - 1]);
+            return false;
+        }
+        if (redirection.fd > 2) {
+            builtinError(&stage->io,
+                         "%s: can't redirect descriptor %d of a built-in\n",
+                         stage->args[0], redirection.fd);
+            return false;
+        }
+
+        if (redirection.op == REDIRECT_DUPLICATE) {
+            char* end;
+            long  source = strtol(target, &end, 10);
+
+            if (strcmp(target, "-") == 0) {
+                fd = -1;
+            } else if (target[0] == '\0' || *end != '\0' || source < 0
+                    || source > INT_MAX) {
+                builtinError(&stage->io, "%s: not a file descriptor\n",
+                             target);
+                return false;
+            } else {
+                fd = (source <= 2) ? *streams[source] : (int) source;
+            }
+        } else {
+            fd = openRedirectionTarget(redirection.op, target);
+            if (fd < 0) {
+                builtinError(&stage->io, "Error opening file: %s: %s\n",
+                             target, strerror(errno));
+                return false;
+            }
+            ownFd(stage, fd);
+        }
+
+        /* A redirected end of a ring buffer is finished with */
+        if (redirection.fd == 0 && stage->io.inRing != NULL) {
+            ringCloseReader(stage->io.inRing);
+            stage->io.inRing = NULL;
+        }
+        if ((redirection.fd == 1 || redirection.op == REDIRECT_BOTH
+                || redirection.op == REDIRECT_BOTH_APPEND)
+                && stage->io.outRing != NULL) {
+            ringCloseWriter(stage->io.outRing);
+            stage->io.outRing = NULL;
+        }
+
+        if (redirection.op == REDIRECT_BOTH
+                || redirection.op == REDIRECT_BOTH_APPEND) {
+            *streams[2] = fd;
+        }
+        *streams[redirection.fd] = fd;
+    }
+
+    stage->io.outClosed = (stage->io.out < 0 && stage->io.outRing == NULL);
+    return true;
+}
+
+/*
+ * ownFd
+ *
+ * Records that a built-in stage must close 'fd' when it finishes.
+ */
+static void ownFd(Stage* stage, int fd) {
+    stage->ownedFds = (int*) realloc(stage->ownedFds,
+                                     (stage->ownedCount + 1) * sizeof(int));
+    if (stage->ownedFds == NULL) {
+        perror("realloc");
+        exit(1);
+    }
+    stage->ownedFds[stage->ownedCount++] = fd;
+}
+
+/*
+ * runBuiltinStage
+ *
+ * Runs the built-in of a stage and then finishes the stage.  Has the
+ * signature of a thread's start routine.
+ */
+static void* runBuiltinStage(void* arg) {
+    Stage* stage = (Stage*) arg;
+
+    stage->status = W_EXITCODE(stage->builtin(stage->args, &stage->io) & 0xff,
+                               0);
+    if (builtinInterrupted()) {
+        /* Stopped by Ctrl-C, as a command killed by SIGINT would be */
+        stage->status = W_EXITCODE(0, SIGINT);
+    }
+    finishBuiltinStage(stage);
+
+    return NULL;
+}
+
+/*
+ * finishBuiltinStage
+ *
+ * Flushes the output of a built-in stage and closes the descriptors and
+ * ring buffer ends it owns, so the neighbouring stages see end-of-file or
+ * EPIPE.
+ */
+static void finishBuiltinStage(Stage* stage) {
+    int i;
+
+    builtinIoFinish(&stage->io);
+
+    if (stage->io.inRing != NULL) {
+        ringCloseReader(stage->io.inRing);
+    }
+    if (stage->io.outRing != NULL) {
+        ringCloseWriter(stage->io.outRing);
+    }
+
+    for (i = 0; i < stage->ownedCount; ++i) {
+        close(stage->ownedFds[i]);
+    }
+    free(stage->ownedFds);
+    stage->ownedFds   = NULL;
+    stage->ownedCount = 0;
+}
+
+/*
+ * expandLine
+ *
+ * Performs command and process substitution on a line of tokens.  Each
+ * $(...) or `...` token is replaced by the words of the command's output;
+ * each <(...) or >(...) token is replaced by a /dev/fd path connected to a
+ * command that runs concurrently with the line.
+ *
+ * line  - The tokens returned by the scanner.
+ * kinds - Set to the kind of each word: that of its token, or TOKEN_WORD
+ *         for the words a substitution produced, which are never
+ *         operators.
+ *
+ * Returns a NULL terminated array of words that remains valid until the
+ * next call to this function, as does the array of kinds.
+ */
+static char** expandLine(char** line, const char** kinds) {
+    char** words     = NULL;
+    char*  wordKinds = NULL;
+    int    count     = 0;
+    int    capacity  = 0;
+    int    i;
+
+    /* Release the previous line's words and captured output */
+    for (i = 0; i < captureCount; ++i) {
+        if (captures[i].mapped) {
+            munmap(captures[i].data, captures[i].size);
+        } else {
+            free(captures[i].data);
+        }
+    }
+    free(captures);
+    free(expandedLine);
+    free(expandedKinds);
+    captures      = NULL;
+    captureCount  = 0;
+    expandedLine  = NULL;
+    expandedKinds = NULL;
+
+    /* Start out with an empty, NULL terminated array */
+    appendWord(&words, &wordKinds, &count, &capacity, NULL, TOKEN_WORD);
+    count = 0;
+
+    for (i = 0; line[i] != NULL; ++i) {
+        if (getArgKind(i) == TOKEN_COMMAND_SUB) {
+            captures = (Capture*) realloc(captures,
+                                          (captureCount + 1) * sizeof(Capture));
+            if (captures == NULL) {
+                perror("realloc");
+                exit(1);
+            }
+            captureCommandOutput(line[i], &captures[captureCount]);
+            splitWords(&captures[captureCount++], &words, &wordKinds, &count,
+                       &capacity);
+        } else if (getArgKind(i) == TOKEN_PROCESS_SUB_IN
+                || getArgKind(i) == TOKEN_PROCESS_SUB_OUT) {
+            appendWord(&words, &wordKinds, &count, &capacity,
+                       startProcessSubstitution(line[i],
+                               getArgKind(i) == TOKEN_PROCESS_SUB_IN),
+                       TOKEN_WORD);
+        } else {
+            appendWord(&words, &wordKinds, &count, &capacity, line[i],
+                       (char) getArgKind(i));
+        }
+    }
+
+    expandedLine  = words;
+    expandedKinds = wordKinds;
+    *kinds        = wordKinds;
+    return words;
+}
+
+/*
+ * appendWord
+ *
+ * Appends 'word', of the specified kind, to a growable, NULL terminated
+ * array of words and the parallel array of their kinds, doubling the
+ * arrays' capacity as necessary.
+ */
+static void appendWord(char*** words, char** kinds, int* count,
+                       int* capacity, char* word, char kind) {
+    if (*count + 2 > *capacity) {
+        *capacity = (*capacity > 0) ? *capacity * 2 : MAX_ARGS;
+        *words    = (char**) realloc(*words, *capacity * sizeof(char*));
+        *kinds    = (char*) realloc(*kinds, *capacity);
+        if (*words == NULL || *kinds == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    (*kinds)[*count]     = kind;
+    (*words)[(*count)++] = word;
+    (*words)[*count]     = NULL;
+}
+
+/*
+ * splitWords
+ *
+ * Splits captured output into words at blanks and newlines.  The
+ * splitting happens in place: separators are overwritten with NUL bytes
+ * and the words point into the capture, so the output is never copied.
+ * The words are ordinary words even if they look like operators.
+ */
+static void splitWords(Capture* capture, char*** words, char** kinds,
+                       int* count, int* capacity) {
+    char* p   = capture->data;
+    char* end = capture->data + capture->length;
+
+    *end = '\0';
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n')) {
+            ++p;
+        }
+        if (p == end) {
+            break;
+        }
+
+        appendWord(words, kinds, count, capacity, p, TOKEN_WORD);
+
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\n') {
+            ++p;
+        }
+        *p++ = '\0';
+    }
+}
 
 /*
- * A global variable representing the process ID of this shell's child.  When the value of this
- * variable is 0, there are no running children.
+ * captureCommandOutput
+ *
+ * Runs 'text' as a command line in a child process and captures its
+ * standard output.  The child writes straight into a memfd which is then
+ * mapped back, so the output is never copied.  If memfd_create() is not
+ * available the output is read through a pipe into a buffer that doubles
+ * in size as it fills.
+ *
+ * text    - The text of the substitution.
+ * capture - Filled in with the captured output.
  */
-static pid_t childPid = 0;
+static void captureCommandOutput(const char* text, Capture* capture) {
+    int status;
+    int memfd = memfd_create("substitution", MFD_CLOEXEC);
+
+    /* Don't let the child inherit (and repeat) our pending output */
+    fflush(stdout);
+
+    if (memfd >= 0) {
+        struct stat info;
+
+        childPid = forkWrapper();
+        if (CHILD_PID(childPid)) {
+            dup2(memfd, 1);
+            runSubstitution(text);
+        }
+        waitpid(childPid, &status, 0);
+        childPid = 0;
+
+        /* Grow the file by one byte so the output can be NUL terminated */
+        if (fstat(memfd, &info) == -1
+                || ftruncate(memfd, info.st_size + 1) == -1) {
+            perror("memfd");
+            exit(1);
+        }
+
+        capture->length = info.st_size;
+        capture->size   = info.st_size + 1;
+        capture->mapped = true;
+        capture->data   = (char*) mmap(NULL, capture->size,
+                                       PROT_READ | PROT_WRITE, MAP_SHARED,
+                                       memfd, 0);
+        if (capture->data == MAP_FAILED) {
+            perror("mmap");
+            exit(1);
+        }
+        close(memfd);
+    } else {
+        int     pipefd[2];
+        ssize_t bytesRead;
+
+        pipeWrapper(pipefd);
+
+        childPid = forkWrapper();
+        if (CHILD_PID(childPid)) {
+            close(pipefd[0]);
+            dup2(pipefd[1], 1);
+            close(pipefd[1]);
+            runSubstitution(text);
+        }
+        close(pipefd[1]);
+
+        capture->length = 0;
+        capture->size   = CAPTURE_BUFFER_SIZE;
+        capture->mapped = false;
+        capture->data   = (char*) malloc(capture->size);
+
+        /* Read as much as fits, doubling the buffer whenever it fills up */
+        while (capture->data != NULL) {
+            bytesRead = read(pipefd[0], capture->data + capture->length,
+                             capture->size - capture->length - 1);
+            if (bytesRead == 0 || (bytesRead < 0 && errno != EINTR)) {
+                break;
+            }
+            if (bytesRead > 0) {
+                capture->length += bytesRead;
+            }
+            if (capture->length + 1 == capture->size) {
+                capture->size *= 2;
+                capture->data  = (char*) realloc(capture->data, capture->size);
+            }
+        }
+        if (capture->data == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        close(pipefd[0]);
+        waitpid(childPid, &status, 0);
+        childPid = 0;
+    }
+}
 
 /*
- * Entry point of the application
+ * runSubstitution
+ *
+ * Runs the text of a command substitution in the (child) shell and exits
+ * with the command's status.  Standard output must already be redirected
+ * to wherever the output is captured.
  */
-int main(void) {
-    char** line;
+static void runSubstitution(const char* text) {
+    /* The scanner reuses the buffer holding 'text', so take a copy */
+    char* copy   = strdup(text);
+    int   status = runCommandLine(getArgListFromString(copy), false, true);
 
-    signal(SIGINT, signalHandler);
+    fflush(stdout);
+    _exit(WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+}
 
-    /* Read a line of input from the keyboard */
-    line = promptAndRead();
+/*
+ * startProcessSubstitution
+ *
+ * Starts 'text' as a command line in a child process connected to the
+ * shell by a pipe, and returns the /dev/fd path of the shell's end of the
+ * pipe.  The shell keeps its end open (and inheritable) so the command
+ * that receives the path can open it; the child is tracked in
+ * 'processSubs' and reaped by reapProcessSubstitutions().
+ *
+ * text     - The text of the substitution.
+ * readFrom - true for <(cmd), whose output is read by the command;
+ *            false for >(cmd), whose input is written by the command.
+ */
+static char* startProcessSubstitution(const char* text, bool readFrom) {
+    int         pipefd[2];
+    ProcessSub* sub;
+
+    processSubs = (ProcessSub*) realloc(processSubs,
+                                (processSubCount + 1) * sizeof(ProcessSub));
+    if (processSubs == NULL) {
+        perror("realloc");
+        exit(1);
+    }
+    sub = &processSubs[processSubCount];
 
-    /* While the line was blank or the user didn't type exit */
-    while (line[0] == NULL || (strcmp(line[0], "exit") != 0)) {
-        int lineIndex = 0; /* An index into the line array */
+    pipeWrapper(pipefd);
+    fflush(stdout);
 
-        /* Ignore blank lines */
-        if (line[lineIndex] != NULL) {
-            int   status;
-            char* args[MAX_ARGS]; /* A processes arguments */
+    sub->pid = forkWrapper();
+    if (CHILD_PID(sub->pid)) {
+        int i;
 
-            /* Dig out the arguments for a single process */
-            parseArgs(args, line, &lineIndex);
+        /* Don't hold other substitutions' pipes open */
+        for (i = 0; i < processSubCount; ++i) {
+            close(processSubs[i].fd);
+        }
 
-            if (strcmp(args[0], "ls") == 0) {
-                doLs(args);
-            } else if (strcmp(args[0], "rm") == 0) {
-                doRm(args);
-            } else {
-                /* Fork off a child process */
-                childPid = forkWrapper();
-
-                if (CHILD_PID(childPid)) {
-                    /* The child shell continues to process the command line */
-                    continueProcessingLine(line, &lineIndex, args);
-                } else {
-
-                    waitpid(childPid, &status, 0);
-                    printf("\nChild %d exited with status %d\n", childPid,
-                            status);
-                }
-            }
+        if (readFrom) {
+            close(pipefd[0]);
+            dup2(pipefd[1], 1);
+            close(pipefd[1]);
+        } else {
+            close(pipefd[1]);
+            dup2(pipefd[0], 0);
+            close(pipefd[0]);
         }
+        runSubstitution(text);
+    }
 
-        /* Read the next line of input from the keyboard */
-        line = promptAndRead();
+    if (readFrom) {
+        close(pipefd[1]);
+        sub->fd = pipefd[0];
+    } else {
+        close(pipefd[0]);
+        sub->fd = pipefd[1];
     }
 
-    /* User must have typed "exit", time to gracefully exit. */
-    return 0;
+    /* The command handed the /dev/fd path must inherit this end */
+    fcntl(sub->fd, F_SETFD, 0);
+
+    sub->path = (char*) malloc(sizeof("/dev/fd/") + 3 * sizeof(int));
+    if (sub->path == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    sprintf(sub->path, "/dev/fd/%d", sub->fd);
+    processSubCount++;
+
+    return sub->path;
+}
+
+/*
+ * reapProcessSubstitutions
+ *
+ * Closes the shell's ends of the current line's process substitution
+ * pipes (so writers see EPIPE and readers see end-of-file) and waits for
+ * the substituted commands to finish.
+ */
+static void reapProcessSubstitutions(void) {
+    int i;
+    int status;
+
+    for (i = 0; i < processSubCount; ++i) {
+        close(processSubs[i].fd);
+    }
+    for (i = 0; i < processSubCount; ++i) {
+        waitpid(processSubs[i].pid, &status, 0);
+        free(processSubs[i].path);
+    }
+
+    free(processSubs);
+    processSubs     = NULL;
+    processSubCount = 0;
 }
 
 /**
@@ -137,12 +1685,18 @@ int main(void) {
  * @param signo is the signal to be taken care of
  */
 void signalHandler(int signo) {
+    int i;
 
     if(childPid > 0) {
         kill(childPid, signo);
     }
-    else if(childPid < 0) {
-        perror("fork");
+
+    /* Built-in stages run in the shell: ask them to stop, and wake them */
+    builtinInterrupt();
+    for (i = 0; i < runningLinkCount; ++i) {
+        if (runningLinks[i].ring != NULL) {
+            ringInterrupt(runningLinks[i].ring);
+        }
     }
 }
 
@@ -150,272 +1704,370 @@ void signalHandler(int signo) {
 /*
  * continueProcessingLine
  *
- * This function continues to process a line read in from the user.  This processing can include
- * append redirection, stderr redirection, etc.  Note that this function operates recursively; it
- * breaks off a piece associated with a process until it gets to something "special", decides what
- * to do with that "special" thing, and then calls itself to handle the rest.  The base case of
- * the recursion is when the end of the 'line' array is reached (i.e., when line[*lineIndex] ==
- * NULL).
+ * This function continues to process a line read in from the user in the child process of one
+ * stage of a pipeline.  This processing can include append redirection, stderr redirection,
+ * etc.  Note that this function operates recursively; it steps over the arguments of the process
+ * until it gets to something "special", decides what to do with that "special" thing, and then
+ * calls itself to handle the rest.  The base case of the recursion is the end of this process's
+ * part of the line (i.e., when line[*lineIndex] is NULL or "|"), where the command is executed.
+ * The pipes between the stages are set up by runPipeline() before the child gets here.
  *
  * line      - An array of pointers to string corresponding to ALL of the tokens entered on the
  * command line.
+ * kinds     - The kind (TOKEN_WORD, ...) of each token of the line.
  * lineIndex - A pointer to the index of the next token to be processed
  * args      - A NULL terminated array of string corresponding to the arguments for a process
  * (i.e., stuff that was already parsed off of line).
  */
-static void continueProcessingLine(char** line, int* lineIndex, char** args) {
-    if (line[*lineIndex] == NULL) { /* Base case -- nothing left in line */
-        
-        if(execvp(line[0], args) < 0){
+static void continueProcessingLine(char** line, const char* kinds,
+                                   int* lineIndex, char** args) {
+    Redirection redirection;
+
+    if (line[*lineIndex] == NULL || isPipe(line, kinds, *lineIndex)) {
+        /* Base case -- nothing left in this process's part of the line */
+
+        if (args[0] == NULL) {
+            /* Only redirections (e.g., "> file") */
+            _exit(0);
+        }
+        if(execvp(args[0], args) < 0){
             perror("EXEC failed");
             _exit(1);
         }		 
-    } else if (strcmp(line[*lineIndex], ">>") == 0) {
-        (*lineIndex)++;
-        doAppendRedirection(line[*lineIndex]);
-
-        (*lineIndex)++;
-        continueProcessingLine(line, lineIndex, args);
-
-    } else if (strcmp(line[*lineIndex], "2>") == 0) {
-        (*lineIndex)++;
-        doStderrRedirection(line[*lineIndex]);
-
-        (*lineIndex)++;
-        continueProcessingLine(line, lineIndex, args);
-
-    } else if (strcmp(line[*lineIndex], "&>") == 0) {
-        (*lineIndex)++;
-        doStdoutStderrRedirection(line[*lineIndex]);
-
-        (*lineIndex)++;
-        continueProcessingLine(line, lineIndex, args);
-
-    } else if (strcmp(line[*lineIndex], ">") == 0) {
-        (*lineIndex)++;
-        doStdoutRedirection(line[*lineIndex]);
-
-        (*lineIndex)++;
-        continueProcessingLine(line, lineIndex, args);
-
-    } else if (strcmp(line[*lineIndex], "<") == 0) {
+    } else if (isRedirection(line, kinds, *lineIndex, &redirection)) {
         (*lineIndex)++;
-        doStdinRedirection(line[*lineIndex]);
+        if (line[*lineIndex] == NULL) {
+            fprintf(stderr, "Missing target for '%s'\n", line[*lineIndex - 1]);
+            exit(1);
+        }
+        applyRedirection(&redirection, line[*lineIndex]);
 
         (*lineIndex)++;
-        continueProcessingLine(line, lineIndex, args);
+        continueProcessingLine(line, kinds, lineIndex, args);
 
-    } else if (strcmp(line[*lineIndex], "|") == 0) {
+    } else {
+        /* An argument, already collected in 'args' */
         (*lineIndex)++;
-        doPipe(args, line, lineIndex);
-        /* doPipe() calls continueProcessingLine() only in some cases */
+        continueProcessingLine(line, kinds, lineIndex, args);
     }
 }
 
 /*
- * doPipe
+ * parseRedirection
  *
- * Implements a pipe between two processes.
+ * Recognizes a redirection operator of the form [n]op, where op is one of
+ * <, >, >>, <>, <&, >&, <<, <<-, <<<, or one of &> and &>> (which take no
+ * n).  When n is omitted, operators starting with '<' apply to standard
+ * input and the others to standard output.
  *
- * p1Args    - The arguments for the left-hand-side command.
- * line      - An array of pointers to string corresponding to ALL of the
- *             tokens entered on the command line.
- * lineIndex - A pointer to the index of the next token to be processed.
- *             This index should point to one element beyond the pipe
- *             symbol.
+ * token       - The token to examine.
+ * redirection - Filled in with the descriptor and operation on success.
+ *
+ * Returns true if 'token' is a redirection operator; false otherwise.
  */
-static void doPipe(char** p1Args, char** line, int* lineIndex) {
-    int   pipefd[2]; /* Array of integers to hold 2 file descriptors. */
-    pid_t pid;       /* PID of a child process */
-
-    pipeWrapper(pipefd);
-
-    /* Fork the current process */
-    pid = forkWrapper();
-
-    if (CHILD_PID(pid)) { /* Child -- will execute left-hand-side process */
-       
-        dup2(pipefd[1], 1);
-        close(pipefd[0]);
-      
-        execvp(line[0], p1Args);
-
-    } else {  /* Parent will keep going */
-        char* args[MAX_ARGS];
- 
-        dup2(pipefd[0], 0);
-        close(pipefd[1]);
-        execvp(line[2], p1Args);
-
-        /* Read the args for the next process in the pipeline */
-        parseArgs(args, line, lineIndex);
+static bool parseRedirection(const char* token, Redirection* redirection) {
+    static const struct {
+        const char*   symbol;
+        RedirectionOp op;
+    } operators[] = {
+        { "<<<", REDIRECT_HERESTRING },
+        { "<<-", REDIRECT_HEREDOC    },
+        { "<<",  REDIRECT_HEREDOC    },
+        { "<>",  REDIRECT_READ_WRITE },
+        { "<&",  REDIRECT_DUPLICATE  },
+        { ">>",  REDIRECT_APPEND     },
+        { ">&",  REDIRECT_DUPLICATE  },
+        { "<",   REDIRECT_INPUT      },
+        { ">",   REDIRECT_OUTPUT     },
+    };
+    const char* op = token;
+    size_t      i;
+
+    if (strcmp(token, "&>") == 0 || strcmp(token, "&>>") == 0) {
+        redirection->fd = 1;
+        redirection->op = (token[2] == '>') ? REDIRECT_BOTH_APPEND
+                                            : REDIRECT_BOTH;
+        return true;
+    }
 
-        /* And keep going... */
-        continueProcessingLine(line, lineIndex, args);
+    while (*op >= '0' && *op <= '9') {
+        ++op;
+    }
 
+    for (i = 0; i < sizeof(operators) / sizeof(operators[0]); ++i) {
+        if (strcmp(op, operators[i].symbol) == 0) {
+            redirection->op = operators[i].op;
+            redirection->fd = (op != token) ? atoi(token)
+                                            : (op[0] == '<') ? 0 : 1;
+            return true;
+        }
     }
+    return false;
 }
 
 /*
- * doAppendRedirection
+ * applyRedirection
  *
- * Redirects the standard output of this process to append to the
- * file with the specified name.
+ * Performs a redirection in this process.
  *
- * filename - the name of the file to which to append our output
+ * redirection - The operator, as parsed by parseRedirection().
+ * target      - The token following the operator (a file name, a
+ *               descriptor number, or a here-document body).
  */
-static void doAppendRedirection(char* filename) {
-   
-    int stdOutFile = open(filename, O_RDWR | O_APPEND, S_IRWXU);
-    if(stdOutFile == -1){
-        perror("Error opening file");
-        exit(1);
+static void applyRedirection(const Redirection* redirection,
+                             const char* target) {
+    int fd;
+
+    if (redirection->op == REDIRECT_DUPLICATE) {
+        doDupRedirection(redirection->fd, target);
+        return;
     }
 
-    if(dup2(stdOutFile, 1) == -1){ // Redirecting stdout to file
-        perror("can't redirect standard out for append");
+    fd = openRedirectionTarget(redirection->op, target);
+    if(fd == -1){
+        perror("Error opening file");
         exit(1);
     }
+    moveFd(fd, redirection->fd);
 
-    fflush(stdout);
-    close(stdOutFile);
+    if (redirection->op == REDIRECT_BOTH
+            || redirection->op == REDIRECT_BOTH_APPEND) {
+        doDupRedirection(2, "1");
+    }
+}
 
-    return;
+/*
+ * openRedirectionTarget
+ *
+ * Opens what a redirection reads from or writes to: the named file, or a
+ * descriptor holding the body of a here-document or here-string.  The
+ * descriptor is close-on-exec.
+ *
+ * op     - Any operation except REDIRECT_DUPLICATE.
+ * target - The token following the operator.
+ *
+ * Returns the descriptor, or -1 (with errno set) on failure.
+ */
+static int openRedirectionTarget(RedirectionOp op, const char* target) {
+    switch (op) {
+        case REDIRECT_INPUT:
+            return open(target, O_RDONLY | O_CLOEXEC);
+
+        case REDIRECT_OUTPUT:
+        case REDIRECT_BOTH:
+            return open(target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                        REDIRECTION_MODE);
+
+        case REDIRECT_APPEND:
+        case REDIRECT_BOTH_APPEND:
+            return open(target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                        REDIRECTION_MODE);
+
+        case REDIRECT_READ_WRITE:
+            return open(target, O_RDWR | O_CREAT | O_CLOEXEC,
+                        REDIRECTION_MODE);
+
+        case REDIRECT_HEREDOC:
+            /* The scanner has already replaced the delimiter by the body */
+            return openHereDoc(target, strlen(target));
+
+        case REDIRECT_HERESTRING: {
+            size_t length = strlen(target);
+            char*  body   = (char*) malloc(length + 2);
+            int    fd;
+
+            if (body == NULL) {
+                return -1;
+            }
+            memcpy(body, target, length);
+            body[length]     = '\n';
+            body[length + 1] = '\0';
+            fd = openHereDoc(body, length + 1);
+            free(body);
+            return fd;
+        }
 
+        default:
+            errno = EINVAL;
+            return -1;
+    }
 }
 
 /*
- * doStdoutRedirection
+ * doDupRedirection
  *
- * Redirects the standard output of this process to overwrite the
- * file with the specified name.
+ * Makes descriptor 'fd' a copy of descriptor 'target', or closes it if
+ * 'target' is "-".
  *
- * filename - the name of the file which to overwrite
+ * fd     - The descriptor to redirect.
+ * target - The number of the descriptor to copy, or "-".
  */
-static void doStdoutRedirection(char* filename) {
-  
-    int stdOutFile = open(filename, O_TRUNC | O_WRONLY | O_CREAT, S_IRWXU);
-    if(stdOutFile == -1){
-        perror("Error opening file");
-        exit(1);
+static void doDupRedirection(int fd, const char* target) {
+    char* end;
+    long  source;
+
+    if (strcmp(target, "-") == 0) {
+        close(fd);
+        return;
     }
 
-    if(dup2(stdOutFile, 1) == -1){ // Redirecting stdout to file
-        perror("can't redirect standard out");
+    source = strtol(target, &end, 10);
+    if (target[0] == '\0' || *end != '\0' || source < 0 || source > INT_MAX) {
+        fprintf(stderr, "%s: not a file descriptor\n", target);
         exit(1);
     }
 
-    fflush(stdout);
-    close(stdOutFile);
-
-    return;
+    if(source != fd && dup2(source, fd) == -1){
+        perror("can't duplicate file descriptor");
+        exit(1);
+    }
 }
 
 /*
- * doStderrRedirection
- *
- * Redirects the standard error of this process to overwrite the
- * file with the specified name.
+ * moveFd
  *
- * filename - the name of the file which to overwrite
+ * Makes descriptor 'to' refer to what 'from' refers to, and closes 'from'.
+ * The result is always inherited across exec, even if 'from' was opened
+ * close-on-exec.
  */
-static void doStderrRedirection(char* filename) {
- 
-    int stdErrFile = open(filename, O_TRUNC | O_WRONLY | O_CREAT, S_IRWXU);
-    if(stdErrFile == -1){
-        perror("Error opening file");
-        exit(1);
+static void moveFd(int from, int to) {
+    if (from == to) {
+        fcntl(to, F_SETFD, 0);
+        return;
     }
-    if(dup2(stdErrFile, 2) == -1){ // Redirecting stderr to file
-        perror("can't redirect standard error");
+
+    if(dup2(from, to) == -1){
+        perror("can't redirect file descriptor");
         exit(1);
     }
-
-    fflush(stderr);
-    close(stdErrFile);
-
-    return;
+    close(from);
 }
 
 /*
- * doStdoutStderrRedirection
+ * openHereDoc
+ *
+ * Returns a close-on-exec descriptor from which the body of a
+ * here-document (or here-string) can be read, without creating a file on
+ * disk.  Small bodies are written into a pipe; larger ones are written
+ * into a memfd which is then rewound.  Without memfd_create(), the pipe is
+ * enlarged to hold the whole body, so the write never blocks.
  *
- * Redirects the standard output AND standard error of this process to
- * overwrite the file with the specified name.
+ * body   - The text to supply.
+ * length - The number of bytes in 'body'.
  *
- * filename - the name of the file which to overwrite
+ * Returns the descriptor, or -1 (with errno set) on failure.
  */
-static void doStdoutStderrRedirection(char* filename) {
-   
-    int stdOutErrFile = open(filename, O_TRUNC | O_WRONLY | O_CREAT, S_IRWXU);
-    if(stdOutErrFile == -1){
-        perror("Error opening file");
-        exit(1);
+static int openHereDoc(const char* body, size_t length) {
+    int pipefd[2];
+
+    if (length > HEREDOC_PIPE_LIMIT) {
+        int fd = memfd_create("heredoc", MFD_CLOEXEC);
+
+        if (fd >= 0) {
+            if (!writeAll(fd, body, length) || lseek(fd, 0, SEEK_SET) == -1) {
+                close(fd);
+                return -1;
+            }
+            return fd;
+        }
     }
 
-    if(dup2(stdOutErrFile, 1) == -1){ // Redirecting stdout to file
-        perror("can't redirect standard out");
-        exit(1);
+    if (pipe2(pipefd, O_CLOEXEC) == -1) {
+        return -1;
     }
-    if(dup2(stdOutErrFile, 2) == -1){ // Redirecting stderr to file
-        perror("can't redirect standard error");
-        exit(1);
+    if (length > HEREDOC_PIPE_LIMIT
+            && (length > INT_MAX
+                || fcntl(pipefd[1], F_SETPIPE_SZ, (int) length) < 0)) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+        errno = EFBIG;
+        return -1;
     }
 
-    fflush(stdout);
-    fflush(stderr);
-    close(stdOutErrFile);
+    writeAll(pipefd[1], body, length);
+    close(pipefd[1]);
 
-    return;
+    return pipefd[0];
 }
 
 /*
- * doStdinRedirection
- *
- * Redirects the standard input to this process from the file with the
- * specified name.
+ * writeAll
  *
- * filename - the name of the file from which to read as standard input.
+ * Writes all 'length' bytes of 'data' to 'fd', retrying after short
+ * writes and interruptions.  Returns false if the data could not be
+ * written.
  */
-static void doStdinRedirection(char* filename) {
-  
-    int stdInFile = open(filename, O_RDONLY);
-    if(stdInFile == -1){
-        perror("Error opening file");
-        exit(1);
-    }
+static bool writeAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
 
-    if(dup2(stdInFile, 0) == -1){ // Redirecting stdin to file
-        perror("can't redirect standard in");
-        exit(1);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data   += written;
+        length -= written;
     }
-
-    fflush(stdin);
-    close(stdInFile);
-
-    return;
+    return true;
 }
 
 /*
  * parseArgs
  *
- * Parse the command line, stopping at a special symbol of the end of the line.
+ * Parse the arguments of one process from the command line, stepping over its redirections and
+ * stopping at a pipe or the end of the line.
  *
- * args      - The array to populate with arguments from line
  * line      - An array of pointers to string corresponding to ALL of the
  *             tokens entered on the command line.
+ * kinds     - The kind (TOKEN_WORD, ...) of each token of the line.
  * lineIndex - A pointer to the index of the next token to be processed.
- *             This index should point to one element beyond the pipe
- *             symbol.
+ *             On return it points at the '|' ending the process's part of
+ *             the line, or at the terminating NULL.
+ *
+ * Returns a dynamically allocated, NULL terminated array of the arguments
+ * for a single process.  The strings themselves still belong to 'line';
+ * only the array must be freed by the caller.
  */
-static void parseArgs(char** args, char** line, int* lineIndex) {
-    int i;
+static char** parseArgs(char** line, const char* kinds, int* lineIndex) {
+    char** args;
+    int    count = 0;
+    int    end;
+
+    /* Brace expansion can produce far more than MAX_ARGS arguments */
+    for (end = *lineIndex;
+            line[end] != NULL && !isPipe(line, kinds, end); ++end) {
+        if (isSpecial(line, kinds, end)) {
+            if (line[end + 1] == NULL) {
+                break;
+            }
+            ++end; /* Step over the redirection's target */
+        } else {
+            ++count;
+        }
+    }
+
+    args = (char**) malloc((count + 1) * sizeof(char*));
+    if (args == NULL) {
+        perror("malloc");
+        exit(1);
+    }
 
-    for (i = 0;    line[*lineIndex] != NULL
-            && !isSpecial(line[*lineIndex]); ++(*lineIndex), ++i) {
-        args[i] = line[*lineIndex];
+    for (count = 0; *lineIndex < end; ++(*lineIndex)) {
+        if (isSpecial(line, kinds, *lineIndex)) {
+            ++(*lineIndex);
+        } else {
+            args[count++] = line[*lineIndex];
+        }
+    }
+    args[count] = NULL;
+
+    if (line[*lineIndex] != NULL && !isPipe(line, kinds, *lineIndex)) {
+        ++(*lineIndex); /* A redirection missing its target */
     }
-    args[i] = NULL;
+
+    return args;
 }
 
 /*
@@ -428,8 +2080,106 @@ static void parseArgs(char** args, char** line, int* lineIndex) {
  * the array corresponds to a token from the input line.
  */
 static char** promptAndRead(void) {
-    printf("(%d) $ ", getpid());
-    return getArgList();
+    char** line;
+
+    /* Report the background jobs that have finished */
+    jobsReap(interactive);
+
+    /* The line editor shows the prompt itself */
+    if (interactive && !lineEditing) {
+        fputs(promptText(), stdout);
+        fflush(stdout);
+    }
+    lineContinues = false;
+
+    commandLength = 0;
+    line = getArgList();
+
+    /* Remember the command (without its final newline) */
+    if (line[0] != NULL && interactive) {
+        historyAdd(commandText, (commandLength > 0
+                                 && commandText[commandLength - 1] == '\n')
+                                ? commandLength - 1 : commandLength);
+    }
+
+    return line;
+}
+
+/*
+ * continuationPrompt
+ *
+ * Returns the prompt for the lines after the first of a command.
+ */
+static const char* continuationPrompt(void) {
+    return "> ";
+}
+
+/*
+ * readInput
+ *
+ * Supplies the scanner with its input, standard input or a script (see
+ * YY_INPUT in shellParser.l), never more than one line at a time, so
+ * that it does not read ahead of the command it is scanning.  Each line
+ * is also added to the text of the command being read.  Lines typed at a terminal go through the line
+ * editor, which shows a "> " prompt for the lines after the first (e.g.,
+ * of a here-document).  Returns 0 at end of input.
+ */
+size_t readInput(char* buffer, size_t size) {
+    size_t count;
+
+    if (inputOffset == (size_t) inputLength) {
+        if (lineEditing && lineContinues) {
+            inputLength = editLine(continuationPrompt, -1, &inputLine,
+                                   &inputCapacity);
+        } else if (lineEditing) {
+            inputLength = editLine(promptText, promptUpdateFd(), &inputLine,
+                                   &inputCapacity);
+            lineContinues = true;
+        } else {
+            inputLength = getline(&inputLine, &inputCapacity,
+                                  (input != NULL) ? input : stdin);
+        }
+        inputOffset = 0;
+        if (inputLength <= 0) {
+            inputLength = 0;
+            inputEnded  = true;
+            return 0;
+        }
+
+        /* A script never blocks, so look ahead for its end */
+        if (!interactive) {
+            int next = getc(input);
+
+            if (next == EOF) {
+                inputDrained = true;
+            } else {
+                ungetc(next, input);
+            }
+        }
+
+        if (commandLength + inputLength > commandCapacity) {
+            size_t capacity = (commandLength + inputLength) * 2;
+            char*  grown = (char*) realloc(commandText, capacity);
+
+            if (grown == NULL) {
+                perror("realloc");
+                exit(1);
+            }
+            commandText     = grown;
+            commandCapacity = capacity;
+        }
+        memcpy(commandText + commandLength, inputLine, inputLength);
+        commandLength += inputLength;
+    }
+
+    count = inputLength - inputOffset;
+    if (count > size) {
+        count = size;
+    }
+    memcpy(buffer, inputLine + inputOffset, count);
+    inputOffset += count;
+
+    return count;
 }
 
 /*
@@ -455,11 +2205,13 @@ static pid_t forkWrapper(void) {
  *
  * A simple wrapper around the 'pipe' system call that attempts to invoke
  * pipe and on failure, prints an appropriate message and terminates the
- * process.
+ * process.  Both ends are close-on-exec, so a command only inherits the
+ * ends that are dup2()ed onto its standard descriptors; stray copies would
+ * otherwise keep pipes open and delay end-of-file.
  */
 static void pipeWrapper(int pipefds[]) {
    
-    int returnValue = pipe(pipefds);
+    int returnValue = pipe2(pipefds, O_CLOEXEC);
     if(returnValue < 0) {
         perror("Pipe_Error!");
         _exit(0);
@@ -490,118 +2242,35 @@ static void pipeWrapper(int pipefds[]) {
 /*
  * isSpecial
  *
- * Returns true if the specified token is "special" (i.e., is an
- * operator like >, >>, |, <); false otherwise.
- */
-static bool isSpecial(char* token) {
-    return    (strlen(token) == 1 && strchr("<>|", token[0]) != NULL)
-        || (strlen(token) == 2 && strchr(">",   token[1]) != NULL);
-}
-
-/**
- * doLs
- *
- * Implements a built-in version of the 'ls' command.
- *
- * args - An array of strings corresponding to the command and its arguments.
- *        If args[1] is NULL, the current directory (./) is assumed; otherwise
- *        it specifies the directory to list.
+ * Returns true if the token at 'index' of a line is "special" (i.e., is
+ * an operator like >, 2>>, |, <, <<); false otherwise.  Only tokens the
+ * scanner saw as operators count, so a quoted "|" or a '>' in the output
+ * of $(...) is an ordinary word.
  */
-static void doLs(char** args) {
-
-    DIR *dp = NULL;
-    struct dirent *dptr = NULL;
-
-    if(args[1] == NULL) {
-
-        dp = opendir("./");
-        lsHelper(dptr, dp);
-        closedir(dp);
-    }
+static bool isSpecial(char** line, const char* kinds, int index) {
+    Redirection redirection;
 
-    else {
-
-        int i = 1;
-        while (args[i] != NULL) {
-            dp = opendir(args[i]);
-
-            if(dp) {
-
-                // If there are more than 1 directory to display
-                //  print the directory name 
-                if(args[2] != NULL) {
-                    printf("%s --->", args[i]);
-                }
-                lsHelper(dptr, dp);
-                closedir(dp);
-            }
-            else {
-                printf("\nError ! Cannot open '%s' : Directory not found\n\n",
-                        args[i]);
-            }
-            i++;
-        }
-    }
+    return isPipe(line, kinds, index)
+           || isRedirection(line, kinds, index, &redirection);
 }
 
-
-/**
- * lsHelper function
- * This is a helper function for doLs to print
- * directory names on the screen
+/*
+ * isPipe
  *
- * @param dptr is the directory pointer
- * @param dp is the directory
+ * Returns true if the token at 'index' of a line is the '|' operator.
  */
-static void lsHelper(struct dirent *dptr, DIR *dp) {
-
-    printf("\n");
-
-    int count;
-
-    for(count = 0; (dptr = readdir(dp)) != NULL; count++) {
-
-        // Not to display hidden files
-        if(dptr->d_name[0] != '.') {
-            printf("%s\n", dptr->d_name);
-        }
-    }
-    printf("\n");
+static bool isPipe(char** line, const char* kinds, int index) {
+    return kinds[index] == TOKEN_OPERATOR && strcmp(line[index], "|") == 0;
 }
 
-
-/**
- * doRm
- *
- * Implements a built-in version of the 'rm' command.
+/*
+ * isRedirection
  *
- * args - An array of strings corresponding to the command and its arguments.
- *        args[0] is "rm", additional arguments are in args[1] ... n.
- *        args[x] = NULL indicates the end of the argument list.
+ * Like parseRedirection(), but for the token at 'index' of a line, which
+ * only counts if the scanner saw it as an operator.
  */
-static void doRm(char** args) {
-    
-    if(args[1] == NULL) {
-
-        printf("\nError! Need file name\n\n");
-
-    }
-    else {
-
-        int i = 1;
-
-        while (args[i] != NULL) {
-
-            int fd = open(args[i], O_RDONLY);
-            if (fd < 0) {
-                printf("\nError! Cannot remove '%s' : File not found\n\n",
-                        args[i]);
-            }
-            else { 
-                unlink(args[i]);
-                close(fd);
-            }
-            i++;
-        }
-    }
+static bool isRedirection(char** line, const char* kinds, int index,
+                          Redirection* redirection) {
+    return kinds[index] == TOKEN_OPERATOR
+           && parseRedirection(line[index], redirection);
 }
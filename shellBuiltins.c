@@ -0,0 +1,489 @@
+/*
+ * shellBuiltins.c
+ *
+ * The shell's built-in commands and the buffered I/O helpers they use to
+ * read and write their (possibly redirected or piped) standard streams.
+ *
+ * Built-ins may run on a pipeline thread, so they report errors through
+ * builtinError() and return a status instead of calling exit().
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include "shellBuiltins.h"
+
+/* Function prototypes */
+static int  doCd(char** args, BuiltinIo* io);
+static int  doLs(char** args, BuiltinIo* io);
+static int  doRm(char** args, BuiltinIo* io);
+static void lsHelper(BuiltinIo* io, struct dirent *dptr, DIR *dp);
+static bool writeOut(BuiltinIo* io, const char* data, size_t length);
+
+/* Set by Ctrl-C: the running built-ins stop reading and writing */
+static atomic_int interrupted = 0;
+
+/* The built-in commands, loaded into the command table (shellCommands.c) */
+static const struct {
+    const char*     name;
+    BuiltinFunction function;
+} builtins[] = {
+    { "admit",      doAdmit      },
+    { "alias",      doAlias      },
+    { "cat",        doCat        },
+    { "cd",         doCd         },
+    { "checksum",   doChecksum   },
+    { "count",      doCount      },
+    { "cp",         doCp         },
+    { "du",         doDu         },
+    { "exec",       doExec       },
+    { "fgrep",      doFgrep      },
+    { "find",       doFind       },
+    { "function",   doFunction   },
+    { "head",       doHead       },
+    { "history",    doHistory    },
+    { "limit",      doLimit      },
+    { "ls",         doLs         },
+    { "prompt",     doPrompt     },
+    { "rm",         doRm         },
+    { "sort",       doSort       },
+    { "tail",       doTail       },
+    { "unalias",    doUnalias    },
+    { "unfunction", doUnfunction },
+    { "wait",       doWait       },
+    { "wc",         doWc         },
+};
+
+/*
+ * builtinName
+ *
+ * Returns the name of the index'th built-in command, or NULL past the
+ * last one.
+ */
+const char* builtinName(size_t index) {
+    if (index >= sizeof(builtins) / sizeof(builtins[0])) {
+        return NULL;
+    }
+    return builtins[index].name;
+}
+
+/*
+ * builtinFunction
+ *
+ * Returns the function of the index'th built-in command.
+ */
+BuiltinFunction builtinFunction(size_t index) {
+    return builtins[index].function;
+}
+
+/*
+ * builtinIoInit
+ *
+ * Prepares the streams of a built-in command.
+ */
+void builtinIoInit(BuiltinIo* io, int in, int out, int err) {
+    io->in        = in;
+    io->out       = out;
+    io->err       = err;
+    io->inRing    = NULL;
+    io->outRing   = NULL;
+    io->outBuffer = NULL;
+    io->outLength = 0;
+    io->outClosed = (out < 0);
+}
+
+/*
+ * builtinIoFinish
+ *
+ * Flushes any buffered output and releases the output buffer.  The
+ * descriptors and ring buffers themselves are left open.
+ */
+void builtinIoFinish(BuiltinIo* io) {
+    builtinFlush(io);
+    free(io->outBuffer);
+    io->outBuffer = NULL;
+}
+
+/*
+ * builtinInterrupt
+ *
+ * Asks the running built-ins to stop, as Ctrl-C does for a command.  Safe
+ * to call from a signal handler.
+ */
+void builtinInterrupt(void) {
+    atomic_store(&interrupted, 1);
+}
+
+/*
+ * builtinInterrupted
+ *
+ * Returns true once the running built-ins have been asked to stop, so a
+ * long loop can give up early.
+ */
+bool builtinInterrupted(void) {
+    return atomic_load(&interrupted) != 0;
+}
+
+/*
+ * builtinClearInterrupt
+ *
+ * Forgets an interruption before the next pipeline starts.
+ */
+void builtinClearInterrupt(void) {
+    atomic_store(&interrupted, 0);
+}
+
+/*
+ * builtinRead
+ *
+ * Reads up to 'length' bytes of standard input, retrying after
+ * interruptions other than Ctrl-C.  Returns the number of bytes read, 0
+ * at end-of-file, or -1 on error (with errno EINTR after Ctrl-C).
+ */
+ssize_t builtinRead(BuiltinIo* io, void* data, size_t length) {
+    ssize_t bytesRead;
+
+    if (builtinInterrupted()) {
+        errno = EINTR;
+        return -1;
+    }
+    if (io->inRing != NULL) {
+        return ringRead(io->inRing, data, length);
+    }
+    if (io->in < 0) {
+        return 0;
+    }
+
+    do {
+        bytesRead = read(io->in, data, length);
+    } while (bytesRead < 0 && errno == EINTR && !builtinInterrupted());
+
+    return bytesRead;
+}
+
+/*
+ * builtinCloseInput
+ *
+ * Stops reading standard input for good, so that the previous stage of a
+ * pipeline gets EPIPE (or SIGPIPE) at once instead of when the built-in
+ * finishes.  A pipe is replaced by /dev/null rather than closed, since
+ * the stage still owns and will close the descriptor; the shell's own
+ * standard input is left alone.
+ */
+void builtinCloseInput(BuiltinIo* io) {
+    int null;
+
+    if (io->inRing != NULL) {
+        ringCloseReader(io->inRing);
+        io->inRing = NULL;
+        return;
+    }
+    if (io->in <= 2) {
+        return;
+    }
+
+    null = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (null >= 0) {
+        dup3(null, io->in, O_CLOEXEC);
+        close(null);
+    }
+}
+
+/*
+ * builtinWrite
+ *
+ * Appends 'length' bytes to standard output.  Small writes are collected
+ * in a buffer; large ones go straight to the descriptor.
+ *
+ * Returns false once output can no longer be written (e.g., the reader of
+ * a pipe has gone away), so a command can stop early.
+ */
+bool builtinWrite(BuiltinIo* io, const void* data, size_t length) {
+    const char* bytes = (const char*) data;
+
+    if (io->outClosed) {
+        return false;
+    }
+    if (builtinInterrupted()) {
+        io->outClosed = true;
+        return false;
+    }
+
+    if (io->outLength + length > BUILTIN_BUFFER_SIZE) {
+        if (!builtinFlush(io)) {
+            return false;
+        }
+    }
+
+    if (length >= BUILTIN_BUFFER_SIZE) {
+        return writeOut(io, bytes, length);
+    }
+
+    if (io->outBuffer == NULL) {
+        io->outBuffer = (char*) malloc(BUILTIN_BUFFER_SIZE);
+        if (io->outBuffer == NULL) {
+            io->outClosed = true;
+            return false;
+        }
+    }
+    memcpy(io->outBuffer + io->outLength, bytes, length);
+    io->outLength += length;
+
+    return true;
+}
+
+/*
+ * builtinPrintf
+ *
+ * Formats a message onto standard output.  Returns false once output can
+ * no longer be written.
+ */
+bool builtinPrintf(BuiltinIo* io, const char* format, ...) {
+    char    text[1024];
+    char*   message = text;
+    int     length;
+    bool    result;
+    va_list ap;
+
+    va_start(ap, format);
+    length = vsnprintf(text, sizeof(text), format, ap);
+    va_end(ap);
+
+    if (length < 0) {
+        return false;
+    }
+    if ((size_t) length >= sizeof(text)) {
+        va_start(ap, format);
+        length = vasprintf(&message, format, ap);
+        va_end(ap);
+        if (length < 0) {
+            return false;
+        }
+    }
+
+    result = builtinWrite(io, message, length);
+    if (message != text) {
+        free(message);
+    }
+    return result;
+}
+
+/*
+ * builtinFlush
+ *
+ * Writes any buffered output to standard output.  Returns false if it
+ * could not be written.
+ */
+bool builtinFlush(BuiltinIo* io) {
+    if (io->outLength > 0 && !io->outClosed) {
+        writeOut(io, io->outBuffer, io->outLength);
+    }
+    io->outLength = 0;
+
+    return !io->outClosed;
+}
+
+/*
+ * writeOut
+ *
+ * Writes all of 'data' to standard output (a ring buffer or a
+ * descriptor), bypassing the buffer.  Returns false, and marks output as
+ * closed, if it could not be written.
+ */
+static bool writeOut(BuiltinIo* io, const char* data, size_t length) {
+    if (io->outRing != NULL) {
+        if (ringWrite(io->outRing, data, length) < 0) {
+            io->outClosed = true;
+        }
+        return !io->outClosed;
+    }
+
+    while (length > 0) {
+        ssize_t written = write(io->out, data, length);
+
+        if (written < 0) {
+            if (errno == EINTR && !builtinInterrupted()) {
+                continue;
+            }
+            io->outClosed = true;
+            return false;
+        }
+        data   += written;
+        length -= written;
+    }
+    return true;
+}
+
+/*
+ * builtinError
+ *
+ * Writes a message to standard error, unbuffered.  Nothing is written
+ * after Ctrl-C, when the failures are the interruption's own.
+ */
+void builtinError(BuiltinIo* io, const char* format, ...) {
+    va_list ap;
+
+    if (io->err < 0 || builtinInterrupted()) {
+        return;
+    }
+
+    va_start(ap, format);
+    vdprintf(io->err, format, ap);
+    va_end(ap);
+}
+
+/**
+ * doCd
+ *
+ * Implements a built-in version of the 'cd' command.
+ *
+ * args - args[1] is the directory to change to; if it is NULL, the home
+ *        directory is used.
+ */
+static int doCd(char** args, BuiltinIo* io) {
+    const char* directory = (args[1] != NULL) ? args[1] : getenv("HOME");
+
+    if (directory == NULL || (args[1] != NULL && args[2] != NULL)) {
+        builtinError(io, "Usage: cd [directory]\n");
+        return 1;
+    }
+    if (chdir(directory) < 0) {
+        builtinError(io, "cd: %s: %s\n", directory, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * doLs
+ *
+ * Implements a built-in version of the 'ls' command.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *        If args[1] is NULL, the current directory (./) is assumed; otherwise
+ *        it specifies the directory to list.
+ */
+static int doLs(char** args, BuiltinIo* io) {
+
+    DIR *dp = NULL;
+    struct dirent *dptr = NULL;
+    int status = 0;
+
+    if(args[1] == NULL) {
+
+        dp = opendir("./");
+        if(dp) {
+            lsHelper(io, dptr, dp);
+            closedir(dp);
+        }
+        else {
+            builtinError(io, "\nError ! Cannot open '.'\n\n");
+            status = 1;
+        }
+    }
+
+    else {
+
+        int i = 1;
+        while (args[i] != NULL) {
+            dp = opendir(args[i]);
+
+            if(dp) {
+
+                // If there are more than 1 directory to display
+                //  print the directory name
+                if(args[2] != NULL) {
+                    builtinPrintf(io, "%s --->", args[i]);
+                }
+                lsHelper(io, dptr, dp);
+                closedir(dp);
+            }
+            else {
+                builtinError(io,
+                        "\nError ! Cannot open '%s' : Directory not found\n\n",
+                        args[i]);
+                status = 1;
+            }
+            i++;
+        }
+    }
+
+    return status;
+}
+
+
+/**
+ * lsHelper function
+ * This is a helper function for doLs to print
+ * directory names on the screen
+ *
+ * @param io is where the names are written
+ * @param dptr is the directory pointer
+ * @param dp is the directory
+ */
+static void lsHelper(BuiltinIo* io, struct dirent *dptr, DIR *dp) {
+
+    builtinPrintf(io, "\n");
+
+    int count;
+
+    for(count = 0; (dptr = readdir(dp)) != NULL; count++) {
+
+        // Not to display hidden files
+        if(dptr->d_name[0] != '.') {
+            builtinPrintf(io, "%s\n", dptr->d_name);
+        }
+    }
+    builtinPrintf(io, "\n");
+}
+
+
+/**
+ * doRm
+ *
+ * Implements a built-in version of the 'rm' command.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *        args[0] is "rm", additional arguments are in args[1] ... n.
+ *        args[x] = NULL indicates the end of the argument list.
+ */
+static int doRm(char** args, BuiltinIo* io) {
+
+    int status = 0;
+
+    if(args[1] == NULL) {
+
+        builtinError(io, "\nError! Need file name\n\n");
+        status = 1;
+
+    }
+    else {
+
+        int i = 1;
+
+        while (args[i] != NULL) {
+
+            int fd = open(args[i], O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                builtinError(io,
+                        "\nError! Cannot remove '%s' : File not found\n\n",
+                        args[i]);
+                status = 1;
+            }
+            else {
+                unlink(args[i]);
+                close(fd);
+            }
+            i++;
+        }
+    }
+
+    return status;
+}
@@ -0,0 +1,87 @@
+/*
+ * shellBuiltins.h
+ *
+ * This file contains the types and function prototypes shared by the
+ * shell and its built-in commands.
+ *
+ * A built-in command runs inside the shell process -- either on the
+ * shell's own thread or, as a stage of a pipeline, on a thread of its
+ * own -- so it must never touch the shell's standard streams directly.
+ * Instead it reads and writes the descriptors in its BuiltinIo.
+ */
+#ifndef SHELL_BUILTINS_H
+#define SHELL_BUILTINS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "shellRingBuffer.h"
+
+/* Size of the buffer that collects a built-in's standard output */
+#define BUILTIN_BUFFER_SIZE (64 * 1024)
+
+/*
+ * The standard streams of a running built-in command.  When the previous
+ * or next stage of the pipeline is also a built-in, standard input or
+ * output is a ring buffer instead of a descriptor.
+ */
+typedef struct {
+    int         in;         /* Standard input  (-1 if closed or a ring) */
+    int         out;        /* Standard output (-1 if closed or a ring) */
+    int         err;        /* Standard error  (-1 if closed)           */
+    RingBuffer* inRing;     /* Standard input from a built-in, or NULL  */
+    RingBuffer* outRing;    /* Standard output to a built-in, or NULL   */
+    char*       outBuffer;  /* Output not yet written                   */
+    size_t      outLength;  /* Number of bytes in 'outBuffer'           */
+    bool        outClosed;  /* true once writing output has failed      */
+} BuiltinIo;
+
+/*
+ * A built-in command.  'args' is NULL terminated with the command's name
+ * in args[0].  Returns the command's exit status.
+ */
+typedef int (*BuiltinFunction)(char** args, BuiltinIo* io);
+
+/* Function prototypes */
+BuiltinFunction findBuiltin(const char* name);
+const char*     builtinName(size_t index);
+BuiltinFunction builtinFunction(size_t index);
+
+/* Built-in commands defined outside shellBuiltins.c */
+int     doAdmit(char** args, BuiltinIo* io);
+int     doAlias(char** args, BuiltinIo* io);
+int     doCat(char** args, BuiltinIo* io);
+int     doChecksum(char** args, BuiltinIo* io);
+int     doCount(char** args, BuiltinIo* io);
+int     doCp(char** args, BuiltinIo* io);
+int     doDu(char** args, BuiltinIo* io);
+int     doExec(char** args, BuiltinIo* io);
+int     doFgrep(char** args, BuiltinIo* io);
+int     doFind(char** args, BuiltinIo* io);
+int     doFunction(char** args, BuiltinIo* io);
+int     doHead(char** args, BuiltinIo* io);
+int     doHistory(char** args, BuiltinIo* io);
+int     doLimit(char** args, BuiltinIo* io);
+int     doPrompt(char** args, BuiltinIo* io);
+int     doSort(char** args, BuiltinIo* io);
+int     doTail(char** args, BuiltinIo* io);
+int     doUnalias(char** args, BuiltinIo* io);
+int     doUnfunction(char** args, BuiltinIo* io);
+int     doWait(char** args, BuiltinIo* io);
+int     doWc(char** args, BuiltinIo* io);
+
+void    builtinIoInit(BuiltinIo* io, int in, int out, int err);
+void    builtinIoFinish(BuiltinIo* io);
+void    builtinInterrupt(void);
+bool    builtinInterrupted(void);
+void    builtinClearInterrupt(void);
+ssize_t builtinRead(BuiltinIo* io, void* data, size_t length);
+void    builtinCloseInput(BuiltinIo* io);
+bool    builtinWrite(BuiltinIo* io, const void* data, size_t length);
+bool    builtinPrintf(BuiltinIo* io, const char* format, ...)
+            __attribute__((format(printf, 2, 3)));
+bool    builtinFlush(BuiltinIo* io);
+void    builtinError(BuiltinIo* io, const char* format, ...)
+            __attribute__((format(printf, 2, 3)));
+
+#endif
@@ -0,0 +1,576 @@
+/*
+ * shellCgroup.c
+ *
+ * Transient cgroups for 'limit' (see shellCgroup.h), and the 'limit'
+ * built-in itself, which only runs when 'limit' is misused: the shell
+ * handles 'limit ... command' before running the pipeline.
+ *
+ * A cgroup may hand controllers to its children only if it has no
+ * processes of its own (unless it is the root), and the shell's cgroup
+ * has at least the shell.  'limit' reports that as an error unless it is
+ * given -s, which moves the shell into a leaf ("shell") beside the
+ * transient cgroups for good.
+ *
+ * The process that starts a limited pipeline is forked as usual and
+ * moves itself into the cgroup before it does anything else, so every
+ * command of the pipeline starts, and is charged, inside the limits.
+ * (clone3() with CLONE_INTO_CGROUP would save the move, but its child
+ * would run the pipeline -- built-ins, threads, stdio -- with the C
+ * library's state as the parent's fork handlers never saw it.)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include "shellBuiltins.h"
+#include "shellCgroup.h"
+
+/* The period over which cpu.max allows its quota (microseconds) */
+#define CPU_PERIOD 100000
+
+/* The cgroup the shell moves into, beside the transient ones */
+#define SHELL_LEAF "shell"
+
+#define LIMIT_USAGE "Usage: limit [-s] [-c cpus] [-m size] [-r rate] " \
+                    "[-w rate] command [| command]...\n"
+
+/* Function prototypes */
+static bool        parseSize(const char* text, unsigned long long* size);
+static const char* findBase(void);
+static bool        enableControllers(const char* base,
+                                     const CgroupLimits* limits);
+static bool        hasWord(const char* list, const char* word);
+static bool        applyLimits(const Cgroup* group,
+                               const CgroupLimits* limits);
+static bool        findDisk(unsigned int* diskMajor, unsigned int* diskMinor);
+static bool        writeFile(const char* directory, const char* name,
+                             const char* text);
+static bool        readFile(const char* directory, const char* name,
+                            char* buffer, size_t size);
+static bool        findValue(const char* text, const char* key,
+                             unsigned long long* value);
+
+/*
+ * cgroupParseLimits
+ *
+ * Reads the options of a 'limit' command (args[0] is "limit"):
+ *
+ *     -c cpus    CPU time, in CPUs' worth (e.g., 0.5 or 2)
+ *     -m size    Memory, in bytes (a suffix K, M, G or T multiplies)
+ *     -r rate    Bytes read per second from the disk holding the
+ *                current directory (suffixes as for -m)
+ *     -w rate    Bytes written per second to that disk
+ *     -s         If the shell's cgroup has to give out controllers,
+ *                move the shell into a leaf cgroup beside the
+ *                transient ones (it stays there)
+ *
+ * Returns the index of the first word of the command, or -1 (after
+ * reporting the usage to io's standard error) if the options are wrong
+ * or there is no command.
+ */
+int cgroupParseLimits(char** args, CgroupLimits* limits, BuiltinIo* io) {
+    int i = 1;
+
+    memset(limits, 0, sizeof(*limits));
+    while (args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'
+           && args[i][2] == '\0') {
+        const char* value = args[i + 1];
+        bool        valid = (value != NULL);
+        char*       end;
+
+        if (args[i][1] == 's') {
+            limits->moveShell = true;
+            ++i;
+            continue;
+        }
+        switch (args[i][1]) {
+            case 'c':
+                if (valid) {
+                    limits->cpus = strtod(value, &end);
+                    valid = (end != value && *end == '\0' && limits->cpus > 0);
+                }
+                break;
+            case 'm':
+                valid = valid && parseSize(value, &limits->memory);
+                break;
+            case 'r':
+                valid = valid && parseSize(value, &limits->readRate);
+                break;
+            case 'w':
+                valid = valid && parseSize(value, &limits->writeRate);
+                break;
+            default:
+                valid = false;
+                break;
+        }
+        if (!valid) {
+            builtinError(io, LIMIT_USAGE);
+            return -1;
+        }
+        i += 2;
+    }
+
+    if (args[i] == NULL) {
+        builtinError(io, LIMIT_USAGE);
+        return -1;
+    }
+    return i;
+}
+
+/*
+ * cgroupCreate
+ *
+ * Creates a transient cgroup with the specified limits.  Returns false
+ * (after printing an error) if it cannot.
+ */
+bool cgroupCreate(const CgroupLimits* limits, Cgroup* group) {
+    static int  count = 0;
+    const char* base  = findBase();
+
+    if (base == NULL || !enableControllers(base, limits)) {
+        return false;
+    }
+
+    if (asprintf(&group->path, "%s/limit.%d.%d", base, (int) getpid(),
+                 ++count) < 0) {
+        perror("asprintf");
+        return false;
+    }
+    if (mkdir(group->path, 0755) < 0) {
+        fprintf(stderr, "limit: %s: %s\n", group->path, strerror(errno));
+        free(group->path);
+        return false;
+    }
+
+    if (!applyLimits(group, limits)) {
+        rmdir(group->path);
+        free(group->path);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * cgroupFork
+ *
+ * Like fork(), but the child moves into the cgroup before returning.
+ * Returns -1 (after printing an error) if there is no child.
+ */
+pid_t cgroupFork(const Cgroup* group) {
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("fork");
+    } else if (pid == 0 && !writeFile(group->path, "cgroup.procs", "0")) {
+        perror("limit: cgroup.procs");
+        _exit(1);
+    }
+    return pid;
+}
+
+/*
+ * cgroupFinish
+ *
+ * Reports the CPU time and peak memory used in a cgroup whose processes
+ * have finished, and removes it.
+ */
+void cgroupFinish(Cgroup* group) {
+    char               text[1024];
+    unsigned long long usage     = 0;
+    unsigned long long user      = 0;
+    unsigned long long system    = 0;
+    unsigned long long periods   = 0;
+    unsigned long long throttled = 0;
+    unsigned long long value;
+
+    if (readFile(group->path, "cpu.stat", text, sizeof(text))) {
+        findValue(text, "usage_usec", &usage);
+        findValue(text, "user_usec", &user);
+        findValue(text, "system_usec", &system);
+        findValue(text, "nr_throttled", &periods);
+        findValue(text, "throttled_usec", &throttled);
+    }
+    fprintf(stderr, "limit: cpu %.2fs (user %.2fs, system %.2fs)",
+            usage / 1e6, user / 1e6, system / 1e6);
+    if (periods > 0) {
+        fprintf(stderr, ", throttled %.2fs in %llu periods", throttled / 1e6,
+                periods);
+    }
+    if (readFile(group->path, "memory.peak", text, sizeof(text))
+            && sscanf(text, "%llu", &value) == 1) {
+        fprintf(stderr, ", memory peak %.1f MiB", value / 1048576.0);
+    }
+    if (readFile(group->path, "memory.events", text, sizeof(text))
+            && findValue(text, "oom_kill", &value) && value > 0) {
+        fprintf(stderr, ", %llu killed for lack of memory", value);
+    }
+    fputc('\n', stderr);
+
+    /* Processes that outlived the pipeline keep the cgroup, and its limits */
+    if (rmdir(group->path) < 0) {
+        fprintf(stderr, "limit: %s left behind: %s\n", group->path,
+                strerror(errno));
+    }
+    free(group->path);
+}
+
+/**
+ * doLimit
+ *
+ * Implements the 'limit' built-in.  The shell runs 'limit ... command'
+ * itself, putting the whole pipeline in the cgroup, so the built-in only
+ * runs to report a mistake: wrong options, no command, or 'limit' not
+ * being the first command of a pipeline.
+ *
+ * args - The command and its arguments.
+ */
+int doLimit(char** args, BuiltinIo* io) {
+    CgroupLimits limits;
+
+    if (cgroupParseLimits(args, &limits, io) >= 0) {
+        builtinError(io, "limit: must start the pipeline it limits\n");
+    }
+    return 1;
+}
+
+/*
+ * parseSize
+ *
+ * Reads a positive number of bytes with an optional suffix (K, M, G or
+ * T, in powers of 1024).  Returns false if 'text' is not one.
+ */
+static bool parseSize(const char* text, unsigned long long* size) {
+    static const char units[] = "KMGT";
+    const char*       unit;
+    char*             end;
+    double            value = strtod(text, &end);
+
+    if (end == text || value <= 0) {
+        return false;
+    }
+    if (*end != '\0') {
+        unit = strchr(units, toupper((unsigned char) *end));
+        if (unit == NULL || end[1] != '\0') {
+            return false;
+        }
+        for (; unit >= units; --unit) {
+            value *= 1024;
+        }
+    }
+
+    *size = (unsigned long long) value;
+    return *size > 0;
+}
+
+/*
+ * findBase
+ *
+ * Returns the directory of the shell's cgroup (where the cgroup version 2
+ * hierarchy is mounted, followed by the path in /proc/self/cgroup), the
+ * parent of the transient cgroups.  Returns NULL (after printing an
+ * error) if there is no such hierarchy.
+ */
+static const char* findBase(void) {
+    static char* base     = NULL;
+    char*        line     = NULL;
+    size_t       capacity = 0;
+    char*        mount    = NULL;
+    char*        path     = NULL;
+    FILE*        file;
+
+    if (base != NULL) {
+        return base;
+    }
+
+    file = fopen("/proc/self/mountinfo", "re");
+    while (file != NULL && mount == NULL
+           && getline(&line, &capacity, file) > 0) {
+        const char* fields = strstr(line, " - ");
+        char        point[PATH_MAX];
+
+        if (fields != NULL && strncmp(fields, " - cgroup2 ", 11) == 0
+                && sscanf(line, "%*s %*s %*s %*s %4095s", point) == 1) {
+            mount = strdup(point);
+        }
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+
+    file = fopen("/proc/self/cgroup", "re");
+    while (file != NULL && path == NULL
+           && getline(&line, &capacity, file) > 0) {
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            path = strdup(line + 3);
+        }
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+
+    if (mount != NULL && path != NULL
+            && asprintf(&base, "%s%s", mount,
+                        (strcmp(path, "/") == 0) ? "" : path) < 0) {
+        base = NULL;
+    }
+    if (base == NULL) {
+        fprintf(stderr, "limit: no cgroup version 2 hierarchy\n");
+    }
+
+    free(line);
+    free(mount);
+    free(path);
+    return base;
+}
+
+/*
+ * enableControllers
+ *
+ * Makes the controllers the limits need available to the transient
+ * cgroups.  If the shell's cgroup has processes, the shell is moved into
+ * its leaf when the limits allow it (-s).  Returns false (after printing
+ * an error) if the controllers cannot be enabled.
+ */
+static bool enableControllers(const char* base, const CgroupLimits* limits) {
+    static const char* const names[] = { "cpu", "memory", "io" };
+    bool   needed[] = { limits->cpus > 0, limits->memory > 0,
+                        limits->readRate > 0 || limits->writeRate > 0 };
+    char   available[256] = "";
+    char   wanted[64]     = "";
+    char*  leaf;
+    size_t i;
+
+    readFile(base, "cgroup.controllers", available, sizeof(available));
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (!needed[i]) {
+            continue;
+        }
+        if (!hasWord(available, names[i])) {
+            fprintf(stderr, "limit: the %s controller is not available in %s\n",
+                    names[i], base);
+            return false;
+        }
+        strcat(wanted, "+");
+        strcat(wanted, names[i]);
+        strcat(wanted, " ");
+    }
+    if (wanted[0] == '\0'
+            || writeFile(base, "cgroup.subtree_control", wanted)) {
+        return true;
+    }
+
+    /* The shell's cgroup has processes (the shell) */
+    if (errno == EBUSY && !limits->moveShell) {
+        fprintf(stderr, "limit: cannot enable controllers in %s: it has "
+                "processes (-s moves the shell out)\n", base);
+        return false;
+    }
+    if (errno == EBUSY && asprintf(&leaf, "%s/%s", base, SHELL_LEAF) >= 0) {
+        bool moved = (mkdir(leaf, 0755) == 0 || errno == EEXIST)
+                     && writeFile(leaf, "cgroup.procs", "0");
+
+        free(leaf);
+        if (moved && writeFile(base, "cgroup.subtree_control", wanted)) {
+            return true;
+        }
+    }
+
+    fprintf(stderr, "limit: cannot enable controllers in %s: %s\n", base,
+            strerror(errno));
+    return false;
+}
+
+/*
+ * hasWord
+ *
+ * Returns true if a list of words separated by white space contains
+ * 'word'.
+ */
+static bool hasWord(const char* list, const char* word) {
+    size_t length = strlen(word);
+
+    while (*list != '\0') {
+        size_t span;
+
+        list += strspn(list, " \t\n");
+        span  = strcspn(list, " \t\n");
+        if (span == length && strncmp(list, word, length) == 0) {
+            return true;
+        }
+        list += span;
+    }
+    return false;
+}
+
+/*
+ * applyLimits
+ *
+ * Writes the limits into the cgroup's cpu.max, memory.max and io.max.
+ * Returns false (after printing an error) if one is refused.
+ */
+static bool applyLimits(const Cgroup* group, const CgroupLimits* limits) {
+    char         text[128];
+    unsigned int diskMajor;
+    unsigned int diskMinor;
+    int          length;
+
+    if (limits->cpus > 0) {
+        snprintf(text, sizeof(text), "%llu %d",
+                 (unsigned long long) (limits->cpus * CPU_PERIOD), CPU_PERIOD);
+        if (!writeFile(group->path, "cpu.max", text)) {
+            fprintf(stderr, "limit: cpu.max: %s\n", strerror(errno));
+            return false;
+        }
+    }
+
+    if (limits->memory > 0) {
+        snprintf(text, sizeof(text), "%llu", limits->memory);
+        if (!writeFile(group->path, "memory.max", text)) {
+            fprintf(stderr, "limit: memory.max: %s\n", strerror(errno));
+            return false;
+        }
+    }
+
+    if (limits->readRate > 0 || limits->writeRate > 0) {
+        if (!findDisk(&diskMajor, &diskMinor)) {
+            return false;
+        }
+        length = snprintf(text, sizeof(text), "%u:%u", diskMajor, diskMinor);
+        if (limits->readRate > 0) {
+            length += snprintf(text + length, sizeof(text) - length,
+                               " rbps=%llu", limits->readRate);
+        }
+        if (limits->writeRate > 0) {
+            snprintf(text + length, sizeof(text) - length, " wbps=%llu",
+                     limits->writeRate);
+        }
+        if (!writeFile(group->path, "io.max", text)) {
+            fprintf(stderr, "limit: io.max: %s\n", strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * findDisk
+ *
+ * Finds the disk holding the current directory: the whole disk, which is
+ * what io.max limits, even if the directory is on a partition of it.
+ * Returns false (after printing an error) if it is not on a disk.
+ */
+static bool findDisk(unsigned int* diskMajor, unsigned int* diskMinor) {
+    char        path[64];
+    char        text[32];
+    struct stat status;
+
+    if (stat(".", &status) < 0) {
+        perror("limit: .");
+        return false;
+    }
+    *diskMajor = major(status.st_dev);
+    *diskMinor = minor(status.st_dev);
+
+    snprintf(path, sizeof(path), "/sys/dev/block/%u:%u", *diskMajor,
+             *diskMinor);
+    if (access(path, F_OK) < 0) {
+        fprintf(stderr, "limit: the current directory is not on a disk\n");
+        return false;
+    }
+
+    /* In sysfs, a partition's directory is inside its disk's */
+    if (readFile(path, "partition", text, sizeof(text))
+            && (!readFile(path, "../dev", text, sizeof(text))
+                || sscanf(text, "%u:%u", diskMajor, diskMinor) != 2)) {
+        fprintf(stderr, "limit: cannot find the disk of %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * writeFile
+ *
+ * Writes text into a file of a cgroup (or other directory).  Returns
+ * false, with errno set, if that fails.
+ */
+static bool writeFile(const char* directory, const char* name,
+                      const char* text) {
+    char    path[PATH_MAX];
+    ssize_t written;
+    int     error;
+    int     fd;
+
+    snprintf(path, sizeof(path), "%s/%s", directory, name);
+    fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    written = write(fd, text, strlen(text));
+    error   = errno;
+    close(fd);
+
+    errno = error;
+    return written == (ssize_t) strlen(text);
+}
+
+/*
+ * readFile
+ *
+ * Reads a file of a cgroup (or other directory) into a NUL-terminated
+ * buffer.  Returns false if it cannot be read or is empty.
+ */
+static bool readFile(const char* directory, const char* name, char* buffer,
+                     size_t size) {
+    char    path[PATH_MAX];
+    ssize_t length;
+    int     fd;
+
+    snprintf(path, sizeof(path), "%s/%s", directory, name);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    length = read(fd, buffer, size - 1);
+    close(fd);
+    if (length <= 0) {
+        return false;
+    }
+
+    buffer[length] = '\0';
+    return true;
+}
+
+/*
+ * findValue
+ *
+ * Finds the line "key value" in the text of a file such as cpu.stat.
+ * Returns false if there is none.
+ */
+static bool findValue(const char* text, const char* key,
+                      unsigned long long* value) {
+    size_t      length = strlen(key);
+    const char* line   = text;
+
+    while (line != NULL && *line != '\0') {
+        if (strncmp(line, key, length) == 0 && line[length] == ' ') {
+            return sscanf(line + length, "%llu", value) == 1;
+        }
+        line = strchr(line, '\n');
+        if (line != NULL) {
+            ++line;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,37 @@
+/*
+ * shellCgroup.h
+ *
+ * Running a pipeline under resource limits ('limit'): the pipeline is
+ * started inside a transient cgroup (version 2) created for it, below
+ * the shell's own, whose cpu.max, memory.max and io.max are set from
+ * the limits given.  When the pipeline is done, the CPU time and peak
+ * memory it used are reported and the cgroup is removed.
+ */
+#ifndef SHELL_CGROUP_H
+#define SHELL_CGROUP_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include "shellBuiltins.h"
+
+/* The limits to run a pipeline under; 0 means no limit */
+typedef struct {
+    double             cpus;        /* CPUs' worth of time (cpu.max)       */
+    unsigned long long memory;      /* Bytes (memory.max)                  */
+    unsigned long long readRate;    /* Bytes per second read (io.max)      */
+    unsigned long long writeRate;   /* Bytes per second written (io.max)   */
+    bool               moveShell;   /* May move the shell to a leaf (-s)   */
+} CgroupLimits;
+
+/* A transient cgroup */
+typedef struct {
+    char* path;
+} Cgroup;
+
+/* Function prototypes */
+int   cgroupParseLimits(char** args, CgroupLimits* limits, BuiltinIo* io);
+bool  cgroupCreate(const CgroupLimits* limits, Cgroup* group);
+pid_t cgroupFork(const Cgroup* group);
+void  cgroupFinish(Cgroup* group);
+
+#endif
@@ -0,0 +1,1277 @@
+/*
+ * shellChecksum.c
+ *
+ * The 'checksum' built-in: hashes files with CRC32C, XXH3 (64-bit) or
+ * SHA-256, or checks them against a list of digests -- hashing several
+ * files at once on the thread pool.
+ *
+ * Every algorithm has a portable kernel and one for the instructions
+ * made for it, chosen once when first used: the SSE4.2 crc32 instruction
+ * for CRC32C, AVX2 (or SSE2) for XXH3's stripes, and the SHA extensions
+ * for SHA-256.  Regular files are mapped and hashed in one pass; anything
+ * else is read in large blocks.
+ *
+ * The output matches sha256sum and friends ("digest  name"), so their
+ * lists can be checked with -c.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shellBuiltins.h"
+#include "shellThreadPool.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/* Size of the buffer used for input that cannot be mapped */
+#define CHECKSUM_BUFFER_SIZE (1024 * 1024)
+
+/* Largest digest, in bytes */
+#define MAX_DIGEST_SIZE 32
+
+/* XXH3: bytes per stripe, and stripes per block (one pass of the secret) */
+#define XXH3_STRIPE_SIZE  64
+#define XXH3_BLOCK_SIZE   1024
+#define XXH3_SECRET_SIZE  192
+
+/* XXH3 and XXH64's primes */
+#define PRIME32_1 0x9E3779B1U
+#define PRIME32_2 0x85EBCA77U
+#define PRIME32_3 0xC2B2AE3DU
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+/* The state of a hash in progress */
+typedef struct {
+    uint64_t      total;                    /* Bytes hashed so far       */
+    size_t        buffered;                 /* Bytes waiting in 'buffer' */
+    uint32_t      crc;                      /* CRC32C                    */
+    uint32_t      sha[8];                   /* SHA-256                   */
+    uint64_t      acc[8];                   /* XXH3                      */
+    unsigned char last[XXH3_STRIPE_SIZE];   /* XXH3: end of last block   */
+    unsigned char buffer[XXH3_BLOCK_SIZE];
+} HashState;
+
+/* A hash function */
+typedef struct {
+    const char* name;
+    size_t      digestSize;
+    void        (*init)(HashState* state);
+    void        (*update)(HashState* state, const unsigned char* data,
+                          size_t length);
+    void        (*finish)(HashState* state, unsigned char* digest);
+} HashAlgorithm;
+
+/* The kernels that do the work, chosen for this processor */
+typedef uint32_t (*Crc32cFunction)(uint32_t crc, const unsigned char* data,
+                                   size_t length);
+typedef void     (*StripeFunction)(uint64_t* acc, const unsigned char* data,
+                                   const unsigned char* secret,
+                                   size_t stripes);
+typedef void     (*ScrambleFunction)(uint64_t* acc,
+                                     const unsigned char* secret);
+typedef void     (*Sha256Function)(uint32_t* state, const unsigned char* data,
+                                   size_t blocks);
+
+/* One 'checksum' command */
+typedef struct {
+    const HashAlgorithm* algorithm;
+    BuiltinIo*           io;
+    pthread_mutex_t      lock;
+    pthread_cond_t       fileDone;  /* Signalled when a file is finished */
+} ChecksumSearch;
+
+/* A file to hash, and (with -c) the digest it should have */
+typedef struct {
+    ChecksumSearch* search;
+    const char*     name;
+    const char*     expected;       /* In hex, or NULL */
+    unsigned char   digest[MAX_DIGEST_SIZE];
+    int             error;
+    bool            done;
+} ChecksumFile;
+
+/* Function prototypes */
+static void     chooseKernels(void);
+static bool     readList(BuiltinIo* io, const char* name, char** text);
+static size_t   parseList(ChecksumSearch* search, const char* listName,
+                          char* text, ChecksumFile** files, size_t* count,
+                          size_t* capacity);
+static void     hashFileTask(void* arg);
+static void     hashFile(ChecksumFile* file);
+static bool     reportFile(ChecksumFile* file);
+static void     crc32cInit(HashState* state);
+static void     crc32cUpdate(HashState* state, const unsigned char* data,
+                             size_t length);
+static void     crc32cFinish(HashState* state, unsigned char* digest);
+static uint32_t crc32cScalar(uint32_t crc, const unsigned char* data,
+                             size_t length);
+static void     xxh3Init(HashState* state);
+static void     xxh3Update(HashState* state, const unsigned char* data,
+                           size_t length);
+static void     xxh3Finish(HashState* state, unsigned char* digest);
+static uint64_t xxh3Short(const unsigned char* data, size_t length);
+static void     xxh3StripesScalar(uint64_t* acc, const unsigned char* data,
+                                  const unsigned char* secret,
+                                  size_t stripes);
+static void     xxh3ScrambleScalar(uint64_t* acc,
+                                   const unsigned char* secret);
+static void     sha256Init(HashState* state);
+static void     sha256Update(HashState* state, const unsigned char* data,
+                             size_t length);
+static void     sha256Finish(HashState* state, unsigned char* digest);
+static void     sha256Scalar(uint32_t* state, const unsigned char* data,
+                             size_t blocks);
+
+static const HashAlgorithm algorithms[] = {
+    { "crc32c", 4,  crc32cInit, crc32cUpdate, crc32cFinish },
+    { "sha256", 32, sha256Init, sha256Update, sha256Finish },
+    { "xxh3",   8,  xxh3Init,   xxh3Update,   xxh3Finish   },
+};
+
+static pthread_once_t   kernelsOnce = PTHREAD_ONCE_INIT;
+static uint32_t         crc32cTable[256];
+static Crc32cFunction   crc32cKernel;
+static StripeFunction   xxh3Stripes;
+static ScrambleFunction xxh3Scramble;
+static Sha256Function   sha256Blocks;
+
+/* XXH3's default secret */
+static const unsigned char xxh3Secret[XXH3_SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c,
+    0xf7, 0x21, 0xad, 0x1c, 0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+    0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f, 0xcb, 0x79, 0xe6, 0x4e,
+    0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6,
+    0x81, 0x3a, 0x26, 0x4c, 0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+    0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3, 0x71, 0x64, 0x48, 0x97,
+    0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7,
+    0xc7, 0x0b, 0x4f, 0x1d, 0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+    0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64, 0xea, 0xc5, 0xac, 0x83,
+    0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26,
+    0x29, 0xd4, 0x68, 0x9e, 0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+    0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce, 0x45, 0xcb, 0x3a, 0x8f,
+    0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+/* SHA-256's round constants */
+static const uint32_t sha256Constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/**
+ * doChecksum
+ *
+ * Implements the 'checksum' built-in.
+ *
+ * args - An array of strings corresponding to the command and its arguments:
+ *        checksum [-a crc32c|sha256|xxh3] [-c] [file...]
+ *        Prints "digest  name" for each file (standard input if none),
+ *        using XXH3 unless -a chooses otherwise.  With -c the files are
+ *        lists of digests in that form, and each file listed is checked.
+ *
+ * Returns 0 if every file could be hashed (and, with -c, matched).
+ */
+int doChecksum(char** args, BuiltinIo* io) {
+    ChecksumSearch search;
+    ChecksumFile*  files = NULL;
+    TaskGroup      group;
+    char**         lists = NULL;
+    char*          stdinName[] = { "-", NULL };
+    char**         names;
+    bool           check = false;
+    size_t         fileCount = 0;
+    size_t         capacity = 0;
+    size_t         listCount = 0;
+    size_t         i;
+    int            status = 0;
+    int            arg;
+
+    memset(&search, 0, sizeof(search));
+    search.algorithm = &algorithms[2];
+    search.io        = io;
+
+    for (arg = 1; args[arg] != NULL && args[arg][0] == '-'
+                  && args[arg][1] != '\0'; ++arg) {
+        if (strcmp(args[arg], "-c") == 0) {
+            check = true;
+        } else if (strcmp(args[arg], "-a") == 0 && args[arg + 1] != NULL) {
+            ++arg;
+            for (i = 0; i < sizeof(algorithms) / sizeof(algorithms[0]); ++i) {
+                if (strcmp(args[arg], algorithms[i].name) == 0) {
+                    search.algorithm = &algorithms[i];
+                    break;
+                }
+            }
+            if (i == sizeof(algorithms) / sizeof(algorithms[0])) {
+                builtinError(io, "checksum: unknown algorithm '%s'\n",
+                             args[arg]);
+                return 1;
+            }
+        } else {
+            builtinError(io, "Usage: checksum [-a crc32c|sha256|xxh3] [-c] "
+                             "[file...]\n");
+            return 1;
+        }
+    }
+    names = (args[arg] != NULL) ? &args[arg] : stdinName;
+    pthread_once(&kernelsOnce, chooseKernels);
+
+    if (check) {
+        /* Gather the files listed, keeping the lists they point into */
+        while (names[listCount] != NULL) {
+            ++listCount;
+        }
+        lists = (char**) calloc(listCount, sizeof(char*));
+        if (lists == NULL) {
+            builtinError(io, "checksum: %s\n", strerror(errno));
+            return 1;
+        }
+        for (i = 0; i < listCount; ++i) {
+            if (!readList(io, names[i], &lists[i])) {
+                status = 1;
+            } else if (parseList(&search, names[i], lists[i], &files,
+                                 &fileCount, &capacity) > 0) {
+                status = 1;
+            }
+        }
+    } else {
+        while (names[fileCount] != NULL) {
+            ++fileCount;
+        }
+        files = (ChecksumFile*) calloc(fileCount, sizeof(ChecksumFile));
+        if (files == NULL) {
+            builtinError(io, "checksum: %s\n", strerror(errno));
+            return 1;
+        }
+        for (i = 0; i < fileCount; ++i) {
+            files[i].name = names[i];
+        }
+    }
+
+    pthread_mutex_init(&search.lock, NULL);
+    pthread_cond_init(&search.fileDone, NULL);
+    for (i = 0; i < fileCount; ++i) {
+        files[i].search = &search;
+    }
+
+    if (fileCount < 2 || poolSize() < 2) {
+        for (i = 0; i < fileCount && !io->outClosed; ++i) {
+            hashFile(&files[i]);
+            if (!reportFile(&files[i])) {
+                status = 1;
+            }
+        }
+    } else {
+        taskGroupInit(&group);
+        for (i = 0; i < fileCount; ++i) {
+            poolSubmit(&group, hashFileTask, &files[i]);
+        }
+
+        /* Report each file as soon as it and its predecessors finish */
+        for (i = 0; i < fileCount; ++i) {
+            pthread_mutex_lock(&search.lock);
+            while (!files[i].done) {
+                pthread_cond_wait(&search.fileDone, &search.lock);
+            }
+            pthread_mutex_unlock(&search.lock);
+
+            if (!reportFile(&files[i])) {
+                status = 1;
+            }
+        }
+
+        poolWait(&group);
+        taskGroupDestroy(&group);
+    }
+
+    pthread_cond_destroy(&search.fileDone);
+    pthread_mutex_destroy(&search.lock);
+    for (i = 0; i < listCount; ++i) {
+        free(lists[i]);
+    }
+    free(lists);
+    free(files);
+
+    return status;
+}
+
+
+/*
+ * readList
+ *
+ * Reads a whole list of digests ("-" for standard input) into a NUL
+ * terminated string, which the caller frees.  Returns false, after
+ * reporting it, on failure.
+ */
+static bool readList(BuiltinIo* io, const char* name, char** text) {
+    size_t  capacity = 64 * 1024;
+    size_t  length = 0;
+    ssize_t bytesRead;
+    int     fd = -1;
+
+    if (strcmp(name, "-") != 0) {
+        fd = open(name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            builtinError(io, "checksum: %s: %s\n", name, strerror(errno));
+            return false;
+        }
+    }
+
+    *text = (char*) malloc(capacity);
+    for (;;) {
+        if (*text == NULL) {
+            errno     = ENOMEM;
+            bytesRead = -1;
+            break;
+        }
+        if (length + 1 == capacity) {
+            char* grown = (char*) realloc(*text, capacity * 2);
+
+            if (grown == NULL) {
+                free(*text);
+                *text = NULL;
+                continue;
+            }
+            *text     = grown;
+            capacity *= 2;
+        }
+
+        if (fd < 0) {
+            bytesRead = builtinRead(io, *text + length, capacity - 1 - length);
+        } else {
+            do {
+                bytesRead = read(fd, *text + length, capacity - 1 - length);
+            } while (bytesRead < 0 && errno == EINTR);
+        }
+        if (bytesRead <= 0) {
+            break;
+        }
+        length += bytesRead;
+    }
+
+    if (bytesRead < 0) {
+        builtinError(io, "checksum: %s: %s\n", name, strerror(errno));
+        free(*text);
+        *text = NULL;
+    } else {
+        (*text)[length] = '\0';
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return *text != NULL;
+}
+
+/*
+ * parseList
+ *
+ * Adds each file of a list of "digest  name" lines to 'files', which
+ * grows as needed; the names and digests point into 'text'.  Returns the
+ * number of malformed lines (each reported).
+ */
+static size_t parseList(ChecksumSearch* search, const char* listName,
+                        char* text, ChecksumFile** files, size_t* count,
+                        size_t* capacity) {
+    size_t digits = search->algorithm->digestSize * 2;
+    size_t malformed = 0;
+    size_t lineNumber = 0;
+    char*  line = text;
+
+    while (*line != '\0') {
+        char*  newline = strchr(line, '\n');
+        size_t length;
+
+        if (newline != NULL) {
+            *newline = '\0';
+        }
+        length = strlen(line);
+        ++lineNumber;
+
+        if (length > 0) {
+            if (length < digits + 3 || strspn(line, "0123456789abcdefABCDEF")
+                                       != digits
+                    || line[digits] != ' '
+                    || (line[digits + 1] != ' ' && line[digits + 1] != '*')) {
+                builtinError(search->io, "checksum: %s: line %zu: "
+                             "improperly formatted\n", listName, lineNumber);
+                ++malformed;
+            } else {
+                if (*count == *capacity) {
+                    size_t        grownCapacity = (*capacity > 0)
+                                                  ? *capacity * 2 : 64;
+                    ChecksumFile* grown = (ChecksumFile*) realloc(*files,
+                                              grownCapacity
+                                              * sizeof(ChecksumFile));
+
+                    if (grown == NULL) {
+                        builtinError(search->io, "checksum: %s\n",
+                                     strerror(errno));
+                        return malformed + 1;
+                    }
+                    *files    = grown;
+                    *capacity = grownCapacity;
+                }
+                line[digits] = '\0';
+                memset(&(*files)[*count], 0, sizeof(ChecksumFile));
+                (*files)[*count].expected = line;
+                (*files)[*count].name     = line + digits + 2;
+                ++*count;
+            }
+        }
+
+        if (newline == NULL) {
+            break;
+        }
+        line = newline + 1;
+    }
+
+    return malformed;
+}
+
+/*
+ * hashFileTask
+ *
+ * Hashes one file on the thread pool, then announces it is done.
+ */
+static void hashFileTask(void* arg) {
+    ChecksumFile* file = (ChecksumFile*) arg;
+
+    hashFile(file);
+
+    pthread_mutex_lock(&file->search->lock);
+    file->done = true;
+    pthread_cond_broadcast(&file->search->fileDone);
+    pthread_mutex_unlock(&file->search->lock);
+}
+
+/*
+ * hashFile
+ *
+ * Computes a file's digest ("-" is standard input), or sets its 'error'.
+ */
+static void hashFile(ChecksumFile* file) {
+    const HashAlgorithm* algorithm = file->search->algorithm;
+    HashState            state;
+    struct stat          fileStat;
+    unsigned char*       buffer;
+    int                  fd = -1;
+
+    algorithm->init(&state);
+
+    if (strcmp(file->name, "-") != 0) {
+        fd = open(file->name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            file->error = errno;
+            return;
+        }
+    }
+
+    if (fd >= 0 && fstat(fd, &fileStat) == 0 && S_ISREG(fileStat.st_mode)
+            && fileStat.st_size > 0) {
+        unsigned char* mapping = (unsigned char*) mmap(NULL,
+                                                       fileStat.st_size,
+                                                       PROT_READ, MAP_PRIVATE,
+                                                       fd, 0);
+
+        if (mapping != MAP_FAILED) {
+            madvise(mapping, fileStat.st_size, MADV_SEQUENTIAL);
+            algorithm->update(&state, mapping, fileStat.st_size);
+            algorithm->finish(&state, file->digest);
+            munmap(mapping, fileStat.st_size);
+            close(fd);
+            return;
+        }
+    }
+
+    buffer = (unsigned char*) malloc(CHECKSUM_BUFFER_SIZE);
+    if (buffer == NULL) {
+        file->error = ENOMEM;
+    }
+    while (buffer != NULL) {
+        ssize_t bytesRead;
+
+        if (fd < 0) {
+            bytesRead = builtinRead(file->search->io, buffer,
+                                    CHECKSUM_BUFFER_SIZE);
+        } else {
+            do {
+                bytesRead = read(fd, buffer, CHECKSUM_BUFFER_SIZE);
+            } while (bytesRead < 0 && errno == EINTR);
+        }
+        if (bytesRead < 0) {
+            file->error = errno;
+            break;
+        }
+        if (bytesRead == 0) {
+            algorithm->finish(&state, file->digest);
+            break;
+        }
+        algorithm->update(&state, buffer, bytesRead);
+    }
+
+    free(buffer);
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+/*
+ * reportFile
+ *
+ * Prints a file's digest or, with -c, whether it matched.  Returns false
+ * if it could not be hashed or did not match.
+ */
+static bool reportFile(ChecksumFile* file) {
+    ChecksumSearch* search = file->search;
+    size_t          size = search->algorithm->digestSize;
+    char            hex[MAX_DIGEST_SIZE * 2 + 1];
+    size_t          i;
+
+    if (file->error != 0) {
+        builtinError(search->io, "checksum: %s: %s\n", file->name,
+                     strerror(file->error));
+        if (file->expected != NULL) {
+            builtinPrintf(search->io, "%s: FAILED open or read\n",
+                          file->name);
+        }
+        return false;
+    }
+
+    for (i = 0; i < size; ++i) {
+        hex[i * 2]     = "0123456789abcdef"[file->digest[i] >> 4];
+        hex[i * 2 + 1] = "0123456789abcdef"[file->digest[i] & 0xf];
+    }
+    hex[size * 2] = '\0';
+
+    if (file->expected == NULL) {
+        builtinPrintf(search->io, "%s  %s\n", hex, file->name);
+        return true;
+    }
+    if (strcasecmp(hex, file->expected) != 0) {
+        builtinPrintf(search->io, "%s: FAILED\n", file->name);
+        return false;
+    }
+    builtinPrintf(search->io, "%s: OK\n", file->name);
+    return true;
+}
+
+/*
+ * read32, read64
+ *
+ * Load little-endian words from anywhere.
+ */
+static inline uint32_t read32(const unsigned char* data) {
+    uint32_t word;
+
+    memcpy(&word, data, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap32(word);
+#endif
+    return word;
+}
+
+static inline uint64_t read64(const unsigned char* data) {
+    uint64_t word;
+
+    memcpy(&word, data, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+/*
+ * crc32cInit, crc32cUpdate, crc32cFinish
+ *
+ * CRC32C (Castagnoli), as used by iSCSI, ext4 and Btrfs.
+ */
+static void crc32cInit(HashState* state) {
+    state->crc = 0xFFFFFFFFU;
+}
+
+static void crc32cUpdate(HashState* state, const unsigned char* data,
+                         size_t length) {
+    state->crc = crc32cKernel(state->crc, data, length);
+}
+
+static void crc32cFinish(HashState* state, unsigned char* digest) {
+    uint32_t crc = ~state->crc;
+
+    digest[0] = crc >> 24;
+    digest[1] = crc >> 16;
+    digest[2] = crc >> 8;
+    digest[3] = crc;
+}
+
+/*
+ * crc32cScalar
+ *
+ * Updates a CRC32C a byte at a time from a table.
+ */
+static uint32_t crc32cScalar(uint32_t crc, const unsigned char* data,
+                             size_t length) {
+    while (length-- > 0) {
+        crc = crc32cTable[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+/*
+ * crc32cSse42
+ *
+ * Updates a CRC32C eight bytes at a time with SSE4.2's crc32 instruction,
+ * which computes exactly this polynomial.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32cSse42(uint32_t crc, const unsigned char* data,
+                            size_t length) {
+    uint64_t crc64 = crc;
+
+    while (length >= 8) {
+        crc64   = _mm_crc32_u64(crc64, read64(data));
+        data   += 8;
+        length -= 8;
+    }
+    crc = (uint32_t) crc64;
+    while (length-- > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+#endif
+
+/*
+ * mix64, mul128Fold64
+ *
+ * XXH3's mixing steps: a final avalanche, and the two halves of a 128-bit
+ * product folded together.
+ */
+static inline uint64_t mix64(uint64_t hash) {
+    hash ^= hash >> 37;
+    hash *= 0x165667919E3779F9ULL;
+    return hash ^ (hash >> 32);
+}
+
+static inline uint64_t mul128Fold64(uint64_t a, uint64_t b) {
+    unsigned __int128 product = (unsigned __int128) a * b;
+
+    return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+/*
+ * mix16
+ *
+ * Mixes 16 bytes of input with 16 bytes of the secret.
+ */
+static inline uint64_t mix16(const unsigned char* data,
+                             const unsigned char* secret) {
+    return mul128Fold64(read64(data) ^ read64(secret),
+                        read64(data + 8) ^ read64(secret + 8));
+}
+
+/*
+ * xxh3Init, xxh3Update, xxh3Finish
+ *
+ * XXH3 (64-bit, seed 0), as computed by xxhsum -H3.  Input is consumed a
+ * block (16 stripes) at a time, except that a full block is only consumed
+ * once more input follows: the end of the input is hashed differently,
+ * and inputs of at most 240 bytes by another algorithm entirely.
+ *
+ * Known answers, one per path through the code, for the bytes
+ * (7 * i + 3) & 255 at i = 0, 1, ...:
+ *
+ *     length 0      2d06800538d394c2      length 241    8beadd3a8874fe17
+ *     length 16     b8c859b0f030b585      length 1024   9b81661c641c72b1
+ *     length 128    67425a03650261bf      length 1025   806c2072ed713576
+ *     length 240    64556dc6b462a6cf      length 100000 0c056f6fcc340974
+ */
+static void xxh3Init(HashState* state) {
+    static const uint64_t initial[8] = {
+        PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3,
+        PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1
+    };
+
+    memcpy(state->acc, initial, sizeof(initial));
+    state->total    = 0;
+    state->buffered = 0;
+}
+
+static void xxh3Update(HashState* state, const unsigned char* data,
+                       size_t length) {
+    const unsigned char* scrambleSecret = xxh3Secret + XXH3_SECRET_SIZE
+                                          - XXH3_STRIPE_SIZE;
+
+    state->total += length;
+    while (length > 0) {
+        size_t count;
+
+        if (state->buffered == XXH3_BLOCK_SIZE) {
+            xxh3Stripes(state->acc, state->buffer, xxh3Secret,
+                        XXH3_BLOCK_SIZE / XXH3_STRIPE_SIZE);
+            xxh3Scramble(state->acc, scrambleSecret);
+            memcpy(state->last,
+                   state->buffer + XXH3_BLOCK_SIZE - XXH3_STRIPE_SIZE,
+                   XXH3_STRIPE_SIZE);
+            state->buffered = 0;
+        }
+
+        /* Hash whole blocks straight from the input */
+        if (state->buffered == 0 && length > XXH3_BLOCK_SIZE) {
+            while (length > XXH3_BLOCK_SIZE) {
+                xxh3Stripes(state->acc, data, xxh3Secret,
+                            XXH3_BLOCK_SIZE / XXH3_STRIPE_SIZE);
+                xxh3Scramble(state->acc, scrambleSecret);
+                data   += XXH3_BLOCK_SIZE;
+                length -= XXH3_BLOCK_SIZE;
+            }
+            memcpy(state->last, data - XXH3_STRIPE_SIZE, XXH3_STRIPE_SIZE);
+        }
+
+        count = XXH3_BLOCK_SIZE - state->buffered;
+        if (count > length) {
+            count = length;
+        }
+        memcpy(state->buffer + state->buffered, data, count);
+        state->buffered += count;
+        data            += count;
+        length          -= count;
+    }
+}
+
+static void xxh3Finish(HashState* state, unsigned char* digest) {
+    unsigned char lastStripe[XXH3_STRIPE_SIZE];
+    uint64_t      acc[8];
+    uint64_t      hash;
+    size_t        length = state->buffered;
+    int           i;
+
+    if (state->total <= 240) {
+        hash = xxh3Short(state->buffer, state->total);
+    } else {
+        /* The stripes left, then the last 64 bytes of the input */
+        memcpy(acc, state->acc, sizeof(acc));
+        xxh3Stripes(acc, state->buffer, xxh3Secret,
+                    (length - 1) / XXH3_STRIPE_SIZE);
+        if (length >= XXH3_STRIPE_SIZE) {
+            memcpy(lastStripe, state->buffer + length - XXH3_STRIPE_SIZE,
+                   XXH3_STRIPE_SIZE);
+        } else {
+            memcpy(lastStripe, state->last + length,
+                   XXH3_STRIPE_SIZE - length);
+            memcpy(lastStripe + XXH3_STRIPE_SIZE - length, state->buffer,
+                   length);
+        }
+        xxh3Stripes(acc, lastStripe,
+                    xxh3Secret + XXH3_SECRET_SIZE - XXH3_STRIPE_SIZE - 7, 1);
+
+        /* Merge the accumulators */
+        hash = state->total * PRIME64_1;
+        for (i = 0; i < 4; ++i) {
+            hash += mul128Fold64(acc[2 * i] ^ read64(xxh3Secret + 11 + 16 * i),
+                                 acc[2 * i + 1]
+                                 ^ read64(xxh3Secret + 19 + 16 * i));
+        }
+        hash = mix64(hash);
+    }
+
+    for (i = 0; i < 8; ++i) {
+        digest[i] = hash >> (56 - 8 * i);
+    }
+}
+
+/*
+ * xxh3Short
+ *
+ * XXH3 of an input of at most 240 bytes.
+ */
+static uint64_t xxh3Short(const unsigned char* data, size_t length) {
+    const unsigned char* secret = xxh3Secret;
+    uint64_t             hash;
+    size_t               i;
+
+    if (length == 0) {
+        hash  = read64(secret + 56) ^ read64(secret + 64);
+        hash ^= hash >> 33;
+        hash *= PRIME64_2;
+        hash ^= hash >> 29;
+        hash *= PRIME64_3;
+        return hash ^ (hash >> 32);
+    }
+
+    if (length <= 3) {
+        uint32_t combined = ((uint32_t) data[0] << 16)
+                            | ((uint32_t) data[length >> 1] << 24)
+                            | data[length - 1] | ((uint32_t) length << 8);
+
+        hash  = combined ^ (uint64_t) (read32(secret) ^ read32(secret + 4));
+        hash ^= hash >> 33;
+        hash *= PRIME64_2;
+        hash ^= hash >> 29;
+        hash *= PRIME64_3;
+        return hash ^ (hash >> 32);
+    }
+
+    if (length <= 8) {
+        uint64_t input = read32(data + length - 4)
+                         + ((uint64_t) read32(data) << 32);
+
+        hash  = input ^ (read64(secret + 8) ^ read64(secret + 16));
+        hash ^= ((hash << 49) | (hash >> 15)) ^ ((hash << 24) | (hash >> 40));
+        hash *= 0x9FB21C651E98DF25ULL;
+        hash ^= (hash >> 35) + length;
+        hash *= 0x9FB21C651E98DF25ULL;
+        return hash ^ (hash >> 28);
+    }
+
+    if (length <= 16) {
+        uint64_t low  = read64(data) ^ (read64(secret + 24)
+                                        ^ read64(secret + 32));
+        uint64_t high = read64(data + length - 8) ^ (read64(secret + 40)
+                                                     ^ read64(secret + 48));
+
+        return mix64(length + __builtin_bswap64(low) + high
+                     + mul128Fold64(low, high));
+    }
+
+    hash = length * PRIME64_1;
+    if (length <= 128) {
+        /* Pairs of 16 bytes from each end, working inwards */
+        for (i = (length - 1) / 32 + 1; i-- > 0; ) {
+            hash += mix16(data + 16 * i, secret + 32 * i);
+            hash += mix16(data + length - 16 * (i + 1), secret + 32 * i + 16);
+        }
+        return mix64(hash);
+    }
+
+    for (i = 0; i < 8; ++i) {
+        hash += mix16(data + 16 * i, secret + 16 * i);
+    }
+    hash = mix64(hash);
+    for (i = 8; i < length / 16; ++i) {
+        hash += mix16(data + 16 * i, secret + 16 * (i - 8) + 3);
+    }
+    hash += mix16(data + length - 16, secret + 136 - 17);
+    return mix64(hash);
+}
+
+/*
+ * xxh3StripesScalar
+ *
+ * Accumulates 'stripes' stripes of 64 bytes, stepping 8 bytes through the
+ * secret per stripe.
+ */
+static void xxh3StripesScalar(uint64_t* acc, const unsigned char* data,
+                              const unsigned char* secret, size_t stripes) {
+    size_t stripe;
+    int    i;
+
+    for (stripe = 0; stripe < stripes; ++stripe) {
+        for (i = 0; i < 8; ++i) {
+            uint64_t value = read64(data + 8 * i);
+            uint64_t keyed = value ^ read64(secret + 8 * i);
+
+            acc[i ^ 1] += value;
+            acc[i]     += (uint32_t) keyed * (keyed >> 32);
+        }
+        data   += XXH3_STRIPE_SIZE;
+        secret += 8;
+    }
+}
+
+/*
+ * xxh3ScrambleScalar
+ *
+ * Scrambles the accumulators at the end of each block.
+ */
+static void xxh3ScrambleScalar(uint64_t* acc, const unsigned char* secret) {
+    int i;
+
+    for (i = 0; i < 8; ++i) {
+        uint64_t value = acc[i];
+
+        value ^= value >> 47;
+        value ^= read64(secret + 8 * i);
+        acc[i] = value * PRIME32_1;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * xxh3StripesAvx2
+ *
+ * Accumulates stripes four lanes at a time: each 64-bit lane gets the
+ * product of its keyed input's halves plus its neighbour's input.
+ */
+__attribute__((target("avx2")))
+static void xxh3StripesAvx2(uint64_t* acc, const unsigned char* data,
+                            const unsigned char* secret, size_t stripes) {
+    __m256i accs[2];
+    size_t  stripe;
+    int     i;
+
+    accs[0] = _mm256_loadu_si256((const __m256i*) acc);
+    accs[1] = _mm256_loadu_si256((const __m256i*) (acc + 4));
+    for (stripe = 0; stripe < stripes; ++stripe) {
+        for (i = 0; i < 2; ++i) {
+            __m256i value = _mm256_loadu_si256(
+                                (const __m256i*) (data + 32 * i));
+            __m256i keyed = _mm256_xor_si256(value, _mm256_loadu_si256(
+                                (const __m256i*) (secret + 32 * i)));
+            __m256i product = _mm256_mul_epu32(keyed,
+                                               _mm256_srli_epi64(keyed, 32));
+            __m256i swapped = _mm256_shuffle_epi32(value,
+                                                   _MM_SHUFFLE(1, 0, 3, 2));
+
+            accs[i] = _mm256_add_epi64(accs[i],
+                                       _mm256_add_epi64(product, swapped));
+        }
+        data   += XXH3_STRIPE_SIZE;
+        secret += 8;
+    }
+    _mm256_storeu_si256((__m256i*) acc, accs[0]);
+    _mm256_storeu_si256((__m256i*) (acc + 4), accs[1]);
+}
+
+/*
+ * xxh3ScrambleAvx2
+ *
+ * Scrambles the accumulators four lanes at a time.  AVX2 has no 64-bit
+ * multiply, so each lane is multiplied by the 32-bit prime in halves.
+ */
+__attribute__((target("avx2")))
+static void xxh3ScrambleAvx2(uint64_t* acc, const unsigned char* secret) {
+    const __m256i prime = _mm256_set1_epi32((int) PRIME32_1);
+    int           i;
+
+    for (i = 0; i < 2; ++i) {
+        __m256i value = _mm256_loadu_si256((const __m256i*) (acc + 4 * i));
+
+        value = _mm256_xor_si256(value, _mm256_srli_epi64(value, 47));
+        value = _mm256_xor_si256(value, _mm256_loadu_si256(
+                                     (const __m256i*) (secret + 32 * i)));
+        value = _mm256_add_epi64(_mm256_mul_epu32(value, prime),
+                                 _mm256_slli_epi64(_mm256_mul_epu32(
+                                     _mm256_srli_epi64(value, 32), prime),
+                                     32));
+        _mm256_storeu_si256((__m256i*) (acc + 4 * i), value);
+    }
+}
+
+#if defined(__SSE2__)
+/*
+ * xxh3StripesSse2
+ *
+ * The SSE2 version of xxh3StripesAvx2, two lanes at a time.
+ */
+static void xxh3StripesSse2(uint64_t* acc, const unsigned char* data,
+                            const unsigned char* secret, size_t stripes) {
+    __m128i accs[4];
+    size_t  stripe;
+    int     i;
+
+    for (i = 0; i < 4; ++i) {
+        accs[i] = _mm_loadu_si128((const __m128i*) (acc + 2 * i));
+    }
+    for (stripe = 0; stripe < stripes; ++stripe) {
+        for (i = 0; i < 4; ++i) {
+            __m128i value = _mm_loadu_si128((const __m128i*) (data + 16 * i));
+            __m128i keyed = _mm_xor_si128(value, _mm_loadu_si128(
+                                (const __m128i*) (secret + 16 * i)));
+            __m128i product = _mm_mul_epu32(keyed, _mm_srli_epi64(keyed, 32));
+            __m128i swapped = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+
+            accs[i] = _mm_add_epi64(accs[i], _mm_add_epi64(product, swapped));
+        }
+        data   += XXH3_STRIPE_SIZE;
+        secret += 8;
+    }
+    for (i = 0; i < 4; ++i) {
+        _mm_storeu_si128((__m128i*) (acc + 2 * i), accs[i]);
+    }
+}
+
+/*
+ * xxh3ScrambleSse2
+ *
+ * The SSE2 version of xxh3ScrambleAvx2.
+ */
+static void xxh3ScrambleSse2(uint64_t* acc, const unsigned char* secret) {
+    const __m128i prime = _mm_set1_epi32((int) PRIME32_1);
+    int           i;
+
+    for (i = 0; i < 4; ++i) {
+        __m128i value = _mm_loadu_si128((const __m128i*) (acc + 2 * i));
+
+        value = _mm_xor_si128(value, _mm_srli_epi64(value, 47));
+        value = _mm_xor_si128(value, _mm_loadu_si128(
+                                  (const __m128i*) (secret + 16 * i)));
+        value = _mm_add_epi64(_mm_mul_epu32(value, prime),
+                              _mm_slli_epi64(_mm_mul_epu32(
+                                  _mm_srli_epi64(value, 32), prime), 32));
+        _mm_storeu_si128((__m128i*) (acc + 2 * i), value);
+    }
+}
+#endif
+#endif
+
+/*
+ * sha256Init, sha256Update, sha256Finish
+ *
+ * SHA-256 (FIPS 180-4).  Whole 64-byte blocks are hashed straight from
+ * the input; the rest waits in the buffer.
+ */
+static void sha256Init(HashState* state) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(state->sha, initial, sizeof(initial));
+    state->total    = 0;
+    state->buffered = 0;
+}
+
+static void sha256Update(HashState* state, const unsigned char* data,
+                         size_t length) {
+    state->total += length;
+
+    if (state->buffered > 0) {
+        size_t count = 64 - state->buffered;
+
+        if (count > length) {
+            count = length;
+        }
+        memcpy(state->buffer + state->buffered, data, count);
+        state->buffered += count;
+        data            += count;
+        length          -= count;
+        if (state->buffered < 64) {
+            return;
+        }
+        sha256Blocks(state->sha, state->buffer, 1);
+        state->buffered = 0;
+    }
+
+    sha256Blocks(state->sha, data, length / 64);
+    memcpy(state->buffer, data + (length & ~(size_t) 63), length % 64);
+    state->buffered = length % 64;
+}
+
+static void sha256Finish(HashState* state, unsigned char* digest) {
+    uint64_t bits = state->total * 8;
+    size_t   length = state->buffered;
+    int      i;
+
+    /* A 1 bit, zeros, then the length in bits, to a multiple of 64 bytes */
+    state->buffer[length++] = 0x80;
+    if (length > 56) {
+        memset(state->buffer + length, 0, 64 - length);
+        sha256Blocks(state->sha, state->buffer, 1);
+        length = 0;
+    }
+    memset(state->buffer + length, 0, 56 - length);
+    for (i = 0; i < 8; ++i) {
+        state->buffer[56 + i] = bits >> (56 - 8 * i);
+    }
+    sha256Blocks(state->sha, state->buffer, 1);
+
+    for (i = 0; i < 32; ++i) {
+        digest[i] = state->sha[i / 4] >> (24 - 8 * (i % 4));
+    }
+}
+
+#define ROTATE_RIGHT(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/*
+ * sha256Scalar
+ *
+ * Hashes whole blocks, one round at a time.
+ */
+static void sha256Scalar(uint32_t* state, const unsigned char* data,
+                         size_t blocks) {
+    uint32_t schedule[64];
+    uint32_t v[8];
+    int      i;
+
+    for (; blocks > 0; --blocks, data += 64) {
+        for (i = 0; i < 16; ++i) {
+            schedule[i] = ((uint32_t) data[4 * i] << 24)
+                          | ((uint32_t) data[4 * i + 1] << 16)
+                          | ((uint32_t) data[4 * i + 2] << 8)
+                          | data[4 * i + 3];
+        }
+        for (i = 16; i < 64; ++i) {
+            uint32_t w15 = schedule[i - 15];
+            uint32_t w2  = schedule[i - 2];
+
+            schedule[i] = schedule[i - 16] + schedule[i - 7]
+                          + (ROTATE_RIGHT(w15, 7) ^ ROTATE_RIGHT(w15, 18)
+                             ^ (w15 >> 3))
+                          + (ROTATE_RIGHT(w2, 17) ^ ROTATE_RIGHT(w2, 19)
+                             ^ (w2 >> 10));
+        }
+
+        memcpy(v, state, sizeof(v));
+        for (i = 0; i < 64; ++i) {
+            uint32_t t1 = v[7] + (ROTATE_RIGHT(v[4], 6) ^ ROTATE_RIGHT(v[4], 11)
+                                  ^ ROTATE_RIGHT(v[4], 25))
+                          + ((v[4] & v[5]) ^ (~v[4] & v[6]))
+                          + sha256Constants[i] + schedule[i];
+            uint32_t t2 = (ROTATE_RIGHT(v[0], 2) ^ ROTATE_RIGHT(v[0], 13)
+                           ^ ROTATE_RIGHT(v[0], 22))
+                          + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+
+            v[7] = v[6];
+            v[6] = v[5];
+            v[5] = v[4];
+            v[4] = v[3] + t1;
+            v[3] = v[2];
+            v[2] = v[1];
+            v[1] = v[0];
+            v[0] = t1 + t2;
+        }
+        for (i = 0; i < 8; ++i) {
+            state[i] += v[i];
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * sha256ShaNi
+ *
+ * Hashes whole blocks with the SHA extensions.  The state is kept as the
+ * two halves sha256rnds2 works on (ABEF and CDGH); each group of four
+ * rounds also extends the message schedule four words with sha256msg1
+ * and sha256msg2.
+ */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256ShaNi(uint32_t* state, const unsigned char* data,
+                        size_t blocks) {
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                            0x0405060700010203ULL);
+    __m128i       message[4];
+    __m128i       abef;
+    __m128i       cdgh;
+    __m128i       temp;
+    int           i;
+
+    temp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) state), 0xB1);
+    cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) (state + 4)),
+                             0x1B);
+    abef = _mm_alignr_epi8(temp, cdgh, 8);
+    cdgh = _mm_blend_epi16(cdgh, temp, 0xF0);
+
+    for (; blocks > 0; --blocks, data += 64) {
+        __m128i abefSaved = abef;
+        __m128i cdghSaved = cdgh;
+
+        for (i = 0; i < 16; ++i) {
+            __m128i words;
+
+            if (i < 4) {
+                message[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+                                 (const __m128i*) (data + 16 * i)), byteSwap);
+            }
+            words = _mm_add_epi32(message[i % 4], _mm_loadu_si128(
+                                      (const __m128i*) &sha256Constants[4 * i]));
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, words);
+            if (i >= 3 && i < 15) {
+                temp = _mm_alignr_epi8(message[i % 4], message[(i + 3) % 4], 4);
+                message[(i + 1) % 4] = _mm_sha256msg2_epu32(
+                                           _mm_add_epi32(message[(i + 1) % 4],
+                                                         temp),
+                                           message[i % 4]);
+            }
+            abef = _mm_sha256rnds2_epu32(abef, cdgh,
+                                         _mm_shuffle_epi32(words, 0x0E));
+            if (i >= 1 && i < 13) {
+                message[(i + 3) % 4] = _mm_sha256msg1_epu32(
+                                           message[(i + 3) % 4],
+                                           message[i % 4]);
+            }
+        }
+
+        abef = _mm_add_epi32(abef, abefSaved);
+        cdgh = _mm_add_epi32(cdgh, cdghSaved);
+    }
+
+    temp = _mm_shuffle_epi32(abef, 0x1B);
+    cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128((__m128i*) state, _mm_blend_epi16(temp, cdgh, 0xF0));
+    _mm_storeu_si128((__m128i*) (state + 4), _mm_alignr_epi8(cdgh, temp, 8));
+}
+#endif
+
+/*
+ * chooseKernels
+ *
+ * Picks the fastest kernel of each algorithm this processor supports,
+ * and builds the table the portable CRC32C kernel uses.
+ */
+static void chooseKernels(void) {
+    uint32_t i;
+
+    for (i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        int      bit;
+
+        for (bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78U : 0);
+        }
+        crc32cTable[i] = crc;
+    }
+
+    crc32cKernel = crc32cScalar;
+    xxh3Stripes  = xxh3StripesScalar;
+    xxh3Scramble = xxh3ScrambleScalar;
+    sha256Blocks = sha256Scalar;
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32cKernel = crc32cSse42;
+    }
+#endif
+    if (__builtin_cpu_supports("avx2")) {
+        xxh3Stripes  = xxh3StripesAvx2;
+        xxh3Scramble = xxh3ScrambleAvx2;
+    } else {
+#if defined(__SSE2__)
+        xxh3Stripes  = xxh3StripesSse2;
+        xxh3Scramble = xxh3ScrambleSse2;
+#endif
+    }
+    if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1")) {
+        sha256Blocks = sha256ShaNi;
+    }
+#endif
+}
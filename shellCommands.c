@@ -0,0 +1,516 @@
+/*
+ * shellCommands.c
+ *
+ * The table of command names (see shellCommands.h) and the 'alias',
+ * 'unalias', 'function' and 'unfunction' built-ins.
+ *
+ * The table is a hash table with open addressing (linear probing) and a
+ * power-of-two number of slots, kept at most half full, so finding a
+ * name takes the same time however many built-ins, aliases and functions
+ * there are.  Entries are never removed: undefining an alias or function
+ * only clears it, and a built-in's entry is there from the start.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "shellBuiltins.h"
+#include "shellCommands.h"
+#include "shellParser.h"
+
+/* Initial number of slots in the table (a power of two) */
+#define COMMAND_INITIAL_SLOTS 64
+
+/* Everything a name stands for; an empty slot has no name */
+typedef struct {
+    char*           name;
+    BuiltinFunction builtin;        /* NULL if not a built-in        */
+    char*           text[2];        /* Definitions, by PlanKind      */
+    CommandPlan*    plan[2];        /* Scanned definitions, or NULL  */
+} Command;
+
+/* Function prototypes */
+static void         buildTable(void);
+static Command*     findCommand(const char* name, bool add);
+static bool         growTable(void);
+static uint64_t     hashName(const char* name);
+static CommandPlan* scanPlan(const char* text);
+static void         freePlan(CommandPlan* plan);
+static int          definePlan(char** args, BuiltinIo* io, PlanKind kind);
+static int          undefinePlan(char** args, BuiltinIo* io, PlanKind kind);
+static bool         printPlan(BuiltinIo* io, const Command* command,
+                              PlanKind kind);
+static int          compareCommands(const void* first, const void* second);
+
+/* The keyword that defines each kind of plan (for listing them) */
+static const char* const planKeywords[] = { "alias", "function" };
+
+/* The table, built on first use */
+static pthread_once_t  tableOnce    = PTHREAD_ONCE_INIT;
+static pthread_mutex_t commandLock  = PTHREAD_MUTEX_INITIALIZER;
+static Command*        commands     = NULL;
+static size_t          commandSlots = 0;
+static size_t          commandCount = 0;
+
+/*
+ * findBuiltin
+ *
+ * Returns the built-in command with the specified name, or NULL if there
+ * is none.
+ */
+BuiltinFunction findBuiltin(const char* name) {
+    BuiltinFunction builtin = NULL;
+    Command*        command;
+
+    pthread_once(&tableOnce, buildTable);
+    pthread_mutex_lock(&commandLock);
+    command = findCommand(name, false);
+    if (command != NULL) {
+        builtin = command->builtin;
+    }
+    pthread_mutex_unlock(&commandLock);
+
+    return builtin;
+}
+
+/*
+ * isPlanDefined
+ *
+ * Returns true if 'name' is an alias or function (as 'kind' says).
+ */
+bool isPlanDefined(const char* name, PlanKind kind) {
+    Command* command;
+    bool     defined;
+
+    pthread_once(&tableOnce, buildTable);
+    pthread_mutex_lock(&commandLock);
+    command = findCommand(name, false);
+    defined = (command != NULL && command->text[kind] != NULL);
+    pthread_mutex_unlock(&commandLock);
+
+    return defined;
+}
+
+/*
+ * findPlan
+ *
+ * Returns the scanned definition of an alias or function, or NULL if
+ * 'name' is not one.  The first time a definition is used it is scanned,
+ * which replaces the line most recently returned by the scanner, so the
+ * caller must be done with that line (or have copied it).  The plan is
+ * valid until the alias or function is redefined.
+ */
+const CommandPlan* findPlan(const char* name, PlanKind kind) {
+    Command*     command;
+    CommandPlan* plan = NULL;
+
+    pthread_once(&tableOnce, buildTable);
+    pthread_mutex_lock(&commandLock);
+    command = findCommand(name, false);
+    if (command != NULL && command->text[kind] != NULL) {
+        if (command->plan[kind] == NULL) {
+            command->plan[kind] = scanPlan(command->text[kind]);
+        }
+        plan = command->plan[kind];
+    }
+    pthread_mutex_unlock(&commandLock);
+
+    return plan;
+}
+
+/**
+ * doAlias
+ *
+ * Implements the 'alias' built-in: 'alias name text' makes 'name' at the
+ * start of a command stand for 'text'; 'alias name' prints the alias and
+ * 'alias' prints them all.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ */
+int doAlias(char** args, BuiltinIo* io) {
+    return definePlan(args, io, PLAN_ALIAS);
+}
+
+/**
+ * doUnalias
+ *
+ * Implements the 'unalias' built-in, which removes the named aliases.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ */
+int doUnalias(char** args, BuiltinIo* io) {
+    return undefinePlan(args, io, PLAN_ALIAS);
+}
+
+/**
+ * doFunction
+ *
+ * Implements the 'function' built-in: 'function name body' defines a
+ * function.  A line starting with 'name' runs 'body' instead, with the
+ * words "$0" to "$9" replaced by the line's words ("$0" is the name) and
+ * "$@" by all of its arguments (quote them, e.g., function greet 'echo
+ * hello "$1"').  'function name' prints the function and 'function'
+ * prints them all.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ */
+int doFunction(char** args, BuiltinIo* io) {
+    return definePlan(args, io, PLAN_FUNCTION);
+}
+
+/**
+ * doUnfunction
+ *
+ * Implements the 'unfunction' built-in, which removes the named functions.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ */
+int doUnfunction(char** args, BuiltinIo* io) {
+    return undefinePlan(args, io, PLAN_FUNCTION);
+}
+
+/*
+ * buildTable
+ *
+ * Adds the built-ins to the table (run once).
+ */
+static void buildTable(void) {
+    size_t i;
+
+    for (i = 0; builtinName(i) != NULL; ++i) {
+        Command* command = findCommand(builtinName(i), true);
+
+        if (command == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        command->builtin = builtinFunction(i);
+    }
+}
+
+/*
+ * findCommand
+ *
+ * Returns the entry for a name, adding it if 'add' is true, or NULL if
+ * there is none (or memory ran out).  Called with 'commandLock' held, or
+ * from buildTable().
+ */
+static Command* findCommand(const char* name, bool add) {
+    size_t slot;
+
+    if (commandSlots == 0 && (!add || !growTable())) {
+        return NULL;
+    }
+
+    for (slot = hashName(name) & (commandSlots - 1);
+         commands[slot].name != NULL;
+         slot = (slot + 1) & (commandSlots - 1)) {
+        if (strcmp(commands[slot].name, name) == 0) {
+            return &commands[slot];
+        }
+    }
+    if (!add) {
+        return NULL;
+    }
+
+    /* Keep the table at most half full */
+    if ((commandCount + 1) * 2 > commandSlots) {
+        if (!growTable()) {
+            return NULL;
+        }
+        return findCommand(name, true);
+    }
+
+    commands[slot].name = strdup(name);
+    if (commands[slot].name == NULL) {
+        return NULL;
+    }
+    ++commandCount;
+
+    return &commands[slot];
+}
+
+/*
+ * growTable
+ *
+ * Doubles the number of slots in the table, moving every entry.
+ */
+static bool growTable(void) {
+    size_t   slots = (commandSlots == 0) ? COMMAND_INITIAL_SLOTS
+                                         : commandSlots * 2;
+    Command* grown = (Command*) calloc(slots, sizeof(Command));
+    size_t   i;
+
+    if (grown == NULL) {
+        return false;
+    }
+    for (i = 0; i < commandSlots; ++i) {
+        if (commands[i].name != NULL) {
+            size_t slot = hashName(commands[i].name) & (slots - 1);
+
+            while (grown[slot].name != NULL) {
+                slot = (slot + 1) & (slots - 1);
+            }
+            grown[slot] = commands[i];
+        }
+    }
+
+    free(commands);
+    commands     = grown;
+    commandSlots = slots;
+
+    return true;
+}
+
+/*
+ * hashName
+ *
+ * Returns the 64-bit FNV-1a hash of a name.
+ */
+static uint64_t hashName(const char* name) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    while (*name != '\0') {
+        hash = (hash ^ (unsigned char) *name++) * 0x100000001b3ULL;
+    }
+    return hash ^ (hash >> 32);
+}
+
+/*
+ * scanPlan
+ *
+ * Scans the text of a definition and returns a copy of its tokens, or
+ * NULL if memory ran out.
+ */
+static CommandPlan* scanPlan(const char* text) {
+    CommandPlan* plan = (CommandPlan*) calloc(1, sizeof(CommandPlan));
+    char*        copy = strdup(text);
+    char**       line;
+    int          i;
+
+    if (plan == NULL || copy == NULL) {
+        free(plan);
+        free(copy);
+        return NULL;
+    }
+
+    /* The scanner reuses the buffer it scans, so give it a copy */
+    line = getArgListFromString(copy);
+    free(copy);
+
+    while (line[plan->count] != NULL) {
+        ++plan->count;
+    }
+    plan->tokens = (char**) calloc(plan->count + 1, sizeof(char*));
+    plan->kinds  = (char*) malloc(plan->count + 1);
+    if (plan->tokens == NULL || plan->kinds == NULL) {
+        freePlan(plan);
+        return NULL;
+    }
+    for (i = 0; i < plan->count; ++i) {
+        plan->tokens[i] = strdup(line[i]);
+        plan->kinds[i]  = (char) getArgKind(i);
+        if (plan->tokens[i] == NULL) {
+            freePlan(plan);
+            return NULL;
+        }
+    }
+
+    return plan;
+}
+
+/*
+ * freePlan
+ *
+ * Frees a plan (which may be NULL or partly built).
+ */
+static void freePlan(CommandPlan* plan) {
+    int i;
+
+    if (plan == NULL) {
+        return;
+    }
+    for (i = 0; plan->tokens != NULL && i < plan->count; ++i) {
+        free(plan->tokens[i]);
+    }
+    free(plan->tokens);
+    free(plan->kinds);
+    free(plan);
+}
+
+/*
+ * definePlan
+ *
+ * Implements 'alias' and 'function': defines, prints one, or prints all.
+ */
+static int definePlan(char** args, BuiltinIo* io, PlanKind kind) {
+    const char* keyword = planKeywords[kind];
+    Command*    command;
+    Command*    sorted;
+    size_t      count = 0;
+    size_t      i;
+    char*       text;
+
+    pthread_once(&tableOnce, buildTable);
+
+    if (args[1] != NULL && args[2] != NULL && args[3] != NULL) {
+        builtinError(io, "Usage: %s [name [text]]\n", keyword);
+        return 1;
+    }
+
+    /* Print one */
+    if (args[1] != NULL && args[2] == NULL) {
+        bool printed = false;
+
+        pthread_mutex_lock(&commandLock);
+        command = findCommand(args[1], false);
+        if (command != NULL && command->text[kind] != NULL) {
+            printed = printPlan(io, command, kind);
+        }
+        pthread_mutex_unlock(&commandLock);
+        if (!printed) {
+            builtinError(io, "%s: %s: not found\n", keyword, args[1]);
+            return 1;
+        }
+        return 0;
+    }
+
+    /* Define */
+    if (args[1] != NULL) {
+        if (strchr(args[1], '/') != NULL || strchr(args[1], '$') != NULL) {
+            builtinError(io, "%s: %s: invalid name\n", keyword, args[1]);
+            return 1;
+        }
+        text = strdup(args[2]);
+        pthread_mutex_lock(&commandLock);
+        command = (text != NULL) ? findCommand(args[1], true) : NULL;
+        if (command != NULL) {
+            free(command->text[kind]);
+            freePlan(command->plan[kind]);
+            command->text[kind] = text;
+            command->plan[kind] = NULL;
+        }
+        pthread_mutex_unlock(&commandLock);
+        if (command == NULL) {
+            free(text);
+            builtinError(io, "%s: out of memory\n", keyword);
+            return 1;
+        }
+        return 0;
+    }
+
+    /* Print all, sorted by name (copied out, as printing may block) */
+    pthread_mutex_lock(&commandLock);
+    sorted = (Command*) malloc((commandCount + 1) * sizeof(Command));
+    for (i = 0; sorted != NULL && i < commandSlots; ++i) {
+        if (commands[i].name != NULL && commands[i].text[kind] != NULL) {
+            sorted[count].name       = strdup(commands[i].name);
+            sorted[count].text[kind] = strdup(commands[i].text[kind]);
+            if (sorted[count].name != NULL
+                    && sorted[count].text[kind] != NULL) {
+                ++count;
+            } else {
+                free(sorted[count].name);
+                free(sorted[count].text[kind]);
+            }
+        }
+    }
+    pthread_mutex_unlock(&commandLock);
+    if (sorted == NULL) {
+        builtinError(io, "%s: out of memory\n", keyword);
+        return 1;
+    }
+
+    qsort(sorted, count, sizeof(Command), compareCommands);
+    for (i = 0; i < count; ++i) {
+        if (!printPlan(io, &sorted[i], kind)) {
+            break;
+        }
+    }
+    for (i = 0; i < count; ++i) {
+        free(sorted[i].name);
+        free(sorted[i].text[kind]);
+    }
+    free(sorted);
+
+    return 0;
+}
+
+/*
+ * undefinePlan
+ *
+ * Implements 'unalias' and 'unfunction'.
+ */
+static int undefinePlan(char** args, BuiltinIo* io, PlanKind kind) {
+    int status = 0;
+    int i;
+
+    pthread_once(&tableOnce, buildTable);
+
+    if (args[1] == NULL) {
+        builtinError(io, "Usage: un%s name...\n", planKeywords[kind]);
+        return 1;
+    }
+
+    for (i = 1; args[i] != NULL; ++i) {
+        Command* command;
+        bool     found = false;
+
+        pthread_mutex_lock(&commandLock);
+        command = findCommand(args[i], false);
+        if (command != NULL && command->text[kind] != NULL) {
+            free(command->text[kind]);
+            freePlan(command->plan[kind]);
+            command->text[kind] = NULL;
+            command->plan[kind] = NULL;
+            found = true;
+        }
+        pthread_mutex_unlock(&commandLock);
+
+        if (!found) {
+            builtinError(io, "un%s: %s: not found\n", planKeywords[kind],
+                         args[i]);
+            status = 1;
+        }
+    }
+
+    return status;
+}
+
+/*
+ * printPlan
+ *
+ * Prints a definition so that it can be run again: the text is put in
+ * double quotes, with any double quote or backslash in it escaped.
+ * Returns false if output failed.
+ */
+static bool printPlan(BuiltinIo* io, const Command* command, PlanKind kind) {
+    const char* text = command->text[kind];
+    size_t      span;
+
+    if (!builtinPrintf(io, "%s %s \"", planKeywords[kind], command->name)) {
+        return false;
+    }
+    for (;;) {
+        span = strcspn(text, "\"\\");
+        if (text[span] == '\0') {
+            return builtinPrintf(io, "%s\"\n", text);
+        }
+        if (!builtinPrintf(io, "%.*s\\%c", (int) span, text, text[span])) {
+            return false;
+        }
+        text += span + 1;
+    }
+}
+
+/*
+ * compareCommands
+ *
+ * Orders entries by name (qsort() comparator).
+ */
+static int compareCommands(const void* first, const void* second) {
+    return strcmp(((const Command*) first)->name,
+                  ((const Command*) second)->name);
+}
@@ -0,0 +1,35 @@
+/*
+ * shellCommands.h
+ *
+ * The table of command names: built-ins, aliases ('alias') and functions
+ * ('function').  A name may be all three; an alias is expanded first,
+ * then a function is called, and a built-in is run only if the name is
+ * neither.
+ *
+ * Aliases and functions are defined as text and scanned the first time
+ * they are used.  The scanned tokens (their plan) are kept, so using them
+ * again does not scan them again.
+ */
+#ifndef SHELL_COMMANDS_H
+#define SHELL_COMMANDS_H
+
+#include <stdbool.h>
+
+/* The scanned tokens of an alias or function */
+typedef struct {
+    char** tokens;      /* NULL terminated */
+    char*  kinds;       /* The kind of each token (TOKEN_WORD, ...) */
+    int    count;
+} CommandPlan;
+
+/* What a plan is the definition of */
+typedef enum {
+    PLAN_ALIAS,
+    PLAN_FUNCTION
+} PlanKind;
+
+/* Function prototypes */
+bool               isPlanDefined(const char* name, PlanKind kind);
+const CommandPlan* findPlan(const char* name, PlanKind kind);
+
+#endif
@@ -0,0 +1,512 @@
+/*
+ * shellCompletion.c
+ *
+ * Completion of command names and paths (see shellCompletion.h).
+ *
+ * Each directory is kept as a Listing: its names in one buffer and two
+ * sorted arrays of pointers into it, one for the names starting with '.'
+ * (offered only once a '.' is typed) and one for the rest.  The names
+ * starting with a prefix are then a range of an array, found by two
+ * binary searches, and the prefix they all share is the one shared by
+ * the first and last of the range.
+ *
+ * The command index merges the built-ins and the listings of the PATH
+ * directories (executables only) into one sorted array without
+ * duplicates.  Before each completion the PATH directories are checked
+ * with stat(); only those that changed are read again, and the index is
+ * merged again only if one did.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "shellBuiltins.h"
+#include "shellCompletion.h"
+
+/* Number of directories whose listings are kept for path completion */
+#define LISTING_CACHE_SIZE 16
+
+/* Searched when PATH is not set */
+#define DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+/* The sorted names in a directory */
+typedef struct {
+    char*           path;         /* The directory, as typed              */
+    bool            read;         /* true once the directory was read     */
+    bool            present;      /* false if it could not be opened      */
+    dev_t           device;       /* Identify the directory read...      */
+    ino_t           inode;
+    struct timespec modified;     /* ...and the version of it             */
+    char*           buffer;       /* The names, NUL terminated            */
+    const char**    visible;      /* Names not starting with '.', sorted */
+    size_t          visibleCount;
+    const char**    hidden;       /* Names starting with '.', sorted     */
+    size_t          hiddenCount;
+    unsigned long   used;         /* When it last served a completion     */
+} Listing;
+
+/* Function prototypes */
+static void         completeCommand(const char* word, size_t length,
+                                    Completions* completions);
+static void         completePath(const char* word, size_t length,
+                                 Completions* completions);
+static void         refreshCommands(void);
+static void         mergeCommands(void);
+static Listing*     cachedListing(const char* path, size_t length);
+static bool         listingCurrent(const Listing* listing);
+static void         readListing(Listing* listing, bool executables);
+static void         freeListing(Listing* listing);
+static void         findPrefix(const char** names, size_t count,
+                               const char* prefix, size_t length,
+                               Completions* completions);
+static int          compareNames(const void* first, const void* second);
+
+/* The PATH the command index was built from, and its directories */
+static char*        indexedPath    = NULL;
+static Listing*     pathListings   = NULL;
+static size_t       pathCount      = 0;
+
+/* Every command name, sorted, without duplicates */
+static const char** commands       = NULL;
+static size_t       commandCount   = 0;
+
+/* Directories completed in recently */
+static Listing      listingCache[LISTING_CACHE_SIZE];
+static unsigned long completionCount = 0;
+
+/*
+ * completeWord
+ *
+ * Finds the names completing 'word' (its first 'length' bytes): command
+ * names if 'command' is true and the word has no '/', else paths.
+ */
+void completeWord(const char* word, size_t length, bool command,
+                  Completions* completions) {
+    completions->names  = NULL;
+    completions->count  = 0;
+    completions->common = 0;
+    completions->start  = 0;
+    ++completionCount;
+
+    if (command && memchr(word, '/', length) == NULL) {
+        completeCommand(word, length, completions);
+    } else {
+        completePath(word, length, completions);
+    }
+}
+
+/*
+ * completeCommand
+ *
+ * Looks a command name prefix up in the command index.
+ */
+static void completeCommand(const char* word, size_t length,
+                            Completions* completions) {
+    refreshCommands();
+    findPrefix(commands, commandCount, word, length, completions);
+}
+
+/*
+ * completePath
+ *
+ * Looks the last component of a path up in the listing of the directory
+ * before it.
+ */
+static void completePath(const char* word, size_t length,
+                         Completions* completions) {
+    const char* slash = (const char*) memrchr(word, '/', length);
+    size_t      start = (slash != NULL) ? (size_t) (slash - word) + 1 : 0;
+    Listing*    listing = cachedListing(word, start);
+
+    if (listing == NULL) {
+        return;
+    }
+
+    if (start < length && word[start] == '.') {
+        findPrefix(listing->hidden, listing->hiddenCount, word + start,
+                   length - start, completions);
+    } else {
+        findPrefix(listing->visible, listing->visibleCount, word + start,
+                   length - start, completions);
+    }
+    completions->start = start;
+}
+
+/*
+ * refreshCommands
+ *
+ * Brings the command index up to date with PATH and its directories.
+ */
+static void refreshCommands(void) {
+    const char* path = getenv("PATH");
+    bool        changed = false;
+    size_t      i;
+
+    if (path == NULL) {
+        path = DEFAULT_PATH;
+    }
+
+    /* A new PATH starts the index over */
+    if (indexedPath == NULL || strcmp(path, indexedPath) != 0) {
+        char* copy = strdup(path);
+        char* directory;
+        char* rest;
+
+        if (copy == NULL) {
+            return;
+        }
+        for (i = 0; i < pathCount; ++i) {
+            freeListing(&pathListings[i]);
+        }
+        free(pathListings);
+        free(indexedPath);
+        indexedPath = copy;
+
+        pathCount = 1;
+        for (i = 0; path[i] != '\0'; ++i) {
+            pathCount += (path[i] == ':');
+        }
+        pathListings = (Listing*) calloc(pathCount, sizeof(Listing));
+        if (pathListings == NULL) {
+            pathCount = 0;
+            return;
+        }
+
+        /* An empty entry means the current directory */
+        copy = strdup(path);
+        rest = copy;
+        for (i = 0; i < pathCount && copy != NULL; ++i) {
+            directory = strsep(&rest, ":");
+            pathListings[i].path = strdup((*directory != '\0') ? directory
+                                                              : ".");
+        }
+        free(copy);
+        changed = true;
+    }
+
+    for (i = 0; i < pathCount; ++i) {
+        if (pathListings[i].path != NULL
+                && !listingCurrent(&pathListings[i])) {
+            readListing(&pathListings[i], true);
+            changed = true;
+        }
+    }
+
+    if (changed || commands == NULL) {
+        mergeCommands();
+    }
+}
+
+/*
+ * mergeCommands
+ *
+ * Rebuilds the command index from the built-ins and the PATH listings.
+ */
+static void mergeCommands(void) {
+    const char** merged;
+    size_t       count = 0;
+    size_t       kept = 0;
+    size_t       i;
+    size_t       j;
+
+    while (builtinName(count) != NULL) {
+        ++count;
+    }
+    for (i = 0; i < pathCount; ++i) {
+        count += pathListings[i].visibleCount;
+    }
+
+    merged = (const char**) malloc((count + 1) * sizeof(char*));
+    if (merged == NULL) {
+        return;
+    }
+
+    count = 0;
+    while (builtinName(count) != NULL) {
+        merged[count] = builtinName(count);
+        ++count;
+    }
+    for (i = 0; i < pathCount; ++i) {
+        for (j = 0; j < pathListings[i].visibleCount; ++j) {
+            merged[count++] = pathListings[i].visible[j];
+        }
+    }
+    qsort(merged, count, sizeof(char*), compareNames);
+
+    for (i = 0; i < count; ++i) {
+        if (kept == 0 || strcmp(merged[i], merged[kept - 1]) != 0) {
+            merged[kept++] = merged[i];
+        }
+    }
+
+    free(commands);
+    commands     = merged;
+    commandCount = kept;
+}
+
+/*
+ * cachedListing
+ *
+ * Returns the up-to-date listing of a directory (the first 'length'
+ * bytes of 'path'; none means the current directory), reading it if it
+ * is not cached or has changed.  Returns NULL if memory ran out.
+ */
+static Listing* cachedListing(const char* path, size_t length) {
+    Listing* listing = NULL;
+    size_t   i;
+
+    for (i = 0; i < LISTING_CACHE_SIZE && listing == NULL; ++i) {
+        if (listingCache[i].path != NULL
+                && strlen(listingCache[i].path) == length
+                && memcmp(listingCache[i].path, path, length) == 0) {
+            listing = &listingCache[i];
+        }
+    }
+
+    /* Not cached: replace the least recently used */
+    if (listing == NULL) {
+        listing = &listingCache[0];
+        for (i = 1; i < LISTING_CACHE_SIZE; ++i) {
+            if (listingCache[i].used < listing->used) {
+                listing = &listingCache[i];
+            }
+        }
+        freeListing(listing);
+        listing->path = strndup(path, length);
+        if (listing->path == NULL) {
+            return NULL;
+        }
+    }
+
+    if (!listingCurrent(listing)) {
+        readListing(listing, false);
+    }
+    listing->used = completionCount;
+
+    return listing;
+}
+
+/*
+ * listingCurrent
+ *
+ * Returns true if a listing was read and its directory has not changed
+ * since.
+ */
+static bool listingCurrent(const Listing* listing) {
+    struct stat info;
+    bool        present;
+
+    if (!listing->read) {
+        return false;
+    }
+
+    present = (stat((*listing->path != '\0') ? listing->path : ".", &info)
+               == 0 && S_ISDIR(info.st_mode));
+    if (!present || !listing->present) {
+        return present == listing->present;
+    }
+
+    return info.st_dev == listing->device && info.st_ino == listing->inode
+           && info.st_mtim.tv_sec == listing->modified.tv_sec
+           && info.st_mtim.tv_nsec == listing->modified.tv_nsec;
+}
+
+/*
+ * readListing
+ *
+ * (Re)reads the names in a listing's directory: only executables if
+ * 'executables' is true, else everything, with a '/' added to the names
+ * of directories.
+ */
+static void readListing(Listing* listing, bool executables) {
+    struct stat    info;
+    struct dirent* entry;
+    DIR*           directory;
+    size_t*        offsets = NULL;
+    size_t         count = 0;
+    size_t         capacity = 0;
+    size_t         size = 0;
+    size_t         bufferSize = 0;
+    int            fd;
+    size_t         i;
+
+    free(listing->buffer);
+    free(listing->visible);
+    free(listing->hidden);
+    listing->buffer       = NULL;
+    listing->visible      = NULL;
+    listing->hidden       = NULL;
+    listing->visibleCount = 0;
+    listing->hiddenCount  = 0;
+    listing->read         = true;
+    listing->present      = false;
+
+    fd = open((*listing->path != '\0') ? listing->path : ".",
+              O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    directory = fdopendir(fd);
+    if (directory == NULL || fstat(fd, &info) < 0) {
+        if (directory != NULL) {
+            closedir(directory);
+        } else {
+            close(fd);
+        }
+        return;
+    }
+    listing->present  = true;
+    listing->device   = info.st_dev;
+    listing->inode    = info.st_ino;
+    listing->modified = info.st_mtim;
+
+    while ((entry = readdir(directory)) != NULL) {
+        const char* name = entry->d_name;
+        size_t      length = strlen(name);
+        bool        isDirectory = (entry->d_type == DT_DIR);
+        struct stat target;
+
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+
+        /* Symbolic links (and names of unknown type) count as their targets */
+        if ((entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN)
+                && fstatat(fd, name, &target, 0) == 0) {
+            isDirectory = S_ISDIR(target.st_mode);
+        }
+        if (executables
+                && (isDirectory || faccessat(fd, name, X_OK, 0) < 0)) {
+            continue;
+        }
+
+        if (count == capacity) {
+            size_t* grown;
+
+            capacity = (capacity == 0) ? 256 : capacity * 2;
+            grown = (size_t*) realloc(offsets, capacity * sizeof(size_t));
+            if (grown == NULL) {
+                break;
+            }
+            offsets = grown;
+        }
+        if (size + length + 2 > bufferSize) {
+            char* grown;
+
+            bufferSize = (size + length + 2) * 2;
+            grown = (char*) realloc(listing->buffer, bufferSize);
+            if (grown == NULL) {
+                break;
+            }
+            listing->buffer = grown;
+        }
+
+        offsets[count++] = size;
+        memcpy(listing->buffer + size, name, length);
+        size += length;
+        if (isDirectory) {
+            listing->buffer[size++] = '/';
+        }
+        listing->buffer[size++] = '\0';
+    }
+    closedir(directory);
+
+    /* The buffer has stopped moving, so the offsets become pointers */
+    listing->visible = (const char**) malloc((count + 1) * sizeof(char*));
+    listing->hidden  = (const char**) malloc((count + 1) * sizeof(char*));
+    if (listing->visible != NULL && listing->hidden != NULL) {
+        for (i = 0; i < count; ++i) {
+            const char* name = listing->buffer + offsets[i];
+
+            if (name[0] == '.') {
+                listing->hidden[listing->hiddenCount++] = name;
+            } else {
+                listing->visible[listing->visibleCount++] = name;
+            }
+        }
+        qsort(listing->visible, listing->visibleCount, sizeof(char*),
+              compareNames);
+        qsort(listing->hidden, listing->hiddenCount, sizeof(char*),
+              compareNames);
+    }
+    free(offsets);
+}
+
+/*
+ * freeListing
+ *
+ * Frees a listing and marks it unused.
+ */
+static void freeListing(Listing* listing) {
+    free(listing->path);
+    free(listing->buffer);
+    free(listing->visible);
+    free(listing->hidden);
+    memset(listing, 0, sizeof(Listing));
+}
+
+/*
+ * findPrefix
+ *
+ * Finds the range of a sorted array of names starting with a prefix, and
+ * the length of the prefix they all share.
+ */
+static void findPrefix(const char** names, size_t count,
+                       const char* prefix, size_t length,
+                       Completions* completions) {
+    size_t low = 0;
+    size_t high = count;
+    size_t end;
+    size_t common;
+
+    /* The first name not before the prefix... */
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+
+        if (strncmp(names[middle], prefix, length) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    /* ...and the first one after every name starting with it */
+    end = low;
+    high = count;
+    while (end < high) {
+        size_t middle = end + (high - end) / 2;
+
+        if (strncmp(names[middle], prefix, length) <= 0) {
+            end = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if (end == low) {
+        return;
+    }
+
+    common = length;
+    while (names[low][common] != '\0'
+           && names[low][common] == names[end - 1][common]) {
+        ++common;
+    }
+
+    completions->names  = names + low;
+    completions->count  = end - low;
+    completions->common = common;
+}
+
+/*
+ * compareNames
+ *
+ * Orders names (qsort() comparator over an array of strings).
+ */
+static int compareNames(const void* first, const void* second) {
+    return strcmp(*(const char* const*) first, *(const char* const*) second);
+}
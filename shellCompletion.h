@@ -0,0 +1,34 @@
+/*
+ * shellCompletion.h
+ *
+ * Completion of command names and paths for the line editor.
+ *
+ * Command names come from an index of the built-ins and the executables
+ * in the PATH directories, kept sorted so that the names starting with a
+ * prefix are found by binary search.  Paths come from sorted listings of
+ * the directories completed in recently.  A directory is read again only
+ * once its modification time changes, so a completion normally costs a
+ * stat() per directory and a binary search.
+ */
+#ifndef SHELL_COMPLETION_H
+#define SHELL_COMPLETION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * The names completing a word.  They are valid until the next call to
+ * completeWord().
+ */
+typedef struct {
+    const char* const* names;  /* Sorted; directories end with '/'        */
+    size_t             count;
+    size_t             common; /* Length of the prefix all names share    */
+    size_t             start;  /* Offset in the word where the names go   */
+} Completions;
+
+/* Function prototypes */
+void completeWord(const char* word, size_t length, bool command,
+                  Completions* completions);
+
+#endif
@@ -0,0 +1,445 @@
+/*
+ * shellCount.c
+ *
+ * The 'count' built-in: prints each distinct line of its input with the
+ * number of times it occurred -- the output of 'sort | uniq -c' -- in one
+ * pass over unsorted input.
+ *
+ * Lines are counted in an open-addressing hash table (linear probing,
+ * kept at most half full) whose entries hold the full hash, so most
+ * probes never touch the key.  Keys are copied into an arena of large
+ * blocks, freed all at once.  Only the distinct lines are sorted, once,
+ * at the end.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shellBuiltins.h"
+
+/* Size of the buffer used for input that cannot be mapped */
+#define COUNT_BUFFER_SIZE (1024 * 1024)
+
+/* Size of each block of the key arena */
+#define ARENA_BLOCK_SIZE (1024 * 1024)
+
+/* Initial number of slots in the table (a power of two) */
+#define COUNT_INITIAL_SLOTS 4096
+
+/* A block of the key arena */
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t             used;
+    size_t             size;
+    char               data[];
+} ArenaBlock;
+
+/* A distinct line and its count; an empty slot has a NULL key */
+typedef struct {
+    uint64_t      hash;
+    const char*   key;
+    size_t        length;
+    unsigned long count;
+} CountEntry;
+
+/* The lines counted so far */
+typedef struct {
+    CountEntry* slots;
+    size_t      capacity;   /* A power of two            */
+    size_t      used;       /* Slots holding a key       */
+    ArenaBlock* arena;      /* Most recent block first   */
+} CountTable;
+
+/* Function prototypes */
+static bool        countInput(BuiltinIo* io, const char* name,
+                              CountTable* table);
+static bool        countLine(CountTable* table, const char* line,
+                             size_t length);
+static bool        growTable(CountTable* table);
+static uint64_t    hashLine(const char* line, size_t length);
+static const char* arenaCopy(CountTable* table, const char* text,
+                             size_t length);
+static int         compareByKey(const void* a, const void* b);
+static int         compareByCount(const void* a, const void* b);
+
+/**
+ * doCount
+ *
+ * Implements the 'count' built-in.
+ *
+ * args - An array of strings corresponding to the command and its arguments:
+ *        count [-r] [file...]
+ *        Prints "count line" for each distinct line, in line order, or
+ *        most frequent first with -r.  With no files, standard input is
+ *        counted.
+ */
+int doCount(char** args, BuiltinIo* io) {
+    CountTable table;
+    bool       byCount = false;
+    int        status = 0;
+    size_t     distinct = 0;
+    size_t     i;
+    int        arg;
+
+    for (arg = 1; args[arg] != NULL && args[arg][0] == '-'
+                  && args[arg][1] != '\0'; ++arg) {
+        if (strcmp(args[arg], "-r") != 0) {
+            builtinError(io, "Usage: count [-r] [file...]\n");
+            return 1;
+        }
+        byCount = true;
+    }
+
+    memset(&table, 0, sizeof(table));
+    if (!growTable(&table)) {
+        builtinError(io, "count: %s\n", strerror(errno));
+        return 1;
+    }
+
+    if (args[arg] == NULL) {
+        if (!countInput(io, "-", &table)) {
+            status = 1;
+        }
+    }
+    for (; args[arg] != NULL; ++arg) {
+        if (!countInput(io, args[arg], &table)) {
+            status = 1;
+        }
+    }
+
+    /* Gather the entries at the front of the table and sort only them */
+    for (i = 0; i < table.capacity; ++i) {
+        if (table.slots[i].key != NULL) {
+            table.slots[distinct++] = table.slots[i];
+        }
+    }
+    qsort(table.slots, distinct, sizeof(CountEntry),
+          byCount ? compareByCount : compareByKey);
+
+    for (i = 0; i < distinct; ++i) {
+        if (!builtinPrintf(io, "%7lu ", table.slots[i].count)
+                || !builtinWrite(io, table.slots[i].key,
+                                 table.slots[i].length)
+                || !builtinWrite(io, "\n", 1)) {
+            break;
+        }
+    }
+
+    free(table.slots);
+    while (table.arena != NULL) {
+        ArenaBlock* next = table.arena->next;
+
+        free(table.arena);
+        table.arena = next;
+    }
+
+    return status;
+}
+
+/*
+ * countInput
+ *
+ * Counts every line of one input ("-" for standard input).  Regular files
+ * are mapped; anything else is read a buffer at a time, with a partial
+ * line carried over.  Returns false, after reporting it, on failure.
+ */
+static bool countInput(BuiltinIo* io, const char* name, CountTable* table) {
+    struct stat fileStat;
+    char*       buffer;
+    size_t      capacity = COUNT_BUFFER_SIZE;
+    size_t      kept = 0;
+    bool        result = true;
+    int         fd = -1;
+
+    if (strcmp(name, "-") != 0) {
+        fd = open(name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            builtinError(io, "count: %s: %s\n", name, strerror(errno));
+            return false;
+        }
+    }
+
+    if (fd >= 0 && fstat(fd, &fileStat) == 0 && S_ISREG(fileStat.st_mode)
+            && fileStat.st_size > 0) {
+        char* mapping = (char*) mmap(NULL, fileStat.st_size, PROT_READ,
+                                     MAP_PRIVATE, fd, 0);
+
+        if (mapping != MAP_FAILED) {
+            const char* line = mapping;
+            const char* end  = mapping + fileStat.st_size;
+
+            madvise(mapping, fileStat.st_size, MADV_SEQUENTIAL);
+            while (line < end && result) {
+                const char* newline = (const char*) memchr(line, '\n',
+                                                           end - line);
+                const char* lineEnd = (newline != NULL) ? newline : end;
+
+                result = countLine(table, line, lineEnd - line);
+                line   = lineEnd + 1;
+            }
+            munmap(mapping, fileStat.st_size);
+            close(fd);
+
+            if (!result) {
+                builtinError(io, "count: %s: %s\n", name, strerror(errno));
+            }
+            return result;
+        }
+    }
+
+    buffer = (char*) malloc(capacity);
+    while (result) {
+        ssize_t     bytesRead;
+        const char* line;
+        const char* end;
+
+        if (buffer == NULL) {
+            result = false;
+            break;
+        }
+        if (kept == capacity) {
+            /* One line fills the buffer */
+            char* grown = (char*) realloc(buffer, capacity * 2);
+
+            if (grown == NULL) {
+                result = false;
+                break;
+            }
+            buffer    = grown;
+            capacity *= 2;
+        }
+
+        if (fd < 0) {
+            bytesRead = builtinRead(io, buffer + kept, capacity - kept);
+        } else {
+            do {
+                bytesRead = read(fd, buffer + kept, capacity - kept);
+            } while (bytesRead < 0 && errno == EINTR);
+        }
+        if (bytesRead < 0) {
+            result = false;
+            break;
+        }
+        if (bytesRead == 0) {
+            if (kept > 0) {
+                result = countLine(table, buffer, kept);
+            }
+            break;
+        }
+
+        /* Count the complete lines; keep the partial one */
+        line = buffer;
+        end  = buffer + kept + bytesRead;
+        while (result) {
+            const char* newline = (const char*) memchr(line, '\n', end - line);
+
+            if (newline == NULL) {
+                break;
+            }
+            result = countLine(table, line, newline - line);
+            line   = newline + 1;
+        }
+        kept = end - line;
+        memmove(buffer, line, kept);
+    }
+
+    if (!result) {
+        builtinError(io, "count: %s: %s\n", name, strerror(errno));
+    }
+    free(buffer);
+    if (fd >= 0) {
+        close(fd);
+    }
+    return result;
+}
+
+/*
+ * countLine
+ *
+ * Adds one occurrence of a line to the table.  Returns false if memory
+ * ran out.
+ */
+static bool countLine(CountTable* table, const char* line, size_t length) {
+    uint64_t    hash = hashLine(line, length);
+    size_t      mask = table->capacity - 1;
+    size_t      slot = hash & mask;
+    CountEntry* entry;
+
+    for (;;) {
+        entry = &table->slots[slot];
+        if (entry->key == NULL) {
+            break;
+        }
+        if (entry->hash == hash && entry->length == length
+                && memcmp(entry->key, line, length) == 0) {
+            ++entry->count;
+            return true;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    /* A new line: keep the table at most half full */
+    if ((table->used + 1) * 2 > table->capacity) {
+        if (!growTable(table)) {
+            return false;
+        }
+        return countLine(table, line, length);
+    }
+
+    entry->key = arenaCopy(table, line, length);
+    if (entry->key == NULL) {
+        return false;
+    }
+    entry->hash   = hash;
+    entry->length = length;
+    entry->count  = 1;
+    ++table->used;
+
+    return true;
+}
+
+/*
+ * growTable
+ *
+ * Doubles the number of slots (or creates the first ones) and re-inserts
+ * every entry using its stored hash.  Returns false if memory ran out.
+ */
+static bool growTable(CountTable* table) {
+    size_t      capacity = (table->capacity > 0) ? table->capacity * 2
+                                                 : COUNT_INITIAL_SLOTS;
+    CountEntry* slots = (CountEntry*) calloc(capacity, sizeof(CountEntry));
+    size_t      i;
+
+    if (slots == NULL) {
+        return false;
+    }
+
+    for (i = 0; i < table->capacity; ++i) {
+        if (table->slots[i].key != NULL) {
+            size_t slot = table->slots[i].hash & (capacity - 1);
+
+            while (slots[slot].key != NULL) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            slots[slot] = table->slots[i];
+        }
+    }
+
+    free(table->slots);
+    table->slots    = slots;
+    table->capacity = capacity;
+
+    return true;
+}
+
+/*
+ * hashLine
+ *
+ * Hashes a line 8 bytes at a time, finishing with MurmurHash3's 64-bit
+ * mixer so that every input bit affects the low bits used for slots.
+ */
+static uint64_t hashLine(const char* line, size_t length) {
+    const uint64_t multiplier = 0x9e3779b97f4a7c15ULL;
+    uint64_t       hash = length * multiplier;
+    uint64_t       word;
+
+    while (length >= 8) {
+        memcpy(&word, line, 8);
+        hash    = (hash ^ word) * multiplier;
+        hash   ^= hash >> 29;
+        line   += 8;
+        length -= 8;
+    }
+    if (length > 0) {
+        word = 0;
+        memcpy(&word, line, length);
+        hash = (hash ^ word) * multiplier;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+/*
+ * arenaCopy
+ *
+ * Copies a key into the arena.  Keys larger than a quarter of a block get
+ * a block of their own.  Returns NULL if memory ran out.
+ */
+static const char* arenaCopy(CountTable* table, const char* text,
+                             size_t length) {
+    ArenaBlock* block = table->arena;
+    char*       copy;
+
+    if (block == NULL || block->size - block->used < length) {
+        size_t size = (length > ARENA_BLOCK_SIZE / 4) ? length
+                                                      : ARENA_BLOCK_SIZE;
+
+        block = (ArenaBlock*) malloc(sizeof(ArenaBlock) + size);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->used = 0;
+        block->size = size;
+
+        /* A private block goes behind the current one, which has room */
+        if (size > ARENA_BLOCK_SIZE / 4 && table->arena != NULL) {
+            block->next       = table->arena->next;
+            table->arena->next = block;
+        } else {
+            block->next  = table->arena;
+            table->arena = block;
+        }
+    }
+
+    copy = block->data + block->used;
+    memcpy(copy, text, length);
+    block->used += length;
+
+    return copy;
+}
+
+/*
+ * compareByKey
+ *
+ * qsort() comparison: lines in byte order.
+ */
+static int compareByKey(const void* a, const void* b) {
+    const CountEntry* entryA = (const CountEntry*) a;
+    const CountEntry* entryB = (const CountEntry*) b;
+    size_t            shorter = (entryA->length < entryB->length)
+                                ? entryA->length : entryB->length;
+    int               result = memcmp(entryA->key, entryB->key, shorter);
+
+    if (result != 0) {
+        return result;
+    }
+    return (entryA->length > entryB->length)
+           - (entryA->length < entryB->length);
+}
+
+/*
+ * compareByCount
+ *
+ * qsort() comparison: most frequent first, then lines in byte order.
+ */
+static int compareByCount(const void* a, const void* b) {
+    const CountEntry* entryA = (const CountEntry*) a;
+    const CountEntry* entryB = (const CountEntry*) b;
+
+    if (entryA->count != entryB->count) {
+        return (entryA->count < entryB->count) ? 1 : -1;
+    }
+    return compareByKey(a, b);
+}
@@ -0,0 +1,812 @@
+/*
+ * shellDu.c
+ *
+ * The 'du' built-in: sums the disk space allocated to directory trees,
+ * scanning directories in parallel on the thread pool.
+ *
+ * Each directory is scanned by a task of its own, which reads it with
+ * getdents64 and calls statx on each entry relative to the directory's
+ * descriptor, asking only for the fields needed.  Subdirectories become
+ * new tasks.  A task adds its entries' blocks to its own directory only,
+ * so the walk needs no shared counters; the totals are rolled up from
+ * the leaves when the walk has finished, which is also when the results
+ * are printed.
+ *
+ * A file with several hard links is counted once, in the directory where
+ * du(1) counts it: the first one a sequential, depth-first walk in
+ * directory order reaches it from.  The parallel walk reaches it in an
+ * order that depends on scheduling, so such files are only noted while
+ * scanning, with their position in their directory, and charged once the
+ * walk has finished, in du(1)'s order.  With several paths, every file
+ * and directory is counted once, as du(1) does, so a path inside an
+ * earlier one is skipped.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "shellBuiltins.h"
+#include "shellThreadPool.h"
+
+/* Size of the buffer each directory is read into */
+#define DU_DIRENT_BUFFER_SIZE (64 * 1024)
+
+/* Initial number of slots in the set of files counted (a power of two) */
+#define DU_SET_INITIAL_SLOTS 256
+
+/* Initial number of files noted in a directory */
+#define DU_FILES_INITIAL_SIZE 16
+
+/* Flags for opening a directory to scan */
+#define DU_OPEN_FLAGS (O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+
+/* The statx fields 'du' needs */
+#define DU_STATX_MASK (STATX_TYPE | STATX_NLINK | STATX_INO | STATX_BLOCKS)
+
+/* An entry returned by getdents64 */
+struct linux_dirent64 {
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+/* A file counted; an empty slot has 'used' false */
+typedef struct {
+    uint64_t device;
+    uint64_t inode;
+    bool     used;
+} DuLink;
+
+/* A file noted while scanning, to be charged by chargeTree() */
+typedef struct {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t blocks;
+    size_t   position;          /* Among its directory's entries */
+} DuFile;
+
+/* One 'du' command: its options and shared state */
+typedef struct {
+    BuiltinIo*  io;
+    TaskGroup   group;
+    DuLink*     counted;        /* Files counted, by (device, inode) */
+    size_t      countedSlots;   /* A power of two (or 0) */
+    size_t      countedUsed;
+    int         maxDepth;       /* Deepest directories printed (-1: all) */
+    bool        human;          /* -h */
+    bool        countAll;       /* Several paths: count everything once */
+    atomic_int  errors;
+} DuSearch;
+
+/*
+ * A directory.  Directories are kept until the end, when their totals
+ * are rolled up; each is added to its parent's list of children as it is
+ * found.
+ */
+typedef struct DuDir {
+    DuSearch*               search;
+    struct DuDir*           parent;
+    _Atomic(struct DuDir*)  children;
+    struct DuDir*           sibling;
+    atomic_int              references; /* Holders of 'fd' */
+    int                     fd;
+    bool                    skipped;    /* Counted already, or failed */
+    uint64_t                device;
+    uint64_t                inode;
+    size_t                  position;   /* Among its parent's entries */
+    uint64_t                blocks;     /* Of the directory and its files */
+    uint64_t                total;      /* With everything beneath it */
+    DuFile*                 files;      /* Noted files, in entry order */
+    size_t                  fileCount;
+    size_t                  fileCapacity;
+    char                    name[];
+} DuDir;
+
+/* Function prototypes */
+static DuDir*   newDirectory(DuSearch* search, DuDir* parent,
+                             const char* name, size_t nameLength);
+static void     duStart(DuSearch* search, DuDir* root);
+static void     scanDirectoryTask(void* arg);
+static void     releaseDescriptor(DuDir* dir);
+static char*    directoryPath(const DuDir* dir);
+static void     countFile(DuDir* dir, const struct statx* fileStat,
+                          size_t position);
+static uint64_t statDevice(const struct statx* fileStat);
+static uint64_t chargeTree(DuSearch* search, DuDir* dir);
+static bool     firstLink(DuSearch* search, uint64_t device, uint64_t inode);
+static uint64_t hashLink(uint64_t device, uint64_t inode);
+static bool     rollUp(DuSearch* search, DuDir* dir, char** path,
+                       size_t* capacity, size_t length, int depth);
+static bool     printSize(DuSearch* search, uint64_t blocks,
+                          const char* name);
+static int      compareNames(const void* a, const void* b);
+static void     freeTree(DuDir* dir);
+
+/**
+ * doDu
+ *
+ * Implements a built-in version of the 'du' command.
+ *
+ * args - An array of strings corresponding to the command and its arguments:
+ *        du [-chs] [-d depth] [path...]
+ *        Prints the space used by each directory under the paths (default
+ *        '.') in KiB, or in human-readable units with -h.  -s prints only
+ *        the paths themselves, -d only directories at most 'depth' levels
+ *        below them, and -c adds a grand total.
+ */
+int doDu(char** args, BuiltinIo* io) {
+    DuSearch* search;
+    DuDir**   roots;
+    bool      grandTotal = false;
+    bool      printed = true;
+    uint64_t  total = 0;
+    char*     path = NULL;
+    size_t    capacity = 0;
+    int       rootCount;
+    int       status;
+    int       arg;
+    int       i;
+
+    search = (DuSearch*) calloc(1, sizeof(DuSearch));
+    if (search == NULL) {
+        builtinError(io, "du: %s\n", strerror(errno));
+        return 1;
+    }
+    search->io       = io;
+    search->maxDepth = -1;
+
+    for (arg = 1; args[arg] != NULL && args[arg][0] == '-'
+                  && args[arg][1] != '\0'; ++arg) {
+        const char* option;
+
+        for (option = args[arg] + 1; *option != '\0'; ++option) {
+            if (*option == 'c') {
+                grandTotal = true;
+            } else if (*option == 'h') {
+                search->human = true;
+            } else if (*option == 's') {
+                search->maxDepth = 0;
+            } else if (*option == 'd') {
+                const char* value = (option[1] != '\0') ? option + 1
+                                                        : args[++arg];
+                char*       end = NULL;
+
+                if (value != NULL) {
+                    search->maxDepth = strtol(value, &end, 10);
+                }
+                if (value == NULL || *value == '\0' || *end != '\0'
+                        || search->maxDepth < 0) {
+                    builtinError(io, "du: invalid depth\n");
+                    free(search);
+                    return 1;
+                }
+                break;
+            } else {
+                builtinError(io, "Usage: du [-chs] [-d depth] [path...]\n");
+                free(search);
+                return 1;
+            }
+        }
+    }
+
+    rootCount = 0;
+    while (args[arg + rootCount] != NULL) {
+        ++rootCount;
+    }
+    roots = (DuDir**) calloc((rootCount > 0) ? rootCount : 1, sizeof(DuDir*));
+    if (roots == NULL) {
+        builtinError(io, "du: %s\n", strerror(errno));
+        free(search);
+        return 1;
+    }
+
+    atomic_init(&search->errors, 0);
+    search->countAll = (rootCount > 1);
+    taskGroupInit(&search->group);
+
+    if (rootCount == 0) {
+        roots[0]  = newDirectory(search, NULL, ".", 1);
+        rootCount = 1;
+    } else {
+        for (i = 0; i < rootCount; ++i) {
+            const char* name = args[arg + i];
+            size_t      length = strlen(name);
+
+            /* Trailing slashes are dropped so children are joined cleanly */
+            while (length > 1 && name[length - 1] == '/') {
+                --length;
+            }
+            roots[i] = newDirectory(search, NULL, name, length);
+        }
+    }
+    for (i = 0; i < rootCount; ++i) {
+        if (roots[i] == NULL) {
+            builtinError(io, "du: %s\n", strerror(ENOMEM));
+            atomic_fetch_add(&search->errors, 1);
+        } else {
+            duStart(search, roots[i]);
+        }
+    }
+    poolWait(&search->group);
+
+    /* Every task has finished: add up the totals, in du(1)'s order */
+    for (i = 0; i < rootCount; ++i) {
+        if (roots[i] != NULL) {
+            total += chargeTree(search, roots[i]);
+        }
+    }
+
+    /* And print them */
+    for (i = 0; i < rootCount; ++i) {
+        if (roots[i] != NULL) {
+            size_t length = strlen(roots[i]->name);
+
+            if (length + 1 > capacity) {
+                char* grown = (char*) realloc(path, length + 1);
+
+                if (grown == NULL) {
+                    printed = false;
+                    break;
+                }
+                path     = grown;
+                capacity = length + 1;
+            }
+            memcpy(path, roots[i]->name, length + 1);
+            if (!rollUp(search, roots[i], &path, &capacity, length, 0)) {
+                printed = false;
+                break;
+            }
+        }
+    }
+    if (grandTotal && printed) {
+        printSize(search, total, "total");
+    }
+
+    for (i = 0; i < rootCount; ++i) {
+        if (roots[i] != NULL) {
+            freeTree(roots[i]);
+        }
+    }
+    free(roots);
+    free(path);
+    taskGroupDestroy(&search->group);
+    free(search->counted);
+
+    status = (atomic_load(&search->errors) > 0) ? 1 : 0;
+    free(search);
+    return status;
+}
+
+/*
+ * newDirectory
+ *
+ * Creates a directory and adds it to its parent's children.  It holds a
+ * reference to its parent's descriptor until it has been opened.
+ */
+static DuDir* newDirectory(DuSearch* search, DuDir* parent,
+                           const char* name, size_t nameLength) {
+    DuDir* dir = (DuDir*) malloc(sizeof(DuDir) + nameLength + 1);
+
+    if (dir == NULL) {
+        return NULL;
+    }
+    dir->search       = search;
+    dir->parent       = parent;
+    dir->sibling      = NULL;
+    dir->fd           = -1;
+    dir->skipped      = false;
+    dir->device       = 0;
+    dir->inode        = 0;
+    dir->position     = 0;
+    dir->blocks       = 0;
+    dir->total        = 0;
+    dir->files        = NULL;
+    dir->fileCount    = 0;
+    dir->fileCapacity = 0;
+    memcpy(dir->name, name, nameLength);
+    dir->name[nameLength] = '\0';
+    atomic_init(&dir->children, NULL);
+    atomic_init(&dir->references, 1);
+
+    if (parent != NULL) {
+        DuDir* head = atomic_load(&parent->children);
+
+        atomic_fetch_add(&parent->references, 1);
+        do {
+            dir->sibling = head;
+        } while (!atomic_compare_exchange_weak(&parent->children, &head,
+                                               dir));
+    }
+
+    return dir;
+}
+
+/*
+ * duStart
+ *
+ * Counts a starting path, and starts scanning it if it is a directory.
+ */
+static void duStart(DuSearch* search, DuDir* root) {
+    struct statx fileStat;
+
+    if (statx(AT_FDCWD, root->name, AT_SYMLINK_NOFOLLOW, DU_STATX_MASK,
+              &fileStat) < 0) {
+        builtinError(search->io, "du: '%s': %s\n", root->name,
+                     strerror(errno));
+        atomic_fetch_add(&search->errors, 1);
+        atomic_store(&root->references, 0);
+        root->skipped = true;
+        return;
+    }
+
+    root->device = statDevice(&fileStat);
+    root->inode  = fileStat.stx_ino;
+    root->blocks = fileStat.stx_blocks;
+    if (S_ISDIR(fileStat.stx_mode)) {
+        poolSubmit(&search->group, scanDirectoryTask, root);
+    } else {
+        atomic_store(&root->references, 0);
+    }
+}
+
+/*
+ * scanDirectoryTask
+ *
+ * Scans one directory: adds the blocks of its files to its own count and
+ * submits a task for each subdirectory.
+ */
+static void scanDirectoryTask(void* arg) {
+    DuDir*    dir = (DuDir*) arg;
+    DuSearch* search = dir->search;
+    size_t    position = 0;
+    char*     buffer;
+
+    dir->fd = (dir->parent != NULL)
+              ? openat(dir->parent->fd, dir->name, DU_OPEN_FLAGS)
+              : open(dir->name, DU_OPEN_FLAGS);
+    if (dir->fd < 0 && (errno == EMFILE || errno == ENFILE)) {
+        /* Too many ancestors are open; fall back to the full path */
+        char* path = directoryPath(dir);
+
+        if (path != NULL) {
+            dir->fd = open(path, DU_OPEN_FLAGS);
+            free(path);
+        }
+    }
+    if (dir->parent != NULL) {
+        releaseDescriptor(dir->parent);
+    }
+    if (dir->fd < 0) {
+        char* path = directoryPath(dir);
+
+        builtinError(search->io, "du: '%s': %s\n",
+                     (path != NULL) ? path : dir->name, strerror(errno));
+        free(path);
+        atomic_fetch_add(&search->errors, 1);
+        releaseDescriptor(dir);
+        return;
+    }
+
+    buffer = (char*) malloc(DU_DIRENT_BUFFER_SIZE);
+    while (buffer != NULL && !builtinInterrupted()) {
+        long bytesRead = syscall(SYS_getdents64, dir->fd, buffer,
+                                 DU_DIRENT_BUFFER_SIZE);
+        long offset;
+
+        if (bytesRead <= 0) {
+            if (bytesRead < 0) {
+                char* path = directoryPath(dir);
+
+                builtinError(search->io, "du: '%s': %s\n",
+                             (path != NULL) ? path : dir->name,
+                             strerror(errno));
+                free(path);
+                atomic_fetch_add(&search->errors, 1);
+            }
+            break;
+        }
+
+        for (offset = 0; offset < bytesRead; ) {
+            struct linux_dirent64* entry =
+                (struct linux_dirent64*) (buffer + offset);
+            const char*  name = entry->d_name;
+            struct statx fileStat;
+
+            offset += entry->d_reclen;
+            if (name[0] == '.' && (name[1] == '\0'
+                                   || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            if (statx(dir->fd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+                      DU_STATX_MASK, &fileStat) < 0) {
+                continue;
+            }
+
+            if (S_ISDIR(fileStat.stx_mode)) {
+                DuDir* child = newDirectory(search, dir, name, strlen(name));
+
+                if (child != NULL) {
+                    child->device   = statDevice(&fileStat);
+                    child->inode    = fileStat.stx_ino;
+                    child->position = position;
+                    child->blocks   = fileStat.stx_blocks;
+                    poolSubmit(&search->group, scanDirectoryTask, child);
+                }
+            } else {
+                countFile(dir, &fileStat, position);
+            }
+            ++position;
+        }
+    }
+
+    free(buffer);
+    releaseDescriptor(dir);
+}
+
+/*
+ * releaseDescriptor
+ *
+ * Drops a reference to a directory's descriptor, closing it with the
+ * last.  The directory itself is kept for the roll-up.
+ */
+static void releaseDescriptor(DuDir* dir) {
+    if (atomic_fetch_sub(&dir->references, 1) == 1 && dir->fd >= 0) {
+        close(dir->fd);
+        dir->fd = -1;
+    }
+}
+
+/*
+ * directoryPath
+ *
+ * Builds a directory's full path from its ancestors' names.  The caller
+ * frees it.  Returns NULL if memory ran out.
+ */
+static char* directoryPath(const DuDir* dir) {
+    const DuDir* ancestor;
+    size_t       length = 0;
+    char*        path;
+
+    for (ancestor = dir; ancestor != NULL; ancestor = ancestor->parent) {
+        length += strlen(ancestor->name) + 1;
+    }
+    path = (char*) malloc(length);
+    if (path == NULL) {
+        return NULL;
+    }
+
+    path[--length] = '\0';
+    for (ancestor = dir; ancestor != NULL; ancestor = ancestor->parent) {
+        size_t nameLength = strlen(ancestor->name);
+
+        length -= nameLength;
+        memcpy(path + length, ancestor->name, nameLength);
+        if (length > 0) {
+            path[--length] = '/';
+        }
+    }
+
+    return path;
+}
+
+/*
+ * countFile
+ *
+ * Counts a file found in a directory.  A file that
+ * may be counted elsewhere too is noted, to be charged by chargeTree(),
+ * and any other is added to the directory's blocks straight away.  Only
+ * the task scanning the directory calls this, so no lock is needed.
+ */
+static void countFile(DuDir* dir, const struct statx* fileStat,
+                      size_t position) {
+    DuFile* file;
+
+    if (fileStat->stx_nlink <= 1 && !dir->search->countAll) {
+        dir->blocks += fileStat->stx_blocks;
+        return;
+    }
+
+    if (dir->fileCount == dir->fileCapacity) {
+        size_t  capacity = (dir->fileCapacity > 0) ? dir->fileCapacity * 2
+                                                   : DU_FILES_INITIAL_SIZE;
+        DuFile* files = (DuFile*) realloc(dir->files,
+                                          capacity * sizeof(DuFile));
+
+        if (files == NULL) {
+            /* Memory is short: count it here rather than lose it */
+            dir->blocks += fileStat->stx_blocks;
+            return;
+        }
+        dir->files        = files;
+        dir->fileCapacity = capacity;
+    }
+
+    file           = &dir->files[dir->fileCount++];
+    file->device   = statDevice(fileStat);
+    file->inode    = fileStat->stx_ino;
+    file->blocks   = fileStat->stx_blocks;
+    file->position = position;
+}
+
+/*
+ * statDevice
+ *
+ * Returns the device of a file as one number.
+ */
+static uint64_t statDevice(const struct statx* fileStat) {
+    return ((uint64_t) fileStat->stx_dev_major << 32) | fileStat->stx_dev_minor;
+}
+
+/*
+ * chargeTree
+ *
+ * Charges the files noted beneath a directory in the order du(1) meets
+ * them: each directory's entries in the order it lists them, going into
+ * each subdirectory as it comes.  A file is charged to the first
+ * directory it is met in.  Stores the total of each directory beneath
+ * (and returns this one's).  A path that could not be found is skipped,
+ * and so, with several paths, is a directory (or a path to a file)
+ * counted already.
+ */
+static uint64_t chargeTree(DuSearch* search, DuDir* dir) {
+    DuDir* child    = atomic_load(&dir->children);
+    DuDir* reversed = NULL;
+    size_t i        = 0;
+
+    if (dir->skipped) {
+        return 0;
+    }
+    if (search->countAll && !firstLink(search, dir->device, dir->inode)) {
+        dir->skipped = true;
+        return 0;
+    }
+
+    /* The children were added at the front as found: restore their order */
+    while (child != NULL) {
+        DuDir* next = child->sibling;
+
+        child->sibling = reversed;
+        reversed       = child;
+        child          = next;
+    }
+    atomic_store(&dir->children, reversed);
+
+    dir->total = dir->blocks;
+    for (child = reversed; child != NULL || i < dir->fileCount; ) {
+        if (child == NULL || (i < dir->fileCount
+                              && dir->files[i].position < child->position)) {
+            if (firstLink(search, dir->files[i].device, dir->files[i].inode)) {
+                dir->total += dir->files[i].blocks;
+            }
+            ++i;
+        } else {
+            dir->total += chargeTree(search, child);
+            child = child->sibling;
+        }
+    }
+
+    return dir->total;
+}
+
+/*
+ * firstLink
+ *
+ * Records a file in the set of files counted.  Returns true the first
+ * time it is seen (or if memory runs out, so it is counted rather than
+ * lost).  Only chargeTree() calls this, after the walk, so no lock is
+ * needed.
+ */
+static bool firstLink(DuSearch* search, uint64_t device, uint64_t inode) {
+    size_t slot;
+
+    /* Keep the set at most half full */
+    if ((search->countedUsed + 1) * 2 > search->countedSlots) {
+        size_t  capacity = (search->countedSlots > 0)
+                           ? search->countedSlots * 2 : DU_SET_INITIAL_SLOTS;
+        DuLink* slots = (DuLink*) calloc(capacity, sizeof(DuLink));
+        size_t  i;
+
+        if (slots == NULL) {
+            return true;
+        }
+        for (i = 0; i < search->countedSlots; ++i) {
+            if (search->counted[i].used) {
+                slot = hashLink(search->counted[i].device,
+                                search->counted[i].inode) & (capacity - 1);
+                while (slots[slot].used) {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                slots[slot] = search->counted[i];
+            }
+        }
+        free(search->counted);
+        search->counted      = slots;
+        search->countedSlots = capacity;
+    }
+
+    for (slot = hashLink(device, inode) & (search->countedSlots - 1);
+         search->counted[slot].used;
+         slot = (slot + 1) & (search->countedSlots - 1)) {
+        if (search->counted[slot].inode == inode
+                && search->counted[slot].device == device) {
+            return false;
+        }
+    }
+    search->counted[slot].device = device;
+    search->counted[slot].inode  = inode;
+    search->counted[slot].used   = true;
+    ++search->countedUsed;
+
+    return true;
+}
+
+/*
+ * hashLink
+ *
+ * Mixes a (device, inode) pair with MurmurHash3's 64-bit finalizer.
+ */
+static uint64_t hashLink(uint64_t device, uint64_t inode) {
+    uint64_t hash = inode ^ (device * 0x9e3779b97f4a7c15ULL);
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+/*
+ * rollUp
+ *
+ * Prints the totals found by chargeTree(), each directory after
+ * everything beneath it (as du(1) does), children in name order.  'path'
+ * holds the directory's path, 'length' bytes long, and grows as needed.
+ * Returns false if output failed.
+ */
+static bool rollUp(DuSearch* search, DuDir* dir, char** path,
+                   size_t* capacity, size_t length, int depth) {
+    DuDir*  child;
+    DuDir** children = NULL;
+    size_t  count = 0;
+    size_t  i;
+
+    if (dir->skipped) {
+        return true;
+    }
+
+    for (child = atomic_load(&dir->children); child != NULL;
+         child = child->sibling) {
+        ++count;
+    }
+    if (count > 0) {
+        children = (DuDir**) malloc(count * sizeof(DuDir*));
+    }
+    if (children != NULL) {
+        i = 0;
+        for (child = atomic_load(&dir->children); child != NULL;
+             child = child->sibling) {
+            children[i++] = child;
+        }
+        qsort(children, count, sizeof(DuDir*), compareNames);
+    }
+
+    for (i = 0; i < count; ++i) {
+        size_t nameLength;
+        size_t childLength;
+
+        if (children == NULL) {
+            /* Memory is short: keep the order they were found in */
+            child = (i == 0) ? atomic_load(&dir->children) : child->sibling;
+        } else {
+            child = children[i];
+        }
+
+        nameLength  = strlen(child->name);
+        childLength = length + 1 + nameLength;
+        if (childLength + 1 > *capacity) {
+            char* grown = (char*) realloc(*path, childLength * 2);
+
+            if (grown == NULL) {
+                free(children);
+                return false;
+            }
+            *path     = grown;
+            *capacity = childLength * 2;
+        }
+        if (length == 1 && (*path)[0] == '/') {
+            --childLength;
+        } else {
+            (*path)[length] = '/';
+        }
+        memcpy(*path + childLength - nameLength, child->name, nameLength + 1);
+
+        if (!rollUp(search, child, path, capacity, childLength, depth + 1)) {
+            free(children);
+            return false;
+        }
+    }
+    free(children);
+
+    (*path)[length] = '\0';
+    if (search->maxDepth >= 0 && depth > search->maxDepth) {
+        return true;
+    }
+    return printSize(search, dir->total, *path);
+}
+
+/*
+ * printSize
+ *
+ * Prints a size (in 512-byte blocks) and a name, in KiB or, with -h,
+ * with a unit suffix.  Sizes are rounded up, as du(1) does.
+ */
+static bool printSize(DuSearch* search, uint64_t blocks, const char* name) {
+    static const char units[] = "KMGTPE";
+    uint64_t          bytes = blocks * 512;
+    double            value;
+    int               unit;
+
+    if (!search->human) {
+        return builtinPrintf(search->io, "%llu\t%s\n",
+                             (unsigned long long) ((bytes + 1023) / 1024),
+                             name);
+    }
+    if (bytes < 1024) {
+        return builtinPrintf(search->io, "%llu\t%s\n",
+                             (unsigned long long) bytes, name);
+    }
+
+    value = bytes / 1024.0;
+    for (unit = 0; value >= 1024 && units[unit + 1] != '\0'; ++unit) {
+        value /= 1024;
+    }
+    if (value < 10) {
+        value = (double) (uint64_t) (value * 10 + 0.999999) / 10;
+    }
+    if (value < 10) {
+        return builtinPrintf(search->io, "%.1f%c\t%s\n", value, units[unit],
+                             name);
+    }
+    value = (double) (uint64_t) (value + 0.999999);
+    return builtinPrintf(search->io, "%.0f%c\t%s\n", value, units[unit],
+                         name);
+}
+
+/*
+ * compareNames
+ *
+ * qsort() comparison: directories in name order.
+ */
+static int compareNames(const void* a, const void* b) {
+    return strcmp((*(DuDir* const*) a)->name, (*(DuDir* const*) b)->name);
+}
+
+/*
+ * freeTree
+ *
+ * Frees a directory and everything beneath it.
+ */
+static void freeTree(DuDir* dir) {
+    DuDir* child = atomic_load(&dir->children);
+
+    free(dir->files);
+    while (child != NULL) {
+        DuDir* next = child->sibling;
+
+        freeTree(child);
+        child = next;
+    }
+    free(dir);
+}
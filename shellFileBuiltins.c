@@ -0,0 +1,405 @@
+/*
+ * shellFileBuiltins.c
+ *
+ * The 'cat' and 'cp' built-ins.  Both keep the data inside the kernel
+ * wherever they can -- sharing a file's extents (reflink), copy_file_range()
+ * between files, sendfile() out of a file, splice() through a pipe -- and
+ * only copy through a user-space buffer when none of those applies.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include "shellBuiltins.h"
+
+/* Size (and alignment) of the buffer used when the kernel cannot copy */
+#define COPY_BUFFER_SIZE (1024 * 1024)
+
+/* Most bytes requested from the kernel by one copy call */
+#define KERNEL_COPY_CHUNK 0x7ffff000
+
+/* Returned by kernelCopy() when a method does not apply to the files */
+#define COPY_UNSUPPORTED 1
+
+/* The ways kernelCopy() can move data */
+typedef enum {
+    COPY_FILE_RANGE,
+    COPY_SENDFILE,
+    COPY_SPLICE
+} CopyMethod;
+
+/* Function prototypes */
+static int  copyData(int in, int out);
+static int  kernelCopy(CopyMethod method, int in, int out);
+static int  bufferedCopy(int in, int out);
+static bool catStream(BuiltinIo* io, int in, const char* name);
+static bool relayStream(BuiltinIo* io, int in, const char* name);
+static bool copyFile(BuiltinIo* io, const char* source, const char* target);
+
+/*
+ * copyData
+ *
+ * Copies everything from 'in' (starting at its current offset) to 'out',
+ * using the cheapest method the two descriptors allow.  Returns 0 on
+ * success or -1 on error with errno set.
+ */
+static int copyData(int in, int out) {
+    struct stat inStat;
+    struct stat outStat;
+    int         result = COPY_UNSUPPORTED;
+
+    if (fstat(in, &inStat) < 0 || fstat(out, &outStat) < 0) {
+        return -1;
+    }
+
+    /*
+     * Pseudo-files (e.g., in /proc) claim a size of 0 but are not empty,
+     * and the kernel copy calls may return nothing for them.
+     */
+    if (S_ISREG(inStat.st_mode) && inStat.st_size > 0) {
+        if (S_ISREG(outStat.st_mode)) {
+            result = kernelCopy(COPY_FILE_RANGE, in, out);
+        }
+        if (result == COPY_UNSUPPORTED) {
+            result = kernelCopy(COPY_SENDFILE, in, out);
+        }
+    }
+    if (result == COPY_UNSUPPORTED
+            && (S_ISFIFO(inStat.st_mode) || S_ISFIFO(outStat.st_mode))) {
+        result = kernelCopy(COPY_SPLICE, in, out);
+    }
+    if (result == COPY_UNSUPPORTED) {
+        result = bufferedCopy(in, out);
+    }
+
+    return result;
+}
+
+/*
+ * kernelCopy
+ *
+ * Copies from 'in' to 'out' with one of the kernel's copy calls until
+ * end-of-file.  Returns 0 on success, -1 on error with errno set, or
+ * COPY_UNSUPPORTED if the call refused these descriptors before copying
+ * anything (so another method can be tried).
+ */
+static int kernelCopy(CopyMethod method, int in, int out) {
+    bool    started = false;
+    ssize_t copied;
+
+    for (;;) {
+        switch (method) {
+        case COPY_FILE_RANGE:
+            copied = copy_file_range(in, NULL, out, NULL,
+                                     KERNEL_COPY_CHUNK, 0);
+            break;
+        case COPY_SENDFILE:
+            copied = sendfile(out, in, NULL, KERNEL_COPY_CHUNK);
+            break;
+        default:
+            copied = splice(in, NULL, out, NULL, KERNEL_COPY_CHUNK,
+                            SPLICE_F_MOVE);
+            break;
+        }
+
+        if (copied == 0) {
+            return 0;
+        }
+        if (copied < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (!started && (errno == EINVAL || errno == ENOSYS
+                             || errno == EXDEV || errno == EOPNOTSUPP
+                             || errno == EBADF)) {
+                return COPY_UNSUPPORTED;
+            }
+            return -1;
+        }
+        started = true;
+    }
+}
+
+/*
+ * bufferedCopy
+ *
+ * Copies from 'in' to 'out' through a large page-aligned buffer.  Returns
+ * 0 on success or -1 on error with errno set.
+ */
+static int bufferedCopy(int in, int out) {
+    void*   buffer;
+    ssize_t bytesRead;
+    int     result = 0;
+
+    if ((errno = posix_memalign(&buffer, sysconf(_SC_PAGESIZE),
+                                COPY_BUFFER_SIZE)) != 0) {
+        return -1;
+    }
+
+    while (result == 0) {
+        const char* next;
+
+        bytesRead = read(in, buffer, COPY_BUFFER_SIZE);
+        if (bytesRead == 0) {
+            break;
+        }
+        if (bytesRead < 0) {
+            if (errno != EINTR) {
+                result = -1;
+            }
+            continue;
+        }
+
+        for (next = (const char*) buffer; bytesRead > 0; ) {
+            ssize_t written = write(out, next, bytesRead);
+
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                result = -1;
+                break;
+            }
+            next      += written;
+            bytesRead -= written;
+        }
+    }
+
+    free(buffer);
+    return result;
+}
+
+/**
+ * doCat
+ *
+ * Implements a built-in version of the 'cat' command.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *        Each argument names a file to copy to standard output ('-' is
+ *        standard input).  With no arguments, standard input is copied.
+ */
+int doCat(char** args, BuiltinIo* io) {
+    int status = 0;
+    int i;
+
+    if (args[1] == NULL) {
+        return catStream(io, io->in, "-") ? 0 : 1;
+    }
+
+    for (i = 1; args[i] != NULL && !io->outClosed; ++i) {
+        int in;
+
+        if (strcmp(args[i], "-") == 0) {
+            if (!catStream(io, io->in, "-")) {
+                status = 1;
+            }
+            continue;
+        }
+
+        in = open(args[i], O_RDONLY | O_CLOEXEC);
+        if (in < 0) {
+            builtinError(io, "cat: %s: %s\n", args[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        if (!catStream(io, in, args[i])) {
+            status = 1;
+        }
+        close(in);
+    }
+
+    return status;
+}
+
+/*
+ * catStream
+ *
+ * Copies all of 'in' (io->in for standard input) to the built-in's
+ * standard output.  A reader that goes away early is not an error.
+ * Returns false, after reporting it, if the copy failed.
+ */
+static bool catStream(BuiltinIo* io, int in, const char* name) {
+    bool fromStdin = (in == io->in);
+
+    if (io->outRing != NULL || (fromStdin && io->inRing != NULL)) {
+        return relayStream(io, fromStdin ? -1 : in, name);
+    }
+    if (in < 0 || !builtinFlush(io)) {
+        return true;
+    }
+
+    if (copyData(in, io->out) < 0) {
+        if (errno == EPIPE) {
+            io->outClosed = true;
+            return true;
+        }
+        builtinError(io, "cat: %s: %s\n", name, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/*
+ * relayStream
+ *
+ * Copies 'in' (or the built-in's standard input, if 'in' is -1) through
+ * the built-in's own buffers.  Used when one end is a ring buffer, which
+ * the kernel cannot copy to or from.
+ */
+static bool relayStream(BuiltinIo* io, int in, const char* name) {
+    char*   buffer = (char*) malloc(COPY_BUFFER_SIZE);
+    ssize_t bytesRead;
+    bool    result = true;
+
+    if (buffer == NULL) {
+        builtinError(io, "cat: %s: %s\n", name, strerror(errno));
+        return false;
+    }
+
+    for (;;) {
+        if (in < 0) {
+            bytesRead = builtinRead(io, buffer, COPY_BUFFER_SIZE);
+        } else {
+            do {
+                bytesRead = read(in, buffer, COPY_BUFFER_SIZE);
+            } while (bytesRead < 0 && errno == EINTR);
+        }
+
+        if (bytesRead < 0) {
+            builtinError(io, "cat: %s: %s\n", name, strerror(errno));
+            result = false;
+            break;
+        }
+        if (bytesRead == 0 || !builtinWrite(io, buffer, bytesRead)) {
+            break;
+        }
+    }
+
+    free(buffer);
+    return result;
+}
+
+/**
+ * doCp
+ *
+ * Implements a built-in version of the 'cp' command.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *        'cp source target' copies a file; 'cp source... directory' copies
+ *        each source into an existing directory.
+ */
+int doCp(char** args, BuiltinIo* io) {
+    struct stat targetStat;
+    const char* target;
+    bool        intoDirectory;
+    int         count = 0;
+    int         status = 0;
+    int         i;
+
+    while (args[count + 1] != NULL) {
+        ++count;
+    }
+    if (count < 2) {
+        builtinError(io, "cp: missing file operand\n");
+        return 1;
+    }
+
+    target        = args[count];
+    intoDirectory = (stat(target, &targetStat) == 0
+                     && S_ISDIR(targetStat.st_mode));
+    if (count > 2 && !intoDirectory) {
+        builtinError(io, "cp: target '%s' is not a directory\n", target);
+        return 1;
+    }
+
+    for (i = 1; i < count; ++i) {
+        char* path = NULL;
+
+        if (intoDirectory) {
+            const char* slash = strrchr(args[i], '/');
+
+            if (asprintf(&path, "%s/%s", target,
+                         (slash != NULL) ? slash + 1 : args[i]) < 0) {
+                builtinError(io, "cp: %s\n", strerror(ENOMEM));
+                return 1;
+            }
+        }
+        if (!copyFile(io, args[i], (path != NULL) ? path : target)) {
+            status = 1;
+        }
+        free(path);
+    }
+
+    return status;
+}
+
+/*
+ * copyFile
+ *
+ * Copies the file 'source' to 'target', creating or truncating it.  On
+ * filesystems that support it the copy shares the source's extents
+ * (a reflink) instead of duplicating any data.  Returns false, after
+ * reporting it, if the copy failed.
+ */
+static bool copyFile(BuiltinIo* io, const char* source, const char* target) {
+    struct stat sourceStat;
+    struct stat targetStat;
+    int         in;
+    int         out;
+    int         result;
+
+    in = open(source, O_RDONLY | O_CLOEXEC);
+    if (in < 0 || fstat(in, &sourceStat) < 0) {
+        builtinError(io, "cp: cannot open '%s': %s\n", source, strerror(errno));
+        if (in >= 0) {
+            close(in);
+        }
+        return false;
+    }
+    if (S_ISDIR(sourceStat.st_mode)) {
+        builtinError(io, "cp: omitting directory '%s'\n", source);
+        close(in);
+        return false;
+    }
+
+    /* Truncating the target must not destroy the source */
+    if (stat(target, &targetStat) == 0
+            && targetStat.st_dev == sourceStat.st_dev
+            && targetStat.st_ino == sourceStat.st_ino) {
+        builtinError(io, "cp: '%s' and '%s' are the same file\n",
+                     source, target);
+        close(in);
+        return false;
+    }
+
+    out = open(target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+               sourceStat.st_mode & 0777);
+    if (out < 0) {
+        builtinError(io, "cp: cannot create '%s': %s\n",
+                     target, strerror(errno));
+        close(in);
+        return false;
+    }
+
+    result = 0;
+    if (!S_ISREG(sourceStat.st_mode) || ioctl(out, FICLONE, in) < 0) {
+        result = copyData(in, out);
+    }
+    if (close(out) < 0 && result == 0) {
+        result = -1;
+    }
+    if (result < 0) {
+        builtinError(io, "cp: error copying '%s' to '%s': %s\n",
+                     source, target, strerror(errno));
+    }
+    close(in);
+
+    return result == 0;
+}
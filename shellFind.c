@@ -0,0 +1,577 @@
+/*
+ * shellFind.c
+ *
+ * The 'find' built-in: walks directory trees in parallel on the thread
+ * pool, printing the paths that satisfy every predicate given.
+ *
+ * Each directory is scanned by a task of its own.  It is opened relative
+ * to its parent's descriptor (openat), read with getdents64 in large
+ * batches, and every subdirectory found becomes a new task, which idle
+ * workers steal.  An entry's type comes from d_type, so lstat is only
+ * called when a predicate needs the size or modification time (or the
+ * filesystem does not report types).
+ *
+ * Tasks collect output in small buffers that are written out as they
+ * fill, so memory stays bounded however large the tree.  Paths are
+ * printed in the order they are found, which varies between runs.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "shellBuiltins.h"
+#include "shellThreadPool.h"
+
+/* Size of the buffer each directory is read into */
+#define FIND_DIRENT_BUFFER_SIZE (64 * 1024)
+
+/* Size of a task's output buffer */
+#define FIND_OUTPUT_SIZE (16 * 1024)
+
+/* Flags for opening a directory to scan */
+#define FIND_OPEN_FLAGS (O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+
+/* An entry returned by getdents64 */
+struct linux_dirent64 {
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+/* A comparison with a number: +n (more than), -n (less than), or n */
+typedef struct {
+    bool      used;
+    int       sign;
+    long long value;
+} FindNumber;
+
+/* One 'find' command: its predicates and shared state */
+typedef struct {
+    BuiltinIo*      io;
+    TaskGroup       group;
+    pthread_mutex_t outputLock;
+    const char*     namePattern;    /* -name  */
+    unsigned        typeMask;       /* -type: bits indexed by DT_* */
+    FindNumber      size;           /* -size  */
+    long long       sizeUnit;       /* Bytes per unit of -size */
+    FindNumber      mtime;          /* -mtime */
+    int             maxDepth;       /* -maxdepth */
+    time_t          now;
+    atomic_bool     stopped;        /* Output has gone */
+    atomic_int      errors;
+} FindSearch;
+
+/* A directory to scan, shared with the tasks of its subdirectories */
+typedef struct FindDir {
+    FindSearch*     search;
+    struct FindDir* parent;     /* Held until this directory is opened */
+    atomic_int      references;
+    int             fd;
+    int             depth;
+    char*           path;
+    const char*     name;       /* The last component of 'path' */
+} FindDir;
+
+/* A task's output, written out when full */
+typedef struct {
+    char   data[FIND_OUTPUT_SIZE];
+    size_t length;
+} FindOutput;
+
+/* Function prototypes */
+static bool     parseFindArgs(char** args, int first, FindSearch* search);
+static bool     parseNumber(const char* text, FindNumber* number,
+                            long long* unit);
+static void     findStart(FindSearch* search, const char* path);
+static void     scanDirectoryTask(void* arg);
+static FindDir* newDirectory(FindSearch* search, FindDir* parent,
+                             const char* path, size_t pathLength,
+                             int depth);
+static void     releaseDirectory(FindDir* dir);
+static bool     entryMatches(FindSearch* search, int dirFd, const char* name,
+                             const char* statName, unsigned char* type);
+static bool     compareNumber(const FindNumber* number, long long value);
+static void     printPath(FindSearch* search, FindOutput* output,
+                          const char* path, size_t length);
+static void     flushOutput(FindSearch* search, FindOutput* output);
+
+/**
+ * doFind
+ *
+ * Implements a built-in version of the 'find' command.
+ *
+ * args - An array of strings corresponding to the command and its arguments:
+ *        find [path...] [-name pattern] [-type c] [-size [+-]n[ckMG]]
+ *             [-mtime [+-]n] [-maxdepth n]
+ *        Prints every file under the paths (default '.') that matches all
+ *        of the predicates.
+ */
+int doFind(char** args, BuiltinIo* io) {
+    FindSearch search;
+    int        first = 1;
+    int        i;
+
+    while (args[first] != NULL && args[first][0] != '-') {
+        ++first;
+    }
+
+    memset(&search, 0, sizeof(search));
+    search.io       = io;
+    search.maxDepth = -1;
+    search.sizeUnit = 512;
+    search.now      = time(NULL);
+    if (!parseFindArgs(args, first, &search)) {
+        return 1;
+    }
+
+    atomic_init(&search.stopped, false);
+    atomic_init(&search.errors, 0);
+    pthread_mutex_init(&search.outputLock, NULL);
+    taskGroupInit(&search.group);
+
+    if (first == 1) {
+        findStart(&search, ".");
+    }
+    for (i = 1; i < first && !atomic_load(&search.stopped); ++i) {
+        findStart(&search, args[i]);
+    }
+    poolWait(&search.group);
+
+    taskGroupDestroy(&search.group);
+    pthread_mutex_destroy(&search.outputLock);
+
+    return (atomic_load(&search.errors) > 0) ? 1 : 0;
+}
+
+/*
+ * parseFindArgs
+ *
+ * Reads the predicates, starting at args[first], into 'search'.  Returns
+ * false, after reporting it, if they are malformed.
+ */
+static bool parseFindArgs(char** args, int first, FindSearch* search) {
+    int i;
+
+    for (i = first; args[i] != NULL; i += 2) {
+        const char* value = args[i + 1];
+        char*       end;
+
+        if (strcmp(args[i], "-name") != 0 && strcmp(args[i], "-type") != 0
+                && strcmp(args[i], "-size") != 0
+                && strcmp(args[i], "-mtime") != 0
+                && strcmp(args[i], "-maxdepth") != 0) {
+            builtinError(search->io, "find: unknown predicate '%s'\n",
+                         args[i]);
+            return false;
+        }
+        if (value == NULL) {
+            builtinError(search->io, "find: missing argument to '%s'\n",
+                         args[i]);
+            return false;
+        }
+
+        if (strcmp(args[i], "-name") == 0) {
+            search->namePattern = value;
+        } else if (strcmp(args[i], "-type") == 0) {
+            static const char    letters[] = "fdlbcps";
+            static const unsigned char types[] = {
+                DT_REG, DT_DIR, DT_LNK, DT_BLK, DT_CHR, DT_FIFO, DT_SOCK
+            };
+            const char* letter = (value[0] != '\0' && value[1] == '\0')
+                                 ? strchr(letters, value[0]) : NULL;
+
+            if (letter == NULL) {
+                builtinError(search->io, "find: unknown type '%s'\n", value);
+                return false;
+            }
+            search->typeMask |= 1u << types[letter - letters];
+        } else if (strcmp(args[i], "-size") == 0) {
+            if (!parseNumber(value, &search->size, &search->sizeUnit)) {
+                builtinError(search->io, "find: invalid size '%s'\n", value);
+                return false;
+            }
+        } else if (strcmp(args[i], "-mtime") == 0) {
+            if (!parseNumber(value, &search->mtime, NULL)) {
+                builtinError(search->io, "find: invalid age '%s'\n", value);
+                return false;
+            }
+        } else {
+            search->maxDepth = strtol(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || search->maxDepth < 0) {
+                builtinError(search->io, "find: invalid depth '%s'\n", value);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+ * parseNumber
+ *
+ * Parses "[+-]n", followed (if 'unit' is not NULL) by an optional unit
+ * letter: c (bytes), k, M, G, or none for 512-byte blocks.
+ */
+static bool parseNumber(const char* text, FindNumber* number,
+                        long long* unit) {
+    char* end;
+
+    number->sign = (*text == '+') ? 1 : (*text == '-') ? -1 : 0;
+    if (number->sign != 0) {
+        ++text;
+    }
+    if (*text < '0' || *text > '9') {
+        return false;
+    }
+    number->value = strtoll(text, &end, 10);
+    number->used  = true;
+
+    if (unit != NULL && *end != '\0' && end[1] == '\0') {
+        switch (*end++) {
+        case 'c': *unit = 1;                  break;
+        case 'k': *unit = 1024;               break;
+        case 'M': *unit = 1024 * 1024;        break;
+        case 'G': *unit = 1024 * 1024 * 1024; break;
+        default:  return false;
+        }
+    }
+    return *end == '\0';
+}
+
+/*
+ * findStart
+ *
+ * Visits one starting path: prints it if it matches, and starts scanning
+ * it if it is a directory.
+ */
+static void findStart(FindSearch* search, const char* path) {
+    FindOutput    output;
+    const char*   slash = strrchr(path, '/');
+    const char*   name = (slash != NULL && slash[1] != '\0') ? slash + 1
+                                                              : path;
+    unsigned char type = DT_UNKNOWN;
+    size_t        length = strlen(path);
+
+    output.length = 0;
+    if (entryMatches(search, AT_FDCWD, name, path, &type)) {
+        printPath(search, &output, path, length);
+    }
+    flushOutput(search, &output);
+
+    if (type == DT_UNKNOWN) {
+        struct stat fileStat;
+
+        if (lstat(path, &fileStat) < 0) {
+            builtinError(search->io, "find: '%s': %s\n", path,
+                         strerror(errno));
+            atomic_fetch_add(&search->errors, 1);
+            return;
+        }
+        type = IFTODT(fileStat.st_mode);
+    }
+
+    /* Trailing slashes are dropped so children are joined cleanly */
+    while (length > 1 && path[length - 1] == '/') {
+        --length;
+    }
+    if (type == DT_DIR && search->maxDepth != 0) {
+        FindDir* dir = newDirectory(search, NULL, path, length, 0);
+
+        if (dir != NULL) {
+            poolSubmit(&search->group, scanDirectoryTask, dir);
+        }
+    }
+}
+
+/*
+ * scanDirectoryTask
+ *
+ * Scans one directory: prints the entries that match and submits a task
+ * for each subdirectory.
+ */
+static void scanDirectoryTask(void* arg) {
+    FindDir*    dir = (FindDir*) arg;
+    FindSearch* search = dir->search;
+    FindOutput  output;
+    char*       buffer = NULL;
+    char*       path = NULL;
+    size_t      pathCapacity = 0;
+    size_t      dirLength = strlen(dir->path);
+
+    output.length = 0;
+
+    if (atomic_load(&search->stopped) || builtinInterrupted()) {
+        goto done;
+    }
+
+    dir->fd = (dir->parent != NULL)
+              ? openat(dir->parent->fd, dir->name, FIND_OPEN_FLAGS)
+              : open(dir->path, FIND_OPEN_FLAGS);
+    if (dir->fd < 0 && (errno == EMFILE || errno == ENFILE)) {
+        /* Too many ancestors are open; fall back to the full path */
+        dir->fd = open(dir->path, FIND_OPEN_FLAGS);
+    }
+    if (dir->parent != NULL) {
+        releaseDirectory(dir->parent);
+        dir->parent = NULL;
+    }
+    if (dir->fd < 0) {
+        builtinError(search->io, "find: '%s': %s\n", dir->path,
+                     strerror(errno));
+        atomic_fetch_add(&search->errors, 1);
+        goto done;
+    }
+
+    buffer = (char*) malloc(FIND_DIRENT_BUFFER_SIZE);
+    if (buffer == NULL) {
+        goto done;
+    }
+
+    for (;;) {
+        long bytesRead = syscall(SYS_getdents64, dir->fd, buffer,
+                                 FIND_DIRENT_BUFFER_SIZE);
+        long offset;
+
+        if (bytesRead <= 0) {
+            if (bytesRead < 0) {
+                builtinError(search->io, "find: '%s': %s\n", dir->path,
+                             strerror(errno));
+                atomic_fetch_add(&search->errors, 1);
+            }
+            break;
+        }
+
+        for (offset = 0; offset < bytesRead && !atomic_load(&search->stopped)
+                         && !builtinInterrupted(); ) {
+            struct linux_dirent64* entry =
+                (struct linux_dirent64*) (buffer + offset);
+            const char*   name = entry->d_name;
+            unsigned char type = entry->d_type;
+            size_t        nameLength;
+            size_t        length;
+
+            offset += entry->d_reclen;
+            if (name[0] == '.' && (name[1] == '\0'
+                                   || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            /* Build "dir/name" */
+            nameLength = strlen(name);
+            length     = dirLength + 1 + nameLength;
+            if (length + 1 > pathCapacity) {
+                char* grown = (char*) realloc(path, length + 1);
+
+                if (grown == NULL) {
+                    continue;
+                }
+                path         = grown;
+                pathCapacity = length + 1;
+            }
+            memcpy(path, dir->path, dirLength);
+            path[dirLength] = '/';
+            memcpy(path + dirLength + 1, name, nameLength + 1);
+            if (dirLength == 1 && dir->path[0] == '/') {
+                memmove(path + 1, path + 2, nameLength + 1);
+                --length;
+            }
+
+            if (entryMatches(search, dir->fd, name, name, &type)) {
+                printPath(search, &output, path, length);
+            }
+
+            if (type == DT_DIR && (search->maxDepth < 0
+                                   || dir->depth + 1 < search->maxDepth)) {
+                FindDir* child = newDirectory(search, dir, path, length,
+                                              dir->depth + 1);
+
+                if (child != NULL) {
+                    poolSubmit(&search->group, scanDirectoryTask, child);
+                }
+            }
+        }
+    }
+
+done:
+    flushOutput(search, &output);
+    free(buffer);
+    free(path);
+    if (dir->parent != NULL) {
+        releaseDirectory(dir->parent);
+        dir->parent = NULL;
+    }
+    releaseDirectory(dir);
+}
+
+/*
+ * newDirectory
+ *
+ * Creates a directory to scan.  A child holds a reference to its parent
+ * (so the parent's descriptor stays open) until it has been opened.
+ */
+static FindDir* newDirectory(FindSearch* search, FindDir* parent,
+                             const char* path, size_t pathLength,
+                             int depth) {
+    FindDir*    dir = (FindDir*) malloc(sizeof(FindDir));
+    const char* slash;
+
+    if (dir == NULL || (dir->path = strndup(path, pathLength)) == NULL) {
+        free(dir);
+        return NULL;
+    }
+    slash = strrchr(dir->path, '/');
+
+    dir->search = search;
+    dir->parent = parent;
+    dir->fd     = -1;
+    dir->depth  = depth;
+    dir->name   = (slash != NULL && slash[1] != '\0') ? slash + 1 : dir->path;
+    atomic_init(&dir->references, 1);
+    if (parent != NULL) {
+        atomic_fetch_add(&parent->references, 1);
+    }
+
+    return dir;
+}
+
+/*
+ * releaseDirectory
+ *
+ * Drops a reference to a directory, closing and freeing it with the last.
+ */
+static void releaseDirectory(FindDir* dir) {
+    if (atomic_fetch_sub(&dir->references, 1) == 1) {
+        if (dir->fd >= 0) {
+            close(dir->fd);
+        }
+        if (dir->parent != NULL) {
+            releaseDirectory(dir->parent);
+        }
+        free(dir->path);
+        free(dir);
+    }
+}
+
+/*
+ * entryMatches
+ *
+ * Tests an entry against every predicate.  'type' is its d_type; it is
+ * filled in (from lstat) if unknown.  lstat is only called when the type
+ * is unknown or a predicate needs the size or modification time.
+ * 'statName' names the entry relative to 'dirFd'.
+ */
+static bool entryMatches(FindSearch* search, int dirFd, const char* name,
+                         const char* statName, unsigned char* type) {
+    struct stat fileStat;
+    bool        haveStat = false;
+
+    if (*type == DT_UNKNOWN) {
+        if (fstatat(dirFd, statName, &fileStat, AT_SYMLINK_NOFOLLOW) < 0) {
+            return false;
+        }
+        *type    = IFTODT(fileStat.st_mode);
+        haveStat = true;
+    }
+
+    if (search->namePattern != NULL
+            && fnmatch(search->namePattern, name, 0) != 0) {
+        return false;
+    }
+    if (search->typeMask != 0 && (search->typeMask & (1u << *type)) == 0) {
+        return false;
+    }
+
+    if (search->size.used || search->mtime.used) {
+        if (!haveStat && fstatat(dirFd, statName, &fileStat,
+                                 AT_SYMLINK_NOFOLLOW) < 0) {
+            return false;
+        }
+        /* Sizes are rounded up to whole units, as find(1) does */
+        if (search->size.used
+                && !compareNumber(&search->size,
+                                  (fileStat.st_size + search->sizeUnit - 1)
+                                  / search->sizeUnit)) {
+            return false;
+        }
+        if (search->mtime.used
+                && !compareNumber(&search->mtime,
+                                  (search->now - fileStat.st_mtime) / 86400)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * compareNumber
+ *
+ * Tests a value against "+n", "-n" or "n".
+ */
+static bool compareNumber(const FindNumber* number, long long value) {
+    if (number->sign > 0) {
+        return value > number->value;
+    }
+    if (number->sign < 0) {
+        return value < number->value;
+    }
+    return value == number->value;
+}
+
+/*
+ * printPath
+ *
+ * Adds a path to a task's output, writing the output out if it is full.
+ */
+static void printPath(FindSearch* search, FindOutput* output,
+                      const char* path, size_t length) {
+    if (output->length + length + 1 > FIND_OUTPUT_SIZE) {
+        flushOutput(search, output);
+    }
+    if (length + 1 > FIND_OUTPUT_SIZE) {
+        pthread_mutex_lock(&search->outputLock);
+        if (!builtinWrite(search->io, path, length)
+                || !builtinWrite(search->io, "\n", 1)) {
+            atomic_store(&search->stopped, true);
+        }
+        pthread_mutex_unlock(&search->outputLock);
+        return;
+    }
+
+    memcpy(output->data + output->length, path, length);
+    output->data[output->length + length] = '\n';
+    output->length += length + 1;
+}
+
+/*
+ * flushOutput
+ *
+ * Writes a task's output to standard output.  Whole lines are written
+ * under a lock, so lines from different tasks never interleave.
+ */
+static void flushOutput(FindSearch* search, FindOutput* output) {
+    if (output->length == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&search->outputLock);
+    if (!builtinWrite(search->io, output->data, output->length)) {
+        atomic_store(&search->stopped, true);
+    }
+    pthread_mutex_unlock(&search->outputLock);
+
+    output->length = 0;
+}
@@ -0,0 +1,771 @@
+/*
+ * shellGrep.c
+ *
+ * The 'fgrep' built-in: prints the lines that contain any of a small set
+ * of fixed strings.
+ *
+ * Candidate matches are found with a vector filter (AVX2 or SSE2, chosen
+ * when the command runs): a block of positions is compared against the
+ * pattern's first byte and, at the same time, the block pattern-length-1
+ * bytes further on against its last byte.  Only positions where both
+ * agree are checked in full.  Each pattern remembers its next match, so
+ * with several patterns the input is still scanned once per pattern
+ * rather than once per line.
+ *
+ * Regular files are mapped and searched in place.  When several files
+ * are named they are searched in parallel on the thread pool; each file's
+ * output is collected separately and printed in the order the files were
+ * named.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "shellBuiltins.h"
+#include "shellThreadPool.h"
+
+/* Size of the buffer used for input that cannot be mapped */
+#define GREP_BUFFER_SIZE (1024 * 1024)
+
+/* A fixed string to search for */
+typedef struct {
+    const char* text;
+    size_t      length;
+} Pattern;
+
+/* Returns the first occurrence of a pattern in [from, end), or NULL */
+typedef const char* (*FindFunction)(const Pattern* pattern, const char* from,
+                                    const char* end);
+
+/* One search: the options and the state shared by all of its files */
+typedef struct {
+    Pattern*        patterns;
+    int             patternCount;
+    FindFunction    find;
+    bool            lineNumbers;   /* -n: prefix lines with their number   */
+    bool            countOnly;     /* -c: print only a count per file      */
+    bool            listFiles;     /* -l: print only names of files        */
+    bool            invert;        /* -v: select non-matching lines        */
+    bool            showNames;     /* Prefix lines with the file name      */
+    atomic_bool     cancelled;     /* Output has gone; stop searching      */
+    pthread_mutex_t lock;
+    pthread_cond_t  fileDone;      /* Signalled when a file is finished    */
+} GrepSearch;
+
+/* One file of a search */
+typedef struct {
+    GrepSearch*   search;
+    const char*   name;         /* The name as given ("-" is stdin)       */
+    BuiltinIo*    io;           /* Where stdin comes from                 */
+    BuiltinIo*    output;       /* Write output here, or (if NULL) ...    */
+    char*         text;         /* ... collect it here                    */
+    size_t        textLength;
+    size_t        textCapacity;
+    const char**  next;         /* Each pattern's next match, if known    */
+    unsigned long lineNumber;   /* Lines before the current position      */
+    unsigned long selected;     /* Lines selected so far                  */
+    int           error;        /* errno of a failure, or 0               */
+    bool          stopped;      /* Nothing more is needed from this file  */
+    bool          done;
+} GrepFile;
+
+/* Function prototypes */
+static FindFunction chooseFinder(void);
+static const char*  findScalar(const Pattern* pattern, const char* from,
+                               const char* end);
+static bool         parseGrepArgs(char** args, BuiltinIo* io,
+                                  GrepSearch* search, int* firstFile);
+static void         searchFileTask(void* arg);
+static void         searchFile(GrepFile* file);
+static size_t       searchBlock(GrepFile* file, const char* data,
+                                size_t length, bool atEnd);
+static const char*  findNextMatch(GrepFile* file, const char* from,
+                                  const char* end);
+static void         skipLines(GrepFile* file, const char* from,
+                              const char* to);
+static void         selectLines(GrepFile* file, const char* from,
+                                const char* to);
+static void         selectLine(GrepFile* file, const char* start,
+                               const char* end);
+static void         emit(GrepFile* file, const char* data, size_t length);
+static const char*  fileLabel(const GrepFile* file);
+
+/*
+ * findScalar
+ *
+ * Finds a pattern without vector instructions.
+ */
+static const char* findScalar(const Pattern* pattern, const char* from,
+                              const char* end) {
+    if (pattern->length == 0) {
+        return from;
+    }
+    if (pattern->length == 1) {
+        return (const char*) memchr(from, pattern->text[0], end - from);
+    }
+    return (const char*) memmem(from, end - from, pattern->text,
+                                pattern->length);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * findAvx2
+ *
+ * Finds a pattern 32 candidate positions at a time.  Only positions whose
+ * first and last bytes both match are compared in full.
+ */
+__attribute__((target("avx2")))
+static const char* findAvx2(const Pattern* pattern, const char* from,
+                            const char* end) {
+    const size_t length = pattern->length;
+    const char*  position = from;
+    __m256i      first;
+    __m256i      last;
+
+    if (length < 2) {
+        return findScalar(pattern, from, end);
+    }
+    first = _mm256_set1_epi8(pattern->text[0]);
+    last  = _mm256_set1_epi8(pattern->text[length - 1]);
+
+    for (; end - position >= (ptrdiff_t) (length - 1 + 32); position += 32) {
+        __m256i  blockFirst = _mm256_loadu_si256((const __m256i*) position);
+        __m256i  blockLast  = _mm256_loadu_si256(
+                                  (const __m256i*) (position + length - 1));
+        uint32_t candidates = _mm256_movemask_epi8(
+                                  _mm256_and_si256(
+                                      _mm256_cmpeq_epi8(blockFirst, first),
+                                      _mm256_cmpeq_epi8(blockLast, last)));
+
+        while (candidates != 0) {
+            int bit = __builtin_ctz(candidates);
+
+            if (memcmp(position + bit + 1, pattern->text + 1,
+                       length - 2) == 0) {
+                return position + bit;
+            }
+            candidates &= candidates - 1;
+        }
+    }
+
+    return findScalar(pattern, position, end);
+}
+
+#if defined(__SSE2__)
+/*
+ * findSse2
+ *
+ * The same as findAvx2(), 16 candidate positions at a time.
+ */
+static const char* findSse2(const Pattern* pattern, const char* from,
+                            const char* end) {
+    const size_t length = pattern->length;
+    const char*  position = from;
+    __m128i      first;
+    __m128i      last;
+
+    if (length < 2) {
+        return findScalar(pattern, from, end);
+    }
+    first = _mm_set1_epi8(pattern->text[0]);
+    last  = _mm_set1_epi8(pattern->text[length - 1]);
+
+    for (; end - position >= (ptrdiff_t) (length - 1 + 16); position += 16) {
+        __m128i  blockFirst = _mm_loadu_si128((const __m128i*) position);
+        __m128i  blockLast  = _mm_loadu_si128(
+                                  (const __m128i*) (position + length - 1));
+        uint32_t candidates = _mm_movemask_epi8(
+                                  _mm_and_si128(
+                                      _mm_cmpeq_epi8(blockFirst, first),
+                                      _mm_cmpeq_epi8(blockLast, last)));
+
+        while (candidates != 0) {
+            int bit = __builtin_ctz(candidates);
+
+            if (memcmp(position + bit + 1, pattern->text + 1,
+                       length - 2) == 0) {
+                return position + bit;
+            }
+            candidates &= candidates - 1;
+        }
+    }
+
+    return findScalar(pattern, position, end);
+}
+#endif
+#endif
+
+/*
+ * chooseFinder
+ *
+ * Returns the fastest search function this processor supports.
+ */
+static FindFunction chooseFinder(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return findAvx2;
+    }
+#if defined(__SSE2__)
+    return findSse2;
+#endif
+#endif
+    return findScalar;
+}
+
+/**
+ * doFgrep
+ *
+ * Implements a built-in version of the 'fgrep' (grep -F) command.
+ *
+ * args - An array of strings corresponding to the command and its arguments:
+ *        fgrep [-cHhlnv] [-e pattern]... [pattern] [file...]
+ *        A pattern containing newlines is several patterns.  With no
+ *        files, standard input is searched.
+ *
+ * Returns 0 if any line was selected, 1 if none was, 2 on error.
+ */
+int doFgrep(char** args, BuiltinIo* io) {
+    GrepSearch search;
+    GrepFile*  files;
+    TaskGroup  group;
+    char*      stdinName[] = { "-", NULL };
+    char**     names;
+    int        fileCount = 0;
+    int        status = 1;
+    int        i;
+
+    memset(&search, 0, sizeof(search));
+    if (!parseGrepArgs(args, io, &search, &i)) {
+        free(search.patterns);
+        return 2;
+    }
+    names = (args[i] != NULL) ? &args[i] : stdinName;
+    while (names[fileCount] != NULL) {
+        ++fileCount;
+    }
+    files = (GrepFile*) calloc(fileCount, sizeof(GrepFile));
+    if (files == NULL) {
+        builtinError(io, "fgrep: %s\n", strerror(errno));
+        free(search.patterns);
+        return 2;
+    }
+    search.find = chooseFinder();
+    atomic_init(&search.cancelled, false);
+    pthread_mutex_init(&search.lock, NULL);
+    pthread_cond_init(&search.fileDone, NULL);
+
+    for (i = 0; i < fileCount; ++i) {
+        files[i].search = &search;
+        files[i].name   = names[i];
+        files[i].io     = io;
+    }
+
+    if (fileCount == 1 || poolSize() < 2) {
+        /* Stream straight to standard output */
+        for (i = 0; i < fileCount && !io->outClosed; ++i) {
+            files[i].output = io;
+            searchFile(&files[i]);
+            if (files[i].error != 0) {
+                builtinError(io, "fgrep: %s: %s\n", fileLabel(&files[i]),
+                             strerror(files[i].error));
+            }
+        }
+    } else {
+        taskGroupInit(&group);
+        for (i = 0; i < fileCount; ++i) {
+            poolSubmit(&group, searchFileTask, &files[i]);
+        }
+
+        /* Print each file's output as soon as it and its predecessors finish */
+        for (i = 0; i < fileCount; ++i) {
+            pthread_mutex_lock(&search.lock);
+            while (!files[i].done) {
+                pthread_cond_wait(&search.fileDone, &search.lock);
+            }
+            pthread_mutex_unlock(&search.lock);
+
+            if (!builtinWrite(io, files[i].text, files[i].textLength)) {
+                atomic_store(&search.cancelled, true);
+            }
+            free(files[i].text);
+            files[i].text = NULL;
+            if (files[i].error != 0) {
+                builtinError(io, "fgrep: %s: %s\n", fileLabel(&files[i]),
+                             strerror(files[i].error));
+            }
+        }
+
+        poolWait(&group);
+        taskGroupDestroy(&group);
+    }
+
+    for (i = 0; i < fileCount; ++i) {
+        if (files[i].error != 0) {
+            status = 2;
+        } else if (files[i].selected > 0 && status == 1) {
+            status = 0;
+        }
+    }
+
+    pthread_cond_destroy(&search.fileDone);
+    pthread_mutex_destroy(&search.lock);
+    free(search.patterns);
+    free(files);
+
+    return status;
+}
+
+/*
+ * parseGrepArgs
+ *
+ * Reads the options and patterns of an 'fgrep' command into 'search' and
+ * sets 'firstFile' to the index of the first file argument.  Returns
+ * false, after reporting it, if the command is malformed.
+ */
+static bool parseGrepArgs(char** args, BuiltinIo* io, GrepSearch* search,
+                          int* firstFile) {
+    char** patternArgs;
+    int    patternArgCount = 0;
+    int    names = 0;           /* 1 for -H, -1 for -h */
+    int    i;
+    int    j;
+
+    for (i = 1; args[i] != NULL; ++i) {
+        ++patternArgCount;
+    }
+    patternArgs = (char**) calloc(patternArgCount + 1, sizeof(char*));
+    if (patternArgs == NULL) {
+        builtinError(io, "fgrep: %s\n", strerror(errno));
+        return false;
+    }
+    patternArgCount = 0;
+
+    for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0';
+            ++i) {
+        const char* option;
+
+        if (strcmp(args[i], "--") == 0) {
+            ++i;
+            break;
+        }
+        for (option = args[i] + 1; *option != '\0'; ++option) {
+            if (*option == 'e') {
+                /* The rest of the word, or the next one, is a pattern */
+                if (option[1] != '\0') {
+                    patternArgs[patternArgCount++] = (char*) option + 1;
+                } else if (args[i + 1] != NULL) {
+                    patternArgs[patternArgCount++] = args[++i];
+                } else {
+                    builtinError(io, "fgrep: option requires an argument"
+                                     " -- 'e'\n");
+                    free(patternArgs);
+                    return false;
+                }
+                break;
+            }
+
+            switch (*option) {
+            case 'c': search->countOnly   = true; break;
+            case 'l': search->listFiles   = true; break;
+            case 'n': search->lineNumbers = true; break;
+            case 'v': search->invert      = true; break;
+            case 'H': names = 1;                  break;
+            case 'h': names = -1;                 break;
+            default:
+                builtinError(io, "fgrep: invalid option -- '%c'\n", *option);
+                free(patternArgs);
+                return false;
+            }
+        }
+    }
+
+    if (patternArgCount == 0) {
+        if (args[i] == NULL) {
+            builtinError(io, "Usage: fgrep [-cHhlnv] [-e pattern]..."
+                             " [pattern] [file...]\n");
+            free(patternArgs);
+            return false;
+        }
+        patternArgs[patternArgCount++] = args[i++];
+    }
+    *firstFile = i;
+
+    /* Every line of every pattern argument is a pattern */
+    for (i = 0; i < patternArgCount; ++i) {
+        const char* text;
+
+        for (text = patternArgs[i]; text != NULL; ) {
+            const char* newline = strchr(text, '\n');
+            Pattern*    grown = (Pattern*) realloc(search->patterns,
+                                    (search->patternCount + 1)
+                                    * sizeof(Pattern));
+
+            if (grown == NULL) {
+                builtinError(io, "fgrep: %s\n", strerror(errno));
+                free(patternArgs);
+                return false;
+            }
+            search->patterns = grown;
+            search->patterns[search->patternCount].text   = text;
+            search->patterns[search->patternCount].length =
+                (newline != NULL) ? (size_t) (newline - text) : strlen(text);
+            ++search->patternCount;
+
+            text = (newline != NULL) ? newline + 1 : NULL;
+        }
+    }
+    free(patternArgs);
+
+    for (j = *firstFile; args[j] != NULL; ++j) {
+        ;
+    }
+    search->showNames = (names == 0) ? (j - *firstFile > 1) : (names > 0);
+
+    return true;
+}
+
+/*
+ * searchFileTask
+ *
+ * Searches one file on the thread pool, then announces it is done.
+ */
+static void searchFileTask(void* arg) {
+    GrepFile* file = (GrepFile*) arg;
+
+    searchFile(file);
+
+    pthread_mutex_lock(&file->search->lock);
+    file->done = true;
+    pthread_cond_broadcast(&file->search->fileDone);
+    pthread_mutex_unlock(&file->search->lock);
+}
+
+/*
+ * searchFile
+ *
+ * Searches one file (or standard input, for "-").  A mapped file is
+ * searched as one block; anything else is read a buffer at a time, with
+ * a partial last line carried over to the next read.
+ */
+static void searchFile(GrepFile* file) {
+    GrepSearch* search = file->search;
+    struct stat fileStat;
+    char*       buffer = NULL;
+    size_t      capacity = GREP_BUFFER_SIZE;
+    size_t      kept = 0;
+    bool        fromStdin = (strcmp(file->name, "-") == 0);
+    int         fd = -1;
+
+    file->next = (const char**) calloc(search->patternCount,
+                                       sizeof(const char*));
+    if (file->next == NULL) {
+        file->error = errno;
+        return;
+    }
+
+    if (!fromStdin) {
+        fd = open(file->name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            file->error = errno;
+            free(file->next);
+            return;
+        }
+    }
+
+    if (fd >= 0 && fstat(fd, &fileStat) == 0 && S_ISREG(fileStat.st_mode)
+            && fileStat.st_size > 0) {
+        void* mapping = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE,
+                             fd, 0);
+
+        if (mapping != MAP_FAILED) {
+            madvise(mapping, fileStat.st_size, MADV_SEQUENTIAL);
+            searchBlock(file, (const char*) mapping, fileStat.st_size, true);
+            munmap(mapping, fileStat.st_size);
+            goto finish;
+        }
+    }
+
+    buffer = (char*) malloc(capacity);
+    if (buffer == NULL) {
+        file->error = errno;
+        goto finish;
+    }
+    while (!file->stopped) {
+        ssize_t bytesRead;
+        size_t  consumed;
+
+        if (kept == capacity) {
+            /* One line fills the buffer */
+            char* grown = (char*) realloc(buffer, capacity * 2);
+
+            if (grown == NULL) {
+                file->error = errno;
+                break;
+            }
+            buffer    = grown;
+            capacity *= 2;
+        }
+
+        if (fromStdin) {
+            bytesRead = builtinRead(file->io, buffer + kept, capacity - kept);
+        } else {
+            do {
+                bytesRead = read(fd, buffer + kept, capacity - kept);
+            } while (bytesRead < 0 && errno == EINTR);
+        }
+        if (bytesRead < 0) {
+            file->error = errno;
+            break;
+        }
+
+        consumed = searchBlock(file, buffer, kept + bytesRead, bytesRead == 0);
+        kept    += bytesRead - consumed;
+        memmove(buffer, buffer + consumed, kept);
+        if (bytesRead == 0) {
+            break;
+        }
+    }
+
+finish:
+    if (file->error == 0 && !atomic_load(&search->cancelled)) {
+        char line[32];
+
+        if (search->listFiles) {
+            if (file->selected > 0) {
+                emit(file, fileLabel(file), strlen(fileLabel(file)));
+                emit(file, "\n", 1);
+            }
+        } else if (search->countOnly) {
+            if (search->showNames) {
+                emit(file, fileLabel(file), strlen(fileLabel(file)));
+                emit(file, ":", 1);
+            }
+            emit(file, line, snprintf(line, sizeof(line), "%lu\n",
+                                      file->selected));
+        }
+    }
+
+    free(buffer);
+    free(file->next);
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+/*
+ * searchBlock
+ *
+ * Searches the complete lines of a block of input (all of it, if 'atEnd'
+ * is true, even without a final newline).  Returns the number of bytes
+ * consumed; the rest is the start of a line still being read.
+ */
+static size_t searchBlock(GrepFile* file, const char* data, size_t length,
+                          bool atEnd) {
+    GrepSearch* search = file->search;
+    const char* position = data;
+    const char* limit = data + length;
+    int         i;
+
+    if (!atEnd) {
+        const char* newline = (const char*) memrchr(data, '\n', length);
+
+        if (newline == NULL) {
+            return 0;
+        }
+        limit = newline + 1;
+    }
+
+    /* Matches remembered from an earlier block point into freed memory */
+    for (i = 0; i < search->patternCount; ++i) {
+        file->next[i] = NULL;
+    }
+
+    while (position < limit && !file->stopped) {
+        const char* match = findNextMatch(file, position, limit);
+        const char* lineStart;
+        const char* lineEnd;
+
+        if (atomic_load(&search->cancelled)) {
+            file->stopped = true;
+            break;
+        }
+        if (match == NULL) {
+            if (search->invert) {
+                selectLines(file, position, limit);
+            } else {
+                skipLines(file, position, limit);
+            }
+            position = limit;
+            break;
+        }
+
+        lineStart = (const char*) memrchr(position, '\n', match - position);
+        lineStart = (lineStart != NULL) ? lineStart + 1 : position;
+        lineEnd   = (const char*) memchr(match, '\n', limit - match);
+        if (lineEnd == NULL) {
+            lineEnd = limit;
+        }
+
+        if (search->invert) {
+            selectLines(file, position, lineStart);
+            ++file->lineNumber;
+        } else {
+            skipLines(file, position, lineStart);
+            selectLine(file, lineStart, lineEnd);
+        }
+        position = (lineEnd < limit) ? lineEnd + 1 : limit;
+    }
+
+    return limit - data;
+}
+
+/*
+ * findNextMatch
+ *
+ * Returns the earliest match of any pattern in [from, end), or NULL.
+ * Each pattern's next match is remembered until it is passed, so every
+ * pattern scans the block only once.
+ */
+static const char* findNextMatch(GrepFile* file, const char* from,
+                                 const char* end) {
+    GrepSearch* search = file->search;
+    const char* earliest = end;
+    int         i;
+
+    for (i = 0; i < search->patternCount; ++i) {
+        if (file->next[i] == NULL || file->next[i] < from) {
+            const char* match = search->find(&search->patterns[i], from, end);
+
+            file->next[i] = (match != NULL) ? match : end;
+        }
+        if (file->next[i] < earliest) {
+            earliest = file->next[i];
+        }
+    }
+
+    return (earliest < end) ? earliest : NULL;
+}
+
+/*
+ * skipLines
+ *
+ * Passes over the unselected lines in [from, to), counting them if line
+ * numbers are wanted.
+ */
+static void skipLines(GrepFile* file, const char* from, const char* to) {
+    if (!file->search->lineNumbers) {
+        return;
+    }
+    while (from < to) {
+        const char* newline = (const char*) memchr(from, '\n', to - from);
+
+        ++file->lineNumber;
+        from = (newline != NULL) ? newline + 1 : to;
+    }
+}
+
+/*
+ * selectLines
+ *
+ * Selects every line in [from, to).
+ */
+static void selectLines(GrepFile* file, const char* from, const char* to) {
+    while (from < to && !file->stopped) {
+        const char* newline = (const char*) memchr(from, '\n', to - from);
+        const char* end = (newline != NULL) ? newline : to;
+
+        selectLine(file, from, end);
+        from = (newline != NULL) ? newline + 1 : to;
+    }
+}
+
+/*
+ * selectLine
+ *
+ * Selects the line [start, end) (which excludes its newline): prints it,
+ * unless only counts or file names are wanted.
+ */
+static void selectLine(GrepFile* file, const char* start, const char* end) {
+    GrepSearch* search = file->search;
+
+    ++file->lineNumber;
+    ++file->selected;
+
+    if (search->listFiles) {
+        file->stopped = true;
+        return;
+    }
+    if (search->countOnly) {
+        return;
+    }
+
+    if (search->showNames) {
+        emit(file, fileLabel(file), strlen(fileLabel(file)));
+        emit(file, ":", 1);
+    }
+    if (search->lineNumbers) {
+        char number[32];
+
+        emit(file, number, snprintf(number, sizeof(number), "%lu:",
+                                    file->lineNumber));
+    }
+    emit(file, start, end - start);
+    emit(file, "\n", 1);
+}
+
+/*
+ * emit
+ *
+ * Writes output for a file: straight to standard output when the file is
+ * being searched on the built-in's own thread, otherwise into the file's
+ * own buffer to be printed in order later.
+ */
+static void emit(GrepFile* file, const char* data, size_t length) {
+    if (file->output != NULL) {
+        if (!builtinWrite(file->output, data, length)) {
+            file->stopped = true;
+        }
+        return;
+    }
+
+    if (file->textLength + length > file->textCapacity) {
+        size_t capacity = (file->textCapacity > 0) ? file->textCapacity
+                                                   : GREP_BUFFER_SIZE;
+        char*  grown;
+
+        while (capacity < file->textLength + length) {
+            capacity *= 2;
+        }
+        grown = (char*) realloc(file->text, capacity);
+        if (grown == NULL) {
+            file->error   = errno;
+            file->stopped = true;
+            return;
+        }
+        file->text         = grown;
+        file->textCapacity = capacity;
+    }
+    memcpy(file->text + file->textLength, data, length);
+    file->textLength += length;
+}
+
+/*
+ * fileLabel
+ *
+ * Returns the name to show for a file: standard input is shown as
+ * "(standard input)", as grep does.
+ */
+static const char* fileLabel(const GrepFile* file) {
+    return (strcmp(file->name, "-") == 0) ? "(standard input)" : file->name;
+}
@@ -0,0 +1,630 @@
+/*
+ * shellHistory.c
+ *
+ * The persistent command history and its search index.
+ *
+ * Opening the history only opens the file.  The first time an entry is
+ * needed the file is mapped and scanned for the start of each entry, and
+ * the first search of three or more characters builds a trigram index:
+ * for each three-byte sequence, the (ascending) numbers of the entries
+ * containing it.  A search then only looks at the entries in the
+ * shortest posting list of the query's trigrams, newest first, checking
+ * each with memmem().  Entries appended later (by any session) are
+ * indexed as the mapping grows to cover them.  If another session
+ * truncates or replaces the file, everything is dropped and the file is
+ * scanned again, rather than reading past its end.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shellBuiltins.h"
+#include "shellHistory.h"
+
+/* The history file, in the home directory */
+#define HISTORY_FILE_NAME ".shell_history"
+
+/* Initial number of slots in the trigram table (a power of two) */
+#define TRIGRAM_INITIAL_SLOTS 4096
+
+/* The entries containing one trigram; an empty slot has no 'entries' */
+typedef struct {
+    uint32_t  trigram;
+    uint32_t  count;
+    uint32_t  capacity;
+    uint32_t* entries;      /* Ascending */
+} Posting;
+
+/* Function prototypes */
+static void           refresh(void);
+static bool           fileChanged(const struct stat* fileStat);
+static void           forgetFile(void);
+static void           indexEntry(uint32_t entry, const char* text,
+                                 size_t length);
+static bool           addPosting(uint32_t trigram, uint32_t entry);
+static bool           growPostings(void);
+static const Posting* findPosting(uint32_t trigram);
+static const char*    entryText(size_t index, size_t* length);
+static bool           printEntry(BuiltinIo* io, long index);
+
+/* Entry points may be called from a built-in's thread */
+static pthread_mutex_t historyLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The history file and the part of it that is mapped */
+static char*     historyPath = NULL;
+static int       historyFd   = -1;
+static char*     mapping     = NULL;
+static size_t    mappedSize  = 0;
+
+/* Where each entry starts, and how much of the file has been scanned */
+static uint64_t* offsets        = NULL;
+static size_t    entryCount     = 0;
+static size_t    offsetCapacity = 0;
+static size_t    scannedSize    = 0;
+
+/* The trigram index, once built; it covers the first 'indexedCount' */
+static Posting*  postings        = NULL;
+static size_t    postingCapacity = 0;
+static size_t    postingUsed     = 0;
+static size_t    indexedCount    = 0;
+static bool      indexBuilt      = false;
+
+/*
+ * historyOpen
+ *
+ * Opens (creating if necessary) the history file.  Without a home
+ * directory or a usable file the shell simply keeps no history.
+ */
+void historyOpen(void) {
+    const char* home = getenv("HOME");
+
+    if (home == NULL || historyFd >= 0
+            || asprintf(&historyPath, "%s/%s", home, HISTORY_FILE_NAME) < 0) {
+        return;
+    }
+    historyFd = open(historyPath, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC,
+                     S_IRUSR | S_IWUSR);
+}
+
+/*
+ * historyAdd
+ *
+ * Appends a command to the history, unless it repeats the latest entry.
+ */
+void historyAdd(const char* text, size_t length) {
+    char*       record;
+    const char* latest;
+    size_t      latestLength;
+
+    if (historyFd < 0 || length == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&historyLock);
+    refresh();
+    latest = (entryCount > 0) ? entryText(entryCount - 1, &latestLength)
+                              : NULL;
+    if (latest != NULL && latestLength == length
+            && memcmp(latest, text, length) == 0) {
+        pthread_mutex_unlock(&historyLock);
+        return;
+    }
+
+    /* One write, so concurrent sessions cannot split the record */
+    record = (char*) malloc(length + 1);
+    if (record != NULL) {
+        memcpy(record, text, length);
+        record[length] = '\0';
+        while (write(historyFd, record, length + 1) < 0 && errno == EINTR) {
+        }
+        free(record);
+    }
+    pthread_mutex_unlock(&historyLock);
+}
+
+/*
+ * historyCount
+ *
+ * Returns the number of entries, including any other sessions added.
+ */
+size_t historyCount(void) {
+    size_t count;
+
+    pthread_mutex_lock(&historyLock);
+    refresh();
+    count = entryCount;
+    pthread_mutex_unlock(&historyLock);
+
+    return count;
+}
+
+/*
+ * historyEntry
+ *
+ * Copies the text of an entry into 'buffer', NUL terminated and cut short
+ * if it does not fit in 'size' bytes.  Returns the entry's full length
+ * (so a caller can retry with a bigger buffer), or -1 if there is no such
+ * entry.
+ */
+ssize_t historyEntry(size_t index, char* buffer, size_t size) {
+    const char* text;
+    size_t      length;
+    ssize_t     result = -1;
+
+    pthread_mutex_lock(&historyLock);
+    if (index >= entryCount) {
+        refresh();
+    }
+    if (index < entryCount) {
+        text   = entryText(index, &length);
+        result = (ssize_t) length;
+        if (size > 0) {
+            if (length > size - 1) {
+                length = size - 1;
+            }
+            memcpy(buffer, text, length);
+            buffer[length] = '\0';
+        }
+    }
+    pthread_mutex_unlock(&historyLock);
+
+    return result;
+}
+
+/*
+ * historySearch
+ *
+ * Returns the number of the newest entry before 'before' (or before the
+ * end, if 'before' is negative) that contains 'query', or -1 if there is
+ * none.
+ */
+long historySearch(const char* query, long before) {
+    size_t         queryLength = strlen(query);
+    const Posting* shortest = NULL;
+    long           result = -1;
+    size_t         i;
+
+    pthread_mutex_lock(&historyLock);
+    refresh();
+    if (before < 0 || (size_t) before > entryCount) {
+        before = entryCount;
+    }
+
+    if (queryLength < 3) {
+        /* Too short to index: look at every entry */
+        for (i = before; i-- > 0; ) {
+            size_t      length;
+            const char* text = entryText(i, &length);
+
+            if (memmem(text, length, query, queryLength) != NULL) {
+                result = i;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&historyLock);
+        return result;
+    }
+
+    if (!indexBuilt) {
+        indexBuilt = true;
+        refresh();
+    }
+
+    /* Only entries holding the query's rarest trigram can match */
+    for (i = 0; i + 3 <= queryLength; ++i) {
+        const Posting* posting = findPosting(
+                                     ((uint32_t) (unsigned char) query[i] << 16)
+                                     | ((uint32_t) (unsigned char) query[i + 1]
+                                        << 8)
+                                     | (unsigned char) query[i + 2]);
+
+        if (posting == NULL) {
+            shortest = NULL;
+            break;
+        }
+        if (shortest == NULL || posting->count < shortest->count) {
+            shortest = posting;
+        }
+    }
+
+    if (shortest != NULL) {
+        /* Find the first candidate at or after 'before', then go back */
+        size_t low = 0;
+        size_t high = shortest->count;
+
+        while (low < high) {
+            size_t middle = (low + high) / 2;
+
+            if (shortest->entries[middle] < (uint32_t) before) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        for (i = low; i-- > 0; ) {
+            size_t      length;
+            const char* text = entryText(shortest->entries[i], &length);
+
+            if (memmem(text, length, query, queryLength) != NULL) {
+                result = shortest->entries[i];
+                break;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&historyLock);
+    return result;
+}
+
+/*
+ * refresh
+ *
+ * Maps any part of the file added since the last look, records where
+ * its entries start, and (once the index is built) indexes them.  A
+ * record still being written, with no NUL yet, is left for next time.
+ * If the file was truncated or replaced, starts again from its start.
+ */
+static void refresh(void) {
+    struct stat fileStat;
+    size_t      size;
+
+    if (historyFd < 0 || fstat(historyFd, &fileStat) < 0) {
+        return;
+    }
+    if (fileChanged(&fileStat)) {
+        forgetFile();
+        if (historyFd < 0 || fstat(historyFd, &fileStat) < 0) {
+            return;
+        }
+    }
+    size = fileStat.st_size;
+
+    if (size > mappedSize) {
+        char* grown = (mapping == NULL)
+                      ? (char*) mmap(NULL, size, PROT_READ, MAP_SHARED,
+                                     historyFd, 0)
+                      : (char*) mremap(mapping, mappedSize, size,
+                                       MREMAP_MAYMOVE);
+
+        if (grown == MAP_FAILED) {
+            return;
+        }
+        mapping    = grown;
+        mappedSize = size;
+    }
+
+    while (scannedSize < mappedSize) {
+        const char* end = (const char*) memchr(mapping + scannedSize, '\0',
+                                               mappedSize - scannedSize);
+
+        if (end == NULL) {
+            break;
+        }
+        if (entryCount == offsetCapacity) {
+            size_t    capacity = (offsetCapacity > 0) ? offsetCapacity * 2
+                                                      : 1024;
+            uint64_t* grown = (uint64_t*) realloc(offsets,
+                                                  capacity * sizeof(uint64_t));
+
+            if (grown == NULL) {
+                break;
+            }
+            offsets        = grown;
+            offsetCapacity = capacity;
+        }
+        offsets[entryCount++] = scannedSize;
+        scannedSize = end - mapping + 1;
+    }
+
+    while (indexBuilt && indexedCount < entryCount) {
+        size_t      length;
+        const char* text = entryText(indexedCount, &length);
+
+        indexEntry(indexedCount, text, length);
+        ++indexedCount;
+    }
+}
+
+/*
+ * fileChanged
+ *
+ * Returns true if what has been read of the file no longer describes it:
+ * it is shorter than the mapping, the last entry scanned no longer ends
+ * where it did, or another file (e.g., a rewritten history) has taken its
+ * name.  In the last case the new file is opened instead.
+ */
+static bool fileChanged(const struct stat* fileStat) {
+    struct stat pathStat;
+    int         fd;
+
+    if ((size_t) fileStat->st_size < mappedSize
+            || (scannedSize > 0 && mapping[scannedSize - 1] != '\0')) {
+        return true;
+    }
+
+    if (stat(historyPath, &pathStat) < 0
+            || (pathStat.st_ino == fileStat->st_ino
+                && pathStat.st_dev == fileStat->st_dev)) {
+        return false;
+    }
+    fd = open(historyPath, O_RDWR | O_APPEND | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    close(historyFd);
+    historyFd = fd;
+    return true;
+}
+
+/*
+ * forgetFile
+ *
+ * Unmaps the file and drops the entries found in it and their index (the
+ * index is rebuilt as the file is scanned again, if it had been built).
+ */
+static void forgetFile(void) {
+    size_t i;
+
+    if (mapping != NULL) {
+        munmap(mapping, mappedSize);
+    }
+    mapping     = NULL;
+    mappedSize  = 0;
+    entryCount  = 0;
+    scannedSize = 0;
+
+    for (i = 0; i < postingCapacity; ++i) {
+        free(postings[i].entries);
+        postings[i].entries  = NULL;
+        postings[i].count    = 0;
+        postings[i].capacity = 0;
+    }
+    postingUsed  = 0;
+    indexedCount = 0;
+}
+
+/*
+ * indexEntry
+ *
+ * Adds an entry to the posting list of each of its trigrams.
+ */
+static void indexEntry(uint32_t entry, const char* text, size_t length) {
+    uint32_t trigram;
+    size_t   i;
+
+    if (length < 3) {
+        return;
+    }
+
+    trigram = ((uint32_t) (unsigned char) text[0] << 8)
+              | (unsigned char) text[1];
+    for (i = 2; i < length; ++i) {
+        trigram = ((trigram << 8) | (unsigned char) text[i]) & 0xFFFFFF;
+        if (!addPosting(trigram, entry)) {
+            return;
+        }
+    }
+}
+
+/*
+ * addPosting
+ *
+ * Records that an entry contains a trigram.  Entries are indexed in
+ * order, so a repeated trigram is always at the end of its list.
+ * Returns false if memory ran out.
+ */
+static bool addPosting(uint32_t trigram, uint32_t entry) {
+    size_t   slot;
+    Posting* posting;
+
+    if ((postingUsed + 1) * 2 > postingCapacity && !growPostings()) {
+        return false;
+    }
+
+    /* The multiplier spreads the (often similar) trigrams over the table */
+    slot = (trigram * 0x9E3779B1U) & (postingCapacity - 1);
+    while (postings[slot].entries != NULL
+           && postings[slot].trigram != trigram) {
+        slot = (slot + 1) & (postingCapacity - 1);
+    }
+    posting = &postings[slot];
+
+    if (posting->entries == NULL) {
+        posting->entries = (uint32_t*) malloc(4 * sizeof(uint32_t));
+        if (posting->entries == NULL) {
+            return false;
+        }
+        posting->trigram  = trigram;
+        posting->count    = 0;
+        posting->capacity = 4;
+        ++postingUsed;
+    } else if (posting->entries[posting->count - 1] == entry) {
+        return true;
+    }
+
+    if (posting->count == posting->capacity) {
+        uint32_t* grown = (uint32_t*) realloc(posting->entries,
+                                              posting->capacity * 2
+                                              * sizeof(uint32_t));
+
+        if (grown == NULL) {
+            return false;
+        }
+        posting->entries   = grown;
+        posting->capacity *= 2;
+    }
+    posting->entries[posting->count++] = entry;
+
+    return true;
+}
+
+/*
+ * growPostings
+ *
+ * Doubles the trigram table (or creates it).  Returns false if memory
+ * ran out.
+ */
+static bool growPostings(void) {
+    size_t   capacity = (postingCapacity > 0) ? postingCapacity * 2
+                                              : TRIGRAM_INITIAL_SLOTS;
+    Posting* grown = (Posting*) calloc(capacity, sizeof(Posting));
+    size_t   i;
+
+    if (grown == NULL) {
+        return false;
+    }
+    for (i = 0; i < postingCapacity; ++i) {
+        if (postings[i].entries != NULL) {
+            size_t slot = (postings[i].trigram * 0x9E3779B1U) & (capacity - 1);
+
+            while (grown[slot].entries != NULL) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            grown[slot] = postings[i];
+        }
+    }
+
+    free(postings);
+    postings        = grown;
+    postingCapacity = capacity;
+
+    return true;
+}
+
+/*
+ * findPosting
+ *
+ * Returns the posting list of a trigram, or NULL if no entry has it.
+ */
+static const Posting* findPosting(uint32_t trigram) {
+    size_t slot;
+
+    if (postingCapacity == 0) {
+        return NULL;
+    }
+    slot = (trigram * 0x9E3779B1U) & (postingCapacity - 1);
+    while (postings[slot].entries != NULL) {
+        if (postings[slot].trigram == trigram) {
+            return &postings[slot];
+        }
+        slot = (slot + 1) & (postingCapacity - 1);
+    }
+    return NULL;
+}
+
+/*
+ * entryText
+ *
+ * Returns where an entry (which must have been scanned) starts in the
+ * mapping, and stores its length.
+ */
+static const char* entryText(size_t index, size_t* length) {
+    uint64_t end = (index + 1 < entryCount) ? offsets[index + 1]
+                                            : scannedSize;
+
+    *length = end - offsets[index] - 1;
+    return mapping + offsets[index];
+}
+
+/**
+ * doHistory
+ *
+ * Implements the 'history' built-in.
+ *
+ * args - An array of strings corresponding to the command and its arguments:
+ *        history [-s text] [count]
+ *        Prints the last 'count' entries (all by default), numbered from
+ *        1, or with -s only those containing 'text'.
+ */
+int doHistory(char** args, BuiltinIo* io) {
+    const char* query = NULL;
+    long*       matches = NULL;
+    long        capacity = 0;
+    long        limit = -1;
+    long        found = 0;
+    long        next;
+    int         arg = 1;
+
+    if (args[arg] != NULL && strcmp(args[arg], "-s") == 0
+            && args[arg + 1] != NULL) {
+        query = args[arg + 1];
+        arg  += 2;
+    }
+    if (args[arg] != NULL) {
+        char* end;
+
+        limit = strtol(args[arg], &end, 10);
+        if (*args[arg] == '\0' || *end != '\0' || limit < 0
+                || args[arg + 1] != NULL) {
+            builtinError(io, "Usage: history [-s text] [count]\n");
+            return 1;
+        }
+    }
+
+    if (query == NULL) {
+        long count = historyCount();
+
+        next = (limit >= 0 && limit < count) ? count - limit : 0;
+        while (next < count && printEntry(io, next)) {
+            ++next;
+        }
+        return 0;
+    }
+
+    /* Collect the newest matches, then print them oldest first */
+    for (next = historySearch(query, -1); next >= 0 && found != limit;
+         next = historySearch(query, next)) {
+        if (found == capacity) {
+            long* grown = (long*) realloc(matches, (capacity + 64) * 2
+                                                   * sizeof(long));
+
+            if (grown == NULL) {
+                break;
+            }
+            matches  = grown;
+            capacity = (capacity + 64) * 2;
+        }
+        matches[found++] = next;
+    }
+    while (found-- > 0 && printEntry(io, matches[found])) {
+    }
+    free(matches);
+
+    return 0;
+}
+
+/*
+ * printEntry
+ *
+ * Prints an entry with its number.  The text is copied out of the
+ * mapping first, since printing may block.  Returns false if output
+ * failed.
+ */
+static bool printEntry(BuiltinIo* io, long index) {
+    size_t      length;
+    const char* text;
+    char*       copy = NULL;
+    bool        result;
+
+    pthread_mutex_lock(&historyLock);
+    if ((size_t) index < entryCount) {
+        text = entryText(index, &length);
+        copy = strndup(text, length);
+    }
+    pthread_mutex_unlock(&historyLock);
+
+    if (copy == NULL) {
+        return false;
+    }
+    result = builtinPrintf(io, "%6ld  %s\n", index + 1, copy);
+    free(copy);
+
+    return result;
+}
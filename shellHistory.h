@@ -0,0 +1,27 @@
+/*
+ * shellHistory.h
+ *
+ * The shell's command history, kept in a file shared by every session
+ * (~/.shell_history).  Each command is appended as one NUL-terminated
+ * record with a single write() to a descriptor opened with O_APPEND, so
+ * sessions never interleave their commands.  The file is mapped, not
+ * read, and commands appended by other sessions show up as it grows.
+ *
+ * Entries are numbered from 0, oldest first.  historyEntry() copies an
+ * entry out while the history is locked, since another session may
+ * truncate the file (and the mapping be replaced) at any time.
+ */
+#ifndef SHELL_HISTORY_H
+#define SHELL_HISTORY_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Function prototypes */
+void        historyOpen(void);
+void        historyAdd(const char* text, size_t length);
+size_t      historyCount(void);
+ssize_t     historyEntry(size_t index, char* buffer, size_t size);
+long        historySearch(const char* query, long before);
+
+#endif
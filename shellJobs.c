@@ -0,0 +1,571 @@
+/*
+ * shellJobs.c
+ *
+ * The shell's background jobs (see shellJobs.h) and the 'admit' and
+ * 'wait' built-ins.
+ *
+ * Pressure is read from the "some" line of each /proc/pressure file.  Its
+ * avg10 figure averages over ten seconds, too slowly to notice the jobs
+ * just started, so the total stall time is also sampled: its share of
+ * the time since the previous sample is the current pressure, and the
+ * higher of the two is held against the limit.  While jobs are running,
+ * new ones are started at most once per ADMIT_INTERVAL, so the next
+ * sample sees the effect of each start.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include "shellBuiltins.h"
+#include "shellJobs.h"
+
+/* The shortest time between starts while jobs are running (seconds) */
+#define ADMIT_INTERVAL 0.1
+
+/* One kind of pressure stall information */
+typedef struct {
+    const char*        name;    /* As given to 'admit'                     */
+    const char*        path;
+    double             limit;   /* Percent of time stalled (0 is off)      */
+    int                fd;      /* -1 until opened, -2 if unavailable      */
+    unsigned long long total;   /* Stall time at 'sampled' (microseconds)  */
+    double             sampled; /* When 'total' was read (0 if never)      */
+    double             recent;  /* Percent stalled between the last samples */
+} Pressure;
+
+/* A background job */
+typedef struct {
+    int   number;   /* As shown to the user, from 1              */
+    pid_t pid;
+    bool  done;     /* true once the process has been waited for */
+    int   status;   /* The wait status, once done                */
+    char* text;     /* The command, for reports                  */
+} Job;
+
+/* Function prototypes */
+static bool   isAdmissible(void);
+static bool   readPressure(Pressure* pressure, double time, double* percent);
+static bool   readLoad(double* load);
+static int    runningJobs(void);
+static void   collectJob(Job* job, int options);
+static int    waitForJob(int number);
+static int    findJob(int number);
+static void   removeJob(int index);
+static void   describeStatus(int status, char* text, size_t size);
+static double now(void);
+
+/* The limits, and what was last read, for each kind of pressure */
+static Pressure pressures[] = {
+    { "cpu",    "/proc/pressure/cpu",    60, -1, 0, 0, 0 },
+    { "memory", "/proc/pressure/memory", 10, -1, 0, 0, 0 },
+    { "io",     "/proc/pressure/io",     40, -1, 0, 0, 0 },
+};
+
+/* Runnable tasks per CPU allowed when there is no pressure information */
+static double loadLimit = 1.5;
+
+/* The running (or not yet reported) jobs, and when the last one started */
+static pthread_mutex_t jobLock   = PTHREAD_MUTEX_INITIALIZER;
+static Job*            jobs      = NULL;
+static int             jobCount  = 0;
+static double          lastStart = 0;
+
+/*
+ * jobAdmit
+ *
+ * Waits until a new background job may be started.  Returns false if the
+ * wait was interrupted (e.g., by Ctrl-C), in which case the job should
+ * not be started.
+ */
+bool jobAdmit(void) {
+    bool admitted = true;
+
+    pthread_mutex_lock(&jobLock);
+    for (;;) {
+        /* Sample even if the job is admitted anyway, for the next one */
+        bool            admissible = isAdmissible();
+        double          wait       = lastStart + ADMIT_INTERVAL - now();
+        struct timespec pause;
+
+        if (runningJobs() == 0 || (admissible && wait <= 0)) {
+            break;
+        }
+
+        if (wait <= 0) {
+            wait = ADMIT_INTERVAL;
+        }
+        pause.tv_sec  = (time_t) wait;
+        pause.tv_nsec = (long) ((wait - pause.tv_sec) * 1e9);
+        pthread_mutex_unlock(&jobLock);
+        admitted = (nanosleep(&pause, NULL) == 0 || errno != EINTR);
+        pthread_mutex_lock(&jobLock);
+        if (!admitted) {
+            break;
+        }
+    }
+    if (admitted) {
+        lastStart = now();
+    }
+    pthread_mutex_unlock(&jobLock);
+
+    return admitted;
+}
+
+/*
+ * jobAdd
+ *
+ * Records a background job started as process 'pid' to run the command
+ * made of 'words' (NULL terminated).  Returns the job's number.
+ */
+int jobAdd(pid_t pid, char** words) {
+    Job*   grown;
+    size_t length = 1;
+    int    number = 1;
+    int    i;
+
+    pthread_mutex_lock(&jobLock);
+    grown = (Job*) realloc(jobs, (jobCount + 1) * sizeof(Job));
+    if (grown == NULL) {
+        perror("realloc");
+        exit(1);
+    }
+    jobs = grown;
+
+    for (i = 0; i < jobCount; ++i) {
+        if (jobs[i].number >= number) {
+            number = jobs[i].number + 1;
+        }
+    }
+    for (i = 0; words[i] != NULL; ++i) {
+        length += strlen(words[i]) + 1;
+    }
+
+    jobs[jobCount].number = number;
+    jobs[jobCount].pid    = pid;
+    jobs[jobCount].done   = false;
+    jobs[jobCount].status = 0;
+    jobs[jobCount].text   = (char*) malloc(length);
+    if (jobs[jobCount].text == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    jobs[jobCount].text[0] = '\0';
+    for (i = 0; words[i] != NULL; ++i) {
+        if (i > 0) {
+            strcat(jobs[jobCount].text, " ");
+        }
+        strcat(jobs[jobCount].text, words[i]);
+    }
+    ++jobCount;
+    pthread_mutex_unlock(&jobLock);
+
+    return number;
+}
+
+/*
+ * jobsReap
+ *
+ * Collects the background jobs that have finished, printing a line for
+ * each if 'report' is true.
+ */
+void jobsReap(bool report) {
+    char status[64];
+    int  i = 0;
+
+    pthread_mutex_lock(&jobLock);
+    while (i < jobCount) {
+        collectJob(&jobs[i], WNOHANG);
+        if (!jobs[i].done) {
+            ++i;
+            continue;
+        }
+        if (report) {
+            describeStatus(jobs[i].status, status, sizeof(status));
+            printf("[%d] %s  %s\n", jobs[i].number, status, jobs[i].text);
+        }
+        removeJob(i);
+    }
+    pthread_mutex_unlock(&jobLock);
+}
+
+/**
+ * doAdmit
+ *
+ * Implements the 'admit' built-in, which sets the limits under which a
+ * background job is started or, with no arguments, shows them with the
+ * current readings.
+ *
+ * args - Pairs of a measure (cpu, memory, io or load) and its limit: the
+ *        percentage of time tasks stalled for cpu, memory and io, or the
+ *        runnable tasks per CPU for load.  A limit of 0 turns the check
+ *        off.
+ */
+int doAdmit(char** args, BuiltinIo* io) {
+    size_t count = sizeof(pressures) / sizeof(pressures[0]);
+    double limits[sizeof(pressures) / sizeof(pressures[0]) + 1];
+    double time = now();
+    double reading;
+    size_t j;
+    int    i;
+
+    if (args[1] == NULL) {
+        pthread_mutex_lock(&jobLock);
+        for (j = 0; j < count; ++j) {
+            if (!readPressure(&pressures[j], time, &reading)) {
+                builtinPrintf(io, "%-7s unavailable\n", pressures[j].name);
+            } else if (pressures[j].limit > 0) {
+                builtinPrintf(io, "%-7s %5.1f%%  (limit %g%%)\n",
+                              pressures[j].name, reading, pressures[j].limit);
+            } else {
+                builtinPrintf(io, "%-7s %5.1f%%  (off)\n", pressures[j].name,
+                              reading);
+            }
+        }
+        if (!readLoad(&reading)) {
+            builtinPrintf(io, "%-7s unavailable\n", "load");
+        } else if (loadLimit > 0) {
+            builtinPrintf(io, "%-7s %5.2f   (limit %g per CPU)\n", "load",
+                          reading, loadLimit);
+        } else {
+            builtinPrintf(io, "%-7s %5.2f   (off)\n", "load", reading);
+        }
+        pthread_mutex_unlock(&jobLock);
+        return 0;
+    }
+
+    /* Check every pair before changing anything */
+    pthread_mutex_lock(&jobLock);
+    for (j = 0; j < count; ++j) {
+        limits[j] = pressures[j].limit;
+    }
+    limits[count] = loadLimit;
+    pthread_mutex_unlock(&jobLock);
+
+    for (i = 1; args[i] != NULL; i += 2) {
+        char*  end;
+        double limit;
+
+        j = 0;
+        while (j < count && strcmp(args[i], pressures[j].name) != 0) {
+            ++j;
+        }
+        if (j == count && strcmp(args[i], "load") != 0) {
+            builtinError(io, "admit: unknown measure '%s'\n", args[i]);
+            return 1;
+        }
+        if (args[i + 1] == NULL) {
+            builtinError(io, "Usage: admit [cpu|memory|io|load limit]...\n");
+            return 1;
+        }
+        limit = strtod(args[i + 1], &end);
+        if (*end != '\0' || end == args[i + 1] || limit < 0) {
+            builtinError(io, "admit: bad limit '%s'\n", args[i + 1]);
+            return 1;
+        }
+        limits[j] = limit;
+    }
+
+    pthread_mutex_lock(&jobLock);
+    for (j = 0; j < count; ++j) {
+        pressures[j].limit = limits[j];
+    }
+    loadLimit = limits[count];
+    pthread_mutex_unlock(&jobLock);
+
+    return 0;
+}
+
+/**
+ * doWait
+ *
+ * Implements the 'wait' built-in, which waits for background jobs to
+ * finish.  Jobs waited for are not reported as done.
+ *
+ * args - The numbers of the jobs to wait for (n or %n); with none, every
+ *        job is waited for.
+ *
+ * Returns the exit status of the last job waited for.
+ */
+int doWait(char** args, BuiltinIo* io) {
+    int status = 0;
+    int i;
+
+    if (args[1] == NULL) {
+        for (;;) {
+            int number = 0;
+
+            pthread_mutex_lock(&jobLock);
+            if (jobCount > 0) {
+                number = jobs[0].number;
+            }
+            pthread_mutex_unlock(&jobLock);
+            if (number == 0) {
+                break;
+            }
+            status = waitForJob(number);
+        }
+        return status;
+    }
+
+    for (i = 1; args[i] != NULL; ++i) {
+        const char* digits = (args[i][0] == '%') ? args[i] + 1 : args[i];
+        char*       end;
+        long        number = strtol(digits, &end, 10);
+
+        status = -1;
+        if (*end == '\0' && end != digits && number > 0 && number <= INT_MAX) {
+            status = waitForJob((int) number);
+        }
+        if (status < 0) {
+            builtinError(io, "wait: %s: no such job\n", args[i]);
+            status = 127;
+        }
+    }
+
+    return status;
+}
+
+/*
+ * isAdmissible
+ *
+ * Returns true if every pressure is under its limit or, if there is no
+ * pressure information, the load is.  Takes a sample of each pressure.
+ * The caller holds 'jobLock'.
+ */
+static bool isAdmissible(void) {
+    double time       = now();
+    bool   measured   = false;
+    bool   admissible = true;
+    double reading;
+    size_t i;
+
+    for (i = 0; i < sizeof(pressures) / sizeof(pressures[0]); ++i) {
+        if (readPressure(&pressures[i], time, &reading)) {
+            measured = true;
+            if (pressures[i].limit > 0 && reading >= pressures[i].limit) {
+                admissible = false;
+            }
+        }
+    }
+    if (!measured && loadLimit > 0 && readLoad(&reading)
+            && reading >= loadLimit) {
+        admissible = false;
+    }
+
+    return admissible;
+}
+
+/*
+ * readPressure
+ *
+ * Reads one kind of pressure stall information and sets 'percent' to the
+ * higher of its ten-second average and its share of the time between the
+ * last two samples (see the top of this file).  Returns false if the
+ * kernel does not provide it.
+ */
+static bool readPressure(Pressure* pressure, double time, double* percent) {
+    char               buffer[256];
+    ssize_t            length;
+    double             average;
+    unsigned long long total;
+
+    if (pressure->fd == -1) {
+        pressure->fd = open(pressure->path, O_RDONLY | O_CLOEXEC);
+        if (pressure->fd < 0) {
+            pressure->fd = -2;
+        }
+    }
+    if (pressure->fd < 0) {
+        return false;
+    }
+
+    length = pread(pressure->fd, buffer, sizeof(buffer) - 1, 0);
+    if (length <= 0) {
+        return false;
+    }
+    buffer[length] = '\0';
+    if (sscanf(buffer, "some avg10=%lf avg60=%*f avg300=%*f total=%llu",
+               &average, &total) != 2) {
+        return false;
+    }
+
+    /* Samples closer together than ADMIT_INTERVAL are too noisy */
+    if (pressure->sampled == 0 || time - pressure->sampled >= ADMIT_INTERVAL) {
+        if (pressure->sampled > 0 && total >= pressure->total) {
+            pressure->recent = (total - pressure->total)
+                               / ((time - pressure->sampled) * 1e6) * 100;
+        }
+        pressure->total   = total;
+        pressure->sampled = time;
+    }
+
+    *percent = (pressure->recent > average) ? pressure->recent : average;
+    return true;
+}
+
+/*
+ * readLoad
+ *
+ * Sets 'load' to the runnable tasks per CPU: the number running now or
+ * the one-minute load average, whichever is higher.  Returns false if
+ * /proc/loadavg cannot be read.
+ */
+static bool readLoad(double* load) {
+    FILE*  file = fopen("/proc/loadavg", "re");
+    long   cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    double average;
+    int    running;
+    bool   read;
+
+    if (file == NULL) {
+        return false;
+    }
+    read = (fscanf(file, "%lf %*f %*f %d/", &average, &running) == 2);
+    fclose(file);
+    if (!read) {
+        return false;
+    }
+
+    /* The task reading the file is one of those running */
+    if (running - 1 > average) {
+        average = running - 1;
+    }
+    *load = average / ((cpus > 0) ? cpus : 1);
+    return true;
+}
+
+/*
+ * runningJobs
+ *
+ * Collects the jobs that have finished, and returns the number of those
+ * still running.  The caller holds 'jobLock'.
+ */
+static int runningJobs(void) {
+    int running = 0;
+    int i;
+
+    for (i = 0; i < jobCount; ++i) {
+        collectJob(&jobs[i], WNOHANG);
+        if (!jobs[i].done) {
+            ++running;
+        }
+    }
+
+    return running;
+}
+
+/*
+ * collectJob
+ *
+ * Waits for a job's process (with waitpid() 'options'), unless it is
+ * known to be done.
+ */
+static void collectJob(Job* job, int options) {
+    pid_t result;
+
+    if (job->done) {
+        return;
+    }
+    result = waitpid(job->pid, &job->status, options);
+    if (result == job->pid || (result < 0 && errno == ECHILD)) {
+        job->done = true;
+    }
+}
+
+/*
+ * waitForJob
+ *
+ * Waits for the job with the specified number and removes it.  Returns
+ * its exit status (128 plus the signal if it was killed), or -1 if there
+ * is no such job.
+ */
+static int waitForJob(int number) {
+    Job job;
+    int index;
+
+    /* Other threads may use the table while this one waits */
+    pthread_mutex_lock(&jobLock);
+    index = findJob(number);
+    if (index >= 0) {
+        job = jobs[index];
+    }
+    pthread_mutex_unlock(&jobLock);
+    if (index < 0) {
+        return -1;
+    }
+
+    collectJob(&job, 0);
+
+    pthread_mutex_lock(&jobLock);
+    index = findJob(number);
+    if (index >= 0) {
+        removeJob(index);
+    }
+    pthread_mutex_unlock(&jobLock);
+
+    return WIFSIGNALED(job.status) ? 128 + WTERMSIG(job.status)
+                                   : WEXITSTATUS(job.status);
+}
+
+/*
+ * findJob
+ *
+ * Returns the index of the job with the specified number, or -1.  The
+ * caller holds 'jobLock'.
+ */
+static int findJob(int number) {
+    int i;
+
+    for (i = 0; i < jobCount; ++i) {
+        if (jobs[i].number == number) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * removeJob
+ *
+ * Removes a job from the table.  The caller holds 'jobLock'.
+ */
+static void removeJob(int index) {
+    free(jobs[index].text);
+    memmove(&jobs[index], &jobs[index + 1],
+            (jobCount - index - 1) * sizeof(Job));
+    --jobCount;
+}
+
+/*
+ * describeStatus
+ *
+ * Describes how a job ended ("Done", "Exit 2", "Killed", ...).
+ */
+static void describeStatus(int status, char* text, size_t size) {
+    if (WIFSIGNALED(status)) {
+        snprintf(text, size, "%s", strsignal(WTERMSIG(status)));
+    } else if (WEXITSTATUS(status) != 0) {
+        snprintf(text, size, "Exit %d", WEXITSTATUS(status));
+    } else {
+        snprintf(text, size, "Done");
+    }
+}
+
+/*
+ * now
+ *
+ * Returns the monotonic time in seconds.
+ */
+static double now(void) {
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
@@ -0,0 +1,24 @@
+/*
+ * shellJobs.h
+ *
+ * Background jobs (p1 &) and the admission of new ones.  Before a job is
+ * started, jobAdmit() waits until the machine has room for it: the share
+ * of time tasks stalled on the CPU, memory and I/O (Linux pressure stall
+ * information, /proc/pressure) must be under the limits set with the
+ * 'admit' built-in.  Without pressure information, the number of
+ * runnable tasks per CPU (/proc/loadavg) is used instead.  A job is
+ * always admitted when none of the shell's jobs is running, so waiting
+ * never stalls the shell for good.
+ */
+#ifndef SHELL_JOBS_H
+#define SHELL_JOBS_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* Function prototypes */
+bool jobAdmit(void);
+int  jobAdd(pid_t pid, char** words);
+void jobsReap(bool report);
+
+#endif
@@ -0,0 +1,1172 @@
+/*
+ * shellLineEditor.c
+ *
+ * The line editor used when the shell reads commands from a terminal.
+ *
+ * The editor keeps a copy of what the terminal row shows.  After each
+ * batch of keys (a whole paste is one batch) it renders the row as it
+ * should look, finds the first column where the two differ, and sends
+ * only what is needed from there -- a cursor movement, the changed tail
+ * and, if the row got shorter, an erase -- in a single write().  Lines
+ * wider than the terminal scroll sideways instead of wrapping.  The
+ * prompt is redrawn the same way when its source signals that it changed.
+ *
+ * Keys (Emacs style):
+ *     Ctrl-A/Ctrl-E, Home/End      start/end of line
+ *     Ctrl-B/Ctrl-F, arrows        back/forward a character
+ *     Alt-B/Alt-F, Ctrl-arrows     back/forward a word
+ *     Backspace, Ctrl-D/Delete     delete before/at the cursor
+ *     Ctrl-K/Ctrl-U                kill to end/start of line
+ *     Ctrl-W, Alt-Backspace/Alt-D  kill the previous/next word
+ *     Ctrl-Y                       yank the last killed text
+ *     Ctrl-P/Ctrl-N, Up/Down       previous/next history entry
+ *     Ctrl-R                       reverse incremental history search
+ *     Tab                          complete a command name or path (a
+ *                                  second Tab lists the choices)
+ *     Ctrl-L                       clear the screen
+ *     Ctrl-C                       abandon the line
+ *     Ctrl-D on an empty line      end of input
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <termios.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include "shellCompletion.h"
+#include "shellHistory.h"
+#include "shellLineEditor.h"
+
+/* The code of a control key */
+#define CONTROL(key) ((key) & 0x1f)
+
+/* Width assumed when the terminal cannot say */
+#define DEFAULT_COLUMNS 80
+
+/* Longest escape sequence recognized */
+#define MAX_SEQUENCE_LENGTH 16
+
+/* More completions than this are counted instead of listed */
+#define MAX_LISTED_COMPLETIONS 256
+
+/* Characters that end a word being completed */
+#define WORD_BREAKS " \t|&;<>()`"
+
+/* Keys that arrive as escape sequences */
+typedef enum {
+    KEY_NONE = 256,
+    KEY_LEFT,
+    KEY_RIGHT,
+    KEY_UP,
+    KEY_DOWN,
+    KEY_HOME,
+    KEY_END,
+    KEY_DELETE,
+    KEY_WORD_LEFT,
+    KEY_WORD_RIGHT,
+    KEY_KILL_WORD,
+    KEY_RUBOUT_WORD
+} Key;
+
+/* What a key does to the edit */
+typedef enum {
+    EDIT_CONTINUE,
+    EDIT_ACCEPT,
+    EDIT_END_OF_INPUT
+} EditResult;
+
+/* A growable string */
+typedef struct {
+    char*  data;
+    size_t length;
+    size_t capacity;
+} Text;
+
+/* A line being edited */
+typedef struct {
+    Text        line;           /* The text being edited                 */
+    size_t      cursor;         /* Byte offset of the cursor in 'line'   */
+    size_t      scroll;         /* First byte shown of a too-wide line   */
+    const char* prompt;
+    const char* (*promptSource)(void);
+    int         promptFd;       /* Readable when the prompt changed      */
+    size_t      columns;        /* Width of the terminal                 */
+    Text        shown;          /* What the terminal row shows           */
+    size_t      shownCursor;    /* The column of the terminal's cursor   */
+    Text        next;           /* The row as it should look             */
+    Text        output;         /* Bytes for the next write()            */
+    char        sequence[MAX_SEQUENCE_LENGTH];
+    size_t      sequenceLength; /* Bytes of an escape sequence so far   */
+    int         lastKey;        /* The key handled before this one      */
+    long        historyIndex;   /* Entry shown; 'historyCount' is new    */
+    long        historyCount;
+    Text        saved;          /* The new line, while browsing history  */
+    bool        searching;      /* In a Ctrl-R search                    */
+    bool        searchFailed;
+    long        match;          /* Entry the search found, or -1         */
+    Text        query;
+    Text        beforeSearch;   /* The line when the search started      */
+    Text        searchPrompt;
+} Editor;
+
+/* Function prototypes */
+static ssize_t    runEditor(Editor* editor);
+static ssize_t    readKeys(Editor* editor, unsigned char* keys, size_t size);
+static EditResult handleByte(Editor* editor, unsigned char byte);
+static int        decodeSequence(const char* sequence, size_t length);
+static EditResult handleKey(Editor* editor, int key);
+static bool       handleSearchKey(Editor* editor, int key);
+static void       complete(Editor* editor, bool again);
+static void       listCompletions(Editor* editor,
+                                  const Completions* completions);
+static void       search(Editor* editor, long before);
+static void       stopSearch(Editor* editor, bool keep);
+static void       recallHistory(Editor* editor, long index);
+static void       insertText(Editor* editor, const char* text, size_t length);
+static void       deleteText(Editor* editor, size_t from, size_t to,
+                             bool kill);
+static size_t     previousChar(const Text* text, size_t position);
+static size_t     nextChar(const Text* text, size_t position);
+static size_t     previousWord(const Text* text, size_t position,
+                               bool spaceOnly);
+static size_t     nextWord(const Text* text, size_t position);
+static bool       isWordChar(char c, bool spaceOnly);
+static void       refresh(Editor* editor);
+static void       render(Editor* editor, size_t* cursorColumn);
+static void       renderChar(Text* row, unsigned char c);
+static size_t     charWidth(unsigned char c);
+static size_t     textWidth(const char* text, size_t length);
+static void       moveCursor(Editor* editor, size_t from, size_t to);
+static void       flushOutput(Editor* editor);
+static size_t     terminalColumns(void);
+static void       windowResized(int signo);
+static bool       setText(Text* text, const char* data, size_t length);
+static bool       appendText(Text* text, const char* data, size_t length);
+static bool       setEntry(Text* text, size_t index);
+
+/* The text last killed, for yanking (kept from line to line) */
+static Text killed;
+
+/* Set when the terminal changes size */
+static volatile sig_atomic_t resized = 0;
+
+/*
+ * editorUsable
+ *
+ * Returns true if commands are typed at a terminal the editor can drive.
+ */
+bool editorUsable(void) {
+    const char* term = getenv("TERM");
+
+    return isatty(STDIN_FILENO) && isatty(STDOUT_FILENO) && term != NULL
+           && strcmp(term, "dumb") != 0;
+}
+
+/*
+ * editLine
+ *
+ * Shows the prompt returned by 'prompt' and lets the user edit a line.
+ * If 'promptFd' is not -1, the prompt is fetched and redrawn again
+ * whenever that descriptor becomes readable (its data is read and
+ * discarded).  The line, with a newline added, is stored in '*line'
+ * (grown as needed, as getline() does).  Returns its length, or -1 at
+ * end of input.
+ */
+ssize_t editLine(const char* (*prompt)(void), int promptFd, char** line,
+                 size_t* capacity) {
+    static bool      handlerInstalled = false;
+    struct termios   original;
+    struct termios   raw;
+    Editor           editor;
+    ssize_t          length;
+
+    fflush(stdout);
+    if (tcgetattr(STDIN_FILENO, &original) < 0) {
+        fputs(prompt(), stdout);
+        fflush(stdout);
+        return getline(line, capacity, stdin);
+    }
+
+    /* Resizing interrupts read(), so the line is redrawn at once */
+    if (!handlerInstalled) {
+        struct sigaction action;
+
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = windowResized;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGWINCH, &action, NULL);
+        handlerInstalled = true;
+    }
+
+    raw = original;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_oflag &= ~OPOST;
+    raw.c_cflag |= CS8;
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN]  = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+    memset(&editor, 0, sizeof(editor));
+    editor.prompt       = prompt();
+    editor.promptSource = prompt;
+    editor.promptFd     = promptFd;
+    editor.columns      = terminalColumns();
+    editor.historyCount = historyCount();
+    editor.historyIndex = editor.historyCount;
+    editor.match        = -1;
+
+    length = runEditor(&editor);
+
+    tcsetattr(STDIN_FILENO, TCSANOW, &original);
+
+    if (length >= 0) {
+        if ((size_t) length + 2 > *capacity) {
+            char* grown = (char*) realloc(*line, length + 2);
+
+            if (grown == NULL) {
+                length = -1;
+            } else {
+                *line     = grown;
+                *capacity = length + 2;
+            }
+        }
+        if (length >= 0) {
+            memcpy(*line, editor.line.data, length);
+            (*line)[length++] = '\n';
+            (*line)[length]   = '\0';
+        }
+    }
+
+    free(editor.line.data);
+    free(editor.shown.data);
+    free(editor.next.data);
+    free(editor.output.data);
+    free(editor.saved.data);
+    free(editor.query.data);
+    free(editor.beforeSearch.data);
+    free(editor.searchPrompt.data);
+
+    return length;
+}
+
+/*
+ * runEditor
+ *
+ * Reads and applies keys until the line is accepted.  Returns the
+ * length of the line, or -1 at end of input.
+ *
+ * Keys are read one byte at a time, so that whatever follows the end of
+ * the line (typed ahead, or the rest of a paste) stays unread for the
+ * command, or the next line, to read.  The row is only redrawn once no
+ * more keys are waiting.
+ */
+static ssize_t runEditor(Editor* editor) {
+    appendText(&editor->output, "\r", 1);
+    refresh(editor);
+
+    for (;;) {
+        unsigned char key;
+        ssize_t       count = readKeys(editor, &key, 1);
+        EditResult    result;
+        int           waiting;
+
+        if (count < 0 && errno == EINTR) {
+            if (resized) {
+                /* Start the row again at the new width */
+                resized         = 0;
+                editor->columns = terminalColumns();
+                appendText(&editor->output, "\r\x1b[K", 4);
+                editor->shown.length = 0;
+                editor->shownCursor  = 0;
+                refresh(editor);
+            }
+            continue;
+        }
+        if (count <= 0) {
+            appendText(&editor->output, "\r\n", 2);
+            flushOutput(editor);
+            return -1;
+        }
+
+        result = handleByte(editor, key);
+        if (result == EDIT_ACCEPT) {
+            editor->cursor = editor->line.length;
+            refresh(editor);
+            appendText(&editor->output, "\r\n", 2);
+            flushOutput(editor);
+            return editor->line.length;
+        }
+        if (result == EDIT_END_OF_INPUT) {
+            appendText(&editor->output, "\r\n", 2);
+            flushOutput(editor);
+            return -1;
+        }
+
+        /* Leave the rest of a batch of keys to be applied first */
+        if (ioctl(STDIN_FILENO, FIONREAD, &waiting) < 0 || waiting == 0) {
+            refresh(editor);
+        }
+    }
+}
+
+/*
+ * readKeys
+ *
+ * Reads the keys typed, like read(), while watching for the prompt to
+ * change.  A new prompt is drawn at once, without waiting for a key.
+ */
+static ssize_t readKeys(Editor* editor, unsigned char* keys, size_t size) {
+    struct pollfd watched[2];
+
+    if (editor->promptFd < 0) {
+        return read(STDIN_FILENO, keys, size);
+    }
+
+    watched[0].fd     = STDIN_FILENO;
+    watched[0].events = POLLIN;
+    watched[1].fd     = editor->promptFd;
+    watched[1].events = POLLIN;
+    for (;;) {
+        if (poll(watched, 2, -1) < 0) {
+            return -1;
+        }
+        if (watched[1].revents & POLLIN) {
+            char discarded[64];
+
+            if (read(editor->promptFd, discarded, sizeof(discarded)) > 0) {
+                editor->prompt = editor->promptSource();
+                refresh(editor);
+            }
+        }
+        if (watched[0].revents != 0) {
+            return read(STDIN_FILENO, keys, size);
+        }
+    }
+}
+
+/*
+ * handleByte
+ *
+ * Applies one byte of input, collecting escape sequences until they are
+ * complete.
+ */
+static EditResult handleByte(Editor* editor, unsigned char byte) {
+    int key;
+
+    if (editor->sequenceLength == 0) {
+        if (byte != 0x1b) {
+            return handleKey(editor, byte);
+        }
+        editor->sequence[editor->sequenceLength++] = byte;
+        return EDIT_CONTINUE;
+    }
+
+    editor->sequence[editor->sequenceLength++] = byte;
+    if (editor->sequenceLength == 2 && (byte == '[' || byte == 'O')) {
+        return EDIT_CONTINUE;
+    }
+    if (editor->sequenceLength > 2 && editor->sequence[1] == '['
+            && (byte < 0x40 || byte > 0x7e)) {
+        /* A parameter byte; the sequence ends with a letter or '~' */
+        if (editor->sequenceLength == MAX_SEQUENCE_LENGTH) {
+            editor->sequenceLength = 0;
+        }
+        return EDIT_CONTINUE;
+    }
+
+    key = decodeSequence(editor->sequence, editor->sequenceLength);
+    editor->sequenceLength = 0;
+    return (key != KEY_NONE) ? handleKey(editor, key) : EDIT_CONTINUE;
+}
+
+/*
+ * decodeSequence
+ *
+ * Returns the key a complete escape sequence stands for, or KEY_NONE.
+ */
+static int decodeSequence(const char* sequence, size_t length) {
+    char final = sequence[length - 1];
+
+    if (length == 2) {
+        switch (final) {
+        case 'b':            return KEY_WORD_LEFT;
+        case 'f':            return KEY_WORD_RIGHT;
+        case 'd':            return KEY_KILL_WORD;
+        case 0x7f:
+        case CONTROL('H'):   return KEY_RUBOUT_WORD;
+        default:             return KEY_NONE;
+        }
+    }
+
+    /* A modifier (e.g., "\x1b[1;5C" for Ctrl-Right) makes arrows move by words */
+    if (memchr(sequence, ';', length) != NULL) {
+        return (final == 'C') ? KEY_WORD_RIGHT
+               : (final == 'D') ? KEY_WORD_LEFT : KEY_NONE;
+    }
+
+    switch (final) {
+    case 'A': return KEY_UP;
+    case 'B': return KEY_DOWN;
+    case 'C': return KEY_RIGHT;
+    case 'D': return KEY_LEFT;
+    case 'H': return KEY_HOME;
+    case 'F': return KEY_END;
+    case '~':
+        switch (atoi(sequence + 2)) {
+        case 1:
+        case 7:  return KEY_HOME;
+        case 4:
+        case 8:  return KEY_END;
+        case 3:  return KEY_DELETE;
+        default: return KEY_NONE;
+        }
+    default:  return KEY_NONE;
+    }
+}
+
+/*
+ * handleKey
+ *
+ * Applies one key (a byte, or a Key decoded from an escape sequence).
+ */
+static EditResult handleKey(Editor* editor, int key) {
+    Text*  line = &editor->line;
+    size_t cursor = editor->cursor;
+    int    lastKey = editor->lastKey;
+
+    editor->lastKey = key;
+    if (editor->searching && handleSearchKey(editor, key)) {
+        return EDIT_CONTINUE;
+    }
+
+    switch (key) {
+    case '\r':
+    case '\n':
+        return EDIT_ACCEPT;
+
+    case '\t':
+        complete(editor, lastKey == '\t');
+        break;
+
+    case CONTROL('A'):
+    case KEY_HOME:
+        editor->cursor = 0;
+        break;
+    case CONTROL('E'):
+    case KEY_END:
+        editor->cursor = line->length;
+        break;
+    case CONTROL('B'):
+    case KEY_LEFT:
+        editor->cursor = previousChar(line, cursor);
+        break;
+    case CONTROL('F'):
+    case KEY_RIGHT:
+        editor->cursor = nextChar(line, cursor);
+        break;
+    case KEY_WORD_LEFT:
+        editor->cursor = previousWord(line, cursor, false);
+        break;
+    case KEY_WORD_RIGHT:
+        editor->cursor = nextWord(line, cursor);
+        break;
+
+    case 0x7f:
+    case CONTROL('H'):
+        deleteText(editor, previousChar(line, cursor), cursor, false);
+        break;
+    case CONTROL('D'):
+        if (line->length == 0) {
+            return EDIT_END_OF_INPUT;
+        }
+        /* Fall through */
+    case KEY_DELETE:
+        deleteText(editor, cursor, nextChar(line, cursor), false);
+        break;
+
+    case CONTROL('K'):
+        deleteText(editor, cursor, line->length, true);
+        break;
+    case CONTROL('U'):
+        deleteText(editor, 0, cursor, true);
+        break;
+    case CONTROL('W'):
+        deleteText(editor, previousWord(line, cursor, true), cursor, true);
+        break;
+    case KEY_RUBOUT_WORD:
+        deleteText(editor, previousWord(line, cursor, false), cursor, true);
+        break;
+    case KEY_KILL_WORD:
+        deleteText(editor, cursor, nextWord(line, cursor), true);
+        break;
+    case CONTROL('Y'):
+        insertText(editor, killed.data, killed.length);
+        break;
+
+    case CONTROL('P'):
+    case KEY_UP:
+        recallHistory(editor, editor->historyIndex - 1);
+        break;
+    case CONTROL('N'):
+    case KEY_DOWN:
+        recallHistory(editor, editor->historyIndex + 1);
+        break;
+    case CONTROL('R'):
+        editor->searching    = true;
+        editor->searchFailed = false;
+        editor->match        = -1;
+        editor->query.length = 0;
+        setText(&editor->beforeSearch, line->data, line->length);
+        break;
+
+    case CONTROL('L'):
+        appendText(&editor->output, "\x1b[H\x1b[2J", 7);
+        editor->shown.length = 0;
+        editor->shownCursor  = 0;
+        break;
+    case CONTROL('C'):
+        /* Leave the abandoned line on the screen and start afresh */
+        editor->cursor = line->length;
+        refresh(editor);
+        appendText(&editor->output, "^C\r\n", 4);
+        editor->shown.length = 0;
+        editor->shownCursor  = 0;
+        editor->line.length  = 0;
+        editor->cursor       = 0;
+        editor->scroll       = 0;
+        editor->historyIndex = editor->historyCount;
+        break;
+
+    default:
+        /* Printable characters (and UTF-8 bytes) are typed in */
+        if (key >= ' ' && key < 0x7f) {
+            char c = (char) key;
+
+            insertText(editor, &c, 1);
+        } else if (key >= 0x80 && key < KEY_NONE) {
+            char c = (char) key;
+
+            insertText(editor, &c, 1);
+        }
+        break;
+    }
+
+    return EDIT_CONTINUE;
+}
+
+/*
+ * complete
+ *
+ * Completes the word before the cursor as far as the choices agree,
+ * adding a space (or nothing, after a directory) once there is only one.
+ * Rings the bell if nothing can be added, or lists the choices if 'again'
+ * (the previous key was also Tab).  The word is a command name if it
+ * starts a command.
+ */
+static void complete(Editor* editor, bool again) {
+    Text*       line = &editor->line;
+    size_t      start = editor->cursor;
+    size_t      before;
+    size_t      typed;
+    bool        command;
+    Completions completions;
+    const char* name;
+
+    while (start > 0 && strchr(WORD_BREAKS, line->data[start - 1]) == NULL) {
+        --start;
+    }
+    before = start;
+    while (before > 0
+           && (line->data[before - 1] == ' ' || line->data[before - 1] == '\t')) {
+        --before;
+    }
+    command = (before == 0 || strchr("|&;(`", line->data[before - 1]) != NULL);
+
+    completeWord(line->data + start, editor->cursor - start, command,
+                 &completions);
+    if (completions.count == 0) {
+        appendText(&editor->output, "\a", 1);
+        return;
+    }
+
+    typed = editor->cursor - start - completions.start;
+    name  = completions.names[0];
+    if (completions.count == 1) {
+        size_t length = strlen(name);
+
+        insertText(editor, name + typed, length - typed);
+        if (name[length - 1] != '/') {
+            insertText(editor, " ", 1);
+        }
+    } else if (completions.common > typed) {
+        insertText(editor, name + typed, completions.common - typed);
+    } else if (again) {
+        listCompletions(editor, &completions);
+    } else {
+        appendText(&editor->output, "\a", 1);
+    }
+}
+
+/*
+ * listCompletions
+ *
+ * Lists the choices below the line, in columns (down, then across) as ls
+ * does, and starts the line again below them.
+ */
+static void listCompletions(Editor* editor, const Completions* completions) {
+    char   count[64];
+    size_t width = 0;
+    size_t perRow;
+    size_t rows;
+    size_t row;
+    size_t i;
+
+    /* Leave the whole line on the screen */
+    i = editor->cursor;
+    editor->cursor = editor->line.length;
+    refresh(editor);
+    editor->cursor = i;
+    appendText(&editor->output, "\r\n", 2);
+
+    if (completions->count > MAX_LISTED_COMPLETIONS) {
+        snprintf(count, sizeof(count), "(%zu choices)\r\n",
+                 completions->count);
+        appendText(&editor->output, count, strlen(count));
+    } else {
+        for (i = 0; i < completions->count; ++i) {
+            size_t nameWidth = textWidth(completions->names[i],
+                                         strlen(completions->names[i]));
+
+            if (nameWidth + 2 > width) {
+                width = nameWidth + 2;
+            }
+        }
+        perRow = (editor->columns > width) ? editor->columns / width : 1;
+        rows   = (completions->count + perRow - 1) / perRow;
+
+        for (row = 0; row < rows; ++row) {
+            for (i = row; i < completions->count; i += rows) {
+                const char* name = completions->names[i];
+                size_t      length = strlen(name);
+
+                appendText(&editor->output, name, length);
+                if (i + rows < completions->count) {
+                    size_t pad = width - textWidth(name, length);
+
+                    while (pad-- > 0) {
+                        appendText(&editor->output, " ", 1);
+                    }
+                }
+            }
+            appendText(&editor->output, "\r\n", 2);
+        }
+    }
+
+    editor->shown.length = 0;
+    editor->shownCursor  = 0;
+}
+
+/*
+ * handleSearchKey
+ *
+ * Applies a key during a Ctrl-R search.  Returns false if the key ends
+ * the search and should then be handled as usual (e.g., Enter runs the
+ * line found).
+ */
+static bool handleSearchKey(Editor* editor, int key) {
+    if ((key >= ' ' && key < 0x7f) || (key >= 0x80 && key < KEY_NONE)) {
+        char c = (char) key;
+
+        appendText(&editor->query, &c, 1);
+        search(editor, (editor->match >= 0) ? editor->match + 1 : -1);
+        return true;
+    }
+
+    switch (key) {
+    case 0x7f:
+    case CONTROL('H'):
+        editor->query.length = previousChar(&editor->query,
+                                            editor->query.length);
+        search(editor, -1);
+        return true;
+    case CONTROL('R'):
+        if (editor->match >= 0) {
+            search(editor, editor->match);
+        }
+        return true;
+    case CONTROL('G'):
+    case CONTROL('C'):
+        stopSearch(editor, false);
+        return true;
+    default:
+        stopSearch(editor, true);
+        return false;
+    }
+}
+
+/*
+ * search
+ *
+ * Finds the newest entry before 'before' (or the end, if negative)
+ * containing the query, and shows it with the cursor on the match.
+ */
+static void search(Editor* editor, long before) {
+    long        match;
+    const char* found;
+
+    if (editor->query.length == 0) {
+        editor->match        = -1;
+        editor->searchFailed = false;
+        return;
+    }
+
+    appendText(&editor->query, "", 1);
+    --editor->query.length;
+    match = historySearch(editor->query.data, before);
+    if (match < 0 || !setEntry(&editor->line, match)) {
+        editor->searchFailed = true;
+        return;
+    }
+
+    editor->searchFailed = false;
+    editor->match        = match;
+    found = (const char*) memmem(editor->line.data, editor->line.length,
+                                 editor->query.data, editor->query.length);
+    editor->cursor = (found != NULL) ? (size_t) (found - editor->line.data)
+                                     : 0;
+}
+
+/*
+ * stopSearch
+ *
+ * Ends a Ctrl-R search, keeping the line found or going back to the line
+ * as it was.
+ */
+static void stopSearch(Editor* editor, bool keep) {
+    editor->searching = false;
+    if (!keep || editor->match < 0) {
+        setText(&editor->line, editor->beforeSearch.data,
+                editor->beforeSearch.length);
+        editor->cursor = editor->line.length;
+    }
+}
+
+/*
+ * recallHistory
+ *
+ * Replaces the line with history entry 'index' (or, one past the newest,
+ * the line that was being typed).
+ */
+static void recallHistory(Editor* editor, long index) {
+    if (index < 0 || index > editor->historyCount) {
+        return;
+    }
+    if (editor->historyIndex == editor->historyCount) {
+        setText(&editor->saved, editor->line.data, editor->line.length);
+    }
+
+    if (index == editor->historyCount) {
+        setText(&editor->line, editor->saved.data, editor->saved.length);
+    } else if (!setEntry(&editor->line, index)) {
+        return;
+    }
+    editor->historyIndex = index;
+    editor->cursor       = editor->line.length;
+}
+
+/*
+ * insertText
+ *
+ * Inserts text at the cursor and moves the cursor past it.
+ */
+static void insertText(Editor* editor, const char* text, size_t length) {
+    Text* line = &editor->line;
+
+    if (length == 0 || !appendText(line, text, length)) {
+        return;
+    }
+    /* appendText() put it at the end; move it to the cursor */
+    memmove(line->data + editor->cursor + length,
+            line->data + editor->cursor,
+            line->length - length - editor->cursor);
+    memcpy(line->data + editor->cursor, text, length);
+    editor->cursor += length;
+}
+
+/*
+ * deleteText
+ *
+ * Deletes bytes [from, to) of the line, saving them for Ctrl-Y if 'kill'
+ * is true, and leaves the cursor at 'from'.
+ */
+static void deleteText(Editor* editor, size_t from, size_t to, bool kill) {
+    Text* line = &editor->line;
+
+    if (from >= to) {
+        return;
+    }
+    if (kill) {
+        setText(&killed, line->data + from, to - from);
+    }
+    memmove(line->data + from, line->data + to, line->length - to);
+    line->length  -= to - from;
+    editor->cursor = from;
+}
+
+/*
+ * previousChar, nextChar
+ *
+ * Step over one (UTF-8) character.
+ */
+static size_t previousChar(const Text* text, size_t position) {
+    while (position > 0
+           && (text->data[--position] & 0xC0) == 0x80) {
+    }
+    return position;
+}
+
+static size_t nextChar(const Text* text, size_t position) {
+    if (position < text->length) {
+        ++position;
+    }
+    while (position < text->length
+           && (text->data[position] & 0xC0) == 0x80) {
+        ++position;
+    }
+    return position;
+}
+
+/*
+ * previousWord
+ *
+ * Returns the start of the word before 'position'.  Words are runs of
+ * letters and digits, or (for Ctrl-W) of anything but white space.
+ */
+static size_t previousWord(const Text* text, size_t position,
+                           bool spaceOnly) {
+    while (position > 0 && !isWordChar(text->data[position - 1], spaceOnly)) {
+        --position;
+    }
+    while (position > 0 && isWordChar(text->data[position - 1], spaceOnly)) {
+        --position;
+    }
+    return position;
+}
+
+/*
+ * nextWord
+ *
+ * Returns the end of the word at or after 'position'.
+ */
+static size_t nextWord(const Text* text, size_t position) {
+    while (position < text->length
+           && !isWordChar(text->data[position], false)) {
+        ++position;
+    }
+    while (position < text->length
+           && isWordChar(text->data[position], false)) {
+        ++position;
+    }
+    return position;
+}
+
+/*
+ * isWordChar
+ *
+ * Returns true if 'c' belongs to a word: a letter, a digit or part of a
+ * multibyte character, or (if 'spaceOnly') anything but white space.
+ */
+static bool isWordChar(char c, bool spaceOnly) {
+    if (spaceOnly) {
+        return c != ' ' && c != '\t';
+    }
+    return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z')
+           || (unsigned char) c >= 0x80;
+}
+
+/*
+ * refresh
+ *
+ * Brings the terminal row up to date, sending only what changed.
+ */
+static void refresh(Editor* editor) {
+    Text   swap;
+    size_t column;
+    size_t same = 0;
+    size_t end;
+
+    render(editor, &column);
+
+    /* The first byte (of a whole character) that differs */
+    while (same < editor->shown.length && same < editor->next.length
+           && editor->shown.data[same] == editor->next.data[same]) {
+        ++same;
+    }
+    while (same > 0 && (editor->next.data[same] & 0xC0) == 0x80) {
+        --same;
+    }
+
+    end = editor->shownCursor;
+    if (same < editor->shown.length || same < editor->next.length) {
+        size_t shownWidth = textWidth(editor->shown.data,
+                                      editor->shown.length);
+
+        moveCursor(editor, editor->shownCursor,
+                   textWidth(editor->next.data, same));
+        appendText(&editor->output, editor->next.data + same,
+                   editor->next.length - same);
+        end = textWidth(editor->next.data, editor->next.length);
+        if (shownWidth > end) {
+            appendText(&editor->output, "\x1b[K", 3);
+        }
+    }
+    moveCursor(editor, end, column);
+
+    swap                = editor->shown;
+    editor->shown       = editor->next;
+    editor->next        = swap;
+    editor->shownCursor = column;
+
+    flushOutput(editor);
+}
+
+/*
+ * render
+ *
+ * Builds the row as it should look in 'editor->next' -- the prompt (or
+ * the search prompt) and as much of the line as fits, scrolled to keep
+ * the cursor in view -- and stores the cursor's column.  Control
+ * characters are shown as ^X.
+ */
+static void render(Editor* editor, size_t* cursorColumn) {
+    Text*       row = &editor->next;
+    Text*       line = &editor->line;
+    const char* prompt = editor->prompt;
+    size_t      available;
+    size_t      width;
+    size_t      i;
+
+    if (editor->searching) {
+        editor->searchPrompt.length = 0;
+        appendText(&editor->searchPrompt, editor->searchFailed
+                                          ? "(failed reverse-i-search)`"
+                                          : "(reverse-i-search)`",
+                   editor->searchFailed ? 26 : 19);
+        appendText(&editor->searchPrompt, editor->query.data,
+                   editor->query.length);
+        appendText(&editor->searchPrompt, "': ", 4);
+        prompt = editor->searchPrompt.data;
+    }
+
+    row->length = 0;
+    appendText(row, prompt, strlen(prompt));
+    width     = textWidth(row->data, row->length);
+    available = (editor->columns > width + 2) ? editor->columns - width - 1
+                                              : 1;
+
+    /* Scroll just enough to keep the cursor in view */
+    if (editor->cursor < editor->scroll
+            || textWidth(line->data, editor->cursor) < available) {
+        editor->scroll = (editor->cursor < editor->scroll
+                          && textWidth(line->data, editor->cursor)
+                             >= available) ? editor->cursor : 0;
+    }
+    while (editor->scroll < editor->cursor
+           && textWidth(line->data + editor->scroll,
+                        editor->cursor - editor->scroll) >= available) {
+        editor->scroll = nextChar(line, editor->scroll);
+    }
+
+    *cursorColumn = width;
+    for (i = editor->scroll; i < line->length; ++i) {
+        unsigned char c = line->data[i];
+
+        if (i == editor->cursor) {
+            *cursorColumn = width;
+        }
+        if (width + charWidth(c) > editor->columns - 1) {
+            break;
+        }
+        renderChar(row, c);
+        width += charWidth(c);
+    }
+    if (i == editor->cursor) {
+        *cursorColumn = width;
+    }
+}
+
+/*
+ * renderChar
+ *
+ * Adds one byte of the line to a row, showing control characters as ^X.
+ */
+static void renderChar(Text* row, unsigned char c) {
+    char shown[2];
+
+    if (c < ' ' || c == 0x7f) {
+        shown[0] = '^';
+        shown[1] = c ^ 0x40;
+        appendText(row, shown, 2);
+    } else {
+        shown[0] = c;
+        appendText(row, shown, 1);
+    }
+}
+
+/*
+ * charWidth
+ *
+ * Returns the number of columns a byte of the line takes: 2 for a
+ * control character (^X), 0 for a UTF-8 continuation byte, 1 otherwise.
+ */
+static size_t charWidth(unsigned char c) {
+    if (c < ' ' || c == 0x7f) {
+        return 2;
+    }
+    return ((c & 0xC0) == 0x80) ? 0 : 1;
+}
+
+/*
+ * textWidth
+ *
+ * Returns the number of columns some text takes.
+ */
+static size_t textWidth(const char* text, size_t length) {
+    size_t width = 0;
+    size_t i;
+
+    for (i = 0; i < length; ++i) {
+        width += charWidth(text[i]);
+    }
+    return width;
+}
+
+/*
+ * moveCursor
+ *
+ * Queues the escape sequence moving the cursor between two columns.
+ */
+static void moveCursor(Editor* editor, size_t from, size_t to) {
+    char sequence[32];
+    int  length = 0;
+
+    if (to + 1 == from) {
+        length = snprintf(sequence, sizeof(sequence), "\b");
+    } else if (to < from) {
+        length = snprintf(sequence, sizeof(sequence), "\x1b[%zuD", from - to);
+    } else if (to > from) {
+        length = snprintf(sequence, sizeof(sequence), "\x1b[%zuC", to - from);
+    }
+    appendText(&editor->output, sequence, length);
+}
+
+/*
+ * flushOutput
+ *
+ * Sends the queued output to the terminal in one write().
+ */
+static void flushOutput(Editor* editor) {
+    size_t written = 0;
+
+    while (written < editor->output.length) {
+        ssize_t count = write(STDOUT_FILENO, editor->output.data + written,
+                              editor->output.length - written);
+
+        if (count < 0 && errno != EINTR) {
+            break;
+        }
+        if (count > 0) {
+            written += count;
+        }
+    }
+    editor->output.length = 0;
+}
+
+/*
+ * terminalColumns
+ *
+ * Returns the width of the terminal.
+ */
+static size_t terminalColumns(void) {
+    struct winsize size;
+
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) < 0 || size.ws_col == 0) {
+        return DEFAULT_COLUMNS;
+    }
+    return size.ws_col;
+}
+
+/*
+ * windowResized
+ *
+ * Handles SIGWINCH: the editor redraws once read() is interrupted.
+ */
+static void windowResized(int signo) {
+    (void) signo;
+    resized = 1;
+}
+
+/*
+ * setText, appendText
+ *
+ * Replace or extend a Text, growing it as needed.  They return false if
+ * memory ran out (leaving the text unchanged).
+ */
+static bool setText(Text* text, const char* data, size_t length) {
+    text->length = 0;
+    return appendText(text, data, length);
+}
+
+static bool appendText(Text* text, const char* data, size_t length) {
+    if (text->length + length + 1 > text->capacity) {
+        size_t capacity = (text->length + length + 1) * 2;
+        char*  grown = (char*) realloc(text->data, capacity);
+
+        if (grown == NULL) {
+            return false;
+        }
+        text->data     = grown;
+        text->capacity = capacity;
+    }
+    if (length > 0) {
+        memmove(text->data + text->length, data, length);
+    }
+    text->length += length;
+    text->data[text->length] = '\0';
+
+    return true;
+}
+
+/*
+ * setEntry
+ *
+ * Replaces a Text by history entry 'index'.  Returns false if there is no
+ * such entry or memory ran out (leaving the text unchanged).
+ */
+static bool setEntry(Text* text, size_t index) {
+    Text    entry  = { NULL, 0, 0 };
+    ssize_t length = historyEntry(index, NULL, 0);
+    bool    loaded;
+
+    /* The entry is copied under the history's lock: size, then copy */
+    while (length >= 0 && (size_t) length + 1 > entry.capacity) {
+        char* grown = (char*) realloc(entry.data, length + 1);
+
+        if (grown == NULL) {
+            length = -1;
+            break;
+        }
+        entry.data     = grown;
+        entry.capacity = length + 1;
+        length         = historyEntry(index, entry.data, entry.capacity);
+    }
+
+    loaded = (length >= 0 && setText(text, entry.data, length));
+    free(entry.data);
+    return loaded;
+}
@@ -0,0 +1,19 @@
+/*
+ * shellLineEditor.h
+ *
+ * An Emacs-style line editor for reading commands from a terminal:
+ * cursor movement, history recall and reverse search, and kill/yank.
+ * The terminal is in raw mode only while a line is being edited.
+ */
+#ifndef SHELL_LINE_EDITOR_H
+#define SHELL_LINE_EDITOR_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* Function prototypes */
+bool    editorUsable(void);
+ssize_t editLine(const char* (*prompt)(void), int promptFd, char** line,
+                 size_t* capacity);
+
+#endif
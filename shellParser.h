@@ -11,10 +11,26 @@
 #ifndef SHELL_PARSER_H
 #define SHELL_PARSER_H
 
+#include <stddef.h>
+
+/* Initial capacity of the argument list; it grows as needed */
 #define MAX_ARGS           256
 #define MAX_STRING_LENGTH 1024
 
+/* The kinds of token reported by getArgKind() */
+#define TOKEN_WORD            0 /* An ordinary (possibly quoted) word      */
+#define TOKEN_COMMAND_SUB     1 /* The text inside $(...) or `...`         */
+#define TOKEN_OPERATOR        2 /* An unquoted redirection, '|', ';', '&' */
+#define TOKEN_PROCESS_SUB_IN  3 /* The text inside <(...)                  */
+#define TOKEN_PROCESS_SUB_OUT 4 /* The text inside >(...)                  */
+
 /* Function prototypes */
 char** getArgList(void);
+char** getArgListFromString(const char* text);
+char** getArgListFromTokens(char* const* tokens, const char* kinds);
+int    getArgKind(int index);
+
+/* Supplied by the shell: reads up to a line of standard input */
+size_t readInput(char* buffer, size_t size);
 
 #endif
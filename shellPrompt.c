@@ -0,0 +1,532 @@
+/*
+ * shellPrompt.c
+ *
+ * The prompt and the 'prompt' built-in that sets its format.
+ *
+ * The git branch is the one segment that touches the file system more
+ * than once (it walks up from the working directory looking for .git),
+ * so it is never computed while the prompt is shown.  Instead the prompt
+ * uses the branch cached for the directory, if any, and asks the worker
+ * thread to bring the cache up to date.  For a directory already in the
+ * cache the worker only has to stat() the HEAD file it found before; if
+ * the branch turns out to have changed, it writes to an eventfd that the
+ * line editor watches, and the editor redraws the prompt.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "shellBuiltins.h"
+#include "shellPrompt.h"
+
+/* The format used until the 'prompt' built-in sets another */
+#define DEFAULT_FORMAT "(%p) $ "
+
+/* Longest prompt shown (longer ones are cut short) */
+#define PROMPT_SIZE (PATH_MAX + 256)
+
+/* Number of directories whose git branch is cached */
+#define BRANCH_CACHE_SIZE 16
+
+/* The git branch of a directory, as last found by the worker */
+typedef struct {
+    char*           directory;
+    char*           branch;      /* NULL if not in a git repository       */
+    char*           headPath;    /* The HEAD file the branch came from    */
+    struct timespec headModified;
+    unsigned long   used;        /* When the prompt last showed it        */
+} BranchEntry;
+
+/* Function prototypes */
+static void         appendPrompt(char* prompt, size_t* length,
+                                 const char* text, size_t textLength);
+static void         appendBranch(char* prompt, size_t* length,
+                                 const char* directory);
+static void         formatDuration(char* text, size_t size, double seconds);
+static BranchEntry* findEntry(const char* directory);
+static void*        branchWorker(void* unused);
+static void         updateBranch(const char* directory);
+static char*        findHead(const char* directory);
+static char*        readBranch(const char* headPath);
+
+/* Protects everything below (the 'prompt' built-in may run on a thread) */
+static pthread_mutex_t promptLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  workReady  = PTHREAD_COND_INITIALIZER;
+
+static char*         format        = NULL;
+static int           lastStatus    = 0;
+static double        lastDuration  = 0;
+static BranchEntry   branches[BRANCH_CACHE_SIZE];
+static unsigned long promptCount   = 0;
+static char*         requested     = NULL;  /* Directory for the worker */
+static bool          workerStarted = false;
+static int           updateFd      = -1;
+
+/*
+ * promptInit
+ *
+ * Starts the worker that finds git branches.  Without it (or the eventfd
+ * it signals) the prompt simply shows no branch.
+ */
+void promptInit(void) {
+    pthread_attr_t attributes;
+    pthread_t      worker;
+    sigset_t       allSignals;
+    sigset_t       oldSignals;
+
+    updateFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (updateFd < 0) {
+        return;
+    }
+
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+
+    /* Signals are for the main thread, whose read() or sleep they end */
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_BLOCK, &allSignals, &oldSignals);
+    workerStarted = (pthread_create(&worker, &attributes, branchWorker,
+                                    NULL) == 0);
+    pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+    pthread_attr_destroy(&attributes);
+}
+
+/*
+ * promptText
+ *
+ * Returns the prompt to show now.  It is valid until the next call.
+ *
+ * The format may contain:
+ *     %p  the shell's process ID        %?  the last command's status
+ *     %w  the working directory         %t  how long it ran
+ *     %W  its last component            %b  the git branch
+ *     %%  a '%'
+ */
+const char* promptText(void) {
+    static char  prompt[PROMPT_SIZE];
+    char         directory[PATH_MAX];
+    char         segment[64];
+    const char*  home = getenv("HOME");
+    const char*  next;
+    size_t       length = 0;
+    size_t       homeLength;
+
+    if (getcwd(directory, sizeof(directory)) == NULL) {
+        strcpy(directory, "?");
+    }
+
+    pthread_mutex_lock(&promptLock);
+    ++promptCount;
+    for (next = (format != NULL) ? format : DEFAULT_FORMAT; *next != '\0';
+         ++next) {
+        if (*next != '%' || next[1] == '\0') {
+            appendPrompt(prompt, &length, next, 1);
+            continue;
+        }
+
+        switch (*++next) {
+        case 'p':
+            snprintf(segment, sizeof(segment), "%d", (int) getpid());
+            appendPrompt(prompt, &length, segment, strlen(segment));
+            break;
+        case 'w':
+            /* The home directory is shown as ~ */
+            homeLength = (home != NULL) ? strlen(home) : 0;
+            if (homeLength > 1 && strncmp(directory, home, homeLength) == 0
+                    && (directory[homeLength] == '/'
+                        || directory[homeLength] == '\0')) {
+                appendPrompt(prompt, &length, "~", 1);
+                appendPrompt(prompt, &length, directory + homeLength,
+                             strlen(directory + homeLength));
+            } else {
+                appendPrompt(prompt, &length, directory, strlen(directory));
+            }
+            break;
+        case 'W':
+            if (strcmp(directory, "/") == 0) {
+                appendPrompt(prompt, &length, "/", 1);
+            } else {
+                const char* last = strrchr(directory, '/');
+
+                last = (last != NULL) ? last + 1 : directory;
+                appendPrompt(prompt, &length, last, strlen(last));
+            }
+            break;
+        case '?':
+            snprintf(segment, sizeof(segment), "%d", lastStatus);
+            appendPrompt(prompt, &length, segment, strlen(segment));
+            break;
+        case 't':
+            formatDuration(segment, sizeof(segment), lastDuration);
+            appendPrompt(prompt, &length, segment, strlen(segment));
+            break;
+        case 'b':
+            appendBranch(prompt, &length, directory);
+            break;
+        default:
+            appendPrompt(prompt, &length, next, 1);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&promptLock);
+
+    prompt[length] = '\0';
+    return prompt;
+}
+
+/*
+ * promptUpdateFd
+ *
+ * Returns a descriptor that becomes readable when the prompt last
+ * returned by promptText() is out of date, or -1 if it never will be.
+ * Reading it (8 bytes) resets it.
+ */
+int promptUpdateFd(void) {
+    return workerStarted ? updateFd : -1;
+}
+
+/*
+ * promptCommandDone
+ *
+ * Records the wait status of the command just run and how long it took,
+ * for the %? and %t segments.
+ */
+void promptCommandDone(int status, double seconds) {
+    pthread_mutex_lock(&promptLock);
+    if (WIFSIGNALED(status)) {
+        lastStatus = 128 + WTERMSIG(status);
+    } else {
+        lastStatus = WEXITSTATUS(status);
+    }
+    lastDuration = seconds;
+    pthread_mutex_unlock(&promptLock);
+}
+
+/**
+ * doPrompt
+ *
+ * Implements the 'prompt' built-in: sets the format of the prompt (see
+ * promptText()) or, with no argument, prints it.
+ *
+ * args - args[1] is the new format.
+ */
+int doPrompt(char** args, BuiltinIo* io) {
+    char* copy;
+
+    if (args[1] == NULL) {
+        pthread_mutex_lock(&promptLock);
+        copy = strdup((format != NULL) ? format : DEFAULT_FORMAT);
+        pthread_mutex_unlock(&promptLock);
+        if (copy == NULL) {
+            builtinError(io, "prompt: out of memory\n");
+            return 1;
+        }
+        builtinPrintf(io, "%s\n", copy);
+        free(copy);
+        return 0;
+    }
+    if (args[2] != NULL) {
+        builtinError(io, "Usage: prompt [format]\n");
+        return 1;
+    }
+
+    copy = strdup(args[1]);
+    if (copy == NULL) {
+        builtinError(io, "prompt: out of memory\n");
+        return 1;
+    }
+    pthread_mutex_lock(&promptLock);
+    free(format);
+    format = copy;
+    pthread_mutex_unlock(&promptLock);
+
+    return 0;
+}
+
+/*
+ * appendPrompt
+ *
+ * Adds text to the prompt, as much as fits.
+ */
+static void appendPrompt(char* prompt, size_t* length, const char* text,
+                         size_t textLength) {
+    if (textLength > PROMPT_SIZE - 1 - *length) {
+        textLength = PROMPT_SIZE - 1 - *length;
+    }
+    memcpy(prompt + *length, text, textLength);
+    *length += textLength;
+}
+
+/*
+ * appendBranch
+ *
+ * Adds the cached git branch of a directory to the prompt, and asks the
+ * worker to check it.  Called with 'promptLock' held.
+ */
+static void appendBranch(char* prompt, size_t* length,
+                         const char* directory) {
+    BranchEntry* entry = findEntry(directory);
+
+    if (entry != NULL) {
+        entry->used = promptCount;
+        if (entry->branch != NULL) {
+            appendPrompt(prompt, length, entry->branch,
+                         strlen(entry->branch));
+        }
+    }
+
+    if (workerStarted
+            && (requested == NULL || strcmp(requested, directory) != 0)) {
+        free(requested);
+        requested = strdup(directory);
+        pthread_cond_signal(&workReady);
+    }
+}
+
+/*
+ * formatDuration
+ *
+ * Formats a duration for the %t segment (e.g., 0.25s, 12.5s, 3m07s).
+ */
+static void formatDuration(char* text, size_t size, double seconds) {
+    long whole = (long) seconds;
+
+    if (seconds < 10) {
+        snprintf(text, size, "%.2fs", seconds);
+    } else if (seconds < 60) {
+        snprintf(text, size, "%.1fs", seconds);
+    } else if (whole < 3600) {
+        snprintf(text, size, "%ldm%02lds", whole / 60, whole % 60);
+    } else {
+        snprintf(text, size, "%ldh%02ldm", whole / 3600, whole / 60 % 60);
+    }
+}
+
+/*
+ * findEntry
+ *
+ * Returns the cache entry for a directory, or NULL.  Called with
+ * 'promptLock' held.
+ */
+static BranchEntry* findEntry(const char* directory) {
+    size_t i;
+
+    for (i = 0; i < BRANCH_CACHE_SIZE; ++i) {
+        if (branches[i].directory != NULL
+                && strcmp(branches[i].directory, directory) == 0) {
+            return &branches[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * branchWorker
+ *
+ * The worker thread: brings the cache entry of each directory the prompt
+ * asks about up to date.
+ */
+static void* branchWorker(void* unused) {
+    (void) unused;
+
+    for (;;) {
+        char* directory;
+
+        pthread_mutex_lock(&promptLock);
+        while (requested == NULL) {
+            pthread_cond_wait(&workReady, &promptLock);
+        }
+        directory = requested;
+        requested = NULL;
+        pthread_mutex_unlock(&promptLock);
+
+        updateBranch(directory);
+        free(directory);
+    }
+
+    return NULL;
+}
+
+/*
+ * updateBranch
+ *
+ * Finds the git branch of a directory and caches it, signalling the
+ * editor if it is not what the prompt showed.  If the directory is
+ * cached, only the HEAD file it used is checked with stat(); the
+ * directory tree is searched again only if that file changed or went
+ * away.
+ */
+static void updateBranch(const char* directory) {
+    BranchEntry*    entry;
+    struct stat     info;
+    struct timespec modified = { 0, 0 };
+    char*           headPath = NULL;
+    char*           branch = NULL;
+    bool            changed;
+    size_t          i;
+
+    pthread_mutex_lock(&promptLock);
+    entry = findEntry(directory);
+    if (entry != NULL && entry->headPath != NULL) {
+        headPath = strdup(entry->headPath);
+        modified = entry->headModified;
+    }
+    pthread_mutex_unlock(&promptLock);
+
+    /* The common case: the HEAD file has not changed */
+    if (headPath != NULL) {
+        if (stat(headPath, &info) == 0
+                && info.st_mtim.tv_sec == modified.tv_sec
+                && info.st_mtim.tv_nsec == modified.tv_nsec) {
+            free(headPath);
+            return;
+        }
+        free(headPath);
+    }
+
+    headPath = findHead(directory);
+    if (headPath != NULL && stat(headPath, &info) == 0) {
+        modified = info.st_mtim;
+        branch   = readBranch(headPath);
+    }
+
+    pthread_mutex_lock(&promptLock);
+    entry = findEntry(directory);
+    if (entry == NULL) {
+        /* Replace the least recently shown entry */
+        entry = &branches[0];
+        for (i = 1; i < BRANCH_CACHE_SIZE; ++i) {
+            if (branches[i].used < entry->used) {
+                entry = &branches[i];
+            }
+        }
+        free(entry->directory);
+        free(entry->branch);
+        free(entry->headPath);
+        memset(entry, 0, sizeof(BranchEntry));
+        entry->directory = strdup(directory);
+        entry->used      = promptCount;
+        changed = (branch != NULL);
+    } else {
+        changed = (entry->branch == NULL) != (branch == NULL)
+                  || (branch != NULL && strcmp(entry->branch, branch) != 0);
+        free(entry->branch);
+        free(entry->headPath);
+    }
+    entry->branch       = branch;
+    entry->headPath     = headPath;
+    entry->headModified = modified;
+    pthread_mutex_unlock(&promptLock);
+
+    if (changed) {
+        uint64_t one = 1;
+
+        if (write(updateFd, &one, sizeof(one)) < 0) {
+            /* The counter is already nonzero; the editor will redraw */
+        }
+    }
+}
+
+/*
+ * findHead
+ *
+ * Returns the path of the HEAD file of the git repository containing a
+ * directory (following a .git file to the repository of a worktree or
+ * submodule), or NULL if there is none.
+ */
+static char* findHead(const char* directory) {
+    char        path[PATH_MAX];
+    char        contents[PATH_MAX];
+    struct stat info;
+    size_t      length = strlen(directory);
+
+    if (length >= sizeof(path)) {
+        return NULL;
+    }
+    memcpy(path, directory, length + 1);
+
+    for (;;) {
+        char* slash;
+
+        if (snprintf(path + length, sizeof(path) - length, "%s.git",
+                     (length > 0 && path[length - 1] == '/') ? "" : "/")
+                < (int) (sizeof(path) - length)
+                && stat(path, &info) == 0) {
+            if (S_ISDIR(info.st_mode)) {
+                strncat(path, "/HEAD", sizeof(path) - strlen(path) - 1);
+                return strdup(path);
+            }
+
+            /* A .git file holds "gitdir: <path>" */
+            if (S_ISREG(info.st_mode)) {
+                FILE* file = fopen(path, "re");
+                char* result = NULL;
+
+                if (file != NULL) {
+                    if (fgets(contents, sizeof(contents), file) != NULL
+                            && strncmp(contents, "gitdir: ", 8) == 0) {
+                        char* gitDirectory = contents + 8;
+
+                        gitDirectory[strcspn(gitDirectory, "\n")] = '\0';
+                        path[length] = '\0';
+                        if ((*gitDirectory == '/'
+                             ? asprintf(&result, "%s/HEAD", gitDirectory)
+                             : asprintf(&result, "%s/%s/HEAD", path,
+                                        gitDirectory)) < 0) {
+                            result = NULL;
+                        }
+                    }
+                    fclose(file);
+                }
+                return result;
+            }
+        }
+
+        /* Go up a directory */
+        path[length] = '\0';
+        slash = strrchr(path, '/');
+        if (slash == NULL || length <= 1) {
+            return NULL;
+        }
+        length = (slash == path) ? 1 : (size_t) (slash - path);
+        path[length] = '\0';
+    }
+}
+
+/*
+ * readBranch
+ *
+ * Returns the branch named by a HEAD file ("ref: refs/heads/<branch>"),
+ * or the abbreviated commit of a detached HEAD.
+ */
+static char* readBranch(const char* headPath) {
+    char  contents[512];
+    char* branch = NULL;
+    FILE* file = fopen(headPath, "re");
+
+    if (file == NULL) {
+        return NULL;
+    }
+    if (fgets(contents, sizeof(contents), file) != NULL) {
+        contents[strcspn(contents, "\n")] = '\0';
+        if (strncmp(contents, "ref: refs/heads/", 16) == 0) {
+            branch = strdup(contents + 16);
+        } else if (strncmp(contents, "ref: ", 5) == 0) {
+            branch = strdup(contents + 5);
+        } else {
+            branch = strndup(contents, 7);
+        }
+    }
+    fclose(file);
+
+    return branch;
+}
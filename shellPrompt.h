@@ -0,0 +1,21 @@
+/*
+ * shellPrompt.h
+ *
+ * The shell's prompt, built from a format set with the 'prompt' built-in.
+ * Segments that are cheap to compute (the process ID, the working
+ * directory, the status and duration of the last command) are filled in
+ * as the prompt is shown.  The git branch is found by a worker thread and
+ * cached per directory: the prompt is shown at once with what the cache
+ * holds, and promptUpdateFd() becomes readable if the worker finds it has
+ * changed, so the line editor can redraw the prompt in place.
+ */
+#ifndef SHELL_PROMPT_H
+#define SHELL_PROMPT_H
+
+/* Function prototypes */
+void        promptInit(void);
+const char* promptText(void);
+int         promptUpdateFd(void);
+void        promptCommandDone(int status, double seconds);
+
+#endif
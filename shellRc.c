@@ -0,0 +1,434 @@
+/*
+ * shellRc.c
+ *
+ * Loads the rc file through its snapshot (see shellRc.h).
+ *
+ * The snapshot is a header identifying the version of the rc file it was
+ * made from, followed by one record per command: the number of tokens
+ * (4 bytes), then for each token its kind (1 byte) and its text with a
+ * terminating NUL.  The records are used in place in the mapping.  A new
+ * snapshot is written to a temporary file and renamed over the old one,
+ * so shells starting at the same time never see half of one.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shellParser.h"
+#include "shellRc.h"
+
+/* The rc file and its snapshot, in the home directory */
+#define RC_FILE_NAME       ".shellrc"
+#define SNAPSHOT_FILE_NAME ".shellrc.snapshot"
+
+/* Identify the snapshot format; change the version with the format */
+#define SNAPSHOT_MAGIC   "SHELLRC"
+#define SNAPSHOT_VERSION 1
+
+/* What a snapshot was made from */
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t commandCount;
+    uint64_t dataSize;      /* Bytes of records after the header   */
+    uint64_t rcSize;        /* The rc file's size...               */
+    uint64_t rcDevice;      /* ...identity...                      */
+    uint64_t rcInode;
+    int64_t  rcSeconds;     /* ...modification time...             */
+    int64_t  rcNanoseconds;
+    uint64_t rcHash;        /* ...and the hash of its contents     */
+} SnapshotHeader;
+
+/* A growable buffer of snapshot records */
+typedef struct {
+    char*  data;
+    size_t length;
+    size_t capacity;
+} Records;
+
+/* Function prototypes */
+static bool     runSnapshot(const char* rcPath, const char* snapshotPath,
+                            const struct stat* rc, RcRunFunction run);
+static bool     validRecords(const char* data, size_t size, uint32_t count);
+static void     replay(const char* data, uint32_t count, RcRunFunction run);
+static char*    readRcFile(const char* rcPath, size_t* size);
+static uint32_t scanRcFile(const char* text, size_t size, Records* records,
+                           RcRunFunction run);
+static bool     appendRecord(Records* records, const void* data,
+                             size_t length);
+static void     writeSnapshot(const char* snapshotPath,
+                              const SnapshotHeader* header,
+                              const Records* records);
+static void     describeRc(SnapshotHeader* header, const struct stat* rc);
+static uint64_t hashText(const char* text, size_t size);
+
+/*
+ * rcLoad
+ *
+ * Runs the commands of the rc file, if there is one: from its snapshot
+ * when that is current, otherwise by scanning the rc file (and writing a
+ * new snapshot).
+ */
+void rcLoad(RcRunFunction run) {
+    const char*    home = getenv("HOME");
+    char           rcPath[PATH_MAX];
+    char           snapshotPath[PATH_MAX];
+    struct stat    rc;
+    SnapshotHeader header;
+    Records        records = { NULL, 0, 0 };
+    char*          text;
+    size_t         size;
+
+    if (home == NULL
+            || snprintf(rcPath, sizeof(rcPath), "%s/%s", home,
+                        RC_FILE_NAME) >= (int) sizeof(rcPath)
+            || snprintf(snapshotPath, sizeof(snapshotPath), "%s/%s", home,
+                        SNAPSHOT_FILE_NAME) >= (int) sizeof(snapshotPath)
+            || stat(rcPath, &rc) < 0) {
+        return;
+    }
+
+    if (runSnapshot(rcPath, snapshotPath, &rc, run)) {
+        return;
+    }
+
+    text = readRcFile(rcPath, &size);
+    if (text == NULL) {
+        return;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    describeRc(&header, &rc);
+    header.rcHash       = hashText(text, size);
+    header.commandCount = scanRcFile(text, size, &records, run);
+    header.dataSize     = records.length;
+    writeSnapshot(snapshotPath, &header, &records);
+
+    free(records.data);
+    free(text);
+}
+
+/*
+ * runSnapshot
+ *
+ * Runs the commands of the snapshot if it matches the rc file.  A
+ * snapshot whose rc file was touched (or copied) but not changed still
+ * matches by hash, and is updated so the next check is by stat() alone.
+ * Returns false if the snapshot is missing, damaged or out of date.
+ */
+static bool runSnapshot(const char* rcPath, const char* snapshotPath,
+                        const struct stat* rc, RcRunFunction run) {
+    SnapshotHeader expected;
+    SnapshotHeader header;
+    struct stat    info;
+    char*          mapping;
+    bool           current = false;
+    int            fd = open(snapshotPath, O_RDWR | O_CLOEXEC);
+
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &info) < 0 || (size_t) info.st_size < sizeof(header)) {
+        close(fd);
+        return false;
+    }
+    mapping = (char*) mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd,
+                           0);
+    if (mapping == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    memcpy(&header, mapping, sizeof(header));
+
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0
+            && header.version == SNAPSHOT_VERSION
+            && header.dataSize == info.st_size - sizeof(header)
+            && validRecords(mapping + sizeof(header), header.dataSize,
+                            header.commandCount)) {
+        expected = header;
+        describeRc(&expected, rc);
+        current = (memcmp(&expected, &header, sizeof(header)) == 0);
+
+        /* Changed according to stat(), but perhaps not in contents */
+        if (!current && expected.rcSize == header.rcSize) {
+            size_t size;
+            char*  text = readRcFile(rcPath, &size);
+
+            if (text != NULL && hashText(text, size) == header.rcHash) {
+                current = true;
+                if (pwrite(fd, &expected, sizeof(expected), 0)
+                        != (ssize_t) sizeof(expected)) {
+                    /* Checked by hash again next time */
+                }
+            }
+            free(text);
+        }
+    }
+    close(fd);
+
+    if (current) {
+        replay(mapping + sizeof(header), header.commandCount, run);
+    }
+    munmap(mapping, info.st_size);
+
+    return current;
+}
+
+/*
+ * validRecords
+ *
+ * Returns true if 'size' bytes of records hold exactly 'count' commands,
+ * so that replay() never reads past the mapping.
+ */
+static bool validRecords(const char* data, size_t size, uint32_t count) {
+    size_t   offset = 0;
+    uint32_t tokens;
+
+    while (count-- > 0) {
+        if (size - offset < sizeof(tokens)) {
+            return false;
+        }
+        memcpy(&tokens, data + offset, sizeof(tokens));
+        offset += sizeof(tokens);
+
+        while (tokens-- > 0) {
+            const char* end;
+
+            if (size - offset < 2) {
+                return false;
+            }
+            end = (const char*) memchr(data + offset + 1, '\0',
+                                       size - offset - 1);
+            if (end == NULL) {
+                return false;
+            }
+            offset = end + 1 - data;
+        }
+    }
+
+    return offset == size;
+}
+
+/*
+ * replay
+ *
+ * Runs the commands recorded in a (valid) snapshot.
+ */
+static void replay(const char* data, uint32_t count, RcRunFunction run) {
+    char**   tokens = NULL;
+    char*    kinds = NULL;
+    uint32_t capacity = 0;
+    uint32_t length;
+    uint32_t i;
+
+    while (count-- > 0) {
+        memcpy(&length, data, sizeof(length));
+        data += sizeof(length);
+
+        if (length + 1 > capacity) {
+            free(tokens);
+            free(kinds);
+            capacity = length + 1;
+            tokens   = (char**) malloc(capacity * sizeof(char*));
+            kinds    = (char*) malloc(capacity);
+            if (tokens == NULL || kinds == NULL) {
+                perror("malloc");
+                exit(1);
+            }
+        }
+
+        for (i = 0; i < length; ++i) {
+            kinds[i]  = *data++;
+            tokens[i] = (char*) data;
+            data     += strlen(data) + 1;
+        }
+        tokens[length] = NULL;
+
+        run(getArgListFromTokens(tokens, kinds));
+    }
+
+    free(tokens);
+    free(kinds);
+}
+
+/*
+ * readRcFile
+ *
+ * Returns the contents of the rc file (NUL terminated) and stores their
+ * size, or returns NULL if it cannot be read.
+ */
+static char* readRcFile(const char* rcPath, size_t* size) {
+    struct stat info;
+    char*       text;
+    ssize_t     count;
+    size_t      total = 0;
+    int         fd = open(rcPath, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &info) < 0
+            || (text = (char*) malloc(info.st_size + 1)) == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    while (total < (size_t) info.st_size
+           && (count = read(fd, text + total, info.st_size - total)) > 0) {
+        total += count;
+    }
+    close(fd);
+
+    text[total] = '\0';
+    *size = total;
+    return text;
+}
+
+/*
+ * scanRcFile
+ *
+ * Scans each line of the rc file, records its tokens and runs it.
+ * Returns the number of commands recorded.
+ */
+static uint32_t scanRcFile(const char* text, size_t size, Records* records,
+                           RcRunFunction run) {
+    const char* end = text + size;
+    uint32_t    count = 0;
+
+    while (text < end) {
+        const char* newline = (const char*) memchr(text, '\n', end - text);
+        const char* next = (newline != NULL) ? newline + 1 : end;
+        char*       copy;
+        char**      line;
+        uint32_t    tokens;
+        uint32_t    i;
+
+        text += strspn(text, " \t");
+        if (text >= next || *text == '\n' || *text == '#') {
+            text = next;
+            continue;
+        }
+
+        /* The scanner reuses the buffer it scans, so give it a copy */
+        copy = strndup(text, next - text);
+        if (copy == NULL) {
+            break;
+        }
+        line = getArgListFromString(copy);
+        free(copy);
+        text = next;
+
+        for (tokens = 0; line[tokens] != NULL; ++tokens) {
+        }
+        if (tokens == 0) {
+            continue;
+        }
+
+        appendRecord(records, &tokens, sizeof(tokens));
+        for (i = 0; i < tokens; ++i) {
+            char kind = (char) getArgKind(i);
+
+            appendRecord(records, &kind, 1);
+            appendRecord(records, line[i], strlen(line[i]) + 1);
+        }
+        ++count;
+
+        run(line);
+    }
+
+    return count;
+}
+
+/*
+ * appendRecord
+ *
+ * Adds bytes to the records being built, growing the buffer as needed.
+ * Returns false if memory ran out.
+ */
+static bool appendRecord(Records* records, const void* data, size_t length) {
+    if (records->length + length > records->capacity) {
+        size_t capacity = (records->length + length) * 2;
+        char*  grown = (char*) realloc(records->data, capacity);
+
+        if (grown == NULL) {
+            return false;
+        }
+        records->data     = grown;
+        records->capacity = capacity;
+    }
+    memcpy(records->data + records->length, data, length);
+    records->length += length;
+
+    return true;
+}
+
+/*
+ * writeSnapshot
+ *
+ * Replaces the snapshot with a new one.  Failing to write it only means
+ * the rc file will be scanned again next time.
+ */
+static void writeSnapshot(const char* snapshotPath,
+                          const SnapshotHeader* header,
+                          const Records* records) {
+    char temporary[PATH_MAX];
+    bool written;
+    int  fd;
+
+    if (snprintf(temporary, sizeof(temporary), "%s.%d", snapshotPath,
+                 (int) getpid()) >= (int) sizeof(temporary)) {
+        return;
+    }
+    fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return;
+    }
+
+    written = (write(fd, header, sizeof(*header))
+               == (ssize_t) sizeof(*header))
+              && (records->length == 0
+                  || write(fd, records->data, records->length)
+                     == (ssize_t) records->length);
+    close(fd);
+
+    if (!written || rename(temporary, snapshotPath) < 0) {
+        unlink(temporary);
+    }
+}
+
+/*
+ * describeRc
+ *
+ * Stores what stat() says about the rc file in a snapshot header.
+ */
+static void describeRc(SnapshotHeader* header, const struct stat* rc) {
+    header->rcSize        = rc->st_size;
+    header->rcDevice      = rc->st_dev;
+    header->rcInode       = rc->st_ino;
+    header->rcSeconds     = rc->st_mtim.tv_sec;
+    header->rcNanoseconds = rc->st_mtim.tv_nsec;
+}
+
+/*
+ * hashText
+ *
+ * Returns the 64-bit FNV-1a hash of some text.
+ */
+static uint64_t hashText(const char* text, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t   i;
+
+    for (i = 0; i < size; ++i) {
+        hash = (hash ^ (unsigned char) text[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
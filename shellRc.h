@@ -0,0 +1,22 @@
+/*
+ * shellRc.h
+ *
+ * The rc file (~/.shellrc): commands run, one per line, when the shell
+ * starts.  Lines starting with '#' are comments.
+ *
+ * Scanning the rc file is the costly part of starting up, so the scanned
+ * commands are saved in a binary snapshot (~/.shellrc.snapshot).  Later
+ * startups map the snapshot and run its commands without scanning,
+ * unless the rc file has changed since: its size, inode and modification
+ * time are checked first, and if those differ, a hash of its contents.
+ */
+#ifndef SHELL_RC_H
+#define SHELL_RC_H
+
+/* Runs one command of the rc file (the tokens returned by the scanner) */
+typedef void (*RcRunFunction)(char** line);
+
+/* Function prototypes */
+void rcLoad(RcRunFunction run);
+
+#endif
@@ -0,0 +1,309 @@
+/*
+ * shellRingBuffer.c
+ *
+ * A lock-free single-producer/single-consumer ring buffer.
+ *
+ * The producer only ever advances 'head' and the consumer only ever
+ * advances 'tail'; both are running byte counts, so the ring is empty when
+ * they are equal and full when they differ by the capacity.  A side that
+ * cannot make progress spins briefly and then sleeps on a futex.  The
+ * other side only issues a wake-up (a system call) if it sees that flag
+ * set, so a steady stream of data moves without any system calls.
+ *
+ * The ring lives in a MAP_SHARED mapping so it would keep working if one
+ * of the stages were moved into a forked child.
+ */
+#define _GNU_SOURCE
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shellRingBuffer.h"
+
+/* Number of times a blocked side polls before going to sleep */
+#define RING_SPIN_COUNT 2048
+
+/* Keeps the producer's and consumer's fields on separate cache lines */
+#define CACHE_LINE 64
+
+struct RingBuffer {
+    /* Written by the producer */
+    _Alignas(CACHE_LINE) _Atomic size_t head;    /* Bytes ever written     */
+    _Atomic int           writerClosed;          /* No more data will come */
+    _Atomic int           writerWaiting;         /* Producer is asleep     */
+    _Atomic uint32_t      headSignal;            /* Futex: head moved      */
+
+    /* Written by the consumer */
+    _Alignas(CACHE_LINE) _Atomic size_t tail;    /* Bytes ever read        */
+    _Atomic int           readerClosed;          /* Nobody will read       */
+    _Atomic int           readerWaiting;         /* Consumer is asleep     */
+    _Atomic uint32_t      tailSignal;            /* Futex: tail moved      */
+
+    /* Set, from a signal handler, to make both sides give up */
+    _Atomic int           interrupted;
+
+    /* Fixed at creation */
+    _Alignas(CACHE_LINE) size_t capacity;        /* A power of two         */
+    size_t                mappingSize;           /* Size of the mapping    */
+    char*                 data;                  /* The bytes of the ring  */
+};
+
+/*
+ * cpuRelax
+ *
+ * Tells the processor we are spinning.
+ */
+static inline void cpuRelax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/*
+ * futexWait
+ *
+ * Sleeps until 'word' is woken, unless it no longer holds 'expected'.
+ */
+static void futexWait(_Atomic uint32_t* word, uint32_t expected) {
+    syscall(SYS_futex, (uint32_t*) word, FUTEX_WAIT_PRIVATE, expected,
+            NULL, NULL, 0);
+}
+
+/*
+ * signalProgress
+ *
+ * Announces that one side has moved (or closed its end).  The futex is
+ * only woken if the other side said it was going to sleep.
+ */
+static void signalProgress(_Atomic uint32_t* word, _Atomic int* waiting) {
+    atomic_fetch_add(word, 1);
+    if (atomic_load(waiting)) {
+        syscall(SYS_futex, (uint32_t*) word, FUTEX_WAKE_PRIVATE, 1,
+                NULL, NULL, 0);
+    }
+}
+
+/*
+ * ringCreate
+ *
+ * Creates a ring buffer holding 'capacity' bytes (rounded up to a power
+ * of two).  Returns NULL on failure.
+ */
+RingBuffer* ringCreate(size_t capacity) {
+    RingBuffer* ring;
+    size_t      rounded = CACHE_LINE;
+    size_t      header  = (sizeof(RingBuffer) + CACHE_LINE - 1)
+                          & ~(size_t) (CACHE_LINE - 1);
+    void*       mapping;
+
+    while (rounded < capacity) {
+        rounded *= 2;
+    }
+
+    mapping = mmap(NULL, header + rounded, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    /* The mapping is zero-filled, so every counter and flag starts at 0 */
+    ring              = (RingBuffer*) mapping;
+    ring->capacity    = rounded;
+    ring->mappingSize = header + rounded;
+    ring->data        = (char*) mapping + header;
+
+    return ring;
+}
+
+/*
+ * ringDestroy
+ *
+ * Releases a ring buffer once both of its ends are finished with it.
+ */
+void ringDestroy(RingBuffer* ring) {
+    if (ring != NULL) {
+        munmap(ring, ring->mappingSize);
+    }
+}
+
+/*
+ * ringRead
+ *
+ * Reads up to 'length' bytes, blocking until at least one byte is
+ * available.  Returns the number of bytes read, 0 at end-of-file (the
+ * writer has closed its end and everything has been read), or -1 with
+ * errno set to EINTR if the ring has been interrupted.
+ */
+ssize_t ringRead(RingBuffer* ring, void* data, size_t length) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head;
+    size_t available;
+    size_t offset;
+    size_t first;
+    int    spins = 0;
+
+    for (;;) {
+        if (atomic_load(&ring->interrupted)) {
+            errno = EINTR;
+            return -1;
+        }
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (head != tail) {
+            break;
+        }
+        if (atomic_load_explicit(&ring->writerClosed, memory_order_acquire)) {
+            /* The writer may have written just before closing */
+            head = atomic_load_explicit(&ring->head, memory_order_acquire);
+            if (head == tail) {
+                return 0;
+            }
+            break;
+        }
+
+        if (++spins < RING_SPIN_COUNT) {
+            cpuRelax();
+        } else {
+            uint32_t signal = atomic_load(&ring->headSignal);
+
+            atomic_store(&ring->readerWaiting, 1);
+            if (atomic_load(&ring->head) == tail
+                    && !atomic_load(&ring->writerClosed)
+                    && !atomic_load(&ring->interrupted)) {
+                futexWait(&ring->headSignal, signal);
+            }
+            atomic_store(&ring->readerWaiting, 0);
+            spins = 0;
+        }
+    }
+
+    available = head - tail;
+    if (length > available) {
+        length = available;
+    }
+
+    /* Copy out, possibly in two pieces if the data wraps around */
+    offset = tail & (ring->capacity - 1);
+    first  = ring->capacity - offset;
+    if (first > length) {
+        first = length;
+    }
+    memcpy(data, ring->data + offset, first);
+    memcpy((char*) data + first, ring->data, length - first);
+
+    atomic_store_explicit(&ring->tail, tail + length, memory_order_release);
+    signalProgress(&ring->tailSignal, &ring->writerWaiting);
+
+    return length;
+}
+
+/*
+ * ringWrite
+ *
+ * Writes all 'length' bytes, blocking while the ring is full.  Returns
+ * 'length', or -1 with errno set to EPIPE if the reader has closed its
+ * end (EINTR if the ring has been interrupted).
+ */
+ssize_t ringWrite(RingBuffer* ring, const void* data, size_t length) {
+    const char* bytes = (const char*) data;
+    size_t      head  = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t      remaining = length;
+
+    while (remaining > 0) {
+        size_t tail;
+        size_t space;
+        size_t chunk;
+        size_t offset;
+        size_t first;
+        int    spins = 0;
+
+        for (;;) {
+            if (atomic_load(&ring->interrupted)) {
+                errno = EINTR;
+                return -1;
+            }
+            if (atomic_load_explicit(&ring->readerClosed,
+                                     memory_order_acquire)) {
+                errno = EPIPE;
+                return -1;
+            }
+            tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+            if (head - tail < ring->capacity) {
+                break;
+            }
+
+            if (++spins < RING_SPIN_COUNT) {
+                cpuRelax();
+            } else {
+                uint32_t signal = atomic_load(&ring->tailSignal);
+
+                atomic_store(&ring->writerWaiting, 1);
+                if (head - atomic_load(&ring->tail) == ring->capacity
+                        && !atomic_load(&ring->readerClosed)
+                        && !atomic_load(&ring->interrupted)) {
+                    futexWait(&ring->tailSignal, signal);
+                }
+                atomic_store(&ring->writerWaiting, 0);
+                spins = 0;
+            }
+        }
+
+        space = ring->capacity - (head - tail);
+        chunk = (remaining < space) ? remaining : space;
+
+        /* Copy in, possibly in two pieces if the space wraps around */
+        offset = head & (ring->capacity - 1);
+        first  = ring->capacity - offset;
+        if (first > chunk) {
+            first = chunk;
+        }
+        memcpy(ring->data + offset, bytes, first);
+        memcpy(ring->data, bytes + first, chunk - first);
+
+        head += chunk;
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+        signalProgress(&ring->headSignal, &ring->readerWaiting);
+
+        bytes     += chunk;
+        remaining -= chunk;
+    }
+
+    return length;
+}
+
+/*
+ * ringCloseReader
+ *
+ * Called by the consumer when it will read no more; the producer's
+ * writes then fail with EPIPE.
+ */
+void ringCloseReader(RingBuffer* ring) {
+    atomic_store(&ring->readerClosed, 1);
+    signalProgress(&ring->tailSignal, &ring->writerWaiting);
+}
+
+/*
+ * ringCloseWriter
+ *
+ * Called by the producer when it will write no more; the consumer sees
+ * end-of-file once it has read everything.
+ */
+void ringCloseWriter(RingBuffer* ring) {
+    atomic_store(&ring->writerClosed, 1);
+    signalProgress(&ring->headSignal, &ring->readerWaiting);
+}
+
+/*
+ * ringInterrupt
+ *
+ * Makes both sides' reads and writes fail with EINTR, waking them if they
+ * sleep.  Safe to call from a signal handler.
+ */
+void ringInterrupt(RingBuffer* ring) {
+    atomic_store(&ring->interrupted, 1);
+    signalProgress(&ring->headSignal, &ring->readerWaiting);
+    signalProgress(&ring->tailSignal, &ring->writerWaiting);
+}
@@ -0,0 +1,31 @@
+/*
+ * shellRingBuffer.h
+ *
+ * A single-producer/single-consumer byte ring buffer used instead of a
+ * kernel pipe between two adjacent built-in stages of a pipeline.  It
+ * behaves like a pipe -- reads block until data or end-of-file, writes
+ * fail with EPIPE once the reader is gone -- but moving data through it
+ * needs no system calls unless one side has to sleep.  Interrupting the
+ * ring (Ctrl-C) makes both sides' reads and writes fail with EINTR.
+ */
+#ifndef SHELL_RING_BUFFER_H
+#define SHELL_RING_BUFFER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Capacity of the ring between two built-in stages (a power of two) */
+#define RING_BUFFER_SIZE (1024 * 1024)
+
+typedef struct RingBuffer RingBuffer;
+
+/* Function prototypes */
+RingBuffer* ringCreate(size_t capacity);
+void        ringDestroy(RingBuffer* ring);
+ssize_t     ringRead(RingBuffer* ring, void* data, size_t length);
+ssize_t     ringWrite(RingBuffer* ring, const void* data, size_t length);
+void        ringCloseReader(RingBuffer* ring);
+void        ringCloseWriter(RingBuffer* ring);
+void        ringInterrupt(RingBuffer* ring);
+
+#endif
@@ -0,0 +1,857 @@
+/*
+ * shellSort.c
+ *
+ * The 'sort' built-in: a parallel external merge sort of lines, compared
+ * byte by byte.
+ *
+ * Input is cut into pieces of at most SORT_PIECE_SIZE bytes (regular files
+ * are mapped and cut in place; other input is read into piece buffers).
+ * Each piece is split into one chunk per pool thread, and each chunk is
+ * turned into an array of compact records -- the line's first eight bytes
+ * as a big-endian integer, plus its offset and length -- and sorted on the
+ * pool.  Most comparisons are decided by the integer alone, without
+ * touching the text.
+ *
+ * The sorted chunks stay in memory until they (and their text) pass the
+ * memory budget; then they are merged into a run in an unlinked temporary
+ * file.  At the end every run, in memory or on disk, is merged k ways to
+ * standard output through a loser tree.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shellBuiltins.h"
+#include "shellThreadPool.h"
+
+/* Largest piece of input sorted at once (offsets must fit in 32 bits) */
+#define SORT_PIECE_SIZE (64 * 1024 * 1024)
+
+/* Smallest chunk of a piece worth giving a thread of its own */
+#define SORT_MIN_CHUNK (1024 * 1024)
+
+/* Default memory budget (-S), in MiB */
+#define SORT_MEMORY_BUDGET 512
+
+/* A line to be sorted, as an offset into its piece */
+typedef struct {
+    uint64_t prefix;    /* First 8 bytes, big-endian, zero-padded */
+    uint32_t offset;    /* Start of the line in its piece         */
+    uint32_t length;    /* Length of the line, without its '\n'   */
+} SortRecord;
+
+/* A sorted run held in memory */
+typedef struct {
+    const char* base;       /* The piece the records point into        */
+    SortRecord* records;
+    size_t      count;
+    char*       owned;      /* A piece buffer to free with this run    */
+} MemoryRun;
+
+/* A sorted run spilled to a temporary file */
+typedef struct {
+    int    fd;
+    char*  text;            /* The file, mapped                        */
+    size_t length;
+} FileRun;
+
+/* A region of a mapped input file, released when the sort finishes */
+typedef struct {
+    void*  address;
+    size_t length;
+} Mapping;
+
+/* One chunk of a piece, sorted by a pool task */
+typedef struct {
+    const char* base;
+    size_t      start;
+    size_t      end;
+    bool        reverse;
+    SortRecord* records;
+    size_t      count;
+    int         error;
+} SortChunk;
+
+/* The next line of a run during a merge */
+typedef struct {
+    uint64_t          prefix;
+    const char*       line;
+    size_t            length;
+    bool              exhausted;
+    const SortRecord* record;       /* For a memory run ...            */
+    const SortRecord* recordEnd;
+    const char*       base;
+    const char*       text;         /* ... or for a file run           */
+    const char*       textEnd;
+} SortCursor;
+
+/* A k-way merge: nodes[0] is the winner, nodes[1..k-1] the losers */
+typedef struct {
+    SortCursor* cursors;
+    int*        nodes;
+    int         count;
+    bool        reverse;
+} LoserTree;
+
+/* Everything about one 'sort' command */
+typedef struct {
+    BuiltinIo* io;
+    bool       reverse;             /* -r */
+    bool       unique;              /* -u */
+    size_t     budget;              /* -S, in bytes */
+    size_t     residentBytes;       /* Held by the memory runs */
+    MemoryRun* memoryRuns;
+    int        memoryRunCount;
+    int        memoryRunCapacity;
+    FileRun*   fileRuns;
+    int        fileRunCount;
+    int        fileRunCapacity;
+    Mapping*   mappings;
+    int        mappingCount;
+    int        mappingCapacity;
+    int        error;               /* errno of a failure, or 0 */
+} SortState;
+
+/* Function prototypes */
+static bool     sortInput(SortState* state, const char* name);
+static bool     addPiece(SortState* state, const char* text, size_t length,
+                         char* owned);
+static void     sortChunkTask(void* arg);
+static int      compareRecords(const void* a, const void* b, void* arg);
+static int      compareLines(uint64_t prefixA, const char* a, size_t lengthA,
+                             uint64_t prefixB, const char* b, size_t lengthB);
+static uint64_t linePrefix(const char* line, size_t length);
+static bool     spill(SortState* state);
+static bool     mergeRuns(SortState* state, bool withFiles, BuiltinIo* out);
+static void     advanceCursor(SortCursor* cursor);
+static bool     beats(const LoserTree* tree, int a, int b);
+static int      buildTree(LoserTree* tree, int node);
+static int      openTempFile(void);
+static bool     growArray(void* array, int* capacity, int count,
+                          size_t elementSize);
+static void     releaseSort(SortState* state);
+
+/**
+ * doSort
+ *
+ * Implements a built-in version of the 'sort' command.
+ *
+ * args - An array of strings corresponding to the command and its arguments:
+ *        sort [-ru] [-S MiB] [file...]
+ *        -r reverses the order, -u prints only the first of equal lines,
+ *        and -S sets how much memory to use before spilling to temporary
+ *        files.  With no files, standard input is sorted.
+ */
+int doSort(char** args, BuiltinIo* io) {
+    SortState state;
+    int       status = 0;
+    int       i;
+
+    memset(&state, 0, sizeof(state));
+    state.io     = io;
+    state.budget = (size_t) SORT_MEMORY_BUDGET * 1024 * 1024;
+
+    for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0';
+            ++i) {
+        const char* option;
+
+        if (strcmp(args[i], "--") == 0) {
+            ++i;
+            break;
+        }
+        for (option = args[i] + 1; *option != '\0'; ++option) {
+            if (*option == 'r') {
+                state.reverse = true;
+            } else if (*option == 'u') {
+                state.unique = true;
+            } else if (*option == 'S') {
+                const char* size = (option[1] != '\0') ? option + 1
+                                                        : args[++i];
+                char*       end;
+                long        megabytes = (size != NULL)
+                                        ? strtol(size, &end, 10) : 0;
+
+                if (size == NULL || *end != '\0' || megabytes < 1) {
+                    builtinError(io, "sort: invalid -S size\n");
+                    return 2;
+                }
+                state.budget = (size_t) megabytes * 1024 * 1024;
+                break;
+            } else {
+                builtinError(io, "sort: invalid option -- '%c'\n", *option);
+                return 2;
+            }
+        }
+    }
+
+    if (args[i] == NULL) {
+        if (!sortInput(&state, "-")) {
+            status = 2;
+        }
+    }
+    for (; args[i] != NULL && status == 0; ++i) {
+        if (!sortInput(&state, args[i])) {
+            status = 2;
+        }
+    }
+
+    if (status == 0 && !mergeRuns(&state, true, io) && !io->outClosed) {
+        builtinError(io, "sort: %s\n", strerror(state.error));
+        status = 2;
+    }
+
+    releaseSort(&state);
+    return status;
+}
+
+/*
+ * sortInput
+ *
+ * Adds one input ("-" for standard input) to the sort.  Returns false,
+ * after reporting it, on failure.
+ */
+static bool sortInput(SortState* state, const char* name) {
+    struct stat fileStat;
+    char*       buffer;
+    size_t      capacity = SORT_PIECE_SIZE;
+    size_t      filled = 0;
+    bool        fromStdin = (strcmp(name, "-") == 0);
+    int         fd = -1;
+
+    if (!fromStdin) {
+        fd = open(name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            builtinError(state->io, "sort: %s: %s\n", name, strerror(errno));
+            return false;
+        }
+    }
+
+    /* A regular file is mapped and cut into pieces in place */
+    if (fd >= 0 && fstat(fd, &fileStat) == 0 && S_ISREG(fileStat.st_mode)
+            && fileStat.st_size > 0
+            && growArray(&state->mappings, &state->mappingCapacity,
+                         state->mappingCount, sizeof(Mapping))) {
+        size_t length = fileStat.st_size;
+        char*  text = (char*) mmap(NULL, length, PROT_READ, MAP_PRIVATE,
+                                   fd, 0);
+
+        if (text != MAP_FAILED) {
+            size_t position = 0;
+
+            close(fd);
+            madvise(text, length, MADV_SEQUENTIAL);
+            state->mappings[state->mappingCount].address = text;
+            state->mappings[state->mappingCount].length  = length;
+            ++state->mappingCount;
+
+            while (position < length) {
+                size_t pieceLength = length - position;
+
+                if (pieceLength > SORT_PIECE_SIZE) {
+                    char* newline = (char*) memrchr(text + position, '\n',
+                                                    SORT_PIECE_SIZE);
+
+                    pieceLength = (newline != NULL)
+                                  ? (size_t) (newline - text) + 1 - position
+                                  : SORT_PIECE_SIZE;
+                }
+                if (!addPiece(state, text + position, pieceLength, NULL)) {
+                    builtinError(state->io, "sort: %s\n",
+                                 strerror(state->error));
+                    return false;
+                }
+                position += pieceLength;
+            }
+            return true;
+        }
+    }
+
+    /* Anything else is read into piece buffers */
+    buffer = (char*) malloc(capacity);
+    for (;;) {
+        ssize_t bytesRead;
+
+        if (buffer == NULL) {
+            state->error = errno;
+            break;
+        }
+        if (filled == capacity) {
+            char* newline = (char*) memrchr(buffer, '\n', filled);
+            char* next;
+
+            if (newline == NULL) {
+                /* One line fills the buffer */
+                next = (char*) realloc(buffer, capacity * 2);
+                if (next != NULL) {
+                    buffer    = next;
+                    capacity *= 2;
+                    continue;
+                }
+                state->error = errno;
+                break;
+            }
+
+            next = (char*) malloc(capacity);
+            if (next == NULL) {
+                state->error = errno;
+                break;
+            }
+            filled = buffer + filled - (newline + 1);
+            memcpy(next, newline + 1, filled);
+            if (!addPiece(state, buffer, newline + 1 - buffer, buffer)) {
+                buffer = next;
+                break;
+            }
+            buffer = next;
+        }
+
+        if (fromStdin) {
+            bytesRead = builtinRead(state->io, buffer + filled,
+                                    capacity - filled);
+        } else {
+            do {
+                bytesRead = read(fd, buffer + filled, capacity - filled);
+            } while (bytesRead < 0 && errno == EINTR);
+        }
+        if (bytesRead < 0) {
+            state->error = errno;
+            break;
+        }
+        if (bytesRead == 0) {
+            if (filled > 0) {
+                addPiece(state, buffer, filled, buffer);
+            } else {
+                free(buffer);
+            }
+            buffer = NULL;
+            break;
+        }
+        filled += bytesRead;
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (state->error != 0) {
+        free(buffer);
+        builtinError(state->io, "sort: %s: %s\n", name,
+                     strerror(state->error));
+        return false;
+    }
+    return true;
+}
+
+/*
+ * addPiece
+ *
+ * Sorts a piece of input in parallel and keeps the sorted chunks as
+ * memory runs, spilling if the memory budget is exceeded.  'owned' (if
+ * not NULL) is freed once the piece is no longer needed.  Returns false
+ * on failure, with state->error set.
+ */
+static bool addPiece(SortState* state, const char* text, size_t length,
+                     char* owned) {
+    SortChunk* chunks;
+    TaskGroup  group;
+    size_t     start = 0;
+    int        chunkCount = poolSize();
+    int        i;
+
+    if ((size_t) chunkCount > length / SORT_MIN_CHUNK) {
+        chunkCount = length / SORT_MIN_CHUNK;
+    }
+    if (chunkCount < 1) {
+        chunkCount = 1;
+    }
+
+    chunks = (SortChunk*) calloc(chunkCount, sizeof(SortChunk));
+    if (chunks == NULL) {
+        state->error = errno;
+        free(owned);
+        return false;
+    }
+
+    /* Cut the piece at the line boundaries nearest equal shares */
+    taskGroupInit(&group);
+    for (i = 0; i < chunkCount; ++i) {
+        size_t end = (i == chunkCount - 1) ? length
+                     : (size_t) ((double) length * (i + 1) / chunkCount);
+
+        if (end < start) {
+            end = start;
+        }
+        if (end < length) {
+            const char* newline = (const char*) memchr(text + end, '\n',
+                                                       length - end);
+
+            end = (newline != NULL) ? (size_t) (newline - text) + 1 : length;
+        }
+
+        chunks[i].base    = text;
+        chunks[i].start   = start;
+        chunks[i].end     = end;
+        chunks[i].reverse = state->reverse;
+        poolSubmit(&group, sortChunkTask, &chunks[i]);
+        start = end;
+    }
+    poolWait(&group);
+    taskGroupDestroy(&group);
+
+    state->residentBytes += length;
+    for (i = 0; i < chunkCount; ++i) {
+        if (chunks[i].error != 0) {
+            state->error = chunks[i].error;
+        }
+        if (chunks[i].count == 0 || state->error != 0
+                || !growArray(&state->memoryRuns, &state->memoryRunCapacity,
+                              state->memoryRunCount, sizeof(MemoryRun))) {
+            free(chunks[i].records);
+            continue;
+        }
+
+        state->memoryRuns[state->memoryRunCount].base    = text;
+        state->memoryRuns[state->memoryRunCount].records = chunks[i].records;
+        state->memoryRuns[state->memoryRunCount].count   = chunks[i].count;
+        state->memoryRuns[state->memoryRunCount].owned   = owned;
+        ++state->memoryRunCount;
+        state->residentBytes += chunks[i].count * sizeof(SortRecord);
+        owned = NULL;
+    }
+    free(chunks);
+    free(owned);
+
+    if (state->error != 0) {
+        return false;
+    }
+    if (state->residentBytes >= state->budget) {
+        return spill(state);
+    }
+    return true;
+}
+
+/*
+ * sortChunkTask
+ *
+ * Builds the records for one chunk of a piece and sorts them.
+ */
+static void sortChunkTask(void* arg) {
+    SortChunk* chunk = (SortChunk*) arg;
+    size_t     capacity = 0;
+    size_t     position = chunk->start;
+
+    while (position < chunk->end) {
+        const char* line = chunk->base + position;
+        const char* newline = (const char*) memchr(line, '\n',
+                                                   chunk->end - position);
+        size_t      length = (newline != NULL) ? (size_t) (newline - line)
+                                               : chunk->end - position;
+
+        if (chunk->count == capacity) {
+            SortRecord* grown;
+
+            capacity = (capacity > 0) ? capacity * 2 : 4096;
+            grown = (SortRecord*) realloc(chunk->records,
+                                          capacity * sizeof(SortRecord));
+            if (grown == NULL) {
+                chunk->error = errno;
+                return;
+            }
+            chunk->records = grown;
+        }
+
+        chunk->records[chunk->count].prefix = linePrefix(line, length);
+        chunk->records[chunk->count].offset = position;
+        chunk->records[chunk->count].length = length;
+        ++chunk->count;
+
+        position += length + 1;
+    }
+
+    qsort_r(chunk->records, chunk->count, sizeof(SortRecord), compareRecords,
+            chunk);
+}
+
+/*
+ * compareRecords
+ *
+ * qsort_r() comparison of two records of the chunk 'arg'.
+ */
+static int compareRecords(const void* a, const void* b, void* arg) {
+    const SortRecord* recordA = (const SortRecord*) a;
+    const SortRecord* recordB = (const SortRecord*) b;
+    const SortChunk*  chunk   = (const SortChunk*) arg;
+    int               result;
+
+    result = compareLines(recordA->prefix, chunk->base + recordA->offset,
+                          recordA->length,
+                          recordB->prefix, chunk->base + recordB->offset,
+                          recordB->length);
+    return chunk->reverse ? -result : result;
+}
+
+/*
+ * compareLines
+ *
+ * Compares two lines byte by byte (a line sorts before any longer line it
+ * begins).  Equal prefixes mean the first min(8, lengths) bytes are equal.
+ */
+static int compareLines(uint64_t prefixA, const char* a, size_t lengthA,
+                        uint64_t prefixB, const char* b, size_t lengthB) {
+    size_t shorter = (lengthA < lengthB) ? lengthA : lengthB;
+    int    result;
+
+    if (prefixA != prefixB) {
+        return (prefixA < prefixB) ? -1 : 1;
+    }
+    if (shorter > 8) {
+        result = memcmp(a + 8, b + 8, shorter - 8);
+        if (result != 0) {
+            return result;
+        }
+    }
+    return (lengthA > lengthB) - (lengthA < lengthB);
+}
+
+/*
+ * linePrefix
+ *
+ * Returns the first 8 bytes of a line as a big-endian integer, so that
+ * integer order is byte order.
+ */
+static uint64_t linePrefix(const char* line, size_t length) {
+    uint64_t prefix = 0;
+    size_t   i;
+
+    if (length >= 8) {
+        memcpy(&prefix, line, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        prefix = __builtin_bswap64(prefix);
+#endif
+        return prefix;
+    }
+    for (i = 0; i < 8; ++i) {
+        prefix = (prefix << 8) | ((i < length) ? (unsigned char) line[i] : 0);
+    }
+    return prefix;
+}
+
+/*
+ * spill
+ *
+ * Merges the memory runs into a new run in a temporary file and frees
+ * them.  Returns false on failure, with state->error set.
+ */
+static bool spill(SortState* state) {
+    BuiltinIo   runIo;
+    struct stat runStat;
+    FileRun*    run;
+    int         fd = openTempFile();
+    int         i;
+
+    if (fd < 0) {
+        state->error = errno;
+        return false;
+    }
+
+    builtinIoInit(&runIo, -1, fd, -1);
+    if (!mergeRuns(state, false, &runIo) || !builtinFlush(&runIo)) {
+        state->error = (state->error != 0) ? state->error : errno;
+        builtinIoFinish(&runIo);
+        close(fd);
+        return false;
+    }
+    builtinIoFinish(&runIo);
+
+    if (!growArray(&state->fileRuns, &state->fileRunCapacity,
+                   state->fileRunCount, sizeof(FileRun))
+            || fstat(fd, &runStat) < 0) {
+        state->error = errno;
+        close(fd);
+        return false;
+    }
+    run         = &state->fileRuns[state->fileRunCount];
+    run->fd     = fd;
+    run->length = runStat.st_size;
+    run->text   = NULL;
+    if (run->length > 0) {
+        run->text = (char*) mmap(NULL, run->length, PROT_READ, MAP_PRIVATE,
+                                 fd, 0);
+        if (run->text == MAP_FAILED) {
+            state->error = errno;
+            close(fd);
+            return false;
+        }
+        madvise(run->text, run->length, MADV_SEQUENTIAL);
+    }
+    ++state->fileRunCount;
+
+    for (i = 0; i < state->memoryRunCount; ++i) {
+        free(state->memoryRuns[i].records);
+        free(state->memoryRuns[i].owned);
+    }
+    state->memoryRunCount = 0;
+    state->residentBytes  = 0;
+
+    return true;
+}
+
+/*
+ * mergeRuns
+ *
+ * Merges the memory runs (and, if 'withFiles' is true, the file runs)
+ * and writes the lines to 'out'.  Returns false if they could not all be
+ * written, or memory ran out (with state->error set).
+ */
+static bool mergeRuns(SortState* state, bool withFiles, BuiltinIo* out) {
+    LoserTree   tree;
+    const char* last = NULL;
+    size_t      lastLength = 0;
+    uint64_t    lastPrefix = 0;
+    bool        result = true;
+    int         i;
+
+    tree.count   = state->memoryRunCount + (withFiles ? state->fileRunCount
+                                                      : 0);
+    tree.reverse = state->reverse;
+    if (tree.count == 0) {
+        return true;
+    }
+    tree.cursors = (SortCursor*) calloc(tree.count, sizeof(SortCursor));
+    tree.nodes   = (int*) malloc(tree.count * sizeof(int));
+    if (tree.cursors == NULL || tree.nodes == NULL) {
+        state->error = errno;
+        free(tree.cursors);
+        free(tree.nodes);
+        return false;
+    }
+
+    for (i = 0; i < state->memoryRunCount; ++i) {
+        tree.cursors[i].base      = state->memoryRuns[i].base;
+        tree.cursors[i].record    = state->memoryRuns[i].records;
+        tree.cursors[i].recordEnd = state->memoryRuns[i].records
+                                    + state->memoryRuns[i].count;
+        advanceCursor(&tree.cursors[i]);
+    }
+    for (i = state->memoryRunCount; i < tree.count; ++i) {
+        const FileRun* run = &state->fileRuns[i - state->memoryRunCount];
+
+        tree.cursors[i].text    = run->text;
+        tree.cursors[i].textEnd = run->text + run->length;
+        advanceCursor(&tree.cursors[i]);
+    }
+    tree.nodes[0] = buildTree(&tree, 1);
+
+    for (;;) {
+        int         winner = tree.nodes[0];
+        SortCursor* cursor = &tree.cursors[winner];
+        int         node;
+
+        if (cursor->exhausted) {
+            break;
+        }
+
+        if (!state->unique || last == NULL
+                || compareLines(lastPrefix, last, lastLength,
+                                cursor->prefix, cursor->line,
+                                cursor->length) != 0) {
+            if (!builtinWrite(out, cursor->line, cursor->length)
+                    || !builtinWrite(out, "\n", 1)) {
+                result = false;
+                break;
+            }
+        }
+        last       = cursor->line;
+        lastLength = cursor->length;
+        lastPrefix = cursor->prefix;
+
+        /* Replay the winner's path from its leaf to the root */
+        advanceCursor(cursor);
+        for (node = (winner + tree.count) / 2; node > 0; node /= 2) {
+            if (beats(&tree, tree.nodes[node], winner)) {
+                int loser = winner;
+
+                winner           = tree.nodes[node];
+                tree.nodes[node] = loser;
+            }
+        }
+        tree.nodes[0] = winner;
+    }
+
+    free(tree.cursors);
+    free(tree.nodes);
+    return result;
+}
+
+/*
+ * advanceCursor
+ *
+ * Moves a cursor to the next line of its run.
+ */
+static void advanceCursor(SortCursor* cursor) {
+    if (cursor->record != NULL) {
+        if (cursor->record == cursor->recordEnd) {
+            cursor->exhausted = true;
+            return;
+        }
+        cursor->prefix = cursor->record->prefix;
+        cursor->line   = cursor->base + cursor->record->offset;
+        cursor->length = cursor->record->length;
+        ++cursor->record;
+        return;
+    }
+
+    if (cursor->text == NULL || cursor->text >= cursor->textEnd) {
+        cursor->exhausted = true;
+        return;
+    }
+    {
+        const char* newline = (const char*) memchr(cursor->text, '\n',
+                                          cursor->textEnd - cursor->text);
+
+        cursor->line   = cursor->text;
+        cursor->length = (newline != NULL)
+                         ? (size_t) (newline - cursor->text)
+                         : (size_t) (cursor->textEnd - cursor->text);
+        cursor->prefix = linePrefix(cursor->line, cursor->length);
+        cursor->text  += cursor->length + 1;
+    }
+}
+
+/*
+ * beats
+ *
+ * Returns true if run 'a' should be output before run 'b'.  Exhausted
+ * runs lose; equal lines go to the earlier run, keeping the sort stable.
+ */
+static bool beats(const LoserTree* tree, int a, int b) {
+    const SortCursor* cursorA = &tree->cursors[a];
+    const SortCursor* cursorB = &tree->cursors[b];
+    int               result;
+
+    if (cursorA->exhausted || cursorB->exhausted) {
+        return cursorB->exhausted && (!cursorA->exhausted || a < b);
+    }
+
+    result = compareLines(cursorA->prefix, cursorA->line, cursorA->length,
+                          cursorB->prefix, cursorB->line, cursorB->length);
+    if (tree->reverse) {
+        result = -result;
+    }
+    return (result != 0) ? (result < 0) : (a < b);
+}
+
+/*
+ * buildTree
+ *
+ * Plays the matches below 'node' (runs are the leaves count..2*count-1),
+ * storing each match's loser in its node.  Returns the winner.
+ */
+static int buildTree(LoserTree* tree, int node) {
+    int left;
+    int right;
+
+    if (node >= tree->count) {
+        return node - tree->count;
+    }
+    left  = buildTree(tree, 2 * node);
+    right = buildTree(tree, 2 * node + 1);
+    if (beats(tree, left, right)) {
+        tree->nodes[node] = right;
+        return left;
+    }
+    tree->nodes[node] = left;
+    return right;
+}
+
+/*
+ * openTempFile
+ *
+ * Opens an anonymous temporary file in $TMPDIR (or /tmp).  It disappears
+ * when closed.
+ */
+static int openTempFile(void) {
+    const char* directory = getenv("TMPDIR");
+    char*       path;
+    int         fd;
+
+    if (directory == NULL || directory[0] == '\0') {
+        directory = "/tmp";
+    }
+
+    fd = open(directory, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0 || (errno != EOPNOTSUPP && errno != EISDIR
+                    && errno != EINVAL)) {
+        return fd;
+    }
+
+    /* The filesystem has no O_TMPFILE; create a file and unlink it */
+    if (asprintf(&path, "%s/shellSortXXXXXX", directory) < 0) {
+        return -1;
+    }
+    fd = mkostemp(path, O_CLOEXEC);
+    if (fd >= 0) {
+        unlink(path);
+    }
+    free(path);
+
+    return fd;
+}
+
+/*
+ * growArray
+ *
+ * Makes room for one more element in a malloc'd array of 'count'
+ * elements, doubling its capacity if needed.  Returns false if memory
+ * ran out.
+ */
+static bool growArray(void* array, int* capacity, int count,
+                      size_t elementSize) {
+    void** elements = (void**) array;
+    void*  grown;
+    int    newCapacity;
+
+    if (count < *capacity) {
+        return true;
+    }
+    newCapacity = (*capacity > 0) ? *capacity * 2 : 16;
+    grown = realloc(*elements, newCapacity * elementSize);
+    if (grown == NULL) {
+        return false;
+    }
+    *elements = grown;
+    *capacity = newCapacity;
+
+    return true;
+}
+
+/*
+ * releaseSort
+ *
+ * Frees all of a sort's runs and input mappings.
+ */
+static void releaseSort(SortState* state) {
+    int i;
+
+    for (i = 0; i < state->memoryRunCount; ++i) {
+        free(state->memoryRuns[i].records);
+        free(state->memoryRuns[i].owned);
+    }
+    for (i = 0; i < state->fileRunCount; ++i) {
+        if (state->fileRuns[i].text != NULL) {
+            munmap(state->fileRuns[i].text, state->fileRuns[i].length);
+        }
+        close(state->fileRuns[i].fd);
+    }
+    for (i = 0; i < state->mappingCount; ++i) {
+        munmap(state->mappings[i].address, state->mappings[i].length);
+    }
+    free(state->memoryRuns);
+    free(state->fileRuns);
+    free(state->mappings);
+}
@@ -0,0 +1,680 @@
+/*
+ * shellTextBuiltins.c
+ *
+ * Built-ins that scan text: 'wc', 'head' and 'tail'.
+ *
+ * For 'wc', input files are mapped into memory where possible so the
+ * counting kernels can run over them without copying; other input is read
+ * through a large buffer.  On x86 the kernels use AVX2 or SSE2, chosen
+ * when the command runs, to classify 32 or 16 bytes at a time.
+ *
+ * 'head' reads only as far as it needs and then closes its input, so the
+ * command feeding it stops at once.  'tail' reads a regular file backwards
+ * from the end, a block at a time, instead of scanning all of it.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "shellBuiltins.h"
+
+/* Size of the buffer used for input that cannot be mapped */
+#define SCAN_BUFFER_SIZE (1024 * 1024)
+
+/* Size of the blocks 'head' and 'tail' read */
+#define LINE_BLOCK_SIZE (64 * 1024)
+
+/* Number of lines 'head' and 'tail' print by default */
+#define DEFAULT_LINE_COUNT 10
+
+/* What 'wc' counts, and the counts so far */
+typedef struct {
+    unsigned long lines;    /* Newline characters              */
+    unsigned long words;    /* Runs of non-whitespace          */
+    unsigned long bytes;    /* Bytes                           */
+    bool          inWord;   /* The last byte was not whitespace */
+} WcCounts;
+
+/* Counts the lines and words in a block of input */
+typedef void (*CountFunction)(WcCounts* counts, const unsigned char* data,
+                              size_t length);
+
+/* Function prototypes */
+static CountFunction chooseCounter(void);
+static void countScalar(WcCounts* counts, const unsigned char* data,
+                        size_t length);
+static bool countStream(BuiltinIo* io, int fd, const char* name,
+                        CountFunction count, WcCounts* counts);
+static void printCounts(BuiltinIo* io, const WcCounts* counts,
+                        const char* flags, const char* name);
+static int  headOrTail(char** args, BuiltinIo* io, bool head);
+static bool headStream(BuiltinIo* io, int fd, long lines);
+static bool tailFile(BuiltinIo* io, int fd, off_t size, long lines);
+static bool tailStream(BuiltinIo* io, int fd, long lines);
+static size_t lastLines(const char* data, size_t length, long lines);
+
+/*
+ * countScalar
+ *
+ * Counts a block one byte at a time.  Whitespace is the C locale's:
+ * space, \t, \n, \v, \f and \r.
+ */
+static void countScalar(WcCounts* counts, const unsigned char* data,
+                        size_t length) {
+    size_t i;
+
+    for (i = 0; i < length; ++i) {
+        bool space = (data[i] == ' ' || (data[i] >= '\t' && data[i] <= '\r'));
+
+        if (data[i] == '\n') {
+            ++counts->lines;
+        }
+        if (!space && !counts->inWord) {
+            ++counts->words;
+        }
+        counts->inWord = !space;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * countAvx2
+ *
+ * Counts a block 32 bytes at a time.  Each block yields a bit mask of
+ * newlines and one of non-whitespace bytes; a word starts at every
+ * non-whitespace byte whose predecessor is whitespace, so the words are
+ * the population count of (mask & ~(mask << 1)), with the top bit of the
+ * previous block carried in.
+ */
+__attribute__((target("avx2,popcnt")))
+static void countAvx2(WcCounts* counts, const unsigned char* data,
+                      size_t length) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i space   = _mm256_set1_epi8(' ');
+    const __m256i tab     = _mm256_set1_epi8('\t');
+    const __m256i four    = _mm256_set1_epi8(4);
+    uint32_t      carry   = counts->inWord;
+    size_t        i;
+
+    for (i = 0; i + 32 <= length; i += 32) {
+        __m256i  block = _mm256_loadu_si256((const __m256i*) (data + i));
+        __m256i  control = _mm256_sub_epi8(block, tab);
+        __m256i  isControl = _mm256_cmpeq_epi8(
+                                 _mm256_min_epu8(control, four), control);
+        uint32_t lines = _mm256_movemask_epi8(
+                             _mm256_cmpeq_epi8(block, newline));
+        uint32_t words = ~(uint32_t) _mm256_movemask_epi8(
+                             _mm256_or_si256(isControl,
+                                 _mm256_cmpeq_epi8(block, space)));
+
+        counts->lines += __builtin_popcount(lines);
+        counts->words += __builtin_popcount(words & ~((words << 1) | carry));
+        carry = words >> 31;
+    }
+
+    counts->inWord = carry;
+    countScalar(counts, data + i, length - i);
+}
+
+#if defined(__SSE2__)
+/*
+ * countSse2
+ *
+ * The same as countAvx2(), 16 bytes at a time.
+ */
+static void countSse2(WcCounts* counts, const unsigned char* data,
+                      size_t length) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i space   = _mm_set1_epi8(' ');
+    const __m128i tab     = _mm_set1_epi8('\t');
+    const __m128i four    = _mm_set1_epi8(4);
+    uint32_t      carry   = counts->inWord;
+    size_t        i;
+
+    for (i = 0; i + 16 <= length; i += 16) {
+        __m128i  block = _mm_loadu_si128((const __m128i*) (data + i));
+        __m128i  control = _mm_sub_epi8(block, tab);
+        __m128i  isControl = _mm_cmpeq_epi8(_mm_min_epu8(control, four),
+                                            control);
+        uint32_t lines = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+        uint32_t words = ~_mm_movemask_epi8(
+                             _mm_or_si128(isControl,
+                                          _mm_cmpeq_epi8(block, space)))
+                         & 0xffff;
+
+        counts->lines += __builtin_popcount(lines);
+        counts->words += __builtin_popcount(words & ~((words << 1) | carry));
+        carry = words >> 15;
+    }
+
+    counts->inWord = carry;
+    countScalar(counts, data + i, length - i);
+}
+#endif
+#endif
+
+/*
+ * chooseCounter
+ *
+ * Returns the fastest counting kernel this processor supports.
+ */
+static CountFunction chooseCounter(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        return countAvx2;
+    }
+#if defined(__SSE2__)
+    return countSse2;
+#endif
+#endif
+    return countScalar;
+}
+
+/**
+ * doWc
+ *
+ * Implements a built-in version of the 'wc' command.
+ *
+ * args - An array of strings corresponding to the command and its arguments.
+ *        Options -l, -w and -c select lines, words and bytes (all three by
+ *        default).  The remaining arguments name files to count ('-' is
+ *        standard input); with none, standard input is counted.
+ */
+int doWc(char** args, BuiltinIo* io) {
+    CountFunction count = chooseCounter();
+    WcCounts      total;
+    char          flags[4] = "";
+    int           files = 0;
+    int           status = 0;
+    int           i;
+
+    /* Options come first */
+    for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0';
+            ++i) {
+        const char* option;
+
+        for (option = args[i] + 1; *option != '\0'; ++option) {
+            if (strchr("lwc", *option) == NULL) {
+                builtinError(io, "wc: invalid option -- '%c'\n", *option);
+                return 1;
+            }
+            if (strchr(flags, *option) == NULL) {
+                strncat(flags, option, 1);
+            }
+        }
+    }
+    if (flags[0] == '\0') {
+        strcpy(flags, "lwc");
+    }
+
+    memset(&total, 0, sizeof(total));
+    for (; args[i] != NULL || files == 0; ++i) {
+        const char* name = (args[i] != NULL) ? args[i] : "-";
+        WcCounts    counts;
+        int         fd = -1;
+
+        memset(&counts, 0, sizeof(counts));
+        ++files;
+
+        if (strcmp(name, "-") != 0) {
+            fd = open(name, O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                builtinError(io, "wc: %s: %s\n", name, strerror(errno));
+                status = 1;
+                continue;
+            }
+        }
+
+        if (!countStream(io, fd, name, count, &counts)) {
+            status = 1;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+
+        printCounts(io, &counts, flags, (args[i] != NULL) ? name : NULL);
+        total.lines += counts.lines;
+        total.words += counts.words;
+        total.bytes += counts.bytes;
+
+        if (args[i] == NULL) {
+            break;
+        }
+    }
+
+    if (files > 1) {
+        printCounts(io, &total, flags, "total");
+    }
+
+    return status;
+}
+
+/*
+ * countStream
+ *
+ * Counts everything in 'fd' (or the built-in's standard input, if 'fd' is
+ * -1).  Regular files are mapped and counted in place.  Returns false,
+ * after reporting it, on a read error.
+ */
+static bool countStream(BuiltinIo* io, int fd, const char* name,
+                        CountFunction count, WcCounts* counts) {
+    struct stat    fileStat;
+    unsigned char* buffer;
+    ssize_t        bytesRead;
+    bool           result = true;
+
+    if (fd >= 0 && fstat(fd, &fileStat) == 0 && S_ISREG(fileStat.st_mode)
+            && fileStat.st_size > 0) {
+        void* mapping = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE,
+                             fd, 0);
+
+        if (mapping != MAP_FAILED) {
+            madvise(mapping, fileStat.st_size, MADV_SEQUENTIAL);
+            count(counts, (const unsigned char*) mapping, fileStat.st_size);
+            counts->bytes = fileStat.st_size;
+            munmap(mapping, fileStat.st_size);
+            return true;
+        }
+    }
+
+    /* Pipes, terminals, pseudo-files, or a mapping that failed */
+    buffer = (unsigned char*) malloc(SCAN_BUFFER_SIZE);
+    if (buffer == NULL) {
+        builtinError(io, "wc: %s: %s\n", name, strerror(errno));
+        return false;
+    }
+
+    for (;;) {
+        if (fd < 0) {
+            bytesRead = builtinRead(io, buffer, SCAN_BUFFER_SIZE);
+        } else {
+            do {
+                bytesRead = read(fd, buffer, SCAN_BUFFER_SIZE);
+            } while (bytesRead < 0 && errno == EINTR);
+        }
+
+        if (bytesRead <= 0) {
+            if (bytesRead < 0) {
+                builtinError(io, "wc: %s: %s\n", name, strerror(errno));
+                result = false;
+            }
+            break;
+        }
+        count(counts, buffer, bytesRead);
+        counts->bytes += bytesRead;
+    }
+
+    free(buffer);
+    return result;
+}
+
+/*
+ * printCounts
+ *
+ * Prints the selected counts (in the order lines, words, bytes) followed
+ * by 'name', if it is not NULL.
+ */
+static void printCounts(BuiltinIo* io, const WcCounts* counts,
+                        const char* flags, const char* name) {
+    const char* separator = "";
+
+    if (strchr(flags, 'l') != NULL) {
+        builtinPrintf(io, "%7lu", counts->lines);
+        separator = " ";
+    }
+    if (strchr(flags, 'w') != NULL) {
+        builtinPrintf(io, "%s%7lu", separator, counts->words);
+        separator = " ";
+    }
+    if (strchr(flags, 'c') != NULL) {
+        builtinPrintf(io, "%s%7lu", separator, counts->bytes);
+    }
+    if (name != NULL) {
+        builtinPrintf(io, " %s", name);
+    }
+    builtinPrintf(io, "\n");
+}
+
+/**
+ * doHead
+ *
+ * Implements a built-in version of the 'head' command.
+ *
+ * args - An array of strings corresponding to the command and its arguments:
+ *        head [-n lines | -lines] [file...]
+ *        Prints the first lines (10 by default) of each file, or of
+ *        standard input if there are none.
+ */
+int doHead(char** args, BuiltinIo* io) {
+    return headOrTail(args, io, true);
+}
+
+/**
+ * doTail
+ *
+ * Implements a built-in version of the 'tail' command.
+ *
+ * args - An array of strings corresponding to the command and its arguments:
+ *        tail [-n lines | -lines] [file...]
+ *        Prints the last lines (10 by default) of each file, or of
+ *        standard input if there are none.
+ */
+int doTail(char** args, BuiltinIo* io) {
+    return headOrTail(args, io, false);
+}
+
+/*
+ * headOrTail
+ *
+ * The common part of 'head' and 'tail': reads the options and visits
+ * each file, printing a "==> name <==" header before each when there is
+ * more than one.
+ */
+static int headOrTail(char** args, BuiltinIo* io, bool head) {
+    const char* command = head ? "head" : "tail";
+    char*       stdinName[] = { "-", NULL };
+    char**      names;
+    long        lines = DEFAULT_LINE_COUNT;
+    int         status = 0;
+    int         i;
+
+    for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0';
+            ++i) {
+        const char* count = NULL;
+        char*       end;
+
+        if (strcmp(args[i], "--") == 0) {
+            ++i;
+            break;
+        }
+        if (strcmp(args[i], "-n") == 0) {
+            count = args[++i];
+        } else if (strncmp(args[i], "-n", 2) == 0) {
+            count = args[i] + 2;
+        } else {
+            count = args[i] + 1;
+        }
+
+        lines = (count != NULL) ? strtol(count, &end, 10) : -1;
+        if (count == NULL || *count == '\0' || *end != '\0' || lines < 0) {
+            builtinError(io, "Usage: %s [-n lines] [file...]\n", command);
+            return 1;
+        }
+    }
+
+    names = (args[i] != NULL) ? &args[i] : stdinName;
+    for (i = 0; names[i] != NULL && !io->outClosed; ++i) {
+        int  fd = -1;
+        bool result;
+
+        if (strcmp(names[i], "-") != 0) {
+            fd = open(names[i], O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                builtinError(io, "%s: %s: %s\n", command, names[i],
+                             strerror(errno));
+                status = 1;
+                continue;
+            }
+        }
+
+        if (names[1] != NULL) {
+            builtinPrintf(io, "%s==> %s <==\n", (i > 0) ? "\n" : "",
+                          (fd < 0) ? "standard input" : names[i]);
+        }
+        result = head ? headStream(io, fd, lines) : tailStream(io, fd, lines);
+        if (!result) {
+            builtinError(io, "%s: %s: %s\n", command, names[i],
+                         strerror(errno));
+            status = 1;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    return status;
+}
+
+/*
+ * headStream
+ *
+ * Copies the first 'lines' lines of 'fd' (standard input if -1) to
+ * standard output, reading no further than the block holding the last of
+ * them.  Standard input is closed afterwards, so whatever feeds it learns
+ * straight away that nothing more will be read.  Returns false on a read
+ * error.
+ */
+static bool headStream(BuiltinIo* io, int fd, long lines) {
+    char*   buffer = (char*) malloc(LINE_BLOCK_SIZE);
+    ssize_t bytesRead;
+    bool    result = (buffer != NULL);
+
+    while (result && lines > 0) {
+        const char* position;
+        const char* end;
+
+        if (fd < 0) {
+            bytesRead = builtinRead(io, buffer, LINE_BLOCK_SIZE);
+        } else {
+            do {
+                bytesRead = read(fd, buffer, LINE_BLOCK_SIZE);
+            } while (bytesRead < 0 && errno == EINTR);
+        }
+        if (bytesRead <= 0) {
+            result = (bytesRead == 0);
+            break;
+        }
+
+        position = buffer;
+        end      = buffer + bytesRead;
+        while (lines > 0) {
+            const char* newline = (const char*) memchr(position, '\n',
+                                                       end - position);
+
+            if (newline == NULL) {
+                position = end;
+                break;
+            }
+            position = newline + 1;
+            --lines;
+        }
+
+        if (!builtinWrite(io, buffer, position - buffer)) {
+            break;
+        }
+    }
+
+    if (fd < 0) {
+        builtinCloseInput(io);
+    }
+    free(buffer);
+    return result;
+}
+
+/*
+ * tailStream
+ *
+ * Copies the last 'lines' lines of 'fd' (standard input if -1) to
+ * standard output.  A regular file is read backwards from its end; other
+ * input is read to the end, keeping only a little more than the lines
+ * that might be needed.  Returns false on a read error.
+ */
+static bool tailStream(BuiltinIo* io, int fd, long lines) {
+    struct stat fileStat;
+    char*       buffer = NULL;
+    size_t      capacity = 0;
+    size_t      length = 0;
+    size_t      trimAt = SCAN_BUFFER_SIZE;
+    bool        result = true;
+
+    if (fd >= 0 && fstat(fd, &fileStat) == 0 && S_ISREG(fileStat.st_mode)
+            && fileStat.st_size > 0) {
+        return tailFile(io, fd, fileStat.st_size, lines);
+    }
+
+    for (;;) {
+        ssize_t bytesRead;
+
+        if (capacity - length < LINE_BLOCK_SIZE) {
+            char* grown = (char*) realloc(buffer, capacity * 2
+                                                  + LINE_BLOCK_SIZE);
+
+            if (grown == NULL) {
+                result = false;
+                break;
+            }
+            buffer    = grown;
+            capacity  = capacity * 2 + LINE_BLOCK_SIZE;
+        }
+
+        if (fd < 0) {
+            bytesRead = builtinRead(io, buffer + length, capacity - length);
+        } else {
+            do {
+                bytesRead = read(fd, buffer + length, capacity - length);
+            } while (bytesRead < 0 && errno == EINTR);
+        }
+        if (bytesRead <= 0) {
+            result = (bytesRead == 0);
+            break;
+        }
+        length += bytesRead;
+
+        /* Drop what can no longer be among the last lines */
+        if (length >= trimAt) {
+            size_t start = lastLines(buffer, length, lines);
+
+            memmove(buffer, buffer + start, length - start);
+            length -= start;
+            trimAt  = (length * 2 > SCAN_BUFFER_SIZE) ? length * 2
+                                                      : SCAN_BUFFER_SIZE;
+        }
+    }
+
+    if (result) {
+        size_t start = lastLines(buffer, length, lines);
+
+        builtinWrite(io, buffer + start, length - start);
+    }
+    free(buffer);
+    return result;
+}
+
+/*
+ * tailFile
+ *
+ * Copies the last 'lines' lines of a regular file of 'size' bytes to
+ * standard output.  Blocks are read backwards from the end until enough
+ * newlines have been seen; only the lines printed are ever read forwards.
+ * Returns false on a read error.
+ */
+static bool tailFile(BuiltinIo* io, int fd, off_t size, long lines) {
+    char*   buffer = (char*) malloc(LINE_BLOCK_SIZE);
+    off_t   position = size;
+    off_t   start = 0;
+    bool    last = true;
+    ssize_t bytesRead = 0;
+
+    if (lines == 0) {
+        return true;
+    }
+    if (buffer == NULL) {
+        return false;
+    }
+
+    while (position > 0 && lines > 0) {
+        size_t chunk = (position > LINE_BLOCK_SIZE) ? LINE_BLOCK_SIZE
+                                                    : (size_t) position;
+        size_t searched;
+
+        position -= chunk;
+        do {
+            bytesRead = pread(fd, buffer, chunk, position);
+        } while (bytesRead < 0 && errno == EINTR);
+        if (bytesRead != (ssize_t) chunk) {
+            free(buffer);
+            if (bytesRead >= 0) {
+                errno = EIO;
+            }
+            return false;
+        }
+
+        /* The file's final newline ends the last line; it does not start one */
+        searched = chunk;
+        if (last && buffer[chunk - 1] == '\n') {
+            --searched;
+        }
+        last = false;
+
+        while (searched > 0) {
+            const char* newline = (const char*) memrchr(buffer, '\n',
+                                                        searched);
+
+            if (newline == NULL) {
+                break;
+            }
+            searched = newline - buffer;
+            if (--lines == 0) {
+                start = position + searched + 1;
+                break;
+            }
+        }
+    }
+
+    /* 'start' is 0 if the whole file is fewer lines than wanted */
+    while (start < size && !io->outClosed) {
+        size_t chunk = (size - start > LINE_BLOCK_SIZE) ? LINE_BLOCK_SIZE
+                                                        : (size_t) (size - start);
+
+        do {
+            bytesRead = pread(fd, buffer, chunk, start);
+        } while (bytesRead < 0 && errno == EINTR);
+        if (bytesRead <= 0) {
+            break;
+        }
+        builtinWrite(io, buffer, bytesRead);
+        start += bytesRead;
+    }
+
+    free(buffer);
+    return bytesRead >= 0;
+}
+
+/*
+ * lastLines
+ *
+ * Returns the offset in 'data' at which its last 'lines' lines start.
+ */
+static size_t lastLines(const char* data, size_t length, long lines) {
+    size_t searched = length;
+
+    if (lines == 0) {
+        return length;
+    }
+    if (searched > 0 && data[searched - 1] == '\n') {
+        --searched;
+    }
+
+    while (searched > 0) {
+        const char* newline = (const char*) memrchr(data, '\n', searched);
+
+        if (newline == NULL) {
+            break;
+        }
+        searched = newline - data;
+        if (--lines == 0) {
+            return searched + 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,480 @@
+/*
+ * shellThreadPool.c
+ *
+ * The shared pool of worker threads, which schedules tasks by work
+ * stealing.
+ *
+ * Each worker owns a deque of tasks.  A task submitted by a worker (e.g.,
+ * a directory found while scanning another) goes on the bottom of that
+ * worker's deque, and the worker takes its next task from the bottom too,
+ * so it keeps working on the data it has just touched.  A worker whose
+ * deque is empty first takes from the shared queue of tasks submitted by
+ * other threads, then steals the oldest task -- usually the biggest piece
+ * of remaining work -- from the top of another worker's deque.  Workers
+ * with nothing to do sleep until a task is submitted.
+ *
+ * The shell forks (for $(...), process substitutions and background jobs)
+ * while the workers may be holding the pool's locks.  Fork handlers take
+ * every lock around fork(), and the child, which has none of the workers,
+ * starts with an empty pool of its own.
+ */
+#define _GNU_SOURCE
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "shellThreadPool.h"
+
+/* Initial number of slots in a worker's deque */
+#define DEQUE_INITIAL_SIZE 256
+
+/* How often (in ms) poolWait() looks again for tasks to help with */
+#define WAIT_POLL_INTERVAL 10
+
+/* A queued task */
+typedef struct Task {
+    TaskFunction function;
+    void*        arg;
+    TaskGroup*   group;
+    struct Task* next;          /* In the shared queue */
+} Task;
+
+/* The tasks of one worker, as a growable ring */
+typedef struct {
+    pthread_mutex_t lock;
+    Task**          tasks;
+    size_t          capacity;   /* A power of two (or 0) */
+    size_t          top;        /* The oldest task, stolen from here */
+    size_t          bottom;     /* One past the newest, the owner's end */
+} TaskDeque;
+
+/* Function prototypes */
+static void  startPool(void);
+static void  lockPool(void);
+static void  unlockPool(void);
+static void  resetPoolInChild(void);
+static void* workerMain(void* arg);
+static bool  pushTask(TaskDeque* deque, Task* task);
+static Task* popTask(TaskDeque* deque);
+static Task* stealTask(TaskDeque* deque);
+static Task* takeSharedTask(void);
+static Task* findTask(void);
+static void  runTask(TaskFunction function, void* arg, TaskGroup* group);
+
+static pthread_once_t  poolOnce      = PTHREAD_ONCE_INIT;
+static bool            forkHandled   = false;
+static int             threadCount   = 0;
+static TaskDeque       deques[MAX_POOL_THREADS];
+static __thread int    currentWorker = -1;
+
+/* Tasks submitted from outside the pool */
+static pthread_mutex_t queueLock     = PTHREAD_MUTEX_INITIALIZER;
+static Task*           queueHead     = NULL;
+static Task*           queueTail     = NULL;
+
+/* Idle workers sleep on 'workAvailable' while 'queuedTasks' is 0 */
+static pthread_mutex_t idleLock      = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  workAvailable = PTHREAD_COND_INITIALIZER;
+static atomic_long     queuedTasks   = 0;
+static atomic_int      sleepers      = 0;
+
+/*
+ * startPool
+ *
+ * Starts the worker threads.  They block every signal, so Ctrl-C is
+ * still delivered to the shell's main thread.
+ */
+static void startPool(void) {
+    sigset_t  allSignals;
+    sigset_t  oldSignals;
+    pthread_t thread;
+    long      processors = sysconf(_SC_NPROCESSORS_ONLN);
+    int       i;
+
+    /* A forked child's pool restarts here, with the handlers in place */
+    if (!forkHandled) {
+        pthread_atfork(lockPool, unlockPool, resetPoolInChild);
+        forkHandled = true;
+    }
+
+    if (processors < 1) {
+        processors = 1;
+    } else if (processors > MAX_POOL_THREADS) {
+        processors = MAX_POOL_THREADS;
+    }
+    for (i = 0; i < processors; ++i) {
+        pthread_mutex_init(&deques[i].lock, NULL);
+    }
+
+    /* Workers index 'deques' by their number, so they are numbered densely */
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_BLOCK, &allSignals, &oldSignals);
+    for (i = 0; i < processors; ++i) {
+        if (pthread_create(&thread, NULL, workerMain,
+                           (void*) (long) threadCount) == 0) {
+            pthread_detach(thread);
+            ++threadCount;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+}
+
+/*
+ * lockPool
+ *
+ * Takes every lock of the pool before fork(), so the child gets them in a
+ * consistent state.  No thread holds one of them while waiting for
+ * another, so the order does not matter.
+ */
+static void lockPool(void) {
+    int i;
+
+    pthread_mutex_lock(&queueLock);
+    pthread_mutex_lock(&idleLock);
+    for (i = 0; i < threadCount; ++i) {
+        pthread_mutex_lock(&deques[i].lock);
+    }
+}
+
+/*
+ * unlockPool
+ *
+ * Releases the locks taken by lockPool() in the parent after fork().
+ */
+static void unlockPool(void) {
+    int i;
+
+    for (i = threadCount - 1; i >= 0; --i) {
+        pthread_mutex_unlock(&deques[i].lock);
+    }
+    pthread_mutex_unlock(&idleLock);
+    pthread_mutex_unlock(&queueLock);
+}
+
+/*
+ * resetPoolInChild
+ *
+ * Empties the pool in the child after fork().  The workers were not
+ * copied, so their queued tasks (which belong to the parent's built-ins)
+ * are dropped, and the child starts workers of its own if it uses the
+ * pool.
+ */
+static void resetPoolInChild(void) {
+    int i;
+
+    for (i = 0; i < threadCount; ++i) {
+        pthread_mutex_init(&deques[i].lock, NULL);
+        deques[i].top = deques[i].bottom;
+    }
+    pthread_mutex_init(&queueLock, NULL);
+    pthread_mutex_init(&idleLock, NULL);
+    pthread_cond_init(&workAvailable, NULL);
+    queueHead     = NULL;
+    queueTail     = NULL;
+    queuedTasks   = 0;
+    sleepers      = 0;
+    threadCount   = 0;
+    currentWorker = -1;
+    poolOnce      = (pthread_once_t) PTHREAD_ONCE_INIT;
+}
+
+/*
+ * poolSize
+ *
+ * Returns the number of worker threads (0 if none could be started, in
+ * which case tasks run on the submitting thread).
+ */
+int poolSize(void) {
+    pthread_once(&poolOnce, startPool);
+    return threadCount;
+}
+
+/*
+ * taskGroupInit
+ *
+ * Prepares an empty group of tasks.
+ */
+void taskGroupInit(TaskGroup* group) {
+    pthread_mutex_init(&group->lock, NULL);
+    pthread_cond_init(&group->finished, NULL);
+    group->pending = 0;
+}
+
+/*
+ * taskGroupDestroy
+ *
+ * Releases a group whose tasks have all finished.
+ */
+void taskGroupDestroy(TaskGroup* group) {
+    pthread_cond_destroy(&group->finished);
+    pthread_mutex_destroy(&group->lock);
+}
+
+/*
+ * poolSubmit
+ *
+ * Queues 'function(arg)' to run on the pool as part of 'group': on the
+ * submitting worker's own deque, or the shared queue if the submitter is
+ * not a worker.  If the pool has no threads (or memory is short) the task
+ * runs immediately.
+ */
+void poolSubmit(TaskGroup* group, TaskFunction function, void* arg) {
+    Task* task;
+
+    pthread_mutex_lock(&group->lock);
+    ++group->pending;
+    pthread_mutex_unlock(&group->lock);
+
+    task = (poolSize() > 0) ? (Task*) malloc(sizeof(Task)) : NULL;
+    if (task == NULL) {
+        runTask(function, arg, group);
+        return;
+    }
+    task->function = function;
+    task->arg      = arg;
+    task->group    = group;
+    task->next     = NULL;
+
+    if (currentWorker < 0 || !pushTask(&deques[currentWorker], task)) {
+        pthread_mutex_lock(&queueLock);
+        if (queueTail == NULL) {
+            queueHead = task;
+        } else {
+            queueTail->next = task;
+        }
+        queueTail = task;
+        pthread_mutex_unlock(&queueLock);
+    }
+
+    /* Count the task only once it can be found (see workerMain) */
+    atomic_fetch_add(&queuedTasks, 1);
+    if (atomic_load(&sleepers) > 0) {
+        pthread_mutex_lock(&idleLock);
+        pthread_cond_signal(&workAvailable);
+        pthread_mutex_unlock(&idleLock);
+    }
+}
+
+/*
+ * poolWait
+ *
+ * Waits until every task of 'group' has finished, running queued tasks
+ * on this thread in the meantime.
+ */
+void poolWait(TaskGroup* group) {
+    for (;;) {
+        struct timespec deadline;
+        Task*           task;
+
+        pthread_mutex_lock(&group->lock);
+        if (group->pending == 0) {
+            pthread_mutex_unlock(&group->lock);
+            return;
+        }
+        pthread_mutex_unlock(&group->lock);
+
+        task = findTask();
+        if (task != NULL) {
+            runTask(task->function, task->arg, task->group);
+            free(task);
+            continue;
+        }
+
+        /*
+         * The rest is running elsewhere.  Those tasks may submit more, so
+         * look again now and then rather than sleeping until the end.
+         */
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += WAIT_POLL_INTERVAL * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec  += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&group->lock);
+        if (group->pending > 0) {
+            pthread_cond_timedwait(&group->finished, &group->lock, &deadline);
+        }
+        pthread_mutex_unlock(&group->lock);
+    }
+}
+
+/*
+ * workerMain
+ *
+ * The body of each worker thread: run tasks forever, sleeping when there
+ * are none.
+ */
+static void* workerMain(void* arg) {
+    currentWorker = (int) (long) arg;
+
+    for (;;) {
+        Task* task = findTask();
+
+        if (task == NULL) {
+            /*
+             * A submitter adds to 'queuedTasks' before reading 'sleepers';
+             * we add to 'sleepers' before reading 'queuedTasks'.  So either
+             * it sees us and signals, or we see its task.
+             */
+            pthread_mutex_lock(&idleLock);
+            atomic_fetch_add(&sleepers, 1);
+            while (atomic_load(&queuedTasks) <= 0) {
+                pthread_cond_wait(&workAvailable, &idleLock);
+            }
+            atomic_fetch_sub(&sleepers, 1);
+            pthread_mutex_unlock(&idleLock);
+            continue;
+        }
+
+        runTask(task->function, task->arg, task->group);
+        free(task);
+    }
+    return NULL;
+}
+
+/*
+ * pushTask
+ *
+ * Adds a task to the bottom of a deque, growing it if it is full.
+ * Returns false if memory ran out.
+ */
+static bool pushTask(TaskDeque* deque, Task* task) {
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->bottom - deque->top == deque->capacity) {
+        size_t capacity = (deque->capacity > 0) ? deque->capacity * 2
+                                                : DEQUE_INITIAL_SIZE;
+        Task** tasks = (Task**) malloc(capacity * sizeof(Task*));
+        size_t i;
+
+        if (tasks == NULL) {
+            pthread_mutex_unlock(&deque->lock);
+            return false;
+        }
+        for (i = deque->top; i != deque->bottom; ++i) {
+            tasks[i & (capacity - 1)] = deque->tasks[i & (deque->capacity - 1)];
+        }
+        free(deque->tasks);
+        deque->tasks    = tasks;
+        deque->capacity = capacity;
+    }
+
+    deque->tasks[deque->bottom & (deque->capacity - 1)] = task;
+    ++deque->bottom;
+
+    pthread_mutex_unlock(&deque->lock);
+    return true;
+}
+
+/*
+ * popTask
+ *
+ * Removes the newest task from a worker's own deque, or returns NULL.
+ */
+static Task* popTask(TaskDeque* deque) {
+    Task* task = NULL;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom != deque->top) {
+        --deque->bottom;
+        task = deque->tasks[deque->bottom & (deque->capacity - 1)];
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return task;
+}
+
+/*
+ * stealTask
+ *
+ * Removes the oldest task from another worker's deque, or returns NULL.
+ */
+static Task* stealTask(TaskDeque* deque) {
+    Task* task = NULL;
+
+    if (pthread_mutex_trylock(&deque->lock) != 0) {
+        return NULL;
+    }
+    if (deque->bottom != deque->top) {
+        task = deque->tasks[deque->top & (deque->capacity - 1)];
+        ++deque->top;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return task;
+}
+
+/*
+ * takeSharedTask
+ *
+ * Removes the task at the front of the shared queue, or returns NULL.
+ */
+static Task* takeSharedTask(void) {
+    Task* task;
+
+    pthread_mutex_lock(&queueLock);
+    task = queueHead;
+    if (task != NULL) {
+        queueHead = task->next;
+        if (queueHead == NULL) {
+            queueTail = NULL;
+        }
+    }
+    pthread_mutex_unlock(&queueLock);
+
+    return task;
+}
+
+/*
+ * findTask
+ *
+ * Finds a task for this thread: from its own deque if it is a worker,
+ * then from the shared queue, then by stealing.  Returns NULL if there
+ * seems to be none.
+ */
+static Task* findTask(void) {
+    Task* task = NULL;
+    int   start = (currentWorker >= 0) ? currentWorker : 0;
+    int   i;
+
+    if (atomic_load(&queuedTasks) <= 0) {
+        return NULL;
+    }
+
+    if (currentWorker >= 0) {
+        task = popTask(&deques[currentWorker]);
+    }
+    if (task == NULL) {
+        task = takeSharedTask();
+    }
+    for (i = 0; task == NULL && i < threadCount; ++i) {
+        int victim = (start + 1 + i) % threadCount;
+
+        if (victim != currentWorker) {
+            task = stealTask(&deques[victim]);
+        }
+    }
+
+    if (task != NULL) {
+        atomic_fetch_sub(&queuedTasks, 1);
+    }
+    return task;
+}
+
+/*
+ * runTask
+ *
+ * Runs a task and tells its group it has finished.
+ */
+static void runTask(TaskFunction function, void* arg, TaskGroup* group) {
+    function(arg);
+
+    pthread_mutex_lock(&group->lock);
+    if (--group->pending == 0) {
+        pthread_cond_broadcast(&group->finished);
+    }
+    pthread_mutex_unlock(&group->lock);
+}
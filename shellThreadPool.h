@@ -0,0 +1,38 @@
+/*
+ * shellThreadPool.h
+ *
+ * A pool of worker threads shared by the built-ins that split their work
+ * into tasks.  The pool starts the first time it is used, with one thread
+ * per online processor, and lives as long as the shell.
+ *
+ * Tasks are submitted as part of a TaskGroup so that each built-in can
+ * wait for its own tasks.  Tasks may submit more tasks (e.g., one per
+ * subdirectory); idle workers steal them, so recursive work spreads over
+ * every thread.  A thread waiting for a group runs queued tasks itself.
+ */
+#ifndef SHELL_THREAD_POOL_H
+#define SHELL_THREAD_POOL_H
+
+#include <pthread.h>
+
+/* Most worker threads the pool will start */
+#define MAX_POOL_THREADS 64
+
+/* A unit of work */
+typedef void (*TaskFunction)(void* arg);
+
+/* A set of tasks that can be waited for together */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  finished;   /* Signalled when 'pending' reaches 0 */
+    int             pending;    /* Tasks submitted but not finished   */
+} TaskGroup;
+
+/* Function prototypes */
+int  poolSize(void);
+void taskGroupInit(TaskGroup* group);
+void taskGroupDestroy(TaskGroup* group);
+void poolSubmit(TaskGroup* group, TaskFunction function, void* arg);
+void poolWait(TaskGroup* group);
+
+#endif